@@ -52,46 +52,46 @@ int init_struct (struct reglist *rl, mxArray ** D)
   map_names = malloc ((rl->num_regblocks) * sizeof (char *));
   board_names = malloc ((rl->num_regblocks) * sizeof (char *));
   regblock_names = malloc ((rl->num_regblocks) * sizeof (char *));
-  last_map = rl->r[0].rb.map;
-  last_board = rl->r[0].rb.board;
+  last_map = rb_map (&(rl->r[0].rb));
+  last_board = rb_board (&(rl->r[0].rb));
   map_names[0] = last_map;
   nm = 1;
   board_names[0] = last_board;
   nb = 1;
-  regblock_names[0] = rl->r[0].rb.regblock;
+  regblock_names[0] = rb_regblock (&(rl->r[0].rb));
   nr = 1;
   DEBUG ("About to try initializing structure.\n");
   DEBUG ("On %s.%s.%s\n", map_names[0], board_names[0], regblock_names[0]);
   for (i=1; i<rl->num_regblocks; i++)
   {
-    DEBUG ("On %s.%s.%s\n", rl->r[i].rb.map, rl->r[i].rb.board, rl->r[i].rb.regblock);
-    if (0 != strcmp (rl->r[i].rb.map, last_map))
+    DEBUG ("On %s.%s.%s\n", rb_map (&(rl->r[i].rb)), rb_board (&(rl->r[i].rb)), rb_regblock (&(rl->r[i].rb)));
+    if (0 != strcmp (rb_map (&(rl->r[i].rb)), last_map))
     {
       boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
       maps[nm-1] = mxCreateStructMatrix (1, 1, nb, (const char **)board_names);
       for (j=0; j<nb; j++)
         mxSetFieldByNumber (maps[nm-1], 0, j, boards[j]);
-      regblock_names[0] = rl->r[i].rb.regblock;
+      regblock_names[0] = rb_regblock (&(rl->r[i].rb));
       nr = 1;
-      last_board = rl->r[i].rb.board;
+      last_board = rb_board (&(rl->r[i].rb));
       board_names[0] = last_board;
       nb = 1;
-      last_map = rl->r[i].rb.map;
+      last_map = rb_map (&(rl->r[i].rb));
       map_names[nm] = last_map;
       nm++;
       continue;
     }
-    if (0 != strcmp (rl->r[i].rb.board, last_board))
+    if (0 != strcmp (rb_board (&(rl->r[i].rb)), last_board))
     {
       boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
-      regblock_names[0] = rl->r[i].rb.regblock;
+      regblock_names[0] = rb_regblock (&(rl->r[i].rb));
       nr = 1;
-      last_board = rl->r[i].rb.board;
+      last_board = rb_board (&(rl->r[i].rb));
       board_names[nb] = last_board;
       nb++;
       continue;
     }
-    regblock_names[nr] = rl->r[i].rb.regblock;
+    regblock_names[nr] = rb_regblock (&(rl->r[i].rb));
     nr++;
   }
   boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
@@ -129,10 +129,10 @@ int mat_fill_info (struct reglist * rl, mxArray ** D)
 
   for (i=0; i<rl->num_regblocks; i++)
   {
-    map = mxGetField (*D, 0, rl->r[i].rb.map);
+    map = mxGetField (*D, 0, rb_map (&(rl->r[i].rb)));
     if (map == NULL)
       return -1;
-    board = mxGetField (map, 0, rl->r[i].rb.board);
+    board = mxGetField (map, 0, rb_board (&(rl->r[i].rb)));
     if (board == NULL)
       return -1;
 
@@ -184,7 +184,7 @@ int mat_fill_info (struct reglist * rl, mxArray ** D)
     tmp = mxCreateLogicalScalar (rl->r[i].rb.do_arc);
     mxSetField (regblock, 0, "do_arc", tmp);
 
-    mxSetField (board, 0, rl->r[i].rb.regblock, regblock);
+    mxSetField (board, 0, rb_regblock (&(rl->r[i].rb)), regblock);
   }
   return 0;
 }
@@ -53,46 +53,46 @@ int init_struct (struct dataset * ds, mxArray ** D)
   map_names = malloc ((ds->nb) * sizeof (char *));
   board_names = malloc ((ds->nb) * sizeof (char *));
   regblock_names = malloc ((ds->nb) * sizeof (char *));
-  last_map = ds->buf[0].rb->map;
-  last_board = ds->buf[0].rb->board;
+  last_map = rb_map (ds->buf[0].rb);
+  last_board = rb_board (ds->buf[0].rb);
   map_names[0] = last_map;
   nm = 1;
   board_names[0] = last_board;
   nb = 1;
-  regblock_names[0] = ds->buf[0].rb->regblock;
+  regblock_names[0] = rb_regblock (ds->buf[0].rb);
   nr = 1;
   DEBUG ("About to try initializing structure.\n");
   DEBUG ("On %s.%s.%s\n", map_names[0], board_names[0], regblock_names[0]);
   for (i=1; i<ds->nb; i++)
   {
-    DEBUG ("On %s.%s.%s\n", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock);
-    if (0 != strcmp (ds->buf[i].rb->map, last_map))
+    DEBUG ("On %s.%s.%s\n", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+    if (0 != strcmp (rb_map (ds->buf[i].rb), last_map))
     {
       boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
       maps[nm-1] = mxCreateStructMatrix (1, 1, nb, (const char **)board_names);
       for (j=0; j<nb; j++)
         mxSetFieldByNumber (maps[nm-1], 0, j, boards[j]);
-      regblock_names[0] = ds->buf[i].rb->regblock;
+      regblock_names[0] = rb_regblock (ds->buf[i].rb);
       nr = 1;
-      last_board = ds->buf[i].rb->board;
+      last_board = rb_board (ds->buf[i].rb);
       board_names[0] = last_board;
       nb = 1;
-      last_map = ds->buf[i].rb->map;
+      last_map = rb_map (ds->buf[i].rb);
       map_names[nm] = last_map;
       nm++;
       continue;
     }
-    if (0 != strcmp (ds->buf[i].rb->board, last_board))
+    if (0 != strcmp (rb_board (ds->buf[i].rb), last_board))
     {
       boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
-      regblock_names[0] = ds->buf[i].rb->regblock;
+      regblock_names[0] = rb_regblock (ds->buf[i].rb);
       nr = 1;
-      last_board = ds->buf[i].rb->board;
+      last_board = rb_board (ds->buf[i].rb);
       board_names[nb] = last_board;
       nb++;
       continue;
     }
-    regblock_names[nr] = ds->buf[i].rb->regblock;
+    regblock_names[nr] = rb_regblock (ds->buf[i].rb);
     nr++;
   }
   boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
@@ -127,10 +127,10 @@ int mat_wrap_timestreams (struct dataset * ds, mxArray ** D)
 
   for (i=0; i<ds->nb; i++)
   {
-    map = mxGetField (*D, 0, ds->buf[i].rb->map);
+    map = mxGetField (*D, 0, rb_map (ds->buf[i].rb));
     if (map == NULL)
       return -1;
-    board = mxGetField (map, 0, ds->buf[i].rb->board);
+    board = mxGetField (map, 0, rb_board (ds->buf[i].rb));
     if (board == NULL)
       return -1;
     
@@ -170,24 +170,34 @@ int mat_wrap_timestreams (struct dataset * ds, mxArray ** D)
     if (!ds->buf[i].rb->do_arc)
     {
       DEBUG ("Initializing empty matrix %s.%s.%s\n",
-        ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock);
+        rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
       tmp = mxCreateNumericMatrix (0, 0, mat_class, mxREAL);
-      mxSetField (board, 0, ds->buf[i].rb->regblock, tmp);
+      mxSetField (board, 0, rb_regblock (ds->buf[i].rb), tmp);
       continue;
     }
     DEBUG ("Copying %s.%s.%s, %dx%d, numframes=%d, length=%ld.\n",
-      ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock,
-      ds->buf[i].rb->spf * ds->num_frames, numchan,
+      rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb),
+      ds->buf[i].spf * ds->num_frames, numchan,
       ds->buf[i].numframes, ds->buf[i].bufsize);
-    tmp = mxCreateNumericMatrix (
-      (ds->buf[i].rb->spf * ds->num_frames),
-      numchan,
-      mat_class, mxREAL);
+    if (ds->buf[i].layout == LAYOUT_BY_FRAME)
+    {
+      /* [frame][channel][sample] is spf x nchan x frames here. */
+      mwSize dims[3];
+      dims[0] = ds->buf[i].spf;
+      dims[1] = numchan;
+      dims[2] = ds->num_frames;
+      tmp = mxCreateNumericArray (3, dims, mat_class, mxREAL);
+    }
+    else
+      tmp = mxCreateNumericMatrix (
+        (ds->buf[i].spf * ds->num_frames),
+        numchan,
+        mat_class, mxREAL);
     if (tmp == NULL)
       return -1;
     memcpy ((void *)mxGetPr(tmp), (void *)ds->buf[i].buf,
-      (numchan * ds->buf[i].rb->spf * ds->buf[i].numframes * ds->buf[i].elsize));
-    mxSetField (board, 0, ds->buf[i].rb->regblock, tmp);
+      (numchan * ds->buf[i].spf * ds->buf[i].numframes * ds->buf[i].elsize));
+    mxSetField (board, 0, rb_regblock (ds->buf[i].rb), tmp);
   }
   return 0;
 }
@@ -214,6 +224,7 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
     if (fname == 0)
         mexErrMsgTxt ("could not get file name.");
 
+    arcfilt_init (&filt);
     if ((nrhs < 3) || (mxIsEmpty (prhs[1])) || (mxIsEmpty (prhs[2])))
       filt.use_utc = 0;
     else
@@ -239,6 +250,40 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
         filt.t1[0], filt.t1[1], filt.t2[0], filt.t2[1]);
       filt.use_utc = 1;
     }
+
+    /* Optional fifth argument: the type to store registers as. */
+    if ((nrhs >= 5) && !mxIsEmpty (prhs[4]))
+    {
+      char * convstr;
+      if (mxGetClassID (prhs[4]) != mxCHAR_CLASS)
+        mexErrMsgTxt ("fifth argument to readarc must be a string.");
+      convstr = mxArrayToString (prhs[4]);
+      r = parse_conversion (convstr, &(filt.conv));
+      mxFree (convstr);
+      if (r != 0)
+        mexErrMsgTxt ("could not parse conversion!");
+    }
+
+    /* Optional sixth argument: the UTC register to cut frames by. */
+    if ((nrhs >= 6) && !mxIsEmpty (prhs[5]) && filt.use_utc)
+    {
+      if (mxGetClassID (prhs[5]) != mxCHAR_CLASS)
+        mexErrMsgTxt ("sixth argument to readarc must be a string.");
+      filt.time_reg = mxArrayToString (prhs[5]);
+    }
+
+    /* Optional seventh argument: 'channel' or 'frame' layout. */
+    if ((nrhs >= 7) && !mxIsEmpty (prhs[6]))
+    {
+      char * layoutstr;
+      if (mxGetClassID (prhs[6]) != mxCHAR_CLASS)
+        mexErrMsgTxt ("seventh argument to readarc must be a string.");
+      layoutstr = mxArrayToString (prhs[6]);
+      filt.layout = parse_layout (layoutstr);
+      mxFree (layoutstr);
+      if (filt.layout < 0)
+        mexErrMsgTxt ("layout must be 'channel' or 'frame'.");
+    }
       
     if (nrhs < 4)
     {
@@ -277,6 +322,8 @@ void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
 
     r = readarc (&filt, &ds); 
     DEBUG ("Returned %d.\n", r);
+    if (filt.time_reg != NULL)
+      mxFree (filt.time_reg);
     if (r == ARC_ERR_SIGINT)
     {
       free_namelist (&(filt.nl));
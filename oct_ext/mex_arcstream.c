@@ -0,0 +1,446 @@
+/*
+ * arcstream - read a GCP arc file, or a directory of
+ *             arc files, a window of frames at a time.
+ *
+ *   h = arcstream ('open', fname, utc1, utc2, regs, layout)
+ *   [d, n] = arcstream ('next', h, nframes)
+ *   arcstream ('close', h)
+ *
+ * 'next' returns the same structure as readarc for the
+ * next nframes frames, and the number of frames read;
+ * n is zero once the files are used up.  layout is
+ * 'channel' (the default) or 'frame', which gives
+ * each register as spf x nchan x frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mex.h"
+#include "readarc.h"
+#include "arcstream.h"
+#include "utcrange.h"
+
+#ifndef HAVE_OCTAVE
+#  include "matrix.h"
+#endif
+
+#define PR(args...) mexPrintf(args); mexEvalString("0;")
+
+#define DEBUG_MEX_ARCSTREAM 0
+#if DEBUG_MEX_ARCSTREAM
+#  define DEBUG(args...) PR(args)
+#else
+#  define DEBUG(args...)
+#endif
+
+#define MAX_STREAMS 32
+
+/* Open streams persist between calls; handles are */
+/* 1-based indices into this table.                */
+struct mex_stream {
+    struct arcfilt filt;
+    struct arcstream s;
+    struct dataset ds;
+};
+
+static struct mex_stream * streams[MAX_STREAMS];
+static int registered_exit = 0;
+
+/* Initialize a Matlab structure to hold the output:  */
+/* Loop through all the register blocks we have read, */
+/* building a three-level hierarchy of structs, with  */
+/* the form map.board.regblock.  Don't actually fill  */
+/* in any values now, just create the structs here.   */
+int init_struct (struct dataset * ds, mxArray ** D)
+{
+  int i, j;
+  int nm, nb, nr;
+  char * last_map;
+  char * last_board;
+  char ** map_names;
+  char ** board_names;
+  char ** regblock_names;
+  mxArray ** boards;
+  mxArray ** maps;
+
+  if (ds->nb == 0)
+  {
+    DEBUG ("No registers in data set, returning empty structure.\n");
+    *D = mxCreateStructMatrix (0, 0, 0, NULL);
+    return 0;
+  }
+
+  boards = malloc ((ds->nb) * sizeof (mxArray *));
+  maps = malloc ((ds->nb) * sizeof (mxArray *));
+  map_names = malloc ((ds->nb) * sizeof (char *));
+  board_names = malloc ((ds->nb) * sizeof (char *));
+  regblock_names = malloc ((ds->nb) * sizeof (char *));
+  last_map = rb_map (ds->buf[0].rb);
+  last_board = rb_board (ds->buf[0].rb);
+  map_names[0] = last_map;
+  nm = 1;
+  board_names[0] = last_board;
+  nb = 1;
+  regblock_names[0] = rb_regblock (ds->buf[0].rb);
+  nr = 1;
+  DEBUG ("About to try initializing structure.\n");
+  DEBUG ("On %s.%s.%s\n", map_names[0], board_names[0], regblock_names[0]);
+  for (i=1; i<ds->nb; i++)
+  {
+    DEBUG ("On %s.%s.%s\n", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+    if (0 != strcmp (rb_map (ds->buf[i].rb), last_map))
+    {
+      boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
+      maps[nm-1] = mxCreateStructMatrix (1, 1, nb, (const char **)board_names);
+      for (j=0; j<nb; j++)
+        mxSetFieldByNumber (maps[nm-1], 0, j, boards[j]);
+      regblock_names[0] = rb_regblock (ds->buf[i].rb);
+      nr = 1;
+      last_board = rb_board (ds->buf[i].rb);
+      board_names[0] = last_board;
+      nb = 1;
+      last_map = rb_map (ds->buf[i].rb);
+      map_names[nm] = last_map;
+      nm++;
+      continue;
+    }
+    if (0 != strcmp (rb_board (ds->buf[i].rb), last_board))
+    {
+      boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
+      regblock_names[0] = rb_regblock (ds->buf[i].rb);
+      nr = 1;
+      last_board = rb_board (ds->buf[i].rb);
+      board_names[nb] = last_board;
+      nb++;
+      continue;
+    }
+    regblock_names[nr] = rb_regblock (ds->buf[i].rb);
+    nr++;
+  }
+  boards[nb-1] = mxCreateStructMatrix (1, 1, nr, (const char **)regblock_names);
+  maps[nm-1] = mxCreateStructMatrix (1, 1, nb, (const char **)board_names);
+  for (j=0; j<nb; j++)
+    mxSetFieldByNumber (maps[nm-1], 0, j, boards[j]);
+
+  (*D) = mxCreateStructMatrix (1, 1, nm, (const char **)map_names);
+  for (j=0; j<nm; j++)
+    mxSetFieldByNumber (*D, 0, j, maps[j]);
+
+  DEBUG ("Done allocating, now free the temp. arrays.\n");
+  free (map_names);
+  free (board_names);
+  free (regblock_names);
+  free (maps);
+  free (boards);
+
+  return 0;
+}
+   
+int mat_wrap_timestreams (struct dataset * ds, mxArray ** D)
+{
+  int i;
+  mxArray * map;
+  mxArray * board;
+  mxArray * tmp;
+  mxClassID mat_class;
+  int numchan;
+
+  init_struct (ds, D);
+
+  for (i=0; i<ds->nb; i++)
+  {
+    map = mxGetField (*D, 0, rb_map (ds->buf[i].rb));
+    if (map == NULL)
+      return -1;
+    board = mxGetField (map, 0, rb_board (ds->buf[i].rb));
+    if (board == NULL)
+      return -1;
+    
+    switch (ds->buf[i].rb->typeword & GCP_REG_TYPE)
+    {
+      case GCP_REG_UINT:
+        mat_class = mxUINT32_CLASS;
+        break;
+      case GCP_REG_INT:
+        mat_class = mxINT32_CLASS;
+        break;
+      case GCP_REG_UCHAR:
+        mat_class = mxUINT8_CLASS;
+        break;
+      case GCP_REG_CHAR:
+        mat_class = mxINT8_CLASS;
+        break;
+      case GCP_REG_FLOAT:
+        mat_class = mxSINGLE_CLASS;
+        break;
+      case GCP_REG_DOUBLE:
+        mat_class = mxDOUBLE_CLASS;
+        break;
+
+      /* Just treat UTC times as a UINT64, for now. */
+      case GCP_REG_UTC:
+        mat_class = mxUINT64_CLASS;
+        break;
+
+      default: 
+        PR ("Skipping register of type 0x%lx.\n", ds->buf[i].rb->typeword & GCP_REG_TYPE);
+        continue;
+    }
+    numchan = ds->buf[i].rb->nchan;
+    if (ds->buf[i].chan.n != 0)
+      numchan = ds->buf[i].chan.ntot;
+    if (!ds->buf[i].rb->do_arc)
+    {
+      DEBUG ("Initializing empty matrix %s.%s.%s\n",
+        rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+      tmp = mxCreateNumericMatrix (0, 0, mat_class, mxREAL);
+      mxSetField (board, 0, rb_regblock (ds->buf[i].rb), tmp);
+      continue;
+    }
+    DEBUG ("Copying %s.%s.%s, %dx%d, numframes=%d, length=%ld.\n",
+      rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb),
+      ds->buf[i].spf * ds->num_frames, numchan,
+      ds->buf[i].numframes, ds->buf[i].bufsize);
+    if (ds->buf[i].layout == LAYOUT_BY_FRAME)
+    {
+      /* [frame][channel][sample] is spf x nchan x frames here. */
+      mwSize dims[3];
+      dims[0] = ds->buf[i].spf;
+      dims[1] = numchan;
+      dims[2] = ds->num_frames;
+      tmp = mxCreateNumericArray (3, dims, mat_class, mxREAL);
+    }
+    else
+      tmp = mxCreateNumericMatrix (
+        (ds->buf[i].spf * ds->num_frames),
+        numchan,
+        mat_class, mxREAL);
+    if (tmp == NULL)
+      return -1;
+    memcpy ((void *)mxGetPr(tmp), (void *)ds->buf[i].buf,
+      (numchan * ds->buf[i].spf * ds->buf[i].numframes * ds->buf[i].elsize));
+    mxSetField (board, 0, rb_regblock (ds->buf[i].rb), tmp);
+  }
+  return 0;
+}
+
+
+static void close_stream (int i)
+{
+  struct mex_stream * ms = streams[i];
+
+  if (ms == NULL)
+    return;
+  readarc_close (&(ms->s));
+  if (ms->s.ds_ready)
+    free_dataset (&(ms->ds));
+  free_namelist (&(ms->filt.nl));
+  free (ms->filt.fname);
+  free (ms);
+  streams[i] = NULL;
+}
+
+static void close_all_streams (void)
+{
+  int i;
+
+  for (i=0; i<MAX_STREAMS; i++)
+    close_stream (i);
+}
+
+static int get_handle (const mxArray * h)
+{
+  int i;
+
+  if (mxGetClassID (h) != mxDOUBLE_CLASS)
+    mexErrMsgTxt ("arcstream handle must be a number.");
+  i = (int)mxGetScalar (h) - 1;
+  if ((i < 0) || (i >= MAX_STREAMS) || (streams[i] == NULL))
+    mexErrMsgTxt ("not an open arcstream handle.");
+
+  return i;
+}
+
+static void open_stream (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+    char * fname;
+    mxClassID inpt_class;
+    struct mex_stream * ms;
+    int i, r;
+
+    for (i=0; i<MAX_STREAMS; i++)
+      if (streams[i] == NULL)
+        break;
+    if (i == MAX_STREAMS)
+      mexErrMsgTxt ("too many open arcstreams.");
+
+    if (nrhs < 2)
+      mexErrMsgTxt ("arcstream open takes at least a file name.");
+    inpt_class = mxGetClassID (prhs[1]);
+    if (inpt_class != mxCHAR_CLASS)
+        mexErrMsgTxt ("arcstream open takes a string argument.");
+    fname = mxArrayToString (prhs[1]);
+    if (fname == 0)
+        mexErrMsgTxt ("could not get file name.");
+
+    ms = malloc (sizeof (struct mex_stream));
+    if (ms == NULL)
+      mexErrMsgTxt ("out of memory.");
+    arcfilt_init (&(ms->filt));
+    if ((nrhs < 4) || (mxIsEmpty (prhs[2])) || (mxIsEmpty (prhs[3])))
+      ms->filt.use_utc = 0;
+    else
+    {
+      char * utcstr;
+      if ((mxGetClassID (prhs[2]) != mxCHAR_CLASS) || (mxGetClassID (prhs[3]) != mxCHAR_CLASS))
+      {
+        free (ms);
+        mexErrMsgTxt ("UTC times for arcstream must be strings.");
+      }
+      utcstr = mxArrayToString (prhs[2]);
+      r = txt2utc (utcstr, ms->filt.t1);
+      mxFree (utcstr);
+      if (r == 0)
+      {
+        utcstr = mxArrayToString (prhs[3]);
+        r = txt2utc (utcstr, ms->filt.t2);
+        mxFree (utcstr);
+      }
+      if (r != 0)
+      {
+        free (ms);
+        mexErrMsgTxt ("could not parse UTC time!");
+      }
+      ms->filt.use_utc = 1;
+    }
+
+    if (nrhs >= 5)
+    {
+      int nn, in;
+      char ** nlist;
+      inpt_class = mxGetClassID (prhs[4]);
+      if ((inpt_class != mxCELL_CLASS) && (inpt_class != mxCHAR_CLASS))
+      {
+        free (ms);
+        mexErrMsgTxt ("register list for arcstream must be a string or cell array of strings.");
+      }
+      if (inpt_class == mxCELL_CLASS)
+      {
+	nn = mxGetNumberOfElements (prhs[4]);
+	nlist = malloc (nn * sizeof (char *));
+	for (in=0; in<nn; in++)
+	    nlist[in] = mxArrayToString (mxGetCell (prhs[4], in));
+      }
+      else
+      {
+        nn = 1;
+        nlist = malloc (sizeof (char *));
+        nlist[0] = mxArrayToString (prhs[4]);
+      }
+      create_namelist (nn, nlist, &(ms->filt.nl));
+      for (in=0; in<nn; in++)
+          mxFree (nlist[in]);
+      free (nlist);
+    }
+
+    /* Optional 'channel' or 'frame' layout. */
+    if ((nrhs >= 6) && !mxIsEmpty (prhs[5]))
+    {
+      char * layoutstr;
+      if (mxGetClassID (prhs[5]) != mxCHAR_CLASS)
+      {
+        free_namelist (&(ms->filt.nl));
+        free (ms);
+        mexErrMsgTxt ("layout for arcstream must be a string.");
+      }
+      layoutstr = mxArrayToString (prhs[5]);
+      ms->filt.layout = parse_layout (layoutstr);
+      mxFree (layoutstr);
+      if (ms->filt.layout < 0)
+      {
+        free_namelist (&(ms->filt.nl));
+        free (ms);
+        mexErrMsgTxt ("layout must be 'channel' or 'frame'.");
+      }
+    }
+
+    /* mxArrayToString memory goes away after this call. */
+    ms->filt.fname = strdup (fname);
+    mxFree (fname);
+
+    r = readarc_open (&(ms->filt), &(ms->s));
+    if (r != 0)
+    {
+      PR ("Opening arc file %s:\n", ms->filt.fname);
+      free_namelist (&(ms->filt.nl));
+      free (ms->filt.fname);
+      free (ms);
+      mexErrMsgTxt ("Error opening arc files.\n");
+    }
+
+    if (!registered_exit)
+    {
+      mexAtExit (close_all_streams);
+      registered_exit = 1;
+    }
+    streams[i] = ms;
+    plhs[0] = mxCreateDoubleScalar (i + 1);
+}
+
+static void next_stream (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+    struct mex_stream * ms;
+    mxArray * D;
+    int nframes;
+    int r;
+
+    if (nrhs < 3)
+      mexErrMsgTxt ("arcstream next takes a handle and a number of frames.");
+    ms = streams[get_handle (prhs[1])];
+    nframes = (int)mxGetScalar (prhs[2]);
+
+    r = readarc_next (&(ms->s), nframes, &(ms->ds));
+    if (r != 0)
+      mexErrMsgTxt ("Error reading arc files.\n");
+
+    if (ms->ds.num_frames == 0)
+      D = mxCreateStructMatrix (0, 0, 0, NULL);
+    else
+    {
+      r = mat_wrap_timestreams (&(ms->ds), &D);
+      if (r != 0)
+        mexErrMsgTxt ("Error packaging frames for output.\n");
+    }
+    plhs[0] = D;
+    if (nlhs > 1)
+      plhs[1] = mxCreateDoubleScalar (ms->ds.num_frames);
+}
+
+void mexFunction (int nlhs, mxArray * plhs[], int nrhs, const mxArray * prhs[])
+{
+    char * cmd;
+
+    if ((nrhs < 1) || (mxGetClassID (prhs[0]) != mxCHAR_CLASS))
+        mexErrMsgTxt ("arcstream takes a command: 'open', 'next', or 'close'.");
+    cmd = mxArrayToString (prhs[0]);
+
+    if (!strcmp (cmd, "open"))
+      open_stream (nlhs, plhs, nrhs, prhs);
+    else if (!strcmp (cmd, "next"))
+      next_stream (nlhs, plhs, nrhs, prhs);
+    else if (!strcmp (cmd, "close"))
+    {
+      if (nrhs < 2)
+        mexErrMsgTxt ("arcstream close takes a handle.");
+      close_stream (get_handle (prhs[1]));
+    }
+    else
+    {
+      mxFree (cmd);
+      mexErrMsgTxt ("unknown arcstream command.");
+    }
+    mxFree (cmd);
+
+    return;
+}
@@ -10,7 +10,13 @@ arcfile
 load_arc
     Wrapper for readarc that does some simple unpacking and data selection for 
     the requested time range.
+iter_arc
+    Generator that reads the same data a window of frames at a time.
+lazy_arc
+    Catalog of the same registers, each read from disk only when first used.
+arrow_arc
+    The same data as a pyarrow Table, handed over without copying.
 
 """
 
-from load_arc import load_arc
+from .load_arc import load_arc, iter_arc, lazy_arc, arrow_arc
@@ -1,6 +1,8 @@
 import numpy as np
 from datetime import datetime
-from arcfile import readarc
+from .arcfile import readarc, readarc_plan, readarc_open, readarc_next, readarc_close
+from .arcfile import readarc_arrow
+from .arcfile import lazyarc_open, lazyarc_load
 
 
 """
@@ -11,23 +13,29 @@ load_arc wrapper for readarc
 
 # Use for time conversions.
 SECONDS_PER_DAY = 86400.
+MJD_UNIX_EPOCH = 40587.
 MJD_EPOCH = datetime.strptime('1858-Nov-17:00:00:00', '%Y-%b-%d:%H:%M:%S')
 # Supported time string formats:
 #   2009-Apr-29:14:32:01 (Walt format)
 #   29-Apr-2009:14:32:01 (gcp "show" command format)
 #   090429 14:32:01      (log file format)
 TIME_FORMAT = ('%Y-%b-%d:%H:%M:%S', '%d-%b-%Y:%H:%M:%S', '%y%m%d %H:%M:%S')
+# Register whose first sample in each frame decides if it is in trange.
+TIME_REG = 'antenna0.time.utcslow'
 
 
-def load_arc(arcdir, trange=None, reglist=None):
+def load_arc(arcdir, trange=None, reglist=None, lazy=False, mem_budget=None,
+             frame_step=1, dtype=None, utc='mjdsec', layout='channel',
+             stats=False):
     """
     Read data from gcp arcfiles.
 
     This function is a wrapper for arcfile.readarc and provides the following 
     features:
       - Function interface is more pythonic.
-      - Unpacks time registers into floating-point MJD and seconds.
-      - Select only data within the requested time range, if specified.
+      - Time registers come as floating-point MJD and seconds.
+      - Select only frames within the requested time range, if specified.
+        Frames are cut as they are read, by antenna0.time.utcslow.
 
     Parameters
     ----------
@@ -48,15 +56,56 @@ def load_arc(arcdir, trange=None, reglist=None):
         register (i.e. 'array.frame.features'). The union of the register list
         is returned, so ['antenna0'] and ['antenna0', 'antenna0.frame'] will 
         give the same results. The 'antenna0.time' board is always appended to
-        the list, because it is used to select samples by time. If no register
+        the list, so that the data come with their time stamps. If no register
         list is specified, then all registers are returned.
+    lazy : bool or 'auto', optional
+        If True, return at once without reading any data. Each register is a
+        LazyRegister that is read from disk the first time it is used as an
+        array; see lazy_arc. If 'auto', do this only when reading everything
+        at once would exceed mem_budget.
+    mem_budget : int, optional
+        Most bytes of data to hold in memory. The size of the query is worked
+        out from the file headers before anything is read, and MemoryError is
+        raised if it is too big (or, with lazy='auto', registers are read lazily
+        instead). Use readarc_plan to see the size of a query.
+    frame_step : int, optional
+        Keep only every frame_step'th frame of each arcfile, for quick looks
+        over long spans. Skipped frames are never copied; uncompressed files
+        are not even read past them.
+    dtype : str or numpy dtype, optional
+        Store the numeric registers as float32 or float64 while they are
+        read, rather than converting them afterwards. A string such as
+        'float64:scale:offset' also rescales them. Single registers can be
+        converted with a suffix instead, e.g. 'mce0.data.fb{float32}'.
+        Time registers are left alone.
+    utc : {'mjdsec', 'mjd', 'unix'}, optional
+        How time registers are decoded while they are read: into an MJD row
+        followed by a seconds-of-day row, or a single row of fractional MJD
+        or of Unix seconds.
+    layout : {'channel', 'frame'}, optional
+        Shape of each register's array. 'channel' gives (nchan, nframes*spf),
+        each channel's samples running on in time. 'frame' gives
+        (nframes, nchan, spf), with each frame's samples kept together as
+        they are in the arcfile, which is quicker to read and to take
+        frames from.
+    stats : bool or 'only', optional
+        If True, also gather each channel's summary statistics while the
+        data are read, and return them after the data. If 'only', gather
+        the statistics without keeping any samples, so a query of any
+        length needs next to no memory. Statistics are of the values as
+        stored, after dtype and utc. Not for lazy reads.
 
     Returns
     -------
     data : dict
         Data is stored in numpy arrays nested inside three levels of dict 
         structures -- module, board, and register. To access mce0.data.fb, for
-        example, use `data['mce0']['data']['fb']`.
+        example, use `data['mce0']['data']['fb']`. Not returned with
+        stats='only'.
+    stats : dict, only with stats
+        The same structure, holding for each register a dict of arrays over
+        its channels: 'n' (samples counted), 'nan' (NaN samples, left out
+        of the rest), 'min', 'max', 'mean' and 'var'.
 
     Examples
     --------
@@ -81,6 +130,11 @@ def load_arc(arcdir, trange=None, reglist=None):
     >>> data = load_arc('arc/20160301_000300.dat.gz', 
                          reglist=['antenna0', 'hk0'])
 
+    Get the range and spread of every channel over a day, without the data.
+
+    >>> stats = load_arc('arc/', (t0, '2016-Mar-02:00:00:00'), stats='only')
+    >>> stats['mce0']['data']['fb']['mean']
+
     """
 
     # If trange or reglist are unspecified, set them to empty strings.
@@ -95,17 +149,308 @@ def load_arc(arcdir, trange=None, reglist=None):
         if type(reglist) is tuple: 
             reglist = list(reglist)
         reglist.append('antenna0.time')
-    # Load data from arcfiles using readarc.
-    data = readarc(arcdir, trange[0], trange[1], reglist)
-    # Unpack timestamps.
-    data = unpack_utc(data)
-    # Select only data in time range.
-    if data['antenna0']['time']['utcslow'].size > 0:
-        data = select_data(data, trange)
+    if mem_budget is None:
+        mem_budget = 0
+    if stats and lazy is True:
+        raise ValueError('lazy reads do not gather stats')
+    if lazy == 'auto' and stats:
+        lazy = False
+    elif lazy == 'auto':
+        plan = readarc_plan(arcdir, trange[0], trange[1], reglist, frame_step,
+                            _conversion(dtype, utc))
+        lazy = mem_budget > 0 and plan['peak_bytes'] > mem_budget
+    if lazy:
+        return lazy_arc(arcdir, trange, reglist, mem_budget, frame_step, dtype,
+                        utc, layout)
+    # Load data from arcfiles using readarc; timestamps are decoded and
+    # frames cut to the time range as they are read.
+    data = readarc(arcdir, trange[0], trange[1], reglist, mem_budget,
+                   frame_step, _conversion(dtype, utc), TIME_REG, layout,
+                   _STATS_MODES[stats])
     # Done.
     return data
 
 
+def iter_arc(arcdir, trange=None, reglist=None, nframes=1000, mem_budget=None,
+             frame_step=1, dtype=None, utc='mjdsec', layout='channel'):
+    """
+    Read data from gcp arcfiles a window of frames at a time.
+
+    This is a generator version of load_arc for data sets too large to hold
+    in memory at once. Each iteration yields the same nested dict structure
+    as load_arc, holding the next `nframes` consecutive frames. Windows run
+    across arcfile boundaries; only the last one may be shorter.
+
+    Parameters
+    ----------
+    arcdir : str
+        Path to arcfile directory, or to a specific arcfile.
+    trange : tuple, optional
+        Two-element tuple containing start and stop time, as for load_arc.
+        Frames outside it are dropped as they are read, as for load_arc.
+    reglist : list, optional
+        List of registers to read, as for load_arc.
+    nframes : int, optional
+        Number of frames per window.
+    mem_budget : int, optional
+        Most bytes of data per window. Windows are cut to fewer than
+        `nframes` frames if need be to stay within it.
+    frame_step : int, optional
+        Keep only every frame_step'th frame, as for load_arc. Windows count
+        the frames kept.
+    dtype : str or numpy dtype, optional
+        Type to store numeric registers as, as for load_arc.
+    utc : {'mjdsec', 'mjd', 'unix'}, optional
+        How to decode time registers, as for load_arc.
+    layout : {'channel', 'frame'}, optional
+        Shape of each register's array, as for load_arc.
+
+    Examples
+    --------
+    >>> from arcfile import iter_arc
+
+    >>> for data in iter_arc('arc/', (t0, t1), ['mce0.data.fb'], 2000):
+    ...     process(data['mce0']['data']['fb'])
+
+    """
+
+    if trange is None:
+        trange = ('', '')
+    if reglist is None:
+        reglist = ''
+    if mem_budget is None:
+        mem_budget = 0
+    handle = readarc_open(arcdir, trange[0], trange[1], reglist, mem_budget,
+                          frame_step, _conversion(dtype, utc), TIME_REG, layout)
+    try:
+        while True:
+            data = readarc_next(handle, nframes)
+            if data is None:
+                break
+            yield data
+    finally:
+        readarc_close(handle)
+
+
+class LazyRegister(object):
+    """
+    Stand-in for one register's data, read from disk on first use.
+
+    Anything that needs the values (np.asarray, indexing, arithmetic through
+    numpy) reads them, along with every other register of the same lazy_arc
+    call that has been marked with prefetch(), in a single pass over the
+    arcfiles. The array is then kept, so later uses cost nothing.
+    """
+
+    def __init__(self, reader, index, name, dtype, nchan, spf):
+        self._reader = reader
+        self._index = index
+        self._data = None
+        self.name = name
+        self.dtype = dtype
+        self.nchan = nchan
+        self.spf = spf
+
+    @property
+    def loaded(self):
+        return self._data is not None
+
+    @property
+    def data(self):
+        if self._data is None:
+            self._reader.load([self])
+        return self._data
+
+    def prefetch(self):
+        """Read this register along with the next one that is used."""
+        if self._data is None:
+            self._reader.pending.add(self)
+
+    def release(self):
+        """Drop the loaded array; it is read again if used."""
+        self._data = None
+
+    @property
+    def shape(self):
+        return self.data.shape
+
+    @property
+    def size(self):
+        return self.data.size
+
+    def __array__(self, dtype=None):
+        if dtype is None:
+            return self.data
+        return self.data.astype(dtype)
+
+    def __getitem__(self, key):
+        return self.data[key]
+
+    def __len__(self):
+        return len(self.data)
+
+    def __repr__(self):
+        if self._data is None:
+            state = 'not loaded'
+        else:
+            state = 'shape {}'.format(self._data.shape)
+        return '<LazyRegister {} ({}, {} chan, {} spf), {}>'.format(
+            self.name, self.dtype, self.nchan, self.spf, state)
+
+
+class _LazyReader(object):
+    """Batches reads of LazyRegisters that share one catalog."""
+
+    def __init__(self, handle):
+        self.handle = handle
+        self.pending = set()
+
+    def load(self, regs):
+        regs = set(reg for reg in regs if reg._data is None)
+        regs |= set(reg for reg in self.pending if reg._data is None)
+        self.pending = set()
+        regs = list(regs)
+        arrays = lazyarc_load(self.handle, [reg._index for reg in regs])
+        for reg, arr in zip(regs, arrays):
+            reg._data = arr
+
+
+def lazy_arc(arcdir, trange=None, reglist=None, mem_budget=None,
+             frame_step=1, dtype=None, utc='mjdsec', layout='channel'):
+    """
+    Catalog the registers in gcp arcfiles without reading their data.
+
+    Returns the same nested dict structure as load_arc, but holding a
+    LazyRegister for each register instead of an array. Only the registers
+    that are actually used get read, and only when first used. To read
+    several registers in one pass over the files, call prefetch() on all but
+    one of them before using that one.
+
+    Parameters are as for load_arc. If a time range is given, every
+    register is cut to the frames in it as it is read. With a
+    mem_budget, a batch of registers that would not fit raises MemoryError
+    without reading anything.
+
+    Examples
+    --------
+    >>> from arcfile import lazy_arc
+
+    >>> data = lazy_arc('arc/', (t0, t1))
+    >>> data['antenna0']['tracker']['horiz_mount'].prefetch()
+    >>> fb = np.asarray(data['mce0']['data']['fb'])
+
+    """
+
+    if trange is None:
+        trange = ('', '')
+    if not reglist:
+        reglist = ''
+    if mem_budget is None:
+        mem_budget = 0
+    handle, catalog = lazyarc_open(arcdir, trange[0], trange[1], reglist,
+                                   mem_budget, frame_step,
+                                   _conversion(dtype, utc), TIME_REG, layout)
+    reader = _LazyReader(handle)
+    data = {}
+    for i, (mp, brd, reg, dtype, nchan, spf) in enumerate(catalog):
+        if dtype is None:
+            continue
+        name = '{}.{}.{}'.format(mp, brd, reg)
+        proxy = LazyRegister(reader, i, name, dtype, nchan, spf)
+        data.setdefault(mp, {}).setdefault(brd, {})[reg] = proxy
+    return data
+
+
+def arrow_arc(arcdir, trange=None, reglist=None, mem_budget=None,
+              frame_step=1, dtype=None, utc=None):
+    """
+    Read data from gcp arcfiles into a pyarrow Table, without copying.
+
+    The frames are read as for load_arc and handed to pyarrow through the
+    Arrow C data interface: each column points straight at the buffer the
+    samples were read into, which is freed once pyarrow lets go of the
+    table. Hand the table on to DuckDB, polars and the like in the same way.
+
+    Each channel of a register is a column, named 'map.board.reg', with
+    '[k]' after the name for registers of several channels. Registers with
+    several samples per frame give a fixed size list per row. Complex
+    registers are left out. Needs pyarrow.
+
+    Parameters
+    ----------
+    arcdir, trange, reglist, mem_budget, frame_step, dtype :
+        As for load_arc.
+    utc : {None, 'mjdsec', 'mjd', 'unix'}, optional
+        By default time registers become timestamp columns (the only
+        columns that are copied). Otherwise they are decoded as for
+        load_arc.
+
+    Examples
+    --------
+    >>> from arcfile import arrow_arc
+
+    >>> table = arrow_arc('arc/', (t0, t1), ['antenna0.tracker'])
+    >>> table.column('antenna0.tracker.az')
+
+    """
+
+    import pyarrow as pa
+
+    if trange is None:
+        trange = ('', '')
+    if not reglist:
+        reglist = ''
+    if mem_budget is None:
+        mem_budget = 0
+    handle, array, schema = readarc_arrow(arcdir, trange[0], trange[1],
+                                          reglist, mem_budget, frame_step,
+                                          _conversion(dtype, utc), TIME_REG)
+    batch = pa.RecordBatch._import_from_c(array, schema)
+    del handle
+    return pa.Table.from_batches([batch])
+
+
+# stats argument of load_arc -> that of readarc.
+_STATS_MODES = {False: 0, True: 1, 'only': 2}
+
+
+def _conversion(dtype, utc=None):
+    """Conversion string for readarc from a dtype and utc, or None."""
+    conv = []
+    if dtype is not None:
+        if isinstance(dtype, str):
+            conv.append(dtype)
+        else:
+            conv.append(np.dtype(dtype).name)
+    if utc is not None:
+        conv.append(utc)
+    if not conv:
+        return None
+    return ','.join(conv)
+
+
+def _seconds_since(utc, t0, mode):
+    """Seconds from (mjd, sec) time t0 to time samples decoded as mode."""
+    if mode == 'mjd':
+        return (np.ravel(utc) - t0[0]) * SECONDS_PER_DAY - t0[1]
+    if mode == 'unix':
+        return (np.ravel(utc) - (t0[0] - MJD_UNIX_EPOCH) * SECONDS_PER_DAY
+                - t0[1])
+    if utc.dtype == np.uint64:
+        utc = _unpack_utc_array(utc)
+    return (utc[0,:] - t0[0]) * SECONDS_PER_DAY + (utc[1,:] - t0[1])
+
+
+def _unpack_utc_array(arr):
+    """Convert one utc register from uint64 to floating-point (mjd, sec)."""
+    # MJD = UTC mod 2^32
+    mjd = np.mod(arr, 2**32).astype(np.float64)
+    # sec = (UTC // 2^32) / 1000.
+    sec = (arr // 2**32).astype(np.float64) / 1000.
+    # Combine into [2,N] array.
+    return np.array([mjd, sec]).squeeze()
+
+
 def unpack_utc(data):
     """Convert utc registers from uint64 to floating-point (mjd, sec)."""
     
@@ -117,16 +462,11 @@ def unpack_utc(data):
             for reg in data[mp][brd]:
                 # UTC values are the only thing stored as UINT64.
                 if data[mp][brd][reg].dtype == np.uint64:
-                    # MJD = UTC mod 2^32
-                    mjd = np.mod(data[mp][brd][reg], 2**32).astype(np.float)
-                    # sec = (UTC / 2^32) / 1000.
-                    sec = (data[mp][brd][reg] / 2**32).astype(np.float) / 1000.
-                    # Combine into [2,N] array.
-                    data[mp][brd][reg] = np.array([mjd, sec]).squeeze()
+                    data[mp][brd][reg] = _unpack_utc_array(data[mp][brd][reg])
     return data
 
 
-def select_data(data, trange):
+def select_data(data, trange, utc='mjdsec'):
     """Select only data that falls within the specified time range."""
 
     # If either element of trange is an empty string, then just return the data
@@ -138,12 +478,12 @@ def select_data(data, trange):
     Nslow = utcslow.shape[-1]
     utcfast = data['antenna0']['time']['utcfast']
     Nfast = utcfast.shape[-1]
-    sampratio = Nfast / Nslow # should be integer
+    sampratio = Nfast // Nslow # should be integer
     # Convert time range into (mjd, sec) pairs.
     t0 = tstring_to_mjd(trange[0])
     t1 = tstring_to_mjd(trange[1])
     # Select slow register data that falls within the requested range.
-    utcslow = (utcslow[0,:] - t0[0]) * SECONDS_PER_DAY + (utcslow[1,:] - t0[1])
+    utcslow = _seconds_since(utcslow, t0, utc)
     t1 = (t1[0] - t0[0]) * SECONDS_PER_DAY + (t1[1] - t0[1])
     islow = np.all([utcslow >= 0., utcslow < t1], axis=0)
     # Select fast registers corresponding to integer number of frames 
@@ -12,12 +12,24 @@
 #include <string.h>
 #include "numpy/arrayobject.h"
 #include "readarc.h"
+#include "arcstream.h"
+#include "lazyarc.h"
+#include "arcplan.h"
 #include "utcrange.h"
+#include "arcarrow.h"
 
 /* #define PR(args...) mexPrintf(args); mexEvalString("0;")
  */
 #define PR(args...) printf(args); printf("\n");
 
+/* Register names are str in Python 3, and */
+/* indices int; both were split in two.    */
+#if PY_MAJOR_VERSION >= 3
+#  define PyString_Check(o) PyUnicode_Check(o)
+#  define PyString_AsString(o) ((char *)PyUnicode_AsUTF8(o))
+#  define PyInt_AsLong(o) PyLong_AsLong(o)
+#endif
+
 #define DEBUG_MEX_READARC 0
 #if DEBUG_MEX_READARC
 #  define DEBUG(args...) PR(args)
@@ -54,46 +66,46 @@ int init_dict (struct dataset * ds, PyObject ** D)
   map_names = malloc ((ds->nb) * sizeof (char *));
   board_names = malloc ((ds->nb) * sizeof (char *));
   regblock_names = malloc ((ds->nb) * sizeof (char *));
-  last_map = ds->buf[0].rb->map;
-  last_board = ds->buf[0].rb->board;
+  last_map = rb_map (ds->buf[0].rb);
+  last_board = rb_board (ds->buf[0].rb);
   map_names[0] = last_map;
   nm = 1;
   board_names[0] = last_board;
   nb = 1;
-  regblock_names[0] = ds->buf[0].rb->regblock;
+  regblock_names[0] = rb_regblock (ds->buf[0].rb);
   nr = 1;
   DEBUG ("About to try initializing structure.\n");
   DEBUG ("On %s.%s.%s\n", map_names[0], board_names[0], regblock_names[0]);
   for (i=1; i<ds->nb; i++)
   {
-    DEBUG ("On %s.%s.%s\n", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock);
-    if (0 != strcmp (ds->buf[i].rb->map, last_map))
+    DEBUG ("On %s.%s.%s\n", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+    if (0 != strcmp (rb_map (ds->buf[i].rb), last_map))
     {
       boards[nb-1] = PyDict_New();
       maps[nm-1] = PyDict_New();
       for (j=0; j<nb; j++)
         PyDict_SetItemString(maps[nm-1],board_names[j],boards[j]);
-      regblock_names[0] = ds->buf[i].rb->regblock;
+      regblock_names[0] = rb_regblock (ds->buf[i].rb);
       nr = 1;
-      last_board = ds->buf[i].rb->board;
+      last_board = rb_board (ds->buf[i].rb);
       board_names[0] = last_board;
       nb = 1;
-      last_map = ds->buf[i].rb->map;
+      last_map = rb_map (ds->buf[i].rb);
       map_names[nm] = last_map;
       nm++;
       continue;
     }
-    if (0 != strcmp (ds->buf[i].rb->board, last_board))
+    if (0 != strcmp (rb_board (ds->buf[i].rb), last_board))
     {
       boards[nb-1] = PyDict_New();
-      regblock_names[0] = ds->buf[i].rb->regblock;
+      regblock_names[0] = rb_regblock (ds->buf[i].rb);
       nr = 1;
-      last_board = ds->buf[i].rb->board;
+      last_board = rb_board (ds->buf[i].rb);
       board_names[nb] = last_board;
       nb++;
       continue;
     }
-    regblock_names[nr] = ds->buf[i].rb->regblock;
+    regblock_names[nr] = rb_regblock (ds->buf[i].rb);
     nr++;
   }
   boards[nb-1] = PyDict_New();
@@ -115,6 +127,34 @@ int init_dict (struct dataset * ds, PyObject ** D)
   return 0;
 }
    
+/* Numpy type for a register type word, or -1 if there */
+/* is none.                                            */
+static int pyc_typenum (uint32_t typeword)
+{
+    switch (typeword & GCP_REG_TYPE)
+    {
+      case GCP_REG_UINT:
+        return NPY_UINT32;
+      case GCP_REG_INT:
+        return NPY_INT32;
+      case GCP_REG_UCHAR:
+        return NPY_UINT8;
+      case GCP_REG_CHAR:
+        return NPY_INT8;
+      case GCP_REG_FLOAT:
+        return NPY_FLOAT32;
+      case GCP_REG_DOUBLE:
+        return NPY_FLOAT64;
+
+      /* Just treat UTC times as a UINT64, for now. */
+      case GCP_REG_UTC:
+	return NPY_UINT64;
+
+      default: 
+        return -1;
+    }
+}
+
 int pyc_wrap_timestreams (struct dataset * ds, PyObject ** D)
 {
   int i;
@@ -123,46 +163,22 @@ int pyc_wrap_timestreams (struct dataset * ds, PyObject ** D)
   PyObject * tmp;
   int typenum;
   int numchan;
-  npy_intp dims[2];
+  npy_intp dims[3];
 
   init_dict (ds, D);
 
   for (i=0; i<ds->nb; i++)
   {
-    map = PyDict_GetItemString (*D, ds->buf[i].rb->map);
+    map = PyDict_GetItemString (*D, rb_map (ds->buf[i].rb));
     if (map == NULL)
       return -1;
-    board = PyDict_GetItemString (map, ds->buf[i].rb->board);
+    board = PyDict_GetItemString (map, rb_board (ds->buf[i].rb));
     if (board == NULL)
       return -1;
     
-    switch (ds->buf[i].rb->typeword & GCP_REG_TYPE)
+    typenum = pyc_typenum (ds->buf[i].rb->typeword);
+    if (typenum < 0)
     {
-      case GCP_REG_UINT:
-        typenum = NPY_UINT32;
-        break;
-      case GCP_REG_INT:
-        typenum = NPY_INT32;
-        break;
-      case GCP_REG_UCHAR:
-        typenum = NPY_UINT8;
-        break;
-      case GCP_REG_CHAR:
-        typenum = NPY_INT8;
-        break;
-      case GCP_REG_FLOAT:
-        typenum = NPY_FLOAT32;
-        break;
-      case GCP_REG_DOUBLE:
-        typenum = NPY_FLOAT64;
-        break;
-
-      /* Just treat UTC times as a UINT64, for now. */
-      case GCP_REG_UTC:
-	typenum = NPY_UINT64;
-        break;
-
-      default: 
         PR ("Skipping register of type 0x%lx.\n", (long int)(ds->buf[i].rb->typeword & GCP_REG_TYPE));
         continue;
     }
@@ -172,71 +188,163 @@ int pyc_wrap_timestreams (struct dataset * ds, PyObject ** D)
     if (!ds->buf[i].rb->do_arc)
     {
       DEBUG ("Initializing empty matrix %s.%s.%s\n",
-        ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock);
+        rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
       tmp = PyArray_New (&PyArray_Type, 0, NULL, typenum, NULL, NULL, 0, 0, NULL);
-      PyDict_SetItemString (board, ds->buf[i].rb->regblock, tmp);
+      PyDict_SetItemString (board, rb_regblock (ds->buf[i].rb), tmp);
       continue;
     }
     DEBUG ("Copying %s.%s.%s, %dx%d, numframes=%d, length=%ld.\n",
-      ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock,
-      ds->buf[i].rb->spf * ds->num_frames, numchan,
+      rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb),
+      ds->buf[i].spf * ds->num_frames, numchan,
       ds->buf[i].numframes, (long int)ds->buf[i].bufsize);
-    dims[1] = ds->buf[i].rb->spf * ds->num_frames;
-    dims[0] = numchan;
-    tmp = PyArray_New (&PyArray_Type, 2, dims, typenum, NULL, NULL, 0, 0, NULL);
+    if (ds->buf[i].layout == LAYOUT_BY_FRAME)
+    {
+      /* [frame][channel][sample], in C order. */
+      dims[0] = ds->num_frames;
+      dims[1] = numchan;
+      dims[2] = ds->buf[i].spf;
+      tmp = PyArray_New (&PyArray_Type, 3, dims, typenum, NULL, NULL, 0, 0, NULL);
+    }
+    else
+    {
+      dims[1] = ds->buf[i].spf * ds->num_frames;
+      dims[0] = numchan;
+      tmp = PyArray_New (&PyArray_Type, 2, dims, typenum, NULL, NULL, 0, 0, NULL);
+    }
     if (tmp == NULL) {
       PR ("Failed!");
       return -1;
     }
     memcpy ((void *)PyArray_DATA(tmp), (void *)ds->buf[i].buf,
-      (numchan * ds->buf[i].rb->spf * ds->buf[i].numframes * ds->buf[i].elsize));
-    PyDict_SetItemString (board, ds->buf[i].rb->regblock, tmp);
+      (numchan * ds->buf[i].spf * ds->buf[i].numframes * ds->buf[i].elsize));
+    PyDict_SetItemString (board, rb_regblock (ds->buf[i].rb), tmp);
   }
   return 0;
 }
 
-static PyObject * pyc_readarc (PyObject * self, PyObject * args)
+/* Build the same dictionary hierarchy as for the data, */
+/* holding for each register a dictionary of per-channel */
+/* statistics: n, nan, min, max, mean and var.           */
+int pyc_wrap_stats (struct dataset * ds, PyObject ** S)
 {
-    char * fname = NULL;
-    char * utcstr1 = NULL;
-    char * utcstr2 = NULL;
-    PyObject * regspec = NULL;
-    struct arcfilt filt;
-    struct dataset ds;
-    PyObject * D;
-    int r;
+  int i, k;
+  PyObject * map;
+  PyObject * board;
+  PyObject * st;
+  PyObject * a[6];
+  static const char * names[6] = { "n", "nan", "min", "max", "mean", "var" };
+  struct chanstats * cs;
+  npy_intp dims[1];
 
-    PR ("readarc - a portable arc file reader\n");
-    r = PyArg_ParseTuple (args, "|sssO", &fname, &utcstr1, &utcstr2, &regspec);
-    if (!r || !fname) {
-        PyErr_SetString (PyExc_RuntimeError, "readarc (file or directory, utc1, utc2, registers)");
-        return NULL;
+  init_dict (ds, S);
+
+  for (i=0; i<ds->nb; i++)
+  {
+    if (ds->buf[i].stats == NULL)
+      continue;
+    map = PyDict_GetItemString (*S, rb_map (ds->buf[i].rb));
+    if (map == NULL)
+      return -1;
+    board = PyDict_GetItemString (map, rb_board (ds->buf[i].rb));
+    if (board == NULL)
+      return -1;
+
+    dims[0] = databuf_nchan (&(ds->buf[i]));
+    st = PyDict_New ();
+    for (k=0; k<6; k++)
+    {
+      a[k] = PyArray_SimpleNew (1, dims, (k < 2) ? NPY_INT64 : NPY_FLOAT64);
+      if (a[k] == NULL)
+        return -1;
     }
+    for (k=0; k<dims[0]; k++)
+    {
+      cs = &(ds->buf[i].stats[k]);
+      ((int64_t *)PyArray_DATA (a[0]))[k] = cs->n;
+      ((int64_t *)PyArray_DATA (a[1]))[k] = cs->nnan;
+      ((double *)PyArray_DATA (a[2]))[k] = cs->min;
+      ((double *)PyArray_DATA (a[3]))[k] = cs->max;
+      ((double *)PyArray_DATA (a[4]))[k] = cs->mean;
+      ((double *)PyArray_DATA (a[5]))[k] = chanstats_var (cs);
+    }
+    for (k=0; k<6; k++)
+    {
+      PyDict_SetItemString (st, names[k], a[k]);
+      Py_DECREF (a[k]);
+    }
+    PyDict_SetItemString (board, rb_regblock (ds->buf[i].rb), st);
+    Py_DECREF (st);
+  }
+  return 0;
+}
+
+/* Cancellation callback for readarc.  readarc runs without */
+/* the GIL, so briefly take it back to let the interpreter   */
+/* run its signal handlers.  A KeyboardInterrupt is left     */
+/* set for pyc_readarc to raise once readarc gives up.       */
+static int pyc_check_signals (void * arg)
+{
+  PyGILState_STATE gstate;
+  int r;
+
+  gstate = PyGILState_Ensure ();
+  r = PyErr_CheckSignals ();
+  PyGILState_Release (gstate);
+
+  return (r != 0);
+}
+
+/* Fill in an arcfilt from the Python-style arguments shared */
+/* by readarc and readarc_open.  On failure, sets a Python   */
+/* exception and returns nonzero.                            */
+static int pyc_parse_filt (char * fname, char * utcstr1, char * utcstr2, PyObject * regspec,
+    char * convstr, char * timereg, char * layoutstr, struct arcfilt * filt)
+{
+    int r;
 
+    arcfilt_init (filt);
     if (!utcstr1 || !utcstr1[0] || !utcstr2 || !utcstr2[0]) {
-      filt.use_utc = 0; }
+      filt->use_utc = 0; }
     else
     {
-      r = txt2utc (utcstr1, filt.t1);
+      r = txt2utc (utcstr1, filt->t1);
       if (r != 0) {
         PyErr_SetString (PyExc_RuntimeError, "could not parse UTC time 1!");
-        return NULL;
+        return -1;
       }
-      r = txt2utc (utcstr2, filt.t2);
+      r = txt2utc (utcstr2, filt->t2);
       if (r != 0) {
         PyErr_SetString (PyExc_RuntimeError, "could not parse UTC time 2!");
-        return NULL;
+        return -1;
       }
       DEBUG ("Selecting on time range (%lu,%lu) - (%lu,%lu)\n",
-        filt.t1[0], filt.t1[1], filt.t2[0], filt.t2[1]);
-      filt.use_utc = 1;
+        filt->t1[0], filt->t1[1], filt->t2[0], filt->t2[1]);
+      filt->use_utc = 1;
+      if (timereg && timereg[0])
+        filt->time_reg = timereg;
+    }
+
+    if (convstr && convstr[0] && (parse_conversion (convstr, &(filt->conv)) != 0))
+    {
+      PyErr_SetString (PyExc_RuntimeError, "could not parse conversion!");
+      return -1;
+    }
+
+    if (layoutstr && layoutstr[0])
+    {
+      filt->layout = parse_layout (layoutstr);
+      if (filt->layout < 0)
+      {
+        PyErr_SetString (PyExc_RuntimeError, "layout must be 'channel' or 'frame'!");
+        return -1;
+      }
     }
 
     if (!regspec)
     {
       PR ("No register list specified.  Loading everything.");
-      filt.nl.n = 0;
-      filt.nl.s = 0;
+      filt->nl.n = 0;
+      filt->nl.s = 0;
     }
     else
     {
@@ -264,26 +372,77 @@ static PyObject * pyc_readarc (PyObject * self, PyObject * args)
       else
       {
           PyErr_SetString (PyExc_RuntimeError, "fourth argument to readarc must be a string or cell array of strings.");
-          return NULL;
+          return -1;
       }
-      create_namelist (nn, nlist, &(filt.nl));
+      create_namelist (nn, nlist, &(filt->nl));
       /* 
        * for (in=0; in<nn; in++)
        *    mxFree (nlist[in]);
        */
       free (nlist);
     }
-    filt.fname = fname;
-    DEBUG ("Number of register name specifications = %d.\n", filt.nl.n);
+    filt->fname = fname;
+    DEBUG ("Number of register name specifications = %d.\n", filt->nl.n);
+
+    return 0;
+}
+
+static PyObject * pyc_readarc (PyObject * self, PyObject * args)
+{
+    char * fname = NULL;
+    char * utcstr1 = NULL;
+    char * utcstr2 = NULL;
+    PyObject * regspec = NULL;
+    struct arcfilt filt;
+    struct arccancel cancel;
+    struct dataset ds;
+    PyObject * D;
+    Py_ssize_t budget = 0;
+    int step = 1;
+    char * convstr = NULL;
+    char * timereg = NULL;
+    char * layoutstr = NULL;
+    int stats = STATS_NONE;
+    PyObject * S;
+    int r;
+
+    PR ("readarc - a portable arc file reader\n");
+    r = PyArg_ParseTuple (args, "|sssOnizzzi", &fname, &utcstr1, &utcstr2, &regspec, &budget, &step, &convstr, &timereg, &layoutstr, &stats);
+    if (!r || !fname || (stats < STATS_NONE) || (stats > STATS_ONLY)) {
+        PyErr_SetString (PyExc_RuntimeError, "readarc (file or directory, utc1, utc2, registers, mem_budget, frame_step, convert, time_reg, layout, stats)");
+        return NULL;
+    }
+
+    if (pyc_parse_filt (fname, utcstr1, utcstr2, regspec, convstr, timereg, layoutstr, &filt) != 0)
+      return NULL;
+    filt.mem_budget = budget;
+    filt.frame_step = step;
+    filt.stats = stats;
+
+    /* Don't touch the process-wide SIGINT handler; poll the */
+    /* interpreter's signal state from our own token instead. */
+    init_arccancel (&cancel, pyc_check_signals, NULL);
+    filt.cancel = &cancel;
 
     DEBUG ("Calling readarc.\n");
 
+    /* Nothing in readarc touches Python objects, so let other */
+    /* threads run (and read other time ranges) meanwhile.     */
+    Py_BEGIN_ALLOW_THREADS
     r = readarc (&filt, &ds); 
+    Py_END_ALLOW_THREADS
     DEBUG ("Returned %d.\n", r);
     if (r == ARC_ERR_SIGINT)
     {
       free_namelist (&(filt.nl));
-      PyErr_SetString (PyExc_RuntimeError, "Exiting at user request.\n");
+      if (!PyErr_Occurred ())
+        PyErr_SetString (PyExc_RuntimeError, "Exiting at user request.\n");
+      return NULL;
+    }
+    else if (r == ARC_ERR_BUDGET)
+    {
+      free_namelist (&(filt.nl));
+      PyErr_SetString (PyExc_MemoryError, "arc file data would exceed the memory budget.");
       return NULL;
     }
     else if (r != 0)
@@ -293,8 +452,13 @@ static PyObject * pyc_readarc (PyObject * self, PyObject * args)
     }
     free_namelist (&(filt.nl));
 
-    if (r == 0)
+    /* Statistics only: {stats}; with data: (data, stats). */
+    D = NULL;
+    S = NULL;
+    if ((r == 0) && (stats != STATS_ONLY))
         r = pyc_wrap_timestreams (&ds, &D);
+    if ((r == 0) && (stats != STATS_NONE))
+        r = pyc_wrap_stats (&ds, &S);
     if (r != 0)
     {
         PR ("Reading arc file %s:\n", fname);
@@ -303,20 +467,650 @@ static PyObject * pyc_readarc (PyObject * self, PyObject * args)
     }
 
     free_dataset (&ds);
+    if (stats == STATS_ONLY)
+      return S;
+    if (stats == STATS_WITH_DATA)
+      return Py_BuildValue ("(NN)", D, S);
     return D;
 }
 
+/* State behind a handle from readarc_open.  The arcfilt must */
+/* outlive the stream, so it (and its file name) live here.  */
+#define PYC_STREAM_NAME "arcfile.arcstream"
+
+struct pyc_stream {
+    struct arcfilt filt;
+    struct arccancel cancel;
+    struct arcstream s;
+    struct dataset ds;
+    int is_open;
+};
+
+static void pyc_stream_free (struct pyc_stream * ps)
+{
+    if (!ps->is_open)
+      return;
+    readarc_close (&(ps->s));
+    if (ps->s.ds_ready)
+      free_dataset (&(ps->ds));
+    free_namelist (&(ps->filt.nl));
+    free (ps->filt.fname);
+    free (ps->filt.time_reg);
+    ps->is_open = 0;
+}
+
+static void pyc_stream_destructor (PyObject * h)
+{
+    struct pyc_stream * ps;
+
+    ps = PyCapsule_GetPointer (h, PYC_STREAM_NAME);
+    if (ps == NULL)
+      return;
+    pyc_stream_free (ps);
+    free (ps);
+}
+
+static PyObject * pyc_readarc_open (PyObject * self, PyObject * args)
+{
+    char * fname = NULL;
+    char * utcstr1 = NULL;
+    char * utcstr2 = NULL;
+    PyObject * regspec = NULL;
+    struct pyc_stream * ps;
+    PyObject * h;
+    Py_ssize_t budget = 0;
+    int step = 1;
+    char * convstr = NULL;
+    char * timereg = NULL;
+    char * layoutstr = NULL;
+    int r;
+
+    r = PyArg_ParseTuple (args, "|sssOnizzz", &fname, &utcstr1, &utcstr2, &regspec, &budget, &step, &convstr, &timereg, &layoutstr);
+    if (!r || !fname) {
+        PyErr_SetString (PyExc_RuntimeError, "readarc_open (file or directory, utc1, utc2, registers, mem_budget, frame_step, convert, time_reg, layout)");
+        return NULL;
+    }
+
+    ps = malloc (sizeof (struct pyc_stream));
+    if (ps == NULL)
+      return PyErr_NoMemory ();
+    ps->is_open = 0;
+    if (pyc_parse_filt (fname, utcstr1, utcstr2, regspec, convstr, timereg, layoutstr, &(ps->filt)) != 0)
+    {
+      free (ps);
+      return NULL;
+    }
+    ps->filt.fname = strdup (fname);
+    if (ps->filt.time_reg != NULL)
+      ps->filt.time_reg = strdup (ps->filt.time_reg);
+    ps->filt.mem_budget = budget;
+    ps->filt.frame_step = step;
+    init_arccancel (&(ps->cancel), pyc_check_signals, NULL);
+    ps->filt.cancel = &(ps->cancel);
+
+    Py_BEGIN_ALLOW_THREADS
+    r = readarc_open (&(ps->filt), &(ps->s));
+    Py_END_ALLOW_THREADS
+    if (r != 0)
+    {
+      free_namelist (&(ps->filt.nl));
+      free (ps->filt.fname);
+      free (ps->filt.time_reg);
+      free (ps);
+      PR ("Reading arc file %s:\n", fname);
+      PyErr_SetString (PyExc_RuntimeError, "Error opening arc files.\n");
+      return NULL;
+    }
+    ps->is_open = 1;
+
+    h = PyCapsule_New (ps, PYC_STREAM_NAME, pyc_stream_destructor);
+    if (h == NULL)
+    {
+      pyc_stream_free (ps);
+      free (ps);
+    }
+    return h;
+}
+
+/* Return the next window of frames as a dictionary, or None */
+/* once the stream is used up.                               */
+static PyObject * pyc_readarc_next (PyObject * self, PyObject * args)
+{
+    PyObject * h;
+    int nframes = 1000;
+    struct pyc_stream * ps;
+    PyObject * D;
+    int r;
+
+    if (!PyArg_ParseTuple (args, "O|i", &h, &nframes))
+      return NULL;
+    ps = PyCapsule_GetPointer (h, PYC_STREAM_NAME);
+    if (ps == NULL)
+      return NULL;
+    if (!ps->is_open)
+    {
+      PyErr_SetString (PyExc_RuntimeError, "arc file stream is closed.");
+      return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    r = readarc_next (&(ps->s), nframes, &(ps->ds));
+    Py_END_ALLOW_THREADS
+    if (r == ARC_ERR_SIGINT)
+    {
+      if (!PyErr_Occurred ())
+        PyErr_SetString (PyExc_RuntimeError, "Exiting at user request.\n");
+      return NULL;
+    }
+    else if (r == ARC_ERR_BUDGET)
+    {
+      PyErr_SetString (PyExc_MemoryError, "a single frame exceeds the memory budget.");
+      return NULL;
+    }
+    else if (r != 0)
+    {
+      PyErr_SetString (PyExc_RuntimeError, "Error reading arc files.\n");
+      return NULL;
+    }
+
+    if (ps->ds.num_frames == 0)
+      Py_RETURN_NONE;
+
+    /* The arrays are copies, so the window buffers can be reused. */
+    r = pyc_wrap_timestreams (&(ps->ds), &D);
+    if (r != 0)
+    {
+      PyErr_SetString (PyExc_RuntimeError, "Error packaging frames for output.\n");
+      return NULL;
+    }
+    return D;
+}
+
+static PyObject * pyc_readarc_close (PyObject * self, PyObject * args)
+{
+    PyObject * h;
+    struct pyc_stream * ps;
+
+    if (!PyArg_ParseTuple (args, "O", &h))
+      return NULL;
+    ps = PyCapsule_GetPointer (h, PYC_STREAM_NAME);
+    if (ps == NULL)
+      return NULL;
+    pyc_stream_free (ps);
+
+    Py_RETURN_NONE;
+}
+
+/* State behind a handle from lazyarc_open.  As for streams, */
+/* the arcfilt lives here so that it outlives the catalog.    */
+#define PYC_LAZY_NAME "arcfile.lazyarc"
+
+struct pyc_lazy {
+    struct arcfilt filt;
+    struct arccancel cancel;
+    struct lazyarc la;
+};
+
+static void pyc_lazy_destructor (PyObject * h)
+{
+    struct pyc_lazy * pl;
+
+    pl = PyCapsule_GetPointer (h, PYC_LAZY_NAME);
+    if (pl == NULL)
+      return;
+    lazyarc_close (&(pl->la));
+    free_namelist (&(pl->filt.nl));
+    free (pl->filt.fname);
+    free (pl->filt.time_reg);
+    free (pl);
+}
+
+/* Frees a column buffer once numpy is done with it. */
+static void pyc_free_buffer (PyObject * c)
+{
+    free (PyCapsule_GetPointer (c, NULL));
+}
+
+/* Hand a loaded column over to numpy without copying it.  The */
+/* column is left unloaded; the array owns the buffer now.     */
+static PyObject * pyc_lazy_take (struct lazyarc * la, int i)
+{
+    struct databuf * ts = &(la->col[i].buf);
+    PyObject * tmp;
+    PyObject * base;
+    npy_intp dims[3];
+    int typenum;
+    int numchan;
+
+    typenum = pyc_typenum (ts->rb->typeword);
+    numchan = ts->rb->nchan;
+    if (ts->chan.n != 0)
+      numchan = ts->chan.ntot;
+
+    if ((ts->buf == NULL) || (ts->numframes == 0))
+    {
+      if (ts->rb->do_arc && (ts->layout == LAYOUT_BY_FRAME))
+      {
+        dims[0] = 0;
+        dims[1] = numchan;
+        dims[2] = ts->spf;
+        tmp = PyArray_SimpleNew (3, dims, typenum);
+      }
+      else if (ts->rb->do_arc)
+      {
+        dims[0] = numchan;
+        dims[1] = 0;
+        tmp = PyArray_SimpleNew (2, dims, typenum);
+      }
+      else
+        tmp = PyArray_New (&PyArray_Type, 0, NULL, typenum, NULL, NULL, 0, 0, NULL);
+      lazyarc_forget (la, i);
+      return tmp;
+    }
+
+    if (ts->layout == LAYOUT_BY_FRAME)
+    {
+      dims[0] = ts->numframes;
+      dims[1] = numchan;
+      dims[2] = ts->spf;
+      tmp = PyArray_SimpleNewFromData (3, dims, typenum, ts->buf);
+    }
+    else
+    {
+      dims[0] = numchan;
+      dims[1] = ts->spf * ts->numframes;
+      tmp = PyArray_SimpleNewFromData (2, dims, typenum, ts->buf);
+    }
+    if (tmp == NULL)
+      return NULL;
+    base = PyCapsule_New (ts->buf, NULL, pyc_free_buffer);
+    if (base == NULL)
+    {
+      Py_DECREF (tmp);
+      return NULL;
+    }
+    PyArray_SetBaseObject ((PyArrayObject *)tmp, base);
+
+    ts->buf = NULL;
+    ts->maxframes = 0;
+    lazyarc_forget (la, i);
+
+    return tmp;
+}
+
+/* Open a catalog of registers without reading any data.    */
+/* Returns the handle and a list of (map, board, regblock,  */
+/* dtype, nchan, spf) tuples, one per catalog index; dtype  */
+/* is None for registers that can't be loaded.              */
+static PyObject * pyc_lazyarc_open (PyObject * self, PyObject * args)
+{
+    char * fname = NULL;
+    char * utcstr1 = NULL;
+    char * utcstr2 = NULL;
+    PyObject * regspec = NULL;
+    struct pyc_lazy * pl;
+    struct regblockspec * rb;
+    PyObject * h;
+    PyObject * cat;
+    PyObject * dt;
+    uint32_t typeword;
+    int typenum, numchan, spf;
+    Py_ssize_t budget = 0;
+    int step = 1;
+    char * convstr = NULL;
+    char * timereg = NULL;
+    char * layoutstr = NULL;
+    int i, r;
+
+    r = PyArg_ParseTuple (args, "|sssOnizzz", &fname, &utcstr1, &utcstr2, &regspec, &budget, &step, &convstr, &timereg, &layoutstr);
+    if (!r || !fname) {
+        PyErr_SetString (PyExc_RuntimeError, "lazyarc_open (file or directory, utc1, utc2, registers, mem_budget, frame_step, convert, time_reg, layout)");
+        return NULL;
+    }
+
+    pl = malloc (sizeof (struct pyc_lazy));
+    if (pl == NULL)
+      return PyErr_NoMemory ();
+    if (pyc_parse_filt (fname, utcstr1, utcstr2, regspec, convstr, timereg, layoutstr, &(pl->filt)) != 0)
+    {
+      free (pl);
+      return NULL;
+    }
+    pl->filt.fname = strdup (fname);
+    if (pl->filt.time_reg != NULL)
+      pl->filt.time_reg = strdup (pl->filt.time_reg);
+    pl->filt.mem_budget = budget;
+    pl->filt.frame_step = step;
+    init_arccancel (&(pl->cancel), pyc_check_signals, NULL);
+    pl->filt.cancel = &(pl->cancel);
+
+    Py_BEGIN_ALLOW_THREADS
+    r = lazyarc_open (&(pl->filt), &(pl->la));
+    Py_END_ALLOW_THREADS
+    if (r != 0)
+    {
+      free_namelist (&(pl->filt.nl));
+      free (pl->filt.fname);
+      free (pl->filt.time_reg);
+      free (pl);
+      PR ("Reading arc file %s:\n", fname);
+      PyErr_SetString (PyExc_RuntimeError, "Error opening arc files.\n");
+      return NULL;
+    }
+
+    h = PyCapsule_New (pl, PYC_LAZY_NAME, pyc_lazy_destructor);
+    if (h == NULL)
+    {
+      lazyarc_close (&(pl->la));
+      free_namelist (&(pl->filt.nl));
+      free (pl->filt.fname);
+      free (pl->filt.time_reg);
+      free (pl);
+      return NULL;
+    }
+
+    cat = PyList_New (pl->la.rl.num_regblocks);
+    if (cat == NULL)
+    {
+      Py_DECREF (h);
+      return NULL;
+    }
+    for (i=0; i<pl->la.rl.num_regblocks; i++)
+    {
+      rb = &(pl->la.rl.r[i].rb);
+      if (databuf_layout (&(pl->la.rl.r[i]), &numchan, &spf, &typeword) != 0)
+      {
+        numchan = rb->nchan;
+        if (pl->la.rl.r[i].chan.n != 0)
+          numchan = pl->la.rl.r[i].chan.ntot;
+        spf = rb->spf;
+        typeword = rb->typeword;
+      }
+      typenum = pyc_typenum (typeword);
+      if (typenum < 0)
+      {
+        Py_INCREF (Py_None);
+        dt = Py_None;
+      }
+      else
+        dt = (PyObject *)PyArray_DescrFromType (typenum);
+      PyList_SET_ITEM (cat, i, Py_BuildValue ("(sssNii)",
+        rb_map (rb), rb_board (rb), rb_regblock (rb), dt, numchan, spf));
+    }
+
+    return Py_BuildValue ("(NN)", h, cat);
+}
+
+/* Read the listed catalog indices in one pass over the   */
+/* files, and return their arrays in the same order.      */
+static PyObject * pyc_lazyarc_load (PyObject * self, PyObject * args)
+{
+    PyObject * h;
+    PyObject * idx;
+    PyObject * seq;
+    PyObject * out;
+    PyObject * tmp;
+    struct pyc_lazy * pl;
+    int i, n, k, r;
+
+    if (!PyArg_ParseTuple (args, "OO", &h, &idx))
+      return NULL;
+    pl = PyCapsule_GetPointer (h, PYC_LAZY_NAME);
+    if (pl == NULL)
+      return NULL;
+    seq = PySequence_Fast (idx, "second argument to lazyarc_load must be a list of indices.");
+    if (seq == NULL)
+      return NULL;
+
+    n = PySequence_Fast_GET_SIZE (seq);
+    for (i=0; i<n; i++)
+    {
+      k = PyInt_AsLong (PySequence_Fast_GET_ITEM (seq, i));
+      if ((k == -1) && PyErr_Occurred ())
+        break;
+      if ((k < 0) || (k >= pl->la.rl.num_regblocks)
+          || (pyc_typenum (pl->la.rl.r[k].rb.typeword) < 0))
+      {
+        PyErr_Format (PyExc_IndexError, "no loadable register at catalog index %d.", k);
+        break;
+      }
+      lazyarc_request (&(pl->la), k);
+    }
+    if (PyErr_Occurred ())
+    {
+      Py_DECREF (seq);
+      return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    r = lazyarc_load (&(pl->la));
+    Py_END_ALLOW_THREADS
+    if (r != 0)
+    {
+      /* Don't leave these to be read with the next batch. */
+      for (i=0; i<n; i++)
+        lazyarc_forget (&(pl->la), PyInt_AsLong (PySequence_Fast_GET_ITEM (seq, i)));
+      Py_DECREF (seq);
+      if (!PyErr_Occurred ())
+      {
+        if (r == ARC_ERR_SIGINT)
+          PyErr_SetString (PyExc_RuntimeError, "Exiting at user request.\n");
+        else if (r == ARC_ERR_BUDGET)
+          PyErr_SetString (PyExc_MemoryError, "these registers would exceed the memory budget.");
+        else
+          PyErr_SetString (PyExc_RuntimeError, "Error reading arc files.\n");
+      }
+      return NULL;
+    }
+
+    /* An index listed twice was handed over the first time. */
+    out = PyList_New (n);
+    for (i=0; (out != NULL) && (i<n); i++)
+    {
+      k = PyInt_AsLong (PySequence_Fast_GET_ITEM (seq, i));
+      if (pl->la.col[k].state == LAZY_LOADED)
+        tmp = pyc_lazy_take (&(pl->la), k);
+      else
+      {
+        tmp = Py_None;
+        Py_INCREF (tmp);
+      }
+      if (tmp == NULL)
+      {
+        Py_DECREF (out);
+        out = NULL;
+        break;
+      }
+      PyList_SET_ITEM (out, i, tmp);
+    }
+    Py_DECREF (seq);
+
+    return out;
+}
+
+/* Work out what readarc would read and allocate, without */
+/* reading any frames.  Returns a dictionary.             */
+static PyObject * pyc_readarc_plan (PyObject * self, PyObject * args)
+{
+    char * fname = NULL;
+    char * utcstr1 = NULL;
+    char * utcstr2 = NULL;
+    PyObject * regspec = NULL;
+    struct arcfilt filt;
+    struct arcplan plan;
+    int step = 1;
+    char * convstr = NULL;
+    int r;
+
+    r = PyArg_ParseTuple (args, "|sssOiz", &fname, &utcstr1, &utcstr2, &regspec, &step, &convstr);
+    if (!r || !fname) {
+        PyErr_SetString (PyExc_RuntimeError, "readarc_plan (file or directory, utc1, utc2, registers, frame_step, convert)");
+        return NULL;
+    }
+    if (pyc_parse_filt (fname, utcstr1, utcstr2, regspec, convstr, NULL, NULL, &filt) != 0)
+      return NULL;
+    filt.frame_step = step;
+
+    Py_BEGIN_ALLOW_THREADS
+    r = readarc_plan (&filt, &plan);
+    Py_END_ALLOW_THREADS
+    free_namelist (&(filt.nl));
+    if (r != 0)
+    {
+      PyErr_SetString (PyExc_RuntimeError, "Error opening arc files.\n");
+      return NULL;
+    }
+
+    return Py_BuildValue ("{s:i,s:l,s:O,s:n,s:n,s:n}",
+      "nfiles", plan.nfiles,
+      "nframes", plan.nframes,
+      "exact", plan.exact ? Py_True : Py_False,
+      "frame_bytes", (Py_ssize_t)plan.frame_bytes,
+      "data_bytes", (Py_ssize_t)plan.data_bytes,
+      "peak_bytes", (Py_ssize_t)plan.peak_bytes);
+}
+
+/* An exported data set, until whoever imports it takes it */
+/* over; what's left is released along with the handle.    */
+#define PYC_ARROW_NAME "arcfile.arrow"
+
+struct pyc_arrow {
+    struct ArrowSchema schema;
+    struct ArrowArray array;
+};
+
+static void pyc_arrow_destructor (PyObject * h)
+{
+    struct pyc_arrow * pa;
+
+    pa = PyCapsule_GetPointer (h, PYC_ARROW_NAME);
+    if (pa == NULL)
+      return;
+    if (pa->array.release != NULL)
+      pa->array.release (&(pa->array));
+    if (pa->schema.release != NULL)
+      pa->schema.release (&(pa->schema));
+    free (pa);
+}
+
+/* Read frames as readarc does, but hand them over through */
+/* the Arrow C data interface rather than as numpy arrays. */
+/* Returns (handle, array address, schema address).        */
+static PyObject * pyc_readarc_arrow (PyObject * self, PyObject * args)
+{
+    char * fname = NULL;
+    char * utcstr1 = NULL;
+    char * utcstr2 = NULL;
+    PyObject * regspec = NULL;
+    struct arcfilt filt;
+    struct arccancel cancel;
+    struct dataset ds;
+    struct pyc_arrow * pa;
+    PyObject * h;
+    Py_ssize_t budget = 0;
+    int step = 1;
+    char * convstr = NULL;
+    char * timereg = NULL;
+    int r;
+
+    r = PyArg_ParseTuple (args, "|sssOnizz", &fname, &utcstr1, &utcstr2, &regspec, &budget, &step, &convstr, &timereg);
+    if (!r || !fname) {
+        PyErr_SetString (PyExc_RuntimeError, "readarc_arrow (file or directory, utc1, utc2, registers, mem_budget, frame_step, convert, time_reg)");
+        return NULL;
+    }
+
+    if (pyc_parse_filt (fname, utcstr1, utcstr2, regspec, convstr, timereg, NULL, &filt) != 0)
+      return NULL;
+    filt.mem_budget = budget;
+    filt.frame_step = step;
+    init_arccancel (&cancel, pyc_check_signals, NULL);
+    filt.cancel = &cancel;
+
+    pa = malloc (sizeof (struct pyc_arrow));
+    if (pa == NULL)
+    {
+      free_namelist (&(filt.nl));
+      return PyErr_NoMemory ();
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    r = readarc (&filt, &ds);
+    if (r == 0)
+    {
+      r = dataset_export_arrow (&ds, &(pa->schema), &(pa->array));
+      free_dataset (&ds);
+    }
+    Py_END_ALLOW_THREADS
+    free_namelist (&(filt.nl));
+    if (r != 0)
+    {
+      free (pa);
+      if (r == ARC_ERR_SIGINT)
+      {
+        if (!PyErr_Occurred ())
+          PyErr_SetString (PyExc_RuntimeError, "Exiting at user request.\n");
+      }
+      else if (r == ARC_ERR_BUDGET)
+        PyErr_SetString (PyExc_MemoryError, "arc file data would exceed the memory budget.");
+      else if (r == ARC_ERR_NOMEM)
+        PyErr_NoMemory ();
+      else
+      {
+        PR ("Reading arc file %s:\n", fname);
+        PyErr_SetString (PyExc_RuntimeError, "Error opening or reading files.\n");
+      }
+      return NULL;
+    }
+
+    h = PyCapsule_New (pa, PYC_ARROW_NAME, pyc_arrow_destructor);
+    if (h == NULL)
+    {
+      pa->array.release (&(pa->array));
+      pa->schema.release (&(pa->schema));
+      free (pa);
+      return NULL;
+    }
+    return Py_BuildValue ("(Nnn)", h, (Py_ssize_t)&(pa->array), (Py_ssize_t)&(pa->schema));
+}
+
 static PyMethodDef arcfileMethods[] = {
     {"readarc", pyc_readarc, METH_VARARGS,
      "Read in an arc file."},
+    {"readarc_plan", pyc_readarc_plan, METH_VARARGS,
+     "Estimate the frames and memory a readarc call would take."},
+    {"readarc_arrow", pyc_readarc_arrow, METH_VARARGS,
+     "Read in an arc file as an Arrow record batch, without copying."},
+    {"readarc_open", pyc_readarc_open, METH_VARARGS,
+     "Open arc files for reading a window of frames at a time."},
+    {"readarc_next", pyc_readarc_next, METH_VARARGS,
+     "Read the next window of frames from an open stream."},
+    {"readarc_close", pyc_readarc_close, METH_VARARGS,
+     "Close a stream from readarc_open."},
+    {"lazyarc_open", pyc_lazyarc_open, METH_VARARGS,
+     "List the registers in arc files without reading their data."},
+    {"lazyarc_load", pyc_lazyarc_load, METH_VARARGS,
+     "Read registers from a catalog made by lazyarc_open."},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef arcfileModule = {
+    PyModuleDef_HEAD_INIT, "arcfile", NULL, -1, arcfileMethods
+};
+
+PyMODINIT_FUNC PyInit_arcfile(void)
+{
+    import_array();
+    return PyModule_Create (&arcfileModule);
+}
+#else
 PyMODINIT_FUNC initarcfile(void)
 {
     (void) Py_InitModule("arcfile", arcfileMethods);
     import_array();
+    PyEval_InitThreads();
 }
+#endif
 
 
 
@@ -37,6 +37,7 @@ int main (int argc, char *argv[])
          return 1;
     }
 
+    arcfilt_init (&filt);
     if (argc < 4)
       filt.use_utc = 0;
     else
@@ -86,7 +87,6 @@ int main (int argc, char *argv[])
       return r;
 
     DEBUG ("Dumping timestreams.\n");    
-    /* r = output_dirfile (".", &ds); */
     r = output_dirball ("tmp", &ds, 2);
 
     free_dataset (&ds);
@@ -11,6 +11,12 @@
 #include "output_dirball.h"
 #include "output_txt.h"
 #include "output_hex.h"
+#include "output_stats.h"
+#include "output_dirstream.h"
+#include "output_npy.h"
+#include "output_arrow.h"
+#include "output_fits.h"
+#include "output_arc.h"
 
 #define DEBUG_ARCFILE 1
 
@@ -23,6 +29,12 @@
 #define OUTFORMAT_TXT     0
 #define OUTFORMAT_HEX     1
 #define OUTFORMAT_DIRFILE 2
+#define OUTFORMAT_STATS   3
+#define OUTFORMAT_NPY     4
+#define OUTFORMAT_NPZ     5
+#define OUTFORMAT_ARROW   6
+#define OUTFORMAT_FITS    7
+#define OUTFORMAT_ARC     8
 
 /* The name of this program.  */
 const char* program_name;
@@ -37,10 +49,70 @@ void print_usage (FILE* stream, int exit_code)
   fprintf (stream,
            "  -h  --help             Display this usage information.\n"
            "  -o  --output filename  Write output to file.\n"
+           "  -m  --mem-budget size  Refuse to read more than size bytes\n"
+           "                         (suffix k, M or G for kB, MB, GB).\n"
+           "  -n  --frame-step n     Keep only every n'th frame.\n"
+           "  -c  --convert type     Store registers as float32 or float64,\n"
+           "                         as type:scale:offset to rescale them,\n"
+           "                         and/or decode UTC registers to mjd,\n"
+           "                         unix or mjdsec, comma separated.\n"
+           "  -T  --time-reg name    Keep only frames whose UTC register\n"
+           "                         name is between the start and end.\n"
+           "  -B  --big-endian       Frame data were written big-endian.\n"
+           "  -L  --layout order     Hold data by channel (the default)\n"
+           "                         or by frame (text, hex, npy and\n"
+           "                         npz; fits is always by frame).\n"
+           "  -f  --format type      Write dir (the default), txt, csv,\n"
+           "                         tsv, hex, npy (a directory of .npy\n"
+           "                         arrays), npz, arrow (an Arrow IPC\n"
+           "                         file, a record batch per window),\n"
+           "                         fits (a binary table, a row per\n"
+           "                         frame), arc (an arc file of just\n"
+           "                         the registers and frames picked,\n"
+           "                         gzipped if named .gz), or stats: each\n"
+           "                         channel's count, NaNs, min, max,\n"
+           "                         mean and std, without keeping the\n"
+           "                         samples.\n"
+           "  -U  --utc-column       Start each csv or tsv row with its\n"
+           "                         frame's Unix time, from the -T\n"
+           "                         register or the first UTC register.\n"
+           "  -j  --threads n        Format text and hex, or gzip arc\n"
+           "                         files, on n threads (default: one\n"
+           "                         per CPU).\n"
+           "  -d  --directory        Write a dirfile as a directory rather\n"
+           "                         than a .tgz, a window of frames at\n"
+           "                         a time.\n"
+           "  -w  --window n         Frames per window (default 2000).\n"
+           "  -a  --append           Add to a dirfile directory only the\n"
+           "                         frames after those it already has.\n"
            "  -v  --verbose          Print verbose messages.\n");
   exit (exit_code);
 }
 
+/* Parse a byte count with an optional k, M or G suffix. */
+int parse_mem_size (const char * s, size_t * n)
+{
+  char * end;
+  double x;
+
+  x = strtod (s, &end);
+  if ((end == s) || (x < 0))
+    return -1;
+  switch (*end)
+  {
+    case 'g': case 'G': x *= 1024.0;  /* fall through */
+    case 'm': case 'M': x *= 1024.0;  /* fall through */
+    case 'k': case 'K': x *= 1024.0;
+      end++;
+      break;
+  }
+  if (*end != '\0')
+    return -1;
+  *n = (size_t)x;
+
+  return 0;
+}
+
 int guess_output_filename (const char * input_fname, char ** output_fname, int format, int do_tar, int do_gzip)
 {
   char * basename;
@@ -76,6 +148,7 @@ int guess_output_filename (const char * input_fname, char ** output_fname, int f
   switch (format)
   {
     case OUTFORMAT_TXT:
+    case OUTFORMAT_STATS:
       *output_fname = malloc (iext + 5);
       strncpy (*output_fname, basename, iext);
       strcpy (iext+*output_fname,".txt");
@@ -85,11 +158,37 @@ int guess_output_filename (const char * input_fname, char ** output_fname, int f
       strncpy (*output_fname, basename, iext);
       strcpy (iext+*output_fname,".hex");
       break;
+    case OUTFORMAT_NPY:
+      *output_fname = malloc (iext + 1);
+      strncpy (*output_fname, basename, iext);
+      (*output_fname)[iext] = '\0';
+      break;
+    case OUTFORMAT_NPZ:
+      *output_fname = malloc (iext + 5);
+      strncpy (*output_fname, basename, iext);
+      strcpy (iext+*output_fname,".npz");
+      break;
+    case OUTFORMAT_ARROW:
+      *output_fname = malloc (iext + 7);
+      strncpy (*output_fname, basename, iext);
+      strcpy (iext+*output_fname,".arrow");
+      break;
+    case OUTFORMAT_FITS:
+      *output_fname = malloc (iext + 6);
+      strncpy (*output_fname, basename, iext);
+      strcpy (iext+*output_fname,".fits");
+      break;
+    case OUTFORMAT_ARC:
+      *output_fname = malloc (iext + 12);
+      strncpy (*output_fname, basename, iext);
+      strcpy (iext+*output_fname,"_sub.dat.gz");
+      break;
     case OUTFORMAT_DIRFILE:
       if (!do_tar)
       {
         *output_fname = malloc (iext + 1);
         strncpy (*output_fname, basename, iext);
+        (*output_fname)[iext] = '\0';
       }
       else if (!do_gzip)
       {
@@ -120,19 +219,32 @@ int main (int argc, char* argv[])
   char ** nlist;
   int nn;
   int format, do_tar, do_gzip;
+  int window = 0, append = 0;
+  struct txt_opts txtopt;
 
   /* A string listing valid short options letters.  */
-  const char* const short_options = "ho:r:s:e:f:tzv";
+  const char* const short_options = "ho:m:n:c:T:BL:r:s:e:f:Uj:tzdw:av";
   /* An array describing valid long options.  */
   const struct option long_options[] = {
     { "help",     0, NULL, 'h' },
     { "output",   1, NULL, 'o' },
+    { "mem-budget", 1, NULL, 'm' },
+    { "frame-step", 1, NULL, 'n' },
+    { "convert",  1, NULL, 'c' },
+    { "time-reg", 1, NULL, 'T' },
+    { "big-endian", 0, NULL, 'B' },
+    { "layout",   1, NULL, 'L' },
     { "register", 1, NULL, 'r' },
     { "start",    1, NULL, 's' },
     { "end",      1, NULL, 'e' },
     { "format",   1, NULL, 'f' },
+    { "utc-column", 0, NULL, 'U' },
+    { "threads",  1, NULL, 'j' },
     { "tar",      0, NULL, 't' },
     { "gzip",     0, NULL, 'z' },
+    { "directory", 0, NULL, 'd' },
+    { "window",   1, NULL, 'w' },
+    { "append",   0, NULL, 'a' },
     { "verbose",  0, NULL, 'v' },
     { NULL,       0, NULL, 0   }   /* Required at end of array.  */
   };
@@ -145,6 +257,7 @@ int main (int argc, char* argv[])
      The name is stored in argv[0].  */
   program_name = argv[0];
 
+  arcfilt_init (&filt);
   filt.use_utc = 0;
   filt.t1[0] = 0;
   filt.t1[1] = 0;
@@ -156,6 +269,7 @@ int main (int argc, char* argv[])
     nlist = NULL;
   nn = 0;
   format = OUTFORMAT_DIRFILE;
+  txt_opts_init (&txtopt);
   do_tar = 1;
   do_gzip = 1;
 
@@ -174,6 +288,54 @@ int main (int argc, char* argv[])
       output_filename = optarg;
       break;
 
+    case 'm':   /* -m or --mem-budget */
+      /* This option takes an argument, the most bytes to read. */
+      if (parse_mem_size (optarg, &(filt.mem_budget)) != 0)
+      {
+        printf ("could not parse memory budget %s!", optarg);
+        return -1;
+      }
+      break;
+
+    case 'n':   /* -n or --frame-step */
+      /* This option takes an argument, the frame stride. */
+      filt.frame_step = atoi (optarg);
+      if (filt.frame_step < 1)
+      {
+        printf ("frame step must be at least 1!");
+        return -1;
+      }
+      break;
+
+    case 'c':   /* -c or --convert */
+      /* This option takes an argument, the type to store. */
+      if (parse_conversion (optarg, &(filt.conv)) != 0)
+      {
+        printf ("could not parse conversion %s!", optarg);
+        return -1;
+      }
+      break;
+
+    case 'T':   /* -T or --time-reg */
+      /* This option takes an argument, the register to cut by. */
+      filt.time_reg = optarg;
+      break;
+
+    case 'B':   /* -B or --big-endian */
+      /* Frame data were written on a big-endian host. */
+      filt.big_endian = 1;
+      break;
+
+    case 'L':   /* -L or --layout */
+      /* This option takes an argument, channel or frame. */
+      filt.layout = parse_layout (optarg);
+      if (filt.layout < 0)
+      {
+        printf ("Unrecognized layout %s.\n", optarg);
+        return -1;
+      }
+      break;
+
     case 's':   /* -s or --start */
       /* This option takes an argument, the starting UTC time. */
       r = txt2utc (optarg, filt.t1);
@@ -211,13 +373,55 @@ int main (int argc, char* argv[])
       do_gzip = 1;
       break;
 
+    case 'd':   /* -d or --directory */
+      do_tar = 0;
+      break;
+
+    case 'w':   /* -w or --window */
+      /* This option takes an argument, the frames per window. */
+      window = atoi (optarg);
+      if (window < 1)
+      {
+        printf ("window must be at least 1 frame!");
+        return -1;
+      }
+      break;
+
+    case 'a':   /* -a or --append */
+      do_tar = 0;
+      append = 1;
+      break;
+
     case 'f':   /* -f or --format */
       if (!strcasecmp (optarg, "dir") || !strcasecmp (optarg, "dirfile"))
         format = OUTFORMAT_DIRFILE;
       else if (!strcasecmp (optarg, "txt") || !strcasecmp (optarg, "text"))
         format = OUTFORMAT_TXT;
+      else if (!strcasecmp (optarg, "csv"))
+      {
+        format = OUTFORMAT_TXT;
+        txtopt.style = TXT_CSV;
+      }
+      else if (!strcasecmp (optarg, "tsv"))
+      {
+        format = OUTFORMAT_TXT;
+        txtopt.style = TXT_TSV;
+      }
       else if (!strcasecmp (optarg, "hex") || !strcasecmp (optarg, "dump"))
         format = OUTFORMAT_HEX;
+      else if (!strcasecmp (optarg, "stats"))
+        format = OUTFORMAT_STATS;
+      else if (!strcasecmp (optarg, "npy"))
+        format = OUTFORMAT_NPY;
+      else if (!strcasecmp (optarg, "npz"))
+        format = OUTFORMAT_NPZ;
+      else if (!strcasecmp (optarg, "arrow") || !strcasecmp (optarg, "feather")
+        || !strcasecmp (optarg, "ipc"))
+        format = OUTFORMAT_ARROW;
+      else if (!strcasecmp (optarg, "fits") || !strcasecmp (optarg, "fit"))
+        format = OUTFORMAT_FITS;
+      else if (!strcasecmp (optarg, "arc"))
+        format = OUTFORMAT_ARC;
       else
       {
         printf ("Unrecognized format type %s.\n", optarg);
@@ -225,6 +429,20 @@ int main (int argc, char* argv[])
       }
       break;
 
+    case 'U':   /* -U or --utc-column */
+      txtopt.utc_col = 1;
+      break;
+
+    case 'j':   /* -j or --threads */
+      /* This option takes an argument, the number of threads. */
+      txtopt.nthreads = atoi (optarg);
+      if (txtopt.nthreads < 1)
+      {
+        printf ("need at least 1 thread!");
+        return -1;
+      }
+      break;
+
     case 'v':   /* -v or --verbose */
       verbose = 1;
       break;
@@ -244,6 +462,24 @@ int main (int argc, char* argv[])
   while (next_option != -1);
 
   /* Done with options.  OPTIND points to first non-option argument. */
+  if ((filt.layout == LAYOUT_BY_FRAME) && (format == OUTFORMAT_DIRFILE))
+  {
+    printf ("Dirfiles hold one time stream per file; use the channel layout.\n");
+    return -1;
+  }
+  if ((filt.layout == LAYOUT_BY_FRAME) && (format == OUTFORMAT_ARROW))
+  {
+    printf ("Arrow columns hold one channel each; use the channel layout.\n");
+    return -1;
+  }
+  if (format == OUTFORMAT_STATS)
+    filt.stats = STATS_ONLY;
+  if (txtopt.utc_col && (txtopt.style == TXT_PLAIN))
+  {
+    printf ("A UTC column needs csv or tsv output.\n");
+    return -1;
+  }
+  txtopt.time_reg = filt.time_reg;
   if (nn>0)
     create_namelist (nn, nlist, &(filt.nl));
   else
@@ -260,9 +496,38 @@ int main (int argc, char* argv[])
     filt.fname = argv[i];
 
     DEBUG ("Number of register name specifications = %d.\n", filt.nl.n);
+
+    /* Directories, Arrow, FITS and arc files are written */
+    /* as the frames are read.                            */
+    if (((format == OUTFORMAT_DIRFILE) && !do_tar) || (format == OUTFORMAT_ARROW)
+      || (format == OUTFORMAT_FITS) || (format == OUTFORMAT_ARC))
+    {
+      use_output_fname = output_filename;
+      if (use_output_fname == NULL)
+        guess_output_filename (filt.fname, &use_output_fname, format, do_tar, do_gzip);
+      if (format == OUTFORMAT_ARROW)
+        r = output_arrow (use_output_fname, &filt, window);
+      else if (format == OUTFORMAT_FITS)
+        r = output_fits (use_output_fname, &filt, window);
+      else if (format == OUTFORMAT_ARC)
+        r = output_arc (use_output_fname, &filt, txtopt.nthreads);
+      else
+        r = output_dirstream (use_output_fname, &filt, window, append);
+      if (use_output_fname != output_filename)
+        free (use_output_fname);
+      if (r != 0)
+      {
+        free_namelist (&(filt.nl));
+        return r;
+      }
+      continue;
+    }
+
     DEBUG ("Calling readarc.\n");
 
     r = readarc (&filt, &ds); 
+    if (r == ARC_ERR_BUDGET)
+      fprintf (stderr, "%s: %s is too big for the memory budget.\n", program_name, filt.fname);
     if (r != 0)
     {
       free_namelist (&(filt.nl));
@@ -277,15 +542,25 @@ int main (int argc, char* argv[])
     switch (format)
     {
       case OUTFORMAT_TXT:
-        r = output_txt (&ds);
+        fflush (stdout);
+        r = output_txt_opts (&ds, &txtopt, stdout);
         break;
       case OUTFORMAT_HEX:
-        r = output_hex (&ds);
+        fflush (stdout);
+        r = output_hex_fd (&ds, fileno (stdout), txtopt.nthreads);
+        break;
+      case OUTFORMAT_STATS:
+        r = output_stats (&ds);
+        break;
+      case OUTFORMAT_NPY:
+        r = output_npy (use_output_fname, &ds);
+        break;
+      case OUTFORMAT_NPZ:
+        r = output_npz (use_output_fname, &ds);
         break;
       case OUTFORMAT_DIRFILE:
-        if (!do_tar)
-          r = output_dirball (use_output_fname, &ds, 0);
-        else if (!do_gzip)
+        /* Directories were written as they were read. */
+        if (!do_gzip)
           r = output_dirball (use_output_fname, &ds, 1);
         else
           r = output_dirball (use_output_fname, &ds, 2);
@@ -37,6 +37,7 @@ int main (int argc, char *argv[])
          return 1;
     }
 
+    arcfilt_init (&filt);
     if (argc < 4)
       filt.use_utc = 0;
     else
@@ -0,0 +1,570 @@
+/*
+ * Write the part of an arc file that was asked for as an
+ * arc file of its own: only the selected registers, and
+ * only the frames in the UTC range, copied as they are.
+ *
+ * A map is kept, with its implicit "frame" board, if any of
+ * its registers is, and a board with its status register.
+ * Register blocks are kept whole; channel and sample lists
+ * are left for whoever reads the new file.  The header and
+ * register map keep their byte order, and so do the frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "readarc.h"
+#include "arcfile.h"
+#include "fileset.h"
+#include "reglist.h"
+#include "arc_endian.h"
+#include "pgzip.h"
+#include "output_arc.h"
+
+#define DEBUG_OUTPUT_ARC 0
+
+#if DEBUG_OUTPUT_ARC == 1
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(args...)
+#endif
+
+#define FRAME_BOARD_REGS	8	/* status, received ... markSeq */
+#define REGBLOCK_SPEC_LEN	(6 * sizeof (uint32_t))
+#define BOARD_PAD_LEN		(4 * sizeof (uint32_t))
+
+/* A run of bytes of the source frame copied into the new one. */
+struct arc_range {
+    uint32_t ofs, len;
+};
+
+struct arc_subset {
+    char * map;			/* The new register map    */
+    int nmap, maxmap;
+    struct arc_range * range;
+    int nrange, maxrange;
+    uint32_t frame_len;		/* With the frame's header */
+};
+
+struct arc_out {
+    FILE * f;
+    struct pgzip g;
+    int gz;
+};
+
+static int put_bytes (struct arc_subset * s, const void * p, int n)
+{
+  char * tmp;
+  int max;
+
+  if (s->nmap + n > s->maxmap)
+  {
+    max = 2 * s->maxmap + n + 256;
+    tmp = realloc (s->map, max);
+    if (tmp == NULL)
+      return -1;
+    s->map = tmp;
+    s->maxmap = max;
+  }
+  memcpy (s->map + s->nmap, p, n);
+  s->nmap += n;
+
+  return 0;
+}
+
+static void set_uint16 (struct arc_subset * s, int at, int do_swap, uint16_t x)
+{
+  if (do_swap)
+    x = arc_bswap16 (x);
+  memcpy (s->map + at, &x, sizeof (uint16_t));
+}
+
+static int get_uint16 (const char * buf, int len, int pos, int do_swap, uint16_t * x)
+{
+  if (pos + (int)sizeof (uint16_t) > len)
+    return -1;
+  memcpy (x, buf + pos, sizeof (uint16_t));
+  if (do_swap)
+    *x = arc_bswap16 (*x);
+
+  return 0;
+}
+
+/* Bytes taken by the name at pos, with its length, or -1. */
+static int name_len (const char * buf, int len, int pos, int do_swap)
+{
+  uint16_t l;
+
+  if (get_uint16 (buf, len, pos, do_swap, &l) != 0)
+    return -1;
+  if (pos + (int)sizeof (uint16_t) + l > len)
+    return -1;
+
+  return sizeof (uint16_t) + l;
+}
+
+/* Copy register i of all, which runs up to the next one or */
+/* the end of the frame, joining it onto the last run.      */
+static int add_register (struct arc_subset * s, struct reglist * all, int i, uint32_t frame_len)
+{
+  struct arc_range * tmp;
+  uint32_t ofs = all->r[i].ofs_in_frame;
+  uint32_t end = (i + 1 < all->num_regblocks) ? all->r[i+1].ofs_in_frame : frame_len;
+
+  if (end <= ofs)
+    return 0;
+  s->frame_len += end - ofs;
+  if ((s->nrange > 0) && (s->range[s->nrange-1].ofs + s->range[s->nrange-1].len == ofs))
+  {
+    s->range[s->nrange-1].len += end - ofs;
+    return 0;
+  }
+
+  if (s->nrange >= s->maxrange)
+  {
+    tmp = realloc (s->range, (2 * s->maxrange + 16) * sizeof (struct arc_range));
+    if (tmp == NULL)
+      return -1;
+    s->range = tmp;
+    s->maxrange = 2 * s->maxrange + 16;
+  }
+  s->range[s->nrange].ofs = ofs;
+  s->range[s->nrange].len = end - ofs;
+  s->nrange++;
+
+  return 0;
+}
+
+/* Go through the boards of a map, from *pos in the source */
+/* map and from entry *ie of all (at the map's frame board). */
+/* Returns how many boards are kept, or minus an error code. */
+/* With s, also writes the kept boards out.                  */
+static int subset_boards (struct arc_subset * s, const char * buf, int len, int * pos, int do_swap,
+    struct reglist * all, const char * sel, int * ie, uint32_t frame_len)
+{
+  uint16_t nboards, nblocks;
+  int ib, ir, k, n, at = 0;
+  int keep, nkept = 0, nblocks_kept;
+
+  if (get_uint16 (buf, len, *pos, do_swap, &nboards) != 0)
+    return -ARC_ERR_REGMAP;
+  *pos += sizeof (uint16_t);
+  *ie += FRAME_BOARD_REGS;
+
+  for (ib=0; ib<nboards; ib++)
+  {
+    n = name_len (buf, len, *pos, do_swap);
+    if ((n < 0) || (get_uint16 (buf, len, *pos + n, do_swap, &nblocks) != 0))
+      return -ARC_ERR_REGMAP;
+    if (*ie + nblocks >= all->num_regblocks)
+      return -ARC_ERR_REGMAP;
+
+    keep = 0;
+    for (k=0; k<=nblocks; k++)
+      keep |= sel[*ie + k];
+    if (keep && (s != NULL))
+    {
+      if (put_bytes (s, buf + *pos, n + sizeof (uint16_t)) != 0)
+        return -ARC_ERR_NOMEM;
+      at = s->nmap - sizeof (uint16_t);
+      if (add_register (s, all, *ie, frame_len) != 0)
+        return -ARC_ERR_NOMEM;
+    }
+    nkept += keep;
+    *pos += n + sizeof (uint16_t);
+    (*ie)++;
+
+    nblocks_kept = 0;
+    for (ir=0; ir<nblocks; ir++)
+    {
+      n = name_len (buf, len, *pos, do_swap);
+      if ((n < 0) || (*pos + n + (int)REGBLOCK_SPEC_LEN > len))
+        return -ARC_ERR_REGMAP;
+      if (keep && (s != NULL) && sel[*ie])
+      {
+        if ((put_bytes (s, buf + *pos, n + REGBLOCK_SPEC_LEN) != 0)
+          || (add_register (s, all, *ie, frame_len) != 0))
+          return -ARC_ERR_NOMEM;
+        nblocks_kept++;
+      }
+      *pos += n + REGBLOCK_SPEC_LEN;
+      (*ie)++;
+    }
+
+    if (*pos + (int)BOARD_PAD_LEN > len)
+      return -ARC_ERR_REGMAP;
+    if (keep && (s != NULL))
+    {
+      set_uint16 (s, at, do_swap, nblocks_kept);
+      if (put_bytes (s, buf + *pos, BOARD_PAD_LEN) != 0)
+        return -ARC_ERR_NOMEM;
+    }
+    *pos += BOARD_PAD_LEN;
+  }
+
+  return nkept;
+}
+
+/* Build the new register map from the source one, keeping */
+/* the registers marked in sel, one flag per entry of all.  */
+static int subset_regmap (struct arc_subset * s, const char * buf, int len, int do_swap,
+    struct reglist * all, const char * sel, uint32_t frame_len)
+{
+  uint16_t nmaps, zero = 0;
+  int im, k, n, at, p, i;
+  int pos = sizeof (uint16_t), ie = 0, nkept = 0;
+  int keep, r;
+
+  s->frame_len = 2 * sizeof (uint32_t);
+  if (get_uint16 (buf, len, 0, do_swap, &nmaps) != 0)
+    return ARC_ERR_REGMAP;
+  if (put_bytes (s, &zero, sizeof (uint16_t)) != 0)
+    return ARC_ERR_NOMEM;
+
+  for (im=0; im<nmaps; im++)
+  {
+    n = name_len (buf, len, pos, do_swap);
+    if ((n < 0) || (ie + FRAME_BOARD_REGS > all->num_regblocks))
+      return ARC_ERR_REGMAP;
+
+    /* See whether anything in the map is kept first. */
+    p = pos + n;
+    i = ie;
+    r = subset_boards (NULL, buf, len, &p, do_swap, all, sel, &i, frame_len);
+    if (r < 0)
+      return -r;
+    keep = (r > 0);
+    for (k=0; k<FRAME_BOARD_REGS; k++)
+      keep |= sel[ie + k];
+    if (!keep)
+    {
+      pos = p;
+      ie = i;
+      continue;
+    }
+
+    if (put_bytes (s, buf + pos, n) != 0)
+      return ARC_ERR_NOMEM;
+    at = s->nmap;
+    for (k=0; k<FRAME_BOARD_REGS; k++)
+      if (add_register (s, all, ie + k, frame_len) != 0)
+        return ARC_ERR_NOMEM;
+    pos += n;
+    if (put_bytes (s, &zero, sizeof (uint16_t)) != 0)
+      return ARC_ERR_NOMEM;
+    r = subset_boards (s, buf, len, &pos, do_swap, all, sel, &ie, frame_len);
+    if (r < 0)
+      return -r;
+    set_uint16 (s, at, do_swap, r);
+    nkept++;
+  }
+  set_uint16 (s, 0, do_swap, nkept);
+
+  if (ie != all->num_regblocks)
+    return ARC_ERR_REGMAP;
+  DEBUG ("Keeping %d maps, %d runs of bytes, frames of %lu bytes.\n",
+    nkept, s->nrange, (unsigned long)s->frame_len);
+
+  return ARC_OK;
+}
+
+static int same_regblock (struct regblockspec * a, struct regblockspec * b)
+{
+  return !strcmp (rb_map (a), rb_map (b))
+    && !strcmp (rb_board (a), rb_board (b))
+    && !strcmp (rb_regblock (a), rb_regblock (b));
+}
+
+/* Work out the new file's register map and frames from the */
+/* source map buf and the registers filt picks out of it.   */
+static int init_subset (struct arc_subset * s, struct arcfile * af, void * buf, int buflen, struct reglist * rl)
+{
+  struct reglist all;
+  char * sel;
+  int i, j, r;
+
+  s->map = NULL;
+  s->nmap = s->maxmap = 0;
+  s->range = NULL;
+  s->nrange = s->maxrange = 0;
+
+  r = parse_reglist (buf, buflen, af->do_swap_header, &all, 0);
+  if (r != 0)
+    return ARC_ERR_REGMAP;
+  sel = malloc (all.num_regblocks + 1);
+  if (sel == NULL)
+  {
+    free_reglist (&all);
+    return ARC_ERR_NOMEM;
+  }
+
+  /* Both lists are in the order of the map. */
+  for (i=0, j=0; i<all.num_regblocks; i++)
+  {
+    sel[i] = (j < rl->num_regblocks) && same_regblock (&(all.r[i].rb), &(rl->r[j].rb));
+    if (sel[i])
+      j++;
+  }
+  if (j < rl->num_regblocks)
+    r = ARC_ERR_REGMAP;
+  else
+    r = subset_regmap (s, buf, buflen, af->do_swap_header, &all, sel, af->frame_len);
+
+  free (sel);
+  free_reglist (&all);
+
+  return r;
+}
+
+static void free_subset (struct arc_subset * s)
+{
+  free (s->map);
+  free (s->range);
+}
+
+static int out_open (struct arc_out * o, const char * fname, int nthreads)
+{
+  int n = strlen (fname);
+
+  o->gz = (n > 3) && !strcmp (fname + n - 3, ".gz");
+  if (o->gz)
+    return pgzip_open (&(o->g), fname, Z_DEFAULT_COMPRESSION, nthreads);
+  o->f = fopen (fname, "wb");
+
+  return (o->f == NULL) ? -1 : 0;
+}
+
+static int out_write (struct arc_out * o, const void * p, size_t n)
+{
+  if (o->gz)
+    return pgzip_write (&(o->g), p, n);
+
+  return (fwrite (p, 1, n, o->f) == n) ? 0 : -1;
+}
+
+static int out_close (struct arc_out * o)
+{
+  if (o->gz)
+    return pgzip_close (&(o->g));
+
+  return fclose (o->f);
+}
+
+/* The source's header, with the new lengths. */
+static int write_header (struct arc_out * o, struct arcfile * af, struct arc_subset * s)
+{
+  uint32_t h[6];
+  int k;
+
+  memcpy (h, af->header, sizeof (h));
+  h[2] = s->frame_len + 8;
+  h[3] = s->nmap + 12;
+  if (af->do_swap_header)
+    for (k=0; k<6; k++)
+      swap_4 (h + k);
+  if (out_write (o, h, sizeof (h)) != 0)
+    return -1;
+
+  return out_write (o, s->map, s->nmap);
+}
+
+/* Copy the frames of an open file, positioned at its first */
+/* frame, that are in rl's time range.  Sets *done once a   */
+/* frame past the range is seen.                            */
+static int copy_frames (struct arc_out * o, struct arcfile * af, struct reglist * rl,
+    struct arc_subset * s, char * buf, char * frame, long * nframes, int * done)
+{
+  uint32_t h;
+  char * src;
+  char * p;
+  int k, m, nread;
+
+  while ((nread = arcfile_read_raw_frames (af, buf, ARC_OUT_FRAMES)) > 0)
+  {
+    for (k=0; k<nread; k++)
+    {
+      src = buf + (size_t)k * af->frame_len;
+      h = *(uint32_t *)src;
+      swap_4 (&h);
+      if (h != af->frame_len)
+      {
+        fprintf (stderr, "Corrupted file: frame has length %lu, should be %lu.\n",
+          (unsigned long)h, (unsigned long)af->frame_len);
+        return ARC_ERR_FORMAT;
+      }
+      if (rl->time_ofs >= 0)
+      {
+        m = arcfile_frame_time_cmp (af, rl, src);
+        if (m < 0)
+          continue;
+        if (m > 0)
+        {
+          *done = 1;
+          return ARC_OK;
+        }
+      }
+
+      /* Frame headers are big-endian, and keep their extra word. */
+      h = s->frame_len;
+      swap_4 (&h);
+      memcpy (frame, &h, sizeof (uint32_t));
+      memcpy (frame + sizeof (uint32_t), src + sizeof (uint32_t), sizeof (uint32_t));
+      p = frame + 2 * sizeof (uint32_t);
+      for (m=0; m<s->nrange; m++)
+      {
+        memcpy (p, src + s->range[m].ofs, s->range[m].len);
+        p += s->range[m].len;
+      }
+      if (out_write (o, frame, s->frame_len) != 0)
+        return ARC_ERR_NOFILE;
+      (*nframes)++;
+    }
+    if (nread < ARC_OUT_FRAMES)
+      break;
+  }
+  if (nread < 0)
+    return ARC_ERR_FORMAT;
+
+  return ARC_OK;
+}
+
+/* Whether a later file's register map is the first one's. */
+static int same_regmap (struct arcfile * af, struct arcfile * af0, void * buf0, int buflen0)
+{
+  void * buf;
+  int buflen, same;
+
+  if ((af->frame_len != af0->frame_len) || (af->do_swap_header != af0->do_swap_header))
+    return 0;
+  if (arcfile_read_regmap_raw (af, &buf, &buflen) != 0)
+    return 0;
+  same = (buflen == buflen0) && !memcmp (buf, buf0, buflen);
+  free (buf);
+
+  return same;
+}
+
+static int warn_whole_blocks (struct reglist * rl)
+{
+  int i;
+
+  for (i=0; i<rl->num_regblocks; i++)
+    if ((rl->r[i].chan.n > 0) || (rl->r[i].samp.n > 0)
+      || (rl->r[i].red.op != REDUCE_NONE) || (rl->r[i].conv.type != CONVERT_NONE))
+    {
+      fprintf (stderr, "Arc files keep register blocks whole and as archived; "
+        "channels, samples, reductions and conversions are ignored.\n");
+      return 1;
+    }
+
+  return 0;
+}
+
+int output_arc (const char * fname, struct arcfilt * filt, int nthreads)
+{
+  struct fileset fset;
+  struct arcfile af0, af;
+  struct reglist rl;
+  struct arc_subset s;
+  struct arc_out o;
+  void * map0 = NULL;
+  int maplen0 = 0;
+  char * buf = NULL;
+  char * frame = NULL;
+  long nframes = 0;
+  int i, r, done = 0;
+
+  if (filt->use_utc)
+    r = init_fileset_utc (filt->fname, filt->t1, filt->t2, &fset);
+  else
+    r = init_fileset (filt->fname, &fset);
+  if (r != 0)
+    return r;
+  if (fset.nf < 1)
+  {
+    free_fileset (&fset);
+    return ARC_ERR_NOFILE;
+  }
+
+  /* The register map, as it is and as filt selects from it. */
+  r = arcfile_open (fset.files[0].name, &af0);
+  if (r != 0)
+  {
+    free_fileset (&fset);
+    return r;
+  }
+  r = arcfile_read_regmap_raw (&af0, &map0, &maplen0);
+  arcfile_close (&af0);
+  if (r == 0)
+    r = arcfile_open (fset.files[0].name, &af0);
+  if (r != 0)
+  {
+    free (map0);
+    free_fileset (&fset);
+    return r;
+  }
+  arcfile_set_data_order (&af0, filt->big_endian);
+  r = arcfilt_read_regmap (filt, &af0, &rl);
+  arcfile_close (&af0);
+  if (r != 0)
+  {
+    free (map0);
+    free_fileset (&fset);
+    return r;
+  }
+  warn_whole_blocks (&rl);
+
+  r = init_subset (&s, &af0, map0, maplen0, &rl);
+  if (r == ARC_OK)
+  {
+    buf = malloc ((size_t)af0.frame_len * ARC_OUT_FRAMES);
+    frame = malloc (s.frame_len);
+    if ((buf == NULL) || (frame == NULL))
+      r = ARC_ERR_NOMEM;
+  }
+  if (r != ARC_OK)
+    goto done;
+
+  if (out_open (&o, fname, nthreads) != 0)
+  {
+    fprintf (stderr, "Could not open %s for writing.\n", fname);
+    r = ARC_ERR_NOFILE;
+    goto done;
+  }
+  r = (write_header (&o, &af0, &s) == 0) ? ARC_OK : ARC_ERR_NOFILE;
+
+  for (i=0; (i<fset.nf) && (r == ARC_OK) && !done; i++)
+  {
+    DEBUG ("Copying frames of %s.\n", fset.files[i].name);
+    r = arcfile_open (fset.files[i].name, &af);
+    if (r != 0)
+      break;
+    af.frame_step = filt->frame_step;
+    arcfile_set_data_order (&af, filt->big_endian);
+    if (!same_regmap (&af, &af0, map0, maplen0))
+    {
+      fprintf (stderr, "Register map of %s differs from that of %s.\n",
+        fset.files[i].name, fset.files[0].name);
+      r = ARC_ERR_REGMAP;
+    }
+    else
+      r = copy_frames (&o, &af, &rl, &s, buf, frame, &nframes, &done);
+    arcfile_close (&af);
+  }
+
+  if (out_close (&o) != 0)
+    r = (r == ARC_OK) ? ARC_ERR_NOFILE : r;
+  if (r == ARC_OK)
+    printf ("Wrote %ld frames of %lu bytes to %s.\n", nframes, (unsigned long)s.frame_len, fname);
+
+done:
+  free (buf);
+  free (frame);
+  free_subset (&s);
+  free_reglist (&rl);
+  free (map0);
+  free_fileset (&fset);
+
+  return r;
+}
@@ -0,0 +1,5 @@
+#include <stdlib.h>
+
+#define ARC_OUT_FRAMES	256		/* Frames read at a time */
+
+int output_arc (const char * fname, struct arcfilt * filt, int nthreads);
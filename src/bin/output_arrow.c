@@ -0,0 +1,665 @@
+/*
+ * Write an Apache Arrow IPC file (Feather v2) a window of
+ * frames at a time, each window a record batch, without
+ * the Arrow libraries.
+ *
+ * Every channel of a register is a column: a primitive
+ * column with one sample per frame, or else a fixed size
+ * list of the frame's samples.  Since channels are held end
+ * to end, a column's values go straight from the dataset
+ * to the file.  Undecoded UTC registers become timestamps
+ * in ms.  Buffers start on 64-byte boundaries of the file,
+ * so readers can map it in place.
+ *
+ * The flatbuffers describing it are laid out front to back
+ * here, with each offset filled in once what it points to
+ * has been placed after it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "readarc.h"
+#include "arcstream.h"
+#include "output_arrow.h"
+
+#define DEBUG_OUTPUT_ARROW 0
+
+#if DEBUG_OUTPUT_ARROW == 1
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(args...)
+#endif
+
+#define ARROW_ALIGN		64
+#define ARROW_MAX_IOV		512
+
+/* From Schema.fbs and Message.fbs */
+#define ARROW_V5		4
+#define ARROW_INT		2
+#define ARROW_FLOAT		3
+#define ARROW_TIMESTAMP		10
+#define ARROW_FIXED_SIZE_LIST	16
+#define ARROW_MSG_SCHEMA	1
+#define ARROW_MSG_BATCH		3
+
+struct arrow_col {
+    int ib;			/* Register block in the dataset */
+    int chan;
+    char name[3 * MAX_NAME_LENGTH + 16];
+    int type;			/* ARROW_INT, _FLOAT or _TIMESTAMP */
+    int bits;
+    int is_signed;
+    int spf;			/* Over 1: a list per frame      */
+};
+
+struct fb {
+    unsigned char * b;
+    size_t n, max;
+    int err;
+};
+
+#define FB_MAX_FIELDS 8
+
+struct fb_table {
+    size_t pos;
+    size_t field[FB_MAX_FIELDS];
+};
+
+/* Room for n bytes, zeroed, at a position that's phase */
+/* past a multiple of align.  Once out of memory, err  */
+/* stays set and nothing more is written.               */
+static size_t fb_grow (struct fb * fb, size_t n, size_t align, size_t phase)
+{
+  size_t pos = fb->n;
+  size_t max;
+  unsigned char * b;
+
+  if (fb->err)
+    return 0;
+  while (pos % align != phase)
+    pos++;
+  if (pos + n > fb->max)
+  {
+    max = (fb->max > 0) ? fb->max : 1024;
+    while (max < pos + n)
+      max *= 2;
+    b = realloc (fb->b, max);
+    if (b == NULL)
+    {
+      fb->err = 1;
+      return 0;
+    }
+    fb->b = b;
+    fb->max = max;
+  }
+  memset (fb->b + fb->n, 0, pos + n - fb->n);
+  fb->n = pos + n;
+
+  return pos;
+}
+
+static void fb_u8 (struct fb * fb, size_t at, uint32_t x)
+{
+  if (!fb->err)
+    fb->b[at] = x;
+}
+
+static void fb_u16 (struct fb * fb, size_t at, uint32_t x)
+{
+  if (fb->err)
+    return;
+  fb->b[at] = x & 0xFF;
+  fb->b[at + 1] = (x >> 8) & 0xFF;
+}
+
+static void fb_u32 (struct fb * fb, size_t at, uint32_t x)
+{
+  fb_u16 (fb, at, x & 0xFFFF);
+  fb_u16 (fb, at + 2, x >> 16);
+}
+
+static void fb_u64 (struct fb * fb, size_t at, uint64_t x)
+{
+  fb_u32 (fb, at, x & 0xFFFFFFFF);
+  fb_u32 (fb, at + 4, x >> 32);
+}
+
+/* Point the offset at `at' to what's been put at target. */
+static void fb_ref (struct fb * fb, size_t at, size_t target)
+{
+  fb_u32 (fb, at, target - at);
+}
+
+/* A table with a field of size[i] bytes for each i, or   */
+/* none where it's 0, after its vtable.  Fields go largest */
+/* first, from a multiple of 8, so each is aligned.        */
+static void fb_table (struct fb * fb, int nfield, const int * size, struct fb_table * t)
+{
+  size_t ofs[FB_MAX_FIELDS];
+  size_t v, len = 4;
+  int i, s;
+
+  for (s=8; s>=1; s/=2)
+    for (i=0; i<nfield; i++)
+      if (size[i] == s)
+      {
+        ofs[i] = len;
+        len += s;
+      }
+  v = fb_grow (fb, 4 + 2 * nfield, 2, 0);
+  t->pos = fb_grow (fb, len, 8, 4);
+  fb_u16 (fb, v, 4 + 2 * nfield);
+  fb_u16 (fb, v + 2, len);
+  for (i=0; i<nfield; i++)
+  {
+    fb_u16 (fb, v + 4 + 2 * i, size[i] ? ofs[i] : 0);
+    t->field[i] = size[i] ? t->pos + ofs[i] : 0;
+  }
+  fb_u32 (fb, t->pos, t->pos - v);
+}
+
+static size_t fb_string (struct fb * fb, const char * s)
+{
+  size_t n = strlen (s);
+  size_t pos = fb_grow (fb, 4 + n + 1, 4, 0);
+
+  fb_u32 (fb, pos, n);
+  if (!fb->err)
+    memcpy (fb->b + pos + 4, s, n);
+
+  return pos;
+}
+
+/* A vector of n elements of elsize bytes, aligned to 8 */
+/* for structs with 64-bit members.                     */
+static size_t fb_vector (struct fb * fb, int n, int elsize, int align)
+{
+  size_t pos = (align == 8) ? fb_grow (fb, 4 + (size_t)n * elsize, 8, 4)
+    : fb_grow (fb, 4 + (size_t)n * elsize, 4, 0);
+
+  fb_u32 (fb, pos, n);
+
+  return pos;
+}
+
+static void fb_field (struct fb * fb, size_t at, const char * name, struct arrow_col * c, int child)
+{
+  static const int size[7] = { 4, 1, 1, 4, 0, 4, 0 };
+  int list = (!child && (c->spf > 1));
+  struct fb_table t, ty;
+  size_t v;
+  int sz[2];
+
+  fb_table (fb, 7, size, &t);
+  fb_ref (fb, at, t.pos);
+  fb_ref (fb, t.field[0], fb_string (fb, name));
+  fb_u8 (fb, t.field[1], 0);	/* Not nullable */
+  fb_u8 (fb, t.field[2], list ? ARROW_FIXED_SIZE_LIST : c->type);
+
+  if (list)
+  {
+    sz[0] = 4;
+    fb_table (fb, 1, sz, &ty);
+    fb_u32 (fb, ty.field[0], c->spf);
+  }
+  else if (c->type == ARROW_INT)
+  {
+    sz[0] = 4;
+    sz[1] = 1;
+    fb_table (fb, 2, sz, &ty);
+    fb_u32 (fb, ty.field[0], c->bits);
+    fb_u8 (fb, ty.field[1], c->is_signed);
+  }
+  else if (c->type == ARROW_FLOAT)
+  {
+    sz[0] = 2;
+    fb_table (fb, 1, sz, &ty);
+    fb_u16 (fb, ty.field[0], (c->bits == 32) ? 1 : 2);
+  }
+  else
+  {
+    /* Milliseconds, UTC. */
+    sz[0] = 2;
+    sz[1] = 4;
+    fb_table (fb, 2, sz, &ty);
+    fb_u16 (fb, ty.field[0], 1);
+    fb_ref (fb, ty.field[1], fb_string (fb, "UTC"));
+  }
+  fb_ref (fb, t.field[3], ty.pos);
+
+  v = fb_vector (fb, list ? 1 : 0, 4, 4);
+  fb_ref (fb, t.field[5], v);
+  if (list)
+    fb_field (fb, v + 4, "item", c, 1);
+}
+
+static void fb_schema (struct fb * fb, size_t at, struct arrow_col * col, int ncol)
+{
+  static const int size[4] = { 2, 4, 0, 0 };
+  uint16_t one = 1;
+  struct fb_table t;
+  size_t v;
+  int k;
+
+  fb_table (fb, 4, size, &t);
+  fb_ref (fb, at, t.pos);
+  fb_u16 (fb, t.field[0], (*(uint8_t *)&one == 1) ? 0 : 1);
+  v = fb_vector (fb, ncol, 4, 4);
+  fb_ref (fb, t.field[1], v);
+  for (k=0; k<ncol; k++)
+    fb_field (fb, v + 4 + 4 * k, col[k].name, &(col[k]), 0);
+}
+
+/* Start a Message of a type, giving where its header and */
+/* body length are to go.                                  */
+static void fb_message (struct fb * fb, int type, size_t * header, size_t * body)
+{
+  static const int size[5] = { 2, 1, 4, 8, 0 };
+  struct fb_table t;
+  size_t root;
+
+  fb->n = 0;
+  fb->err = 0;
+  root = fb_grow (fb, 4, 4, 0);
+  fb_table (fb, 5, size, &t);
+  fb_ref (fb, root, t.pos);
+  fb_u16 (fb, t.field[0], ARROW_V5);
+  fb_u8 (fb, t.field[1], type);
+  *header = t.field[2];
+  *body = t.field[3];
+}
+
+struct arrow_file {
+    int fd;
+    int64_t ofs;
+    struct fb fb;
+    struct arrow_col * col;
+    int ncol;
+    struct iovec * iov;
+    int niov, maxiov;
+    int64_t * blocks;		/* Offset, metadata and body length */
+    int nblocks, maxblocks;	/* of each record batch             */
+};
+
+static int write_iov (int fd, struct iovec * iov, int n)
+{
+  ssize_t w;
+
+  while (n > 0)
+  {
+    w = writev (fd, iov, n);
+    if (w < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    while ((n > 0) && ((size_t)w >= iov->iov_len))
+    {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+
+  return 0;
+}
+
+static int af_add (struct arrow_file * a, const void * p, size_t n)
+{
+  struct iovec * iov;
+
+  if (n == 0)
+    return 0;
+  if (a->niov == a->maxiov)
+  {
+    iov = realloc (a->iov, (a->maxiov + 256) * sizeof (struct iovec));
+    if (iov == NULL)
+      return -1;
+    a->iov = iov;
+    a->maxiov += 256;
+  }
+  a->iov[a->niov].iov_base = (void *)p;
+  a->iov[a->niov].iov_len = n;
+  a->niov++;
+  a->ofs += n;
+
+  return 0;
+}
+
+static int af_pad (struct arrow_file * a, size_t align)
+{
+  static const char zeros[ARROW_ALIGN];
+
+  return af_add (a, zeros, (align - a->ofs % align) % align);
+}
+
+static int af_flush (struct arrow_file * a)
+{
+  int k, n, r = 0;
+
+  for (k=0; (k<a->niov) && (r == 0); k+=n)
+  {
+    n = (a->niov - k > ARROW_MAX_IOV) ? ARROW_MAX_IOV : a->niov - k;
+    r = write_iov (a->fd, a->iov + k, n);
+  }
+  a->niov = 0;
+
+  return r;
+}
+
+/* The flatbuffer built, as an encapsulated message padded */
+/* so that its body starts on a boundary.  Returns the     */
+/* length of the metadata, prefix and all.                 */
+static int32_t af_metadata (struct arrow_file * a, uint32_t * prefix)
+{
+  size_t n = a->fb.n;
+
+  while ((a->ofs + 8 + n) % ARROW_ALIGN)
+    n++;
+  fb_grow (&(a->fb), n - a->fb.n, 1, 0);
+  prefix[0] = 0xFFFFFFFF;
+  prefix[1] = n;
+  if (a->fb.err || (af_add (a, prefix, 8) != 0) || (af_add (a, a->fb.b, n) != 0))
+    return -1;
+
+  return 8 + n;
+}
+
+static int arrow_columns (struct dataset * ds, struct arrow_col ** col, int * ncol)
+{
+  struct databuf * ts;
+  int i, k, n = 0, nchan, type, bits, is_signed;
+
+  *col = NULL;
+  for (i=0; i<ds->nb; i++)
+    n += databuf_nchan (&(ds->buf[i]));
+  *col = malloc ((n > 0 ? n : 1) * sizeof (struct arrow_col));
+  if (*col == NULL)
+    return ARC_ERR_NOMEM;
+
+  n = 0;
+  for (i=0; i<ds->nb; i++)
+  {
+    ts = &(ds->buf[i]);
+    if (rb_regblock (ts->rb)[0] == '\0')
+      continue;
+    is_signed = 0;
+    type = ARROW_INT;
+    bits = 8 * ts->elsize;
+    switch (databuf_sample_kind (ts))
+    {
+      case SAMPLE_INT:
+        is_signed = 1;
+        break;
+      case SAMPLE_UINT:
+        break;
+      case SAMPLE_FLOAT:
+        type = ARROW_FLOAT;
+        break;
+      case SAMPLE_UTC:
+        type = ARROW_TIMESTAMP;
+        break;
+      default:
+        printf ("Skipping register of type 0x%lx.\n", (unsigned long)(ts->rb->typeword & (GCP_REG_TYPE | GCP_REG_COMPLEX)));
+        continue;
+    }
+    nchan = databuf_nchan (ts);
+    for (k=0; k<nchan; k++)
+    {
+      (*col)[n].ib = i;
+      (*col)[n].chan = k;
+      (*col)[n].type = type;
+      (*col)[n].bits = bits;
+      (*col)[n].is_signed = is_signed;
+      (*col)[n].spf = ts->spf;
+      if (nchan == 1)
+        snprintf ((*col)[n].name, sizeof ((*col)[n].name), "%s.%s.%s",
+          rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb));
+      else
+        snprintf ((*col)[n].name, sizeof ((*col)[n].name), "%s.%s.%s[%d]",
+          rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb), k);
+      n++;
+    }
+  }
+  *ncol = n;
+
+  return 0;
+}
+
+static int write_schema (struct arrow_file * a)
+{
+  uint32_t prefix[2];
+  size_t at, body;
+
+  fb_message (&(a->fb), ARROW_MSG_SCHEMA, &at, &body);
+  fb_schema (&(a->fb), at, a->col, a->ncol);
+  if (af_metadata (a, prefix) < 0)
+    return -1;
+
+  return af_flush (a);
+}
+
+static int add_block (struct arrow_file * a, int64_t ofs, int64_t meta, int64_t body)
+{
+  int64_t * b;
+
+  if (a->nblocks == a->maxblocks)
+  {
+    b = realloc (a->blocks, 3 * (a->maxblocks + 64) * sizeof (int64_t));
+    if (b == NULL)
+      return -1;
+    a->blocks = b;
+    a->maxblocks += 64;
+  }
+  a->blocks[3 * a->nblocks] = ofs;
+  a->blocks[3 * a->nblocks + 1] = meta;
+  a->blocks[3 * a->nblocks + 2] = body;
+  a->nblocks++;
+
+  return 0;
+}
+
+/* A record batch of the frames in ds.  Its metadata give */
+/* each buffer's place in the body, and the body is then   */
+/* the buffers themselves, each padded to a boundary.      */
+static int write_batch (struct arrow_file * a, struct dataset * ds)
+{
+  static const int size[4] = { 8, 4, 4, 0 };
+  struct fb_table t;
+  struct databuf * ts;
+  struct arrow_col * c;
+  int64_t ** tmp;
+  int64_t start = a->ofs, body = 0, len;
+  uint32_t prefix[2];
+  size_t at, body_at, nodes, bufs;
+  int k, nnodes = 0, nbufs = 0, inode = 0, ibuf = 0, r = 0;
+  int32_t meta;
+
+  for (k=0; k<a->ncol; k++)
+  {
+    nnodes += (a->col[k].spf > 1) ? 2 : 1;
+    nbufs += (a->col[k].spf > 1) ? 3 : 2;
+  }
+
+  fb_message (&(a->fb), ARROW_MSG_BATCH, &at, &body_at);
+  fb_table (&(a->fb), 4, size, &t);
+  fb_ref (&(a->fb), at, t.pos);
+  fb_u64 (&(a->fb), t.field[0], ds->num_frames);
+  nodes = fb_vector (&(a->fb), nnodes, 16, 8);
+  fb_ref (&(a->fb), t.field[1], nodes);
+  bufs = fb_vector (&(a->fb), nbufs, 16, 8);
+  fb_ref (&(a->fb), t.field[2], bufs);
+
+  /* Nodes are (length, nulls) and buffers (offset, length); */
+  /* validity buffers are all empty, as nothing is null.    */
+  for (k=0; k<a->ncol; k++)
+  {
+    c = &(a->col[k]);
+    ts = &(ds->buf[c->ib]);
+    len = (int64_t)ds->num_frames * c->spf * ((c->type == ARROW_TIMESTAMP) ? 8 : ts->elsize);
+    fb_u64 (&(a->fb), nodes + 4 + 16 * inode++, ds->num_frames);
+    if (c->spf > 1)
+    {
+      fb_u64 (&(a->fb), nodes + 4 + 16 * inode++, (int64_t)ds->num_frames * c->spf);
+      fb_u64 (&(a->fb), bufs + 4 + 16 * ibuf++, body);
+    }
+    fb_u64 (&(a->fb), bufs + 4 + 16 * ibuf++, body);
+    fb_u64 (&(a->fb), bufs + 4 + 16 * ibuf, body);
+    fb_u64 (&(a->fb), bufs + 12 + 16 * ibuf++, len);
+    body += (len + ARROW_ALIGN - 1) / ARROW_ALIGN * ARROW_ALIGN;
+  }
+  fb_u64 (&(a->fb), body_at, body);
+
+  meta = af_metadata (a, prefix);
+  if (meta < 0)
+    return -1;
+
+  tmp = calloc ((a->ncol > 0) ? a->ncol : 1, sizeof (int64_t *));
+  if (tmp == NULL)
+    return ARC_ERR_NOMEM;
+  for (k=0; (k<a->ncol) && (r == 0); k++)
+  {
+    c = &(a->col[k]);
+    ts = &(ds->buf[c->ib]);
+    len = (int64_t)ds->num_frames * c->spf;
+    if (c->type == ARROW_TIMESTAMP)
+    {
+      tmp[k] = databuf_utc_ms (ts, c->chan, len);
+      if ((tmp[k] == NULL) || (af_add (a, tmp[k], len * 8) != 0))
+        r = -1;
+    }
+    else if (af_add (a, databuf_sample (ts, c->chan, 0), len * ts->elsize) != 0)
+      r = -1;
+    if ((r == 0) && (af_pad (a, ARROW_ALIGN) != 0))
+      r = -1;
+  }
+  if (r == 0)
+    r = af_flush (a);
+  for (k=0; k<a->ncol; k++)
+    free (tmp[k]);
+  free (tmp);
+  if ((r == 0) && (add_block (a, start, meta, body) != 0))
+    r = -1;
+
+  return r;
+}
+
+/* The end-of-stream marker, then the footer: the schema */
+/* again, and where each record batch is.                */
+static int write_footer (struct arrow_file * a)
+{
+  static const uint32_t eos[2] = { 0xFFFFFFFF, 0 };
+  static const int size[5] = { 2, 4, 4, 4, 0 };
+  struct fb_table t;
+  unsigned char tail[10];
+  size_t root, v;
+  int k;
+
+  if (af_add (a, eos, 8) != 0)
+    return -1;
+
+  a->fb.n = 0;
+  a->fb.err = 0;
+  root = fb_grow (&(a->fb), 4, 4, 0);
+  fb_table (&(a->fb), 5, size, &t);
+  fb_ref (&(a->fb), root, t.pos);
+  fb_u16 (&(a->fb), t.field[0], ARROW_V5);
+  fb_schema (&(a->fb), t.field[1], a->col, a->ncol);
+  v = fb_vector (&(a->fb), 0, 24, 8);
+  fb_ref (&(a->fb), t.field[2], v);
+  v = fb_vector (&(a->fb), a->nblocks, 24, 8);
+  fb_ref (&(a->fb), t.field[3], v);
+  for (k=0; k<a->nblocks; k++)
+  {
+    fb_u64 (&(a->fb), v + 4 + 24 * k, a->blocks[3 * k]);
+    fb_u32 (&(a->fb), v + 12 + 24 * k, a->blocks[3 * k + 1]);
+    fb_u64 (&(a->fb), v + 20 + 24 * k, a->blocks[3 * k + 2]);
+  }
+  if (a->fb.err)
+    return -1;
+
+  tail[0] = a->fb.n & 0xFF;
+  tail[1] = (a->fb.n >> 8) & 0xFF;
+  tail[2] = (a->fb.n >> 16) & 0xFF;
+  tail[3] = (a->fb.n >> 24) & 0xFF;
+  memcpy (tail + 4, "ARROW1", 6);
+  if ((af_add (a, a->fb.b, a->fb.n) != 0) || (af_add (a, tail, 10) != 0))
+    return -1;
+
+  return af_flush (a);
+}
+
+int output_arrow (const char * fname, struct arcfilt * filt, int window)
+{
+  struct arrow_file a;
+  struct arcstream s;
+  struct dataset ds;
+  int first = 1, r;
+
+  if (filt->layout == LAYOUT_BY_FRAME)
+    return -1;
+  if (window <= 0)
+    window = ARROW_WINDOW;
+
+  r = readarc_open (filt, &s);
+  if (r != 0)
+    return r;
+  memset (&a, 0, sizeof (a));
+  a.fd = open (fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (a.fd < 0)
+  {
+    printf ("Could not create %s.\n", fname);
+    readarc_close (&s);
+    return -1;
+  }
+
+  /* Magic, padded to 8. */
+  r = af_add (&a, "ARROW1\0\0", 8);
+
+  ds.nb = 0;
+  ds.buf = NULL;
+  while (r == 0)
+  {
+    r = readarc_next (&s, window, &ds);
+    if ((r != 0) || ((ds.num_frames == 0) && !first))
+      break;
+    if (first)
+    {
+      r = arrow_columns (&ds, &(a.col), &(a.ncol));
+      if (r == 0)
+        r = write_schema (&a);
+      first = 0;
+    }
+    if ((r != 0) || (ds.num_frames == 0))
+      break;
+    r = write_batch (&a, &ds);
+    DEBUG ("output_arrow: batch of %d frames written.\n", ds.num_frames);
+  }
+  if (r == 0)
+    r = write_footer (&a);
+  if ((close (a.fd) != 0) && (r == 0))
+    r = -1;
+  if (r != 0)
+    printf ("Error writing %s.\n", fname);
+
+  readarc_close (&s);
+  free_dataset (&ds);
+  free (a.col);
+  free (a.iov);
+  free (a.blocks);
+  free (a.fb.b);
+
+  return r;
+}
@@ -0,0 +1,5 @@
+#include <stdlib.h>
+
+#define ARROW_WINDOW	2000		/* Frames per record batch */
+
+int output_arrow (const char * fname, struct arcfilt * filt, int window);
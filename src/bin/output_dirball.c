@@ -57,7 +57,7 @@ int write_dirfile_format (struct tarfile * tf, struct dataset * ds)
 
     for (i=0; i<ds->nb; i++)
     {
-        if (ds->buf[i].rb->regblock[0] == '\0')
+        if (rb_regblock (ds->buf[i].rb)[0] == '\0')
             continue;
         if (ds->buf[i].chan.n == 0)
           numchan = ds->buf[i].rb->nchan;
@@ -66,14 +66,14 @@ int write_dirfile_format (struct tarfile * tf, struct dataset * ds)
         for (j=0; j<numchan; j++)
         {
           if (numchan==1)
-            tfprintf (tf, "%s.%s.%s\t", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock);
-          else if (isdigit(ds->buf[i].rb->regblock[strlen(ds->buf[i].rb->regblock)-1]))
-            tfprintf (tf, "%s.%s.%s_%d\t", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock, j);
+            tfprintf (tf, "%s.%s.%s\t", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+          else if (isdigit(rb_regblock (ds->buf[i].rb)[strlen(rb_regblock (ds->buf[i].rb))-1]))
+            tfprintf (tf, "%s.%s.%s_%d\t", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb), j);
           else
-            tfprintf (tf, "%s.%s.%s%d\t", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock, j);
+            tfprintf (tf, "%s.%s.%s%d\t", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb), j);
           tfprintf (tf, "RAW\t");
           tfprintf (tf, "%s\t", dirfile_datatype_code (ds->buf[i].rb->typeword & GCP_REG_TYPE));
-          tfprintf (tf, "%d\n", ds->buf[i].rb->spf);
+          tfprintf (tf, "%d\n", ds->buf[i].spf);
         }
     }
 
@@ -89,7 +89,7 @@ int write_dirfile_data (struct tarfile * tf, struct dataset * ds)
 
     for (i=0; i<ds->nb; i++)
     {
-        if (ds->buf[i].rb->regblock[0] == '\0')
+        if (rb_regblock (ds->buf[i].rb)[0] == '\0')
             continue;
         if (ds->buf[i].chan.n == 0)
           numchan = ds->buf[i].rb->nchan;
@@ -98,14 +98,14 @@ int write_dirfile_data (struct tarfile * tf, struct dataset * ds)
         for (j=0; j<numchan; j++)
         {
           if (numchan==1)
-            snprintf (fname, 255, "%s.%s.%s", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock);
-          else if (isdigit(ds->buf[i].rb->regblock[strlen(ds->buf[i].rb->regblock)-1]))
-            snprintf (fname, 255, "%s.%s.%s_%d", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock, j);
+            snprintf (fname, 255, "%s.%s.%s", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+          else if (isdigit(rb_regblock (ds->buf[i].rb)[strlen(rb_regblock (ds->buf[i].rb))-1]))
+            snprintf (fname, 255, "%s.%s.%s_%d", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb), j);
           else
-            snprintf (fname, 255, "%s.%s.%s%d", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock, j);
+            snprintf (fname, 255, "%s.%s.%s%d", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb), j);
 
-          elsize = get_elsize(ds->buf[i].rb->typeword & GCP_REG_TYPE);
-          tarfile_binary (tf, fname, elsize * ds->buf[i].rb->spf * ds->buf[i].numframes, j*ds->buf[i].rb->spf*ds->buf[i].numframes*elsize + ds->buf[i].buf);
+          elsize = ds->buf[i].elsize;
+          tarfile_binary (tf, fname, elsize * ds->buf[i].spf * ds->buf[i].numframes, databuf_sample (&(ds->buf[i]), j, 0));
         }
     }
 
@@ -122,7 +122,7 @@ int output_dirball (const char * basedir, struct dataset * ds, int ftype)
   tarfile_open (&tf, basedir, ftype);
   tarfile_set_user (&tf, "reuben", 0767, "staff", 0024);
   printf ("Starting format portion.\n");
-  tarfile_start_txt (&tf, "format");
+  tarfile_start_txt (&tf);
   printf ("Writing format portion.\n");
   write_dirfile_format (&tf, ds);
   printf ("CLosing format portion.\n");
@@ -1,3 +1,8 @@
 #include <stdlib.h>
 
+struct tarfile;
+
 int output_dirball (char * basedir, struct dataset * ds, int ftype);
+const char * dirfile_datatype_code (int data_type);
+int write_dirfile_format (struct tarfile * tf, struct dataset * ds);
+int write_dirfile_data (struct tarfile * tf, struct dataset * ds);
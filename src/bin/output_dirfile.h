@@ -1,3 +0,0 @@
-#include <stdlib.h>
-
-int output_dirfile (char * basedir, struct dataset * ds);
@@ -0,0 +1,240 @@
+/*
+ * Write a dirfile directory a window of frames at a time,
+ * adding each window to the end of every field, so that
+ * memory holds no more than one window.
+ *
+ * The UTC of the last frame written is kept in a state
+ * file alongside, so that a later run can append just the
+ * frames that came after it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "readarc.h"
+#include "arcstream.h"
+#include "tarfile.h"
+#include "output_dirball.h"
+#include "output_dirstream.h"
+
+#define DEBUG_OUTPUT_DIRSTREAM 0
+
+#if DEBUG_OUTPUT_DIRSTREAM == 1
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(args...)
+#endif
+
+struct dirstream_state {
+    char time_reg[3 * MAX_NAME_LENGTH + 3];
+    uint32_t last[2];		/* UTC of the last frame written */
+    long frames;		/* Frames written so far         */
+};
+
+static char * dir_path (const char * dirname, const char * fname)
+{
+  char * path = malloc (strlen (dirname) + strlen (fname) + 2);
+
+  if (path != NULL)
+    sprintf (path, "%s/%s", dirname, fname);
+
+  return path;
+}
+
+/* 0 if read, 1 if there is none, -1 if it's unreadable. */
+static int read_state (const char * dirname, struct dirstream_state * st)
+{
+  char * path = dir_path (dirname, DIRSTREAM_STATE);
+  unsigned long day, ms;
+  FILE * f;
+  int n;
+
+  if (path == NULL)
+    return -1;
+  f = fopen (path, "r");
+  free (path);
+  if (f == NULL)
+    return 1;
+  n = fscanf (f, " time_reg %302s last_utc %lu %lu frames %ld",
+    st->time_reg, &day, &ms, &(st->frames));
+  fclose (f);
+  if (n != 4)
+    return -1;
+  st->last[0] = day;
+  st->last[1] = ms;
+
+  return 0;
+}
+
+/* Written aside and renamed, so it's never half there. */
+static int write_state (const char * dirname, struct dirstream_state * st)
+{
+  char * path = dir_path (dirname, DIRSTREAM_STATE);
+  char * tmp = dir_path (dirname, DIRSTREAM_STATE ".tmp");
+  FILE * f;
+  int r = -1;
+
+  if ((path != NULL) && (tmp != NULL) && ((f = fopen (tmp, "w")) != NULL))
+  {
+    fprintf (f, "time_reg %s\nlast_utc %lu %lu\nframes %ld\n", st->time_reg,
+      (unsigned long)st->last[0], (unsigned long)st->last[1], st->frames);
+    if ((fclose (f) == 0) && (rename (tmp, path) == 0))
+      r = 0;
+  }
+  free (path);
+  free (tmp);
+
+  return r;
+}
+
+/* Whether the directory's format file is just txt, or */
+/* -1 if it has none.                                  */
+static int same_format (const char * dirname, const char * txt, size_t n)
+{
+  char * path = dir_path (dirname, "format");
+  char * old;
+  struct stat sb;
+  FILE * f;
+  int same = -1;
+
+  if ((path == NULL) || ((f = fopen (path, "rb")) == NULL))
+  {
+    free (path);
+    return -1;
+  }
+  free (path);
+  if ((fstat (fileno (f), &sb) == 0) && ((size_t)sb.st_size == n))
+  {
+    old = malloc (n + 1);
+    same = (old != NULL) && (fread (old, 1, n, f) == n) && !memcmp (old, txt, n);
+    free (old);
+  }
+  else
+    same = 0;
+  fclose (f);
+
+  return same;
+}
+
+int output_dirstream (const char * dirname, struct arcfilt * filt, int window, int append)
+{
+  struct dirstream_state st;
+  struct arcfilt f = *filt;
+  struct arcstream s;
+  struct dataset ds;
+  struct tarfile tf;
+  struct databuf * tref;
+  int first = 1, r;
+
+  if (window <= 0)
+    window = DIRSTREAM_WINDOW;
+  if ((mkdir (dirname, 0755) != 0) && (errno != EEXIST))
+  {
+    printf ("Could not create directory %s.\n", dirname);
+    return -1;
+  }
+
+  st.frames = 0;
+  r = append ? read_state (dirname, &st) : 1;
+  if (r < 0)
+  {
+    printf ("Could not read %s/%s.\n", dirname, DIRSTREAM_STATE);
+    return -1;
+  }
+  if ((r == 0) && (filt->time_reg != NULL) && strcmp (filt->time_reg, st.time_reg))
+  {
+    printf ("%s was written by %s, not %s.\n", dirname, st.time_reg, filt->time_reg);
+    return -1;
+  }
+  if (r == 0)
+  {
+    /* Pick up a millisecond after the last frame written. */
+    uint32_t next[2] = { st.last[0], st.last[1] + 1 };
+
+    if (next[1] >= 86400000)
+    {
+      next[0]++;
+      next[1] = 0;
+    }
+    if (!f.use_utc)
+    {
+      f.t2[0] = 0 - 1;
+      f.t2[1] = 0;
+    }
+    if (!f.use_utc || (utc_cmp (f.t1, next) < 0))
+    {
+      f.t1[0] = next[0];
+      f.t1[1] = next[1];
+    }
+    f.use_utc = 1;
+    f.time_reg = st.time_reg;
+    DEBUG ("output_dirstream: appending after %lu %lu.\n", (unsigned long)st.last[0], (unsigned long)st.last[1]);
+  }
+  else
+  {
+    snprintf (st.time_reg, sizeof (st.time_reg), "%s",
+      (filt->time_reg != NULL) ? filt->time_reg : DIRSTREAM_TIME_REG);
+    if (append && (same_format (dirname, "", 0) >= 0))
+    {
+      printf ("%s has no %s to append after.\n", dirname, DIRSTREAM_STATE);
+      return -1;
+    }
+  }
+
+  r = readarc_open (&f, &s);
+  if (r != 0)
+  {
+    /* Nothing new since the last run. */
+    if (append && (r == ARC_ERR_NOFILE))
+      return 0;
+    return r;
+  }
+
+  ds.nb = 0;
+  ds.buf = NULL;
+  while (1)
+  {
+    r = readarc_next (&s, window, &ds);
+    if ((r != 0) || (ds.num_frames == 0))
+      break;
+
+    r = tarfile_open (&tf, dirname, (first && !append) ? TARFILE_NOTAR : TARFILE_APPEND);
+    if (r != 0)
+      break;
+    if (first)
+    {
+      /* Fields have to line up with what's there already. */
+      tarfile_start_txt (&tf);
+      write_dirfile_format (&tf, &ds);
+      if (!append || (same_format (dirname, tf.txt, tf.n) < 0))
+        tarfile_stop_txt (&tf, "format");
+      else if (same_format (dirname, tf.txt, tf.n) == 0)
+      {
+        printf ("Registers differ from those already in %s.\n", dirname);
+        tarfile_close (&tf);
+        r = -1;
+        break;
+      }
+    }
+    write_dirfile_data (&tf, &ds);
+    r = tarfile_close (&tf);
+    if (r != 0)
+      break;
+
+    st.frames += ds.num_frames;
+    tref = dataset_find (&ds, st.time_reg);
+    if ((tref != NULL) && (databuf_frame_utc (tref, ds.num_frames - 1, st.last) == 0))
+      write_state (dirname, &st);
+    else if (first)
+      printf ("%s isn't written, so later runs can't append.\n", st.time_reg);
+    DEBUG ("output_dirstream: %ld frames written.\n", st.frames);
+    first = 0;
+  }
+
+  readarc_close (&s);
+  free_dataset (&ds);
+
+  return r;
+}
@@ -0,0 +1,7 @@
+#include <stdlib.h>
+
+#define DIRSTREAM_WINDOW	2000		/* Frames read at a time   */
+#define DIRSTREAM_STATE		"arcfile.state"	/* Where a run left off   */
+#define DIRSTREAM_TIME_REG	"array.frame.utc"
+
+int output_dirstream (const char * dirname, struct arcfilt * filt, int window, int append);
@@ -0,0 +1,419 @@
+/*
+ * Write a FITS binary table a window of frames at a time,
+ * a row per frame and a column per register, each holding
+ * the frame's samples of all its channels.
+ *
+ * Registers are held frame by frame, so that each row is
+ * a run of whole registers to be put into big-endian
+ * order.  Rows are gathered into large blocks and written
+ * out in whole 2880-byte records, and NAXIS2 is filled in
+ * once the rows have been counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "readarc.h"
+#include "arcstream.h"
+#include "arc_endian.h"
+#include "output_fits.h"
+
+#define DEBUG_OUTPUT_FITS 0
+
+#if DEBUG_OUTPUT_FITS == 1
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(args...)
+#endif
+
+#define FITS_RECORD	2880
+#define FITS_CARD	80
+#define FITS_BLOCK	(FITS_RECORD * 1024)	/* Bytes written at a time */
+#define FITS_MAX_COLS	999
+
+/* How samples go into the table: swapped by words of swap */
+/* bytes, with the sign bit flipped for unsigned types kept */
+/* as signed ones plus TZERO, or UTC days and ms as MJD.    */
+struct fits_col {
+    int ib;			/* Register block in the dataset */
+    int repeat;			/* Samples per row               */
+    int width;			/* Bytes per sample in the table */
+    int swap;
+    int flip;
+    int is_utc;
+    char form;
+    const char * tzero;
+    char dim[32];
+};
+
+struct fits_file {
+    int fd;
+    struct fits_col * col;
+    int ncol;
+    long rowbytes;
+    long nrows;
+    off_t naxis2_at;		/* Where NAXIS2's value goes */
+    char * buf;			/* Rows not yet written out  */
+    size_t n, max;
+    int host_le;
+};
+
+static int write_all (int fd, const char * p, size_t n)
+{
+  ssize_t w;
+
+  while (n > 0)
+  {
+    w = write (fd, p, n);
+    if (w < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += w;
+    n -= w;
+  }
+
+  return 0;
+}
+
+/* Header cards, each padded out to 80 characters. */
+static void fits_card (char * h, int * ncard, const char * key, const char * value, const char * comment)
+{
+  char card[FITS_CARD + 1];
+
+  if (value == NULL)
+    snprintf (card, sizeof (card), "%-8.8s", key);
+  else if (comment == NULL)
+    snprintf (card, sizeof (card), "%-8.8s= %s", key, value);
+  else
+    snprintf (card, sizeof (card), "%-8.8s= %s / %s", key, value, comment);
+  memset (h + (size_t)(*ncard) * FITS_CARD, ' ', FITS_CARD);
+  memcpy (h + (size_t)(*ncard) * FITS_CARD, card, strlen (card));
+  (*ncard)++;
+}
+
+static void fits_card_int (char * h, int * ncard, const char * key, long x, const char * comment)
+{
+  char v[32];
+
+  snprintf (v, sizeof (v), "%20ld", x);
+  fits_card (h, ncard, key, v, comment);
+}
+
+/* Quotes doubled, and padded to at least 8 characters. */
+static void fits_card_str (char * h, int * ncard, const char * key, const char * s, const char * comment)
+{
+  char v[FITS_CARD];
+  int i, n = 0;
+
+  v[n++] = '\'';
+  for (i=0; (s[i] != '\0') && (n < 68); i++)
+  {
+    if (s[i] == '\'')
+      v[n++] = '\'';
+    v[n++] = s[i];
+  }
+  while (n < 9)
+    v[n++] = ' ';
+  v[n++] = '\'';
+  v[n] = '\0';
+  fits_card (h, ncard, key, v, comment);
+}
+
+static void fits_card_numbered (char * h, int * ncard, const char * key, int k, const char * s)
+{
+  char name[16];
+
+  snprintf (name, sizeof (name), "%s%d", key, k);
+  fits_card_str (h, ncard, name, s, NULL);
+}
+
+/* Returns the number of columns, or -1. */
+static int fits_columns (struct dataset * ds, struct fits_col ** col)
+{
+  struct databuf * ts;
+  struct fits_col * c;
+  int i, n = 0, nchan, cplx;
+
+  *col = malloc ((ds->nb > 0 ? ds->nb : 1) * sizeof (struct fits_col));
+  if (*col == NULL)
+    return -1;
+
+  for (i=0; i<ds->nb; i++)
+  {
+    ts = &(ds->buf[i]);
+    if (rb_regblock (ts->rb)[0] == '\0')
+      continue;
+    if (n == FITS_MAX_COLS)
+    {
+      printf ("Only the first %d registers fit in a table.\n", FITS_MAX_COLS);
+      break;
+    }
+    c = &((*col)[n]);
+    cplx = ((ts->rb->typeword & GCP_REG_COMPLEX) != 0);
+    c->ib = i;
+    c->width = ts->elsize;
+    c->swap = cplx ? ts->elsize / 2 : ts->elsize;
+    c->flip = 0;
+    c->is_utc = 0;
+    c->tzero = NULL;
+    switch (ts->rb->typeword & GCP_REG_TYPE)
+    {
+      case GCP_REG_BOOL:
+      case GCP_REG_UCHAR:  c->form = 'B'; break;
+      case GCP_REG_CHAR:   c->form = 'B'; c->flip = 1; c->tzero = "-128"; break;
+      case GCP_REG_SHORT:  c->form = 'I'; break;
+      case GCP_REG_USHORT: c->form = 'I'; c->flip = 1; c->tzero = "32768"; break;
+      case GCP_REG_INT:    c->form = 'J'; break;
+      case GCP_REG_UINT:   c->form = 'J'; c->flip = 1; c->tzero = "2147483648"; break;
+      case GCP_REG_FLOAT:  c->form = cplx ? 'C' : 'E'; break;
+      case GCP_REG_DOUBLE: c->form = cplx ? 'M' : 'D'; break;
+
+      /* Undecoded times go in as MJD. */
+      case GCP_REG_UTC:    c->form = 'D'; c->is_utc = 1; break;
+      default:
+        printf ("Skipping register of type 0x%lx.\n", (unsigned long)(ts->rb->typeword & GCP_REG_TYPE));
+        continue;
+    }
+    if (cplx && (c->form != 'C') && (c->form != 'M'))
+    {
+      printf ("Skipping complex register of type 0x%lx.\n", (unsigned long)(ts->rb->typeword & GCP_REG_TYPE));
+      continue;
+    }
+    nchan = databuf_nchan (ts);
+    c->repeat = nchan * ts->spf;
+    c->dim[0] = '\0';
+    if ((nchan > 1) && (ts->spf > 1))
+      snprintf (c->dim, sizeof (c->dim), "(%d,%d)", ts->spf, nchan);
+    n++;
+  }
+
+  return n;
+}
+
+/* The primary HDU, with no data, and the table's header. */
+static int write_header (struct fits_file * ff, struct dataset * ds)
+{
+  struct databuf * ts;
+  struct fits_col * c;
+  char name[3 * MAX_NAME_LENGTH + 3];
+  char form[32];
+  char * h;
+  int k, ncard = 0, nrec, r;
+
+  /* At most 7 cards per column, and 16 more. */
+  nrec = 1 + (7 * ff->ncol + 16 + 35) / 36;
+  h = malloc ((size_t)nrec * FITS_RECORD);
+  if (h == NULL)
+    return ARC_ERR_NOMEM;
+  memset (h, ' ', (size_t)nrec * FITS_RECORD);
+
+  fits_card (h, &ncard, "SIMPLE", "                   T", "conforms to FITS standard");
+  fits_card_int (h, &ncard, "BITPIX", 8, NULL);
+  fits_card_int (h, &ncard, "NAXIS", 0, NULL);
+  fits_card (h, &ncard, "EXTEND", "                   T", NULL);
+  fits_card (h, &ncard, "END", NULL, NULL);
+  ncard = 36;
+
+  ff->rowbytes = 0;
+  for (k=0; k<ff->ncol; k++)
+    ff->rowbytes += (long)ff->col[k].repeat * ff->col[k].width;
+
+  fits_card_str (h, &ncard, "XTENSION", "BINTABLE", "binary table extension");
+  fits_card_int (h, &ncard, "BITPIX", 8, NULL);
+  fits_card_int (h, &ncard, "NAXIS", 2, NULL);
+  fits_card_int (h, &ncard, "NAXIS1", ff->rowbytes, "bytes per frame");
+  ff->naxis2_at = (off_t)ncard * FITS_CARD + 10;
+  fits_card_int (h, &ncard, "NAXIS2", 0, "frames");
+  fits_card_int (h, &ncard, "PCOUNT", 0, NULL);
+  fits_card_int (h, &ncard, "GCOUNT", 1, NULL);
+  fits_card_int (h, &ncard, "TFIELDS", ff->ncol, NULL);
+  fits_card_str (h, &ncard, "EXTNAME", "ARC", NULL);
+  for (k=0; k<ff->ncol; k++)
+  {
+    c = &(ff->col[k]);
+    ts = &(ds->buf[c->ib]);
+    snprintf (name, sizeof (name), "%s.%s.%s", rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb));
+    fits_card_numbered (h, &ncard, "TTYPE", k + 1, name);
+    snprintf (form, sizeof (form), "%d%c", c->repeat, c->form);
+    fits_card_numbered (h, &ncard, "TFORM", k + 1, form);
+    if (c->dim[0] != '\0')
+      fits_card_numbered (h, &ncard, "TDIM", k + 1, c->dim);
+    if (c->tzero != NULL)
+    {
+      snprintf (name, sizeof (name), "TSCAL%d", k + 1);
+      fits_card (h, &ncard, name, "                   1", NULL);
+      snprintf (name, sizeof (name), "TZERO%d", k + 1);
+      snprintf (form, sizeof (form), "%20s", c->tzero);
+      fits_card (h, &ncard, name, form, NULL);
+    }
+    if (c->is_utc)
+      fits_card_numbered (h, &ncard, "TUNIT", k + 1, "d");
+  }
+  fits_card (h, &ncard, "END", NULL, NULL);
+
+  r = write_all (ff->fd, h, (size_t)(ncard + 35) / 36 * FITS_RECORD);
+  free (h);
+
+  return r;
+}
+
+/* Put n samples of a column into the table's order. */
+static void encode_samples (struct fits_file * ff, struct fits_col * c, char * out, const char * in, int n)
+{
+  uint64_t u;
+  double mjd;
+  int k;
+
+  if (c->is_utc)
+  {
+    for (k=0; k<n; k++)
+    {
+      memcpy (&u, in + 8 * k, 8);
+      mjd = (u & 0xFFFFFFFF) + (u >> 32) / 86400000.0;
+      memcpy (out + 8 * k, &mjd, 8);
+    }
+    in = out;
+  }
+  if (ff->host_le && (c->swap > 1))
+    swap_copy (out, in, n * c->width / c->swap, c->swap);
+  else if (in != out)
+    memcpy (out, in, (size_t)n * c->width);
+  if (c->flip)
+    for (k=0; k<n; k++)
+      out[k * c->width] ^= 0x80;
+}
+
+/* Whole records of what's gathered so far go out; the */
+/* rest is kept for next time.                         */
+static int write_records (struct fits_file * ff)
+{
+  size_t n = ff->n / FITS_RECORD * FITS_RECORD;
+
+  if (write_all (ff->fd, ff->buf, n) != 0)
+    return -1;
+  memmove (ff->buf, ff->buf + n, ff->n - n);
+  ff->n -= n;
+
+  return 0;
+}
+
+static int write_rows (struct fits_file * ff, struct dataset * ds)
+{
+  struct databuf * ts;
+  struct fits_col * c;
+  long f;
+  int k;
+
+  for (f=0; f<ds->num_frames; f++)
+  {
+    if ((ff->n + ff->rowbytes > ff->max) && (write_records (ff) != 0))
+      return -1;
+    for (k=0; k<ff->ncol; k++)
+    {
+      c = &(ff->col[k]);
+      ts = &(ds->buf[c->ib]);
+      encode_samples (ff, c, ff->buf + ff->n, databuf_sample (ts, 0, f * ts->spf), c->repeat);
+      ff->n += (size_t)c->repeat * c->width;
+    }
+    ff->nrows++;
+  }
+
+  return 0;
+}
+
+/* Pad the last record, and fill in the number of rows. */
+static int finish_table (struct fits_file * ff)
+{
+  char v[32];
+
+  if (write_records (ff) != 0)
+    return -1;
+  if (ff->n > 0)
+  {
+    memset (ff->buf + ff->n, 0, FITS_RECORD - ff->n);
+    if (write_all (ff->fd, ff->buf, FITS_RECORD) != 0)
+      return -1;
+    ff->n = 0;
+  }
+
+  snprintf (v, sizeof (v), "%20ld", ff->nrows);
+  if (pwrite (ff->fd, v, 20, ff->naxis2_at) != 20)
+    return -1;
+
+  return 0;
+}
+
+int output_fits (const char * fname, struct arcfilt * filt, int window)
+{
+  struct arcfilt f = *filt;
+  struct fits_file ff;
+  struct arcstream s;
+  struct dataset ds;
+  int first = 1, r;
+
+  if (window <= 0)
+    window = FITS_WINDOW;
+
+  /* Each register's row is then in one piece. */
+  f.layout = LAYOUT_BY_FRAME;
+
+  r = readarc_open (&f, &s);
+  if (r != 0)
+    return r;
+  memset (&ff, 0, sizeof (ff));
+  ff.host_le = (check_endianness () == 0);
+  ff.fd = open (fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (ff.fd < 0)
+  {
+    printf ("Could not create %s.\n", fname);
+    readarc_close (&s);
+    return -1;
+  }
+
+  ds.nb = 0;
+  ds.buf = NULL;
+  while (r == 0)
+  {
+    r = readarc_next (&s, window, &ds);
+    if ((r != 0) || ((ds.num_frames == 0) && !first))
+      break;
+    if (first)
+    {
+      ff.ncol = fits_columns (&ds, &(ff.col));
+      r = (ff.ncol < 0) ? ARC_ERR_NOMEM : write_header (&ff, &ds);
+      if (r == 0)
+      {
+        /* Room for a block, and at least a row besides. */
+        ff.max = FITS_BLOCK + ff.rowbytes + FITS_RECORD;
+        ff.buf = malloc (ff.max);
+        if (ff.buf == NULL)
+          r = ARC_ERR_NOMEM;
+      }
+      first = 0;
+    }
+    if ((r != 0) || (ds.num_frames == 0))
+      break;
+    r = write_rows (&ff, &ds);
+    DEBUG ("output_fits: %ld rows written.\n", ff.nrows);
+  }
+  if (r == 0)
+    r = finish_table (&ff);
+  if ((close (ff.fd) != 0) && (r == 0))
+    r = -1;
+  if (r != 0)
+    printf ("Error writing %s.\n", fname);
+
+  readarc_close (&s);
+  free_dataset (&ds);
+  free (ff.col);
+  free (ff.buf);
+
+  return r;
+}
@@ -0,0 +1,5 @@
+#include <stdlib.h>
+
+#define FITS_WINDOW	2000		/* Frames read at a time */
+
+int output_fits (const char * fname, struct arcfilt * filt, int window);
@@ -1,12 +1,24 @@
 /*
  * RWO 090403 - dump time streams to standard output as hex.
  *
+ * Each register is cut into pieces of whole lines, which
+ * are encoded a round at a time, a piece per thread, and
+ * written out in order with one writev per round.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include "readarc.h"
+#include "output_hex.h"
+
+#if HAVE_PTHREAD
+#  include <pthread.h>
+#endif
 
 #define DEBUG_OUTPUT_HEX 1
 
@@ -16,65 +28,295 @@
 #  define DEBUG(args...)
 #endif
 
-int output_hex (struct dataset * ds)
+#define HEX_LINE	2000		/* Bytes encoded per line     */
+#define HEX_JOB_BYTES	(HEX_LINE * 256)	/* Bytes encoded per piece */
+#define HEX_MAX_THREADS	64
+
+/* A piece of one register: bytes b0 to b1, with its header */
+/* in front if it's the first and a blank line if the last. */
+struct hex_job {
+    struct databuf * ts;
+    size_t b0, b1, nbytes;
+    char * out;
+    size_t n, max;
+    int err;
+};
+
+static char hex_pair[256][2];
+
+static void init_hex_pair (void)
+{
+  static const char digits[] = "0123456789abcdef";
+  int i;
+
+  for (i=0; i<256; i++)
+  {
+    hex_pair[i][0] = digits[i >> 4];
+    hex_pair[i][1] = digits[i & 0xF];
+  }
+}
+
+#if defined (__SSSE3__)
+#include <tmmintrin.h>
+
+/* Encode 16 bytes at a time: each nibble looks up its */
+/* digit with one byte shuffle, and the high and low   */
+/* digits are interleaved.  Returns the bytes done.    */
+static size_t hex_encode_ssse3 (char * p, const uint8_t * src, size_t n)
+{
+  const __m128i digits = _mm_setr_epi8 ('0','1','2','3','4','5','6','7',
+    '8','9','a','b','c','d','e','f');
+  const __m128i nibble = _mm_set1_epi8 (0x0F);
+  __m128i x, hi, lo;
+  size_t k, nbytes = n & ~(size_t)15;
+
+  for (k=0; k<nbytes; k+=16)
+  {
+    x = _mm_loadu_si128 ((const __m128i *)(src + k));
+    hi = _mm_shuffle_epi8 (digits, _mm_and_si128 (_mm_srli_epi16 (x, 4), nibble));
+    lo = _mm_shuffle_epi8 (digits, _mm_and_si128 (x, nibble));
+    _mm_storeu_si128 ((__m128i *)(p + 2 * k), _mm_unpacklo_epi8 (hi, lo));
+    _mm_storeu_si128 ((__m128i *)(p + 2 * k + 16), _mm_unpackhi_epi8 (hi, lo));
+  }
+
+  return nbytes;
+}
+#endif
+
+/* Two hex digits for each of n bytes.  With SSSE3 whole */
+/* vectors are encoded at once, and the rest a byte at a  */
+/* time.                                                  */
+static char * hex_encode (char * p, const uint8_t * src, size_t n)
+{
+  size_t k = 0;
+
+#if defined (__SSSE3__)
+  k = hex_encode_ssse3 (p, src, n);
+#endif
+  for (; k<n; k++)
+    memcpy (p + 2 * k, hex_pair[src[k]], 2);
+
+  return p + 2 * n;
+}
+
+static const char * hex_type_name (uint32_t typeword)
+{
+  switch (typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_UINT:   return "uint32";
+    case GCP_REG_INT:    return "int32";
+    case GCP_REG_UCHAR:  return "uint8";
+    case GCP_REG_CHAR:   return "int8";
+    case GCP_REG_FLOAT:  return "single";
+    case GCP_REG_DOUBLE: return "double";
+
+    /* Just treat UTC times as a UINT64, for now. */
+    case GCP_REG_UTC:    return "uint64";
+  }
+
+  return NULL;
+}
+
+static void encode_job (struct hex_job * job)
+{
+  struct databuf * ts = job->ts;
+  const uint8_t * src = (const uint8_t *)ts->buf;
+  const char * type;
+  size_t need, j, n;
+  char * p;
+
+  need = 2 * (job->b1 - job->b0) + (job->b1 - job->b0) / HEX_LINE + 8
+    + strlen (rb_map (ts->rb)) + strlen (rb_board (ts->rb)) + strlen (rb_regblock (ts->rb)) + 128;
+  if (need > job->max)
+  {
+    free (job->out);
+    job->out = malloc (need);
+    job->max = (job->out != NULL) ? need : 0;
+    if (job->out == NULL)
+    {
+      job->err = 1;
+      return;
+    }
+  }
+  p = job->out;
+
+  type = hex_type_name (ts->rb->typeword);
+  if (job->b0 == 0)
+  {
+    p += sprintf (p, "###\n%s %s %s\n", rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb));
+    if (type == NULL)
+    {
+      p += sprintf (p, "Skipping register of type 0x%lx.\n", (unsigned long)(ts->rb->typeword & GCP_REG_TYPE));
+      job->n = p - job->out;
+      return;
+    }
+    p += sprintf (p, "%s\n%ld %d\n", type, (long)ts->spf * ts->numframes, databuf_nchan (ts));
+  }
+
+  for (j=job->b0; j<job->b1; )
+  {
+    if ((j > 0) && (j % HEX_LINE == 0))
+      *p++ = '\n';
+    n = HEX_LINE - j % HEX_LINE;
+    if (n > job->b1 - j)
+      n = job->b1 - j;
+    p = hex_encode (p, src + j, n);
+    j += n;
+  }
+
+  if (job->b1 == job->nbytes)
+  {
+    *p++ = '\n';
+    *p++ = '\n';
+  }
+  job->n = p - job->out;
+}
+
+#if HAVE_PTHREAD
+static void * encode_job_thread (void * arg)
 {
-  int i, j, k;
-  int numchan;
+  encode_job ((struct hex_job *)arg);
+  return NULL;
+}
+#endif
 
-  printf ("dump_timestreams: n=%d.\n", ds->nb);
-  for (i=0; i<ds->nb; i++)
+static int write_all (int fd, struct iovec * iov, int n)
+{
+  ssize_t w;
+
+  while (n > 0)
   {
-    printf ("###\n");
-    printf ("%s %s %s\n", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock);
-    switch (ds->buf[i].rb->typeword & GCP_REG_TYPE)
+    w = writev (fd, iov, n);
+    if (w < 0)
     {
-      case GCP_REG_UINT:
-        printf ("uint32\n");
-        break;
-      case GCP_REG_INT:
-        printf ("int32\n");
-        break;
-      case GCP_REG_UCHAR:
-        printf ("uint8\n");
-        break;
-      case GCP_REG_CHAR:
-        printf ("int8\n");
-        break;
-      case GCP_REG_FLOAT:
-        printf ("single\n");
-        break;
-      case GCP_REG_DOUBLE:
-        printf ("double\n");
-        break;
-
-      /* Just treat UTC times as a UINT64, for now. */
-      case GCP_REG_UTC:
-        printf ("uint64\n");
-        break;
-
-      default: 
-        printf ("Skipping register of type 0x%lx.\n", ds->buf[i].rb->typeword & GCP_REG_TYPE);
+      if (errno == EINTR)
         continue;
+      return -1;
+    }
+    while ((n > 0) && ((size_t)w >= iov->iov_len))
+    {
+      w -= iov->iov_len;
+      iov++;
+      n--;
     }
-    if (ds->buf[i].chan.n == 0)
-      numchan = ds->buf[i].rb->nchan;
-    else
-      numchan = ds->buf[i].chan.ntot;
-    printf ("%ld %ld\n", ds->buf[i].rb->spf * ds->buf[i].numframes, numchan);
-    k = 0;
-    for (j=0;
-      j < (numchan * ds->buf[i].rb->spf * ds->buf[i].numframes *ds->buf[i].elsize);
-      j++)
+    if (n > 0)
     {
-      if (k == 2000)
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+
+  return 0;
+}
+
+/* Bytes of a register that get dumped. */
+static size_t hex_nbytes (struct databuf * ts)
+{
+  if (hex_type_name (ts->rb->typeword) == NULL)
+    return 0;
+
+  return (size_t)databuf_nchan (ts) * ts->spf * ts->numframes * ts->elsize;
+}
+
+int output_hex_fd (struct dataset * ds, int fd, int nthreads)
+{
+  struct hex_job job[HEX_MAX_THREADS];
+  struct iovec iov[HEX_MAX_THREADS];
+#if HAVE_PTHREAD
+  pthread_t tid[HEX_MAX_THREADS];
+  int started[HEX_MAX_THREADS];
+#endif
+  char head[64];
+  size_t off, todo;
+  int i, t, n, r = 0;
+
+  if (nthreads <= 0)
+    nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+#if !HAVE_PTHREAD
+  nthreads = 1;
+#endif
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > HEX_MAX_THREADS)
+    nthreads = HEX_MAX_THREADS;
+  init_hex_pair ();
+
+  for (t=0; t<nthreads; t++)
+  {
+    job[t].out = NULL;
+    job[t].max = 0;
+  }
+
+  iov[0].iov_base = head;
+  iov[0].iov_len = sprintf (head, "dump_timestreams: n=%d.\n", ds->nb);
+  if (write_all (fd, iov, 1) != 0)
+    r = -1;
+
+  /* Deal out pieces of whole lines, register after register, */
+  /* until each thread has one or the registers run out.      */
+  i = 0;
+  off = 0;
+  while ((i < ds->nb) && (r == 0))
+  {
+    todo = 0;
+    for (n=0; (n<nthreads) && (i<ds->nb); n++)
+    {
+      job[n].ts = &(ds->buf[i]);
+      job[n].nbytes = hex_nbytes (job[n].ts);
+      job[n].b0 = off;
+      job[n].b1 = (job[n].nbytes - off > HEX_JOB_BYTES) ? off + HEX_JOB_BYTES : job[n].nbytes;
+      job[n].err = 0;
+      todo += job[n].b1 - job[n].b0;
+      off = job[n].b1;
+      if (off == job[n].nbytes)
+      {
+        i++;
+        off = 0;
+      }
+    }
+
+#if HAVE_PTHREAD
+    /* Threads only pay when there's more than a piece to do. */
+    for (t=1; t<n; t++)
+      started[t] = (todo > HEX_JOB_BYTES)
+        && (pthread_create (&(tid[t]), NULL, encode_job_thread, &(job[t])) == 0);
+    encode_job (&(job[0]));
+    for (t=1; t<n; t++)
+    {
+      if (started[t])
+        pthread_join (tid[t], NULL);
+      else
+        encode_job (&(job[t]));
+    }
+#else
+    for (t=0; t<n; t++)
+      encode_job (&(job[t]));
+#endif
+
+    for (t=0; t<n; t++)
+    {
+      if (job[t].err)
       {
-        printf ("\n");
-        k = 0;
+        fprintf (stderr, "Out of memory encoding %s.%s.%s.\n",
+          rb_map (job[t].ts->rb), rb_board (job[t].ts->rb), rb_regblock (job[t].ts->rb));
+        r = -1;
       }
-      k++;
-      printf ("%02hhx", *((char *)ds->buf[i].buf+j));
+      iov[t].iov_base = job[t].out;
+      iov[t].iov_len = job[t].n;
     }
-    printf ("\n\n");
+    if ((r == 0) && (write_all (fd, iov, n) != 0))
+      r = -1;
   }
-  return 0;
+
+  for (t=0; t<nthreads; t++)
+    free (job[t].out);
+
+  return r;
+}
+
+int output_hex (struct dataset * ds)
+{
+  fflush (stdout);
+
+  return output_hex_fd (ds, fileno (stdout), 0);
 }
@@ -1,3 +1,4 @@
 #include <stdlib.h>
 
 int output_hex (struct dataset * ds);
+int output_hex_fd (struct dataset * ds, int fd, int nthreads);
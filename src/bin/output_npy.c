@@ -0,0 +1,400 @@
+/*
+ * Write registers as NumPy arrays: a .npy file each in a
+ * directory, or all together in an uncompressed .npz.
+ *
+ * Headers are padded so that each array's data start on a
+ * 64-byte boundary of the file, for np.load(mmap_mode='r'),
+ * and the data are written straight from the dataset.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#include "readarc.h"
+#include "arc_endian.h"
+#include "output_npy.h"
+
+#define DEBUG_OUTPUT_NPY 0
+
+#if DEBUG_OUTPUT_NPY == 1
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(args...)
+#endif
+
+#define NPY_ALIGN	64
+#define NPY_MAX_HEADER	512
+#define NPY_MAX_IOV	512
+
+/* Where the data of an array come from: a run per channel, */
+/* or a single run when the buffer holds nothing else.      */
+struct npy_array {
+    struct databuf * ts;
+    char header[NPY_MAX_HEADER];
+    size_t nheader;
+    size_t nrun, nruns;		/* Bytes per run, and runs */
+    size_t nbytes;		/* Header and data          */
+};
+
+/* NumPy's name for a register's type as stored, or 0 if */
+/* there isn't one.                                      */
+static int npy_descr (uint32_t typeword, char * d, size_t n)
+{
+  char e = (check_endianness () == 1) ? '>' : '<';
+  const char * base;
+  int cplx = (typeword & GCP_REG_COMPLEX);
+
+  switch (typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_BOOL:
+    case GCP_REG_UCHAR:  base = "u1"; break;
+    case GCP_REG_CHAR:   base = "i1"; break;
+    case GCP_REG_SHORT:  base = "i2"; break;
+    case GCP_REG_USHORT: base = "u2"; break;
+    case GCP_REG_INT:    base = "i4"; break;
+    case GCP_REG_UINT:   base = "u4"; break;
+    case GCP_REG_FLOAT:  base = cplx ? "c8" : "f4"; break;
+    case GCP_REG_DOUBLE: base = cplx ? "c16" : "f8"; break;
+
+    /* Undecoded times: the day, then ms into it. */
+    case GCP_REG_UTC:
+      if (cplx)
+        return 0;
+      return snprintf (d, n, "[('day', '%cu4'), ('ms', '%cu4')]", e, e);
+    default:
+      return 0;
+  }
+
+  if (base[1] == '1')
+    e = '|';
+  if (cplx && (base[0] != 'c'))
+    return snprintf (d, n, "[('re', '%c%s'), ('im', '%c%s')]", e, base, e, base);
+
+  return snprintf (d, n, "'%c%s'", e, base);
+}
+
+/* Build the .npy header of a register, padded so that the */
+/* data start on a boundary when the header starts at ofs. */
+static int npy_setup (struct databuf * ts, size_t ofs, struct npy_array * a)
+{
+  char descr[128], shape[96];
+  size_t n, pad;
+  int nchan = databuf_nchan (ts);
+
+  a->ts = ts;
+  if (npy_descr (ts->rb->typeword, descr, sizeof (descr)) <= 0)
+    return -1;
+
+  if (ts->layout == LAYOUT_BY_FRAME)
+  {
+    snprintf (shape, sizeof (shape), "(%d, %d, %d)", ts->numframes, nchan, ts->spf);
+    a->nrun = (size_t)ts->numframes * nchan * ts->spf * ts->elsize;
+    a->nruns = 1;
+  }
+  else
+  {
+    snprintf (shape, sizeof (shape), "(%d, %ld)", nchan, (long)ts->numframes * ts->spf);
+    a->nrun = (size_t)ts->numframes * ts->spf * ts->elsize;
+    a->nruns = nchan;
+
+    /* Channels end to end, as readarc leaves them. */
+    if (ts->numframes == ts->maxframes)
+    {
+      a->nrun *= nchan;
+      a->nruns = 1;
+    }
+  }
+
+  /* Magic, version 1.0, and the header length. */
+  n = snprintf (a->header + 10, NPY_MAX_HEADER - 10,
+    "{'descr': %s, 'fortran_order': False, 'shape': %s, }", descr, shape);
+  pad = NPY_ALIGN - (ofs + 10 + n + 1) % NPY_ALIGN;
+  if (pad == NPY_ALIGN)
+    pad = 0;
+  if (10 + n + pad + 1 > NPY_MAX_HEADER)
+    return -1;
+  memset (a->header + 10 + n, ' ', pad);
+  n += pad;
+  a->header[10 + n++] = '\n';
+  memcpy (a->header, "\x93NUMPY\x01\x00", 8);
+  a->header[8] = n & 0xFF;
+  a->header[9] = (n >> 8) & 0xFF;
+  a->nheader = 10 + n;
+  a->nbytes = a->nheader + a->nrun * a->nruns;
+
+  return 0;
+}
+
+static int write_iov (int fd, struct iovec * iov, int n)
+{
+  ssize_t w;
+
+  while (n > 0)
+  {
+    w = writev (fd, iov, n);
+    if (w < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    while ((n > 0) && ((size_t)w >= iov->iov_len))
+    {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+
+  return 0;
+}
+
+/* Write the header and then each run of data, as many to */
+/* a writev as it takes.                                  */
+static int write_array (int fd, struct npy_array * a)
+{
+  struct iovec iov[NPY_MAX_IOV];
+  size_t k = 0;
+  int n = 0;
+
+  iov[n].iov_base = a->header;
+  iov[n++].iov_len = a->nheader;
+  while (k < a->nruns)
+  {
+    for (; (n < NPY_MAX_IOV) && (k < a->nruns); k++)
+    {
+      iov[n].iov_base = databuf_sample (a->ts, (a->nruns > 1) ? k : 0, 0);
+      iov[n++].iov_len = a->nrun;
+    }
+    if (write_iov (fd, iov, n) != 0)
+      return -1;
+    n = 0;
+  }
+  if ((n > 0) && (write_iov (fd, iov, n) != 0))
+    return -1;
+
+  return 0;
+}
+
+static uint32_t array_crc (struct npy_array * a)
+{
+  uint32_t crc = crc32 (0L, Z_NULL, 0);
+  size_t k;
+
+  crc = crc32 (crc, (const Bytef *)a->header, a->nheader);
+  for (k=0; k<a->nruns; k++)
+    crc = crc32 (crc, databuf_sample (a->ts, (a->nruns > 1) ? k : 0, 0), a->nrun);
+
+  return crc;
+}
+
+static void reg_name (struct databuf * ts, char * name, size_t n)
+{
+  snprintf (name, n, "%s.%s.%s", rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb));
+}
+
+/* Registers with no name, or of a type NumPy has no */
+/* name for, are left out.                           */
+static int npy_skip (struct databuf * ts)
+{
+  char descr[128];
+
+  if (rb_regblock (ts->rb)[0] == '\0')
+    return 1;
+  if (npy_descr (ts->rb->typeword, descr, sizeof (descr)) > 0)
+    return 0;
+  printf ("Skipping register of type 0x%lx.\n", (unsigned long)(ts->rb->typeword & GCP_REG_TYPE));
+
+  return 1;
+}
+
+int output_npy (const char * dirname, struct dataset * ds)
+{
+  struct npy_array a;
+  char name[3 * MAX_NAME_LENGTH + 8];
+  char * path;
+  int i, fd, r = 0;
+
+  if ((mkdir (dirname, 0755) != 0) && (errno != EEXIST))
+  {
+    printf ("Could not create directory %s.\n", dirname);
+    return -1;
+  }
+  path = malloc (strlen (dirname) + sizeof (name) + 2);
+  if (path == NULL)
+    return ARC_ERR_NOMEM;
+
+  for (i=0; i<ds->nb; i++)
+  {
+    if (npy_skip (&(ds->buf[i])) || (npy_setup (&(ds->buf[i]), 0, &a) != 0))
+      continue;
+    reg_name (&(ds->buf[i]), name, sizeof (name));
+    sprintf (path, "%s/%s.npy", dirname, name);
+    fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+      printf ("Could not create %s.\n", path);
+      r = -1;
+      break;
+    }
+    if ((write_array (fd, &a) != 0) | (close (fd) != 0))
+    {
+      printf ("Error writing %s.\n", path);
+      r = -1;
+      break;
+    }
+  }
+  free (path);
+
+  return r;
+}
+
+static void put_le16 (unsigned char * p, uint32_t x)
+{
+  p[0] = x & 0xFF;
+  p[1] = (x >> 8) & 0xFF;
+}
+
+static void put_le32 (unsigned char * p, uint32_t x)
+{
+  put_le16 (p, x & 0xFFFF);
+  put_le16 (p + 2, x >> 16);
+}
+
+/* An uncompressed zip of .npy members, as np.savez writes. */
+/* Each member's local header carries an extra field sized  */
+/* to bring its data to a boundary.  No zip64, so members   */
+/* and the whole file have to stay under 4 GB.              */
+int output_npz (const char * fname, struct dataset * ds)
+{
+  struct npy_array a;
+  struct iovec iov[1];
+  unsigned char lh[30 + NPY_ALIGN + 4];
+  unsigned char * cd = NULL;
+  unsigned char * p;
+  char name[3 * MAX_NAME_LENGTH + 8];
+  size_t ncd = 0, maxcd = 0, nname, nextra, ofs = 0;
+  uint32_t crc;
+  int i, fd, n = 0, r = 0;
+
+  fd = open (fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    printf ("Could not create %s.\n", fname);
+    return -1;
+  }
+
+  for (i=0; (i<ds->nb) && (r == 0); i++)
+  {
+    if (npy_skip (&(ds->buf[i])))
+      continue;
+    reg_name (&(ds->buf[i]), name, sizeof (name));
+    strcat (name, ".npy");
+    nname = strlen (name);
+    nextra = 4 + (NPY_ALIGN - (ofs + 30 + nname + 4) % NPY_ALIGN) % NPY_ALIGN;
+    if ((npy_setup (&(ds->buf[i]), ofs + 30 + nname + nextra, &a) != 0))
+      continue;
+    if (ofs + 30 + nname + nextra + a.nbytes >= 0xFFFFFFFFUL)
+    {
+      printf ("%s is too big for a .npz; write .npy files instead.\n", fname);
+      r = -1;
+      break;
+    }
+    crc = array_crc (&a);
+
+    /* Local header, stored, dated 1980-01-01. */
+    memset (lh, 0, sizeof (lh));
+    put_le32 (lh, 0x04034b50);
+    put_le16 (lh + 4, 20);
+    put_le16 (lh + 12, 0x21);
+    put_le32 (lh + 14, crc);
+    put_le32 (lh + 18, a.nbytes);
+    put_le32 (lh + 22, a.nbytes);
+    put_le16 (lh + 26, nname);
+    put_le16 (lh + 28, nextra);
+    iov[0].iov_base = lh;
+    iov[0].iov_len = 30;
+    if (write_iov (fd, iov, 1) != 0)
+      r = -1;
+    iov[0].iov_base = name;
+    iov[0].iov_len = nname;
+    if ((r == 0) && (write_iov (fd, iov, 1) != 0))
+      r = -1;
+
+    /* Padding, in a field of an unused id. */
+    memset (lh, 0, sizeof (lh));
+    put_le16 (lh, 0x4e50);
+    put_le16 (lh + 2, nextra - 4);
+    iov[0].iov_base = lh;
+    iov[0].iov_len = nextra;
+    if ((r == 0) && (write_iov (fd, iov, 1) != 0))
+      r = -1;
+    if ((r == 0) && (write_array (fd, &a) != 0))
+      r = -1;
+
+    if (ncd + 46 + nname > maxcd)
+    {
+      maxcd = 2 * (maxcd + 46 + nname);
+      p = realloc (cd, maxcd);
+      if (p == NULL)
+      {
+        r = ARC_ERR_NOMEM;
+        break;
+      }
+      cd = p;
+    }
+    p = cd + ncd;
+    memset (p, 0, 46);
+    put_le32 (p, 0x02014b50);
+    put_le16 (p + 4, 20);
+    put_le16 (p + 6, 20);
+    put_le16 (p + 14, 0x21);
+    put_le32 (p + 16, crc);
+    put_le32 (p + 20, a.nbytes);
+    put_le32 (p + 24, a.nbytes);
+    put_le16 (p + 28, nname);
+    put_le32 (p + 42, ofs);
+    memcpy (p + 46, name, nname);
+    ncd += 46 + nname;
+    ofs += 30 + nname + nextra + a.nbytes;
+    n++;
+  }
+
+  if (r == 0)
+  {
+    /* End of central directory. */
+    memset (lh, 0, 22);
+    put_le32 (lh, 0x06054b50);
+    put_le16 (lh + 8, n);
+    put_le16 (lh + 10, n);
+    put_le32 (lh + 12, ncd);
+    put_le32 (lh + 16, ofs);
+    iov[0].iov_base = cd;
+    iov[0].iov_len = ncd;
+    if ((ncd > 0) && (write_iov (fd, iov, 1) != 0))
+      r = -1;
+    iov[0].iov_base = lh;
+    iov[0].iov_len = 22;
+    if ((r == 0) && (write_iov (fd, iov, 1) != 0))
+      r = -1;
+  }
+  if (close (fd) != 0)
+    r = -1;
+  if (r != 0)
+    printf ("Error writing %s.\n", fname);
+  free (cd);
+
+  return r;
+}
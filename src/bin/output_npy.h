@@ -0,0 +1,4 @@
+#include <stdlib.h>
+
+int output_npy (const char * dirname, struct dataset * ds);
+int output_npz (const char * fname, struct dataset * ds);
@@ -0,0 +1,47 @@
+/*
+ * Print the per-channel statistics gathered by a
+ * stats query to standard output, one table per
+ * register block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "readarc.h"
+
+#define DEBUG_OUTPUT_STATS 0
+
+#if DEBUG_OUTPUT_STATS == 1
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(args...)
+#endif
+
+int output_stats (struct dataset * ds)
+{
+  struct chanstats * cs;
+  int i, k;
+
+  printf ("stats: n=%d, frames=%d.\n", ds->nb, ds->num_frames);
+  for (i=0; i<ds->nb; i++)
+  {
+    if (ds->buf[i].stats == NULL)
+    {
+      DEBUG ("No statistics for %s.%s.%s.\n", rb_map (ds->buf[i].rb),
+        rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+      continue;
+    }
+    printf ("###\n");
+    printf ("%s %s %s\n", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+    printf ("chan n nan min max mean std\n");
+    for (k=0; k<databuf_nchan (&(ds->buf[i])); k++)
+    {
+      cs = &(ds->buf[i].stats[k]);
+      printf ("%d %ld %ld %.10g %.10g %.10g %.10g\n", k, cs->n, cs->nnan,
+        cs->min, cs->max, cs->mean, sqrt (chanstats_var (cs)));
+    }
+  }
+
+  return 0;
+}
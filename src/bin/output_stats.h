@@ -0,0 +1,3 @@
+#include <stdlib.h>
+
+int output_stats (struct dataset * ds);
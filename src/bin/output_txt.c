@@ -1,12 +1,28 @@
 /*
  * RWO 090403 - dump time streams to standard
  *              output.
+ *
+ * Rows are formatted into memory a block at a time,
+ * on several threads for big registers, and written
+ * out in order with one fwrite per block.  Within a
+ * block, a tile of rows is first gathered channel by
+ * channel into a row-major scratch area, so that the
+ * samples are read in the order they're stored.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
 #include "readarc.h"
+#include "output_txt.h"
+
+#if HAVE_PTHREAD
+#  include <pthread.h>
+#endif
 
 #define DEBUG_OUTPUT_TXT 0
 
@@ -16,86 +32,511 @@
 #  define DEBUG(args...)
 #endif
 
-int output_txt (struct dataset * ds)
+#define TXT_JOB_VALUES	65536	/* Values formatted per block      */
+#define TXT_MAX_THREADS	64
+#define TXT_MAX_VALUE	512	/* Room for the longest %f of a double */
+#define TXT_TILE_BYTES	32768	/* Samples gathered per tile of rows   */
+
+struct txt_buf {
+    char * s;
+    size_t n, max;
+};
+
+/* A block of rows of one register, formatted by one thread. */
+struct txt_job {
+    struct databuf * ts;
+    struct databuf * tref;	/* Time register for the time column, or NULL */
+    struct txt_opts * opt;
+    int numchan;
+    long j0, j1;
+    struct txt_buf out;
+    char * tile;		/* Rows of samples, gathered */
+    size_t maxtile;
+    int err;
+};
+
+void txt_opts_init (struct txt_opts * opt)
 {
-  int i, j, k;
-  int numchan;
+  opt->style = TXT_PLAIN;
+  opt->utc_col = 0;
+  opt->time_reg = NULL;
+  opt->nthreads = 0;
+}
 
-  printf ("dump_timestreams: n=%d.\n", ds->nb);
-  for (i=0; i<ds->nb; i++)
+static int tb_reserve (struct txt_buf * b, size_t n)
+{
+  size_t max;
+  char * s;
+
+  if (b->n + n <= b->max)
+    return 0;
+  max = (b->max > 0) ? b->max : 4096;
+  while (max < b->n + n)
+    max *= 2;
+  s = realloc (b->s, max);
+  if (s == NULL)
+    return -1;
+  b->s = s;
+  b->max = max;
+
+  return 0;
+}
+
+static char * put_uint (char * p, uint64_t u)
+{
+  char tmp[24];
+  int n = 0;
+
+  do
   {
-    printf ("###\n");
-    printf ("%s %s %s\n", ds->buf[i].rb->map, ds->buf[i].rb->board, ds->buf[i].rb->regblock);
-    switch (ds->buf[i].rb->typeword & GCP_REG_TYPE)
-    {
-      case GCP_REG_UINT:
-        printf ("uint32\n");
-        break;
-      case GCP_REG_INT:
-        printf ("int32\n");
-        break;
-      case GCP_REG_UCHAR:
-        printf ("uint8\n");
-        break;
-      case GCP_REG_CHAR:
-        printf ("int8\n");
-        break;
-      case GCP_REG_FLOAT:
-        printf ("single\n");
-        break;
-      case GCP_REG_DOUBLE:
-        printf ("double\n");
-        break;
+    tmp[n++] = '0' + (u % 10);
+    u /= 10;
+  }
+  while (u > 0);
+  while (n > 0)
+    *p++ = tmp[--n];
 
-      /* Just treat UTC times as a UINT64, for now. */
-      case GCP_REG_UTC:
-        printf ("uint64\n");
-        break;
+  return p;
+}
+
+static char * put_int (char * p, int64_t x)
+{
+  if (x < 0)
+  {
+    *p++ = '-';
+    return put_uint (p, -(uint64_t)x);
+  }
+
+  return put_uint (p, x);
+}
+
+/* The fewest significant digits that read back as x.  */
+/* Anything of FLT_DIG (DBL_DIG) digits or fewer comes  */
+/* out the same at that precision, so start there.      */
+static char * put_shortest (char * p, double x, int single)
+{
+  int prec, maxprec, n;
+
+  if (isfinite (x) && (fabs (x) < 1e15) && (x == (double)(int64_t)x))
+    return put_int (p, (int64_t)x);
+  if (!isfinite (x))
+    return p + sprintf (p, "%g", x);
+
+  prec = single ? FLT_DIG : DBL_DIG;
+  maxprec = single ? 9 : 17;
+  for (;; prec++)
+  {
+    n = sprintf (p, "%.*g", prec, x);
+    if (prec >= maxprec)
+      break;
+    if (single ? (strtof (p, NULL) == (float)x) : (strtod (p, NULL) == x))
+      break;
+  }
+
+  return p + n;
+}
+
+/* Sample idx of buf, which holds samples of typeword. */
+static char * put_value (char * p, uint32_t typeword, const void * buf, long idx, int style)
+{
+  uint64_t u;
+  uint32_t u32;
+  int32_t i32;
+  float f;
+  double d;
 
-      default: 
-        printf ("Skipping register of type 0x%lx.\n", ds->buf[i].rb->typeword & GCP_REG_TYPE);
-        continue;
+  switch (typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_UINT:
+      memcpy (&u32, (const uint32_t *)buf + idx, 4);
+      return put_uint (p, u32);
+    case GCP_REG_INT:
+      memcpy (&i32, (const int32_t *)buf + idx, 4);
+      return put_int (p, i32);
+    case GCP_REG_UCHAR:
+      return put_uint (p, ((const uint8_t *)buf)[idx]);
+    case GCP_REG_CHAR:
+      if (style != TXT_PLAIN)
+        return put_int (p, ((const int8_t *)buf)[idx]);
+      *p++ = ((const char *)buf)[idx];
+      return p;
+    case GCP_REG_FLOAT:
+      memcpy (&f, (const float *)buf + idx, 4);
+      if (style != TXT_PLAIN)
+        return put_shortest (p, f, 1);
+      return p + snprintf (p, TXT_MAX_VALUE, "%f", f);
+    case GCP_REG_DOUBLE:
+      memcpy (&d, (const double *)buf + idx, 8);
+      if (style != TXT_PLAIN)
+        return put_shortest (p, d, 0);
+      return p + snprintf (p, TXT_MAX_VALUE, "%f", d);
+
+    /* Just treat UTC times as a UINT64, for now. */
+    case GCP_REG_UTC:
+      memcpy (&u, (const uint64_t *)buf + idx, 8);
+      return put_uint (p, u);
+  }
+
+  return p;
+}
+
+/* Unix time of a frame in ms. */
+static int64_t frame_time_ms (struct databuf * tref, long frame)
+{
+  uint32_t utc[2];
+
+  if (databuf_frame_utc (tref, frame, utc) != 0)
+    return 0;
+
+  return ((int64_t)utc[0] - MJD_UNIX_EPOCH) * 86400000 + utc[1];
+}
+
+/* Unix seconds, to the ms. */
+static char * put_time (char * p, int64_t ms)
+{
+  if (ms < 0)
+  {
+    *p++ = '-';
+    ms = -ms;
+  }
+  p = put_uint (p, ms / 1000);
+  *p++ = '.';
+  *p++ = '0' + (ms / 100) % 10;
+  *p++ = '0' + (ms / 10) % 10;
+  *p++ = '0' + ms % 10;
+
+  return p;
+}
+
+/* Bytes of each value put_value prints; complex registers */
+/* are printed a part at a time.                           */
+static size_t txt_elsize (uint32_t typeword)
+{
+  switch (typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_UCHAR:
+    case GCP_REG_CHAR:
+      return 1;
+    case GCP_REG_UINT:
+    case GCP_REG_INT:
+    case GCP_REG_FLOAT:
+      return 4;
+    case GCP_REG_DOUBLE:
+    case GCP_REG_UTC:
+      return 8;
+  }
+
+  return 0;
+}
+
+/* Copy rows j0 to j0+n-1 of every channel into the job's */
+/* tile, row by row, reading each channel in turn.  Only   */
+/* the real part of a complex sample is printed.           */
+static void gather_rows (struct txt_job * job, long j0, long n)
+{
+  struct databuf * ts = job->ts;
+  size_t el = txt_elsize (ts->rb->typeword);
+  size_t row = (size_t)job->numchan * el;
+  const char * src;
+  char * dst;
+  long j;
+  int k;
+
+  for (k=0; k<job->numchan; k++)
+  {
+    dst = job->tile + k * el;
+    if (ts->layout == LAYOUT_BY_CHANNEL)
+    {
+      src = databuf_sample (ts, k, j0);
+      for (j=0; j<n; j++, src+=ts->elsize, dst+=row)
+        memcpy (dst, src, el);
     }
-    if (ds->buf[i].chan.n == 0)
-      numchan = ds->buf[i].rb->nchan;
     else
-      numchan = ds->buf[i].chan.ntot;
-    printf ("%ld %ld\n", ds->buf[i].rb->spf * ds->buf[i].numframes, numchan);
-    for (j=0; j < (ds->buf[i].rb->spf * ds->buf[i].numframes); j++)
+      for (j=0; j<n; j++, dst+=row)
+        memcpy (dst, databuf_sample (ts, k, j0 + j), el);
+  }
+}
+
+static void format_rows (struct txt_job * job)
+{
+  struct databuf * ts = job->ts;
+  int style = job->opt->style;
+  char sep = (style == TXT_TSV) ? '\t' : ',';
+  size_t row = (size_t)job->numchan * txt_elsize (ts->rb->typeword);
+  long ntile, j0, n, j;
+  char * p;
+  int k;
+
+  ntile = (row > 0) ? TXT_TILE_BYTES / row : 1;
+  if (ntile < 1)
+    ntile = 1;
+  if (ntile * row > job->maxtile)
+  {
+    free (job->tile);
+    job->tile = malloc (ntile * row);
+    job->maxtile = (job->tile != NULL) ? ntile * row : 0;
+    if ((job->tile == NULL) && (row > 0))
+    {
+      job->err = 1;
+      return;
+    }
+  }
+
+  for (j0=job->j0; j0<job->j1; j0+=n)
+  {
+    n = (job->j1 - j0 > ntile) ? ntile : job->j1 - j0;
+    gather_rows (job, j0, n);
+    for (j=0; j<n; j++)
+    {
+      if (tb_reserve (&(job->out), (size_t)(job->numchan + 1) * (TXT_MAX_VALUE + 1) + 1) != 0)
+      {
+        job->err = 1;
+        return;
+      }
+      p = job->out.s + job->out.n;
+      if (job->tref != NULL)
+      {
+        p = put_time (p, frame_time_ms (job->tref, (j0 + j) / ts->spf));
+        *p++ = sep;
+      }
+      for (k=0; k<job->numchan; k++)
+      {
+        p = put_value (p, ts->rb->typeword, job->tile, j * job->numchan + k, style);
+        if (style == TXT_PLAIN)
+          *p++ = ' ';
+        else if (k < job->numchan - 1)
+          *p++ = sep;
+      }
+      *p++ = '\n';
+      job->out.n = p - job->out.s;
+    }
+  }
+}
+
+#if HAVE_PTHREAD
+static void * format_rows_thread (void * arg)
+{
+  format_rows ((struct txt_job *)arg);
+  return NULL;
+}
+#endif
+
+/* Format the rows of a register a round of blocks at a */
+/* time, one block per thread, writing each round out in */
+/* order before starting the next.                       */
+static int write_rows (FILE * f, struct databuf * ts, struct databuf * tref,
+    struct txt_opts * opt, int nthreads)
+{
+  struct txt_job job[TXT_MAX_THREADS];
+#if HAVE_PTHREAD
+  pthread_t tid[TXT_MAX_THREADS];
+  int started[TXT_MAX_THREADS];
+#endif
+  int numchan = databuf_nchan (ts);
+  long nrows = (long)ts->spf * ts->numframes;
+  long rows_per_job, j;
+  int t, n, r = 0;
+
+  rows_per_job = (numchan > 0) ? TXT_JOB_VALUES / numchan : nrows;
+  if (rows_per_job < 1)
+    rows_per_job = 1;
+  for (t=0; t<nthreads; t++)
+  {
+    job[t].ts = ts;
+    job[t].tref = tref;
+    job[t].opt = opt;
+    job[t].numchan = numchan;
+    job[t].out.s = NULL;
+    job[t].out.n = 0;
+    job[t].out.max = 0;
+    job[t].tile = NULL;
+    job[t].maxtile = 0;
+    job[t].err = 0;
+  }
+
+  j = 0;
+  while ((j < nrows) && (r == 0))
+  {
+    for (n=0; (n<nthreads) && (j<nrows); n++)
+    {
+      job[n].j0 = j;
+      job[n].j1 = (nrows - j > rows_per_job) ? j + rows_per_job : nrows;
+      job[n].out.n = 0;
+      j = job[n].j1;
+    }
+#if HAVE_PTHREAD
+    for (t=1; t<n; t++)
+      started[t] = (pthread_create (&(tid[t]), NULL, format_rows_thread, &(job[t])) == 0);
+    format_rows (&(job[0]));
+    for (t=1; t<n; t++)
     {
-      for (k=0; k < numchan; k++)
+      if (started[t])
+        pthread_join (tid[t], NULL);
+      else
+        format_rows (&(job[t]));
+    }
+#else
+    for (t=0; t<n; t++)
+      format_rows (&(job[t]));
+#endif
+    for (t=0; t<n; t++)
+    {
+      if (job[t].err)
       {
-        switch (ds->buf[i].rb->typeword & GCP_REG_TYPE)
-        {
-          case GCP_REG_UINT:
-            printf("%u ", *(j + k*ds->buf[i].rb->spf*ds->buf[i].numframes + (unsigned int *)ds->buf[i].buf));
-            break;
-          case GCP_REG_INT:
-            printf("%d ", *(j + k*ds->buf[i].rb->spf*ds->buf[i].numframes + (int *)ds->buf[i].buf));
-            break;
-          case GCP_REG_UCHAR:
-            printf("%hhu ", *(j + k*ds->buf[i].rb->spf*ds->buf[i].numframes + (unsigned char *)ds->buf[i].buf));
-            break;
-          case GCP_REG_CHAR:
-            printf("%c ", *(j + k*ds->buf[i].rb->spf*ds->buf[i].numframes + (char *)ds->buf[i].buf));
-            break;
-          case GCP_REG_FLOAT:
-            printf("%f ", *(j + k*ds->buf[i].rb->spf*ds->buf[i].numframes + (float *)ds->buf[i].buf));
-            break;
-          case GCP_REG_DOUBLE:
-            printf("%lf ", *(j + k*ds->buf[i].rb->spf*ds->buf[i].numframes + (double *)ds->buf[i].buf));
-            break;
-
-          /* Just treat UTC times as a UINT64, for now. */
-          case GCP_REG_UTC:
-            printf("%llu ", *(j + k*ds->buf[i].rb->spf*ds->buf[i].numframes + (long long int *)ds->buf[i].buf));
-            break;
-        }
+        fprintf (stderr, "Out of memory formatting %s.%s.%s.\n",
+          rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb));
+        r = -1;
+        break;
       }
-      printf ("\n");
+      if (fwrite (job[t].out.s, 1, job[t].out.n, f) != job[t].out.n)
+      {
+        r = -1;
+        break;
+      }
+    }
+  }
+
+  for (t=0; t<nthreads; t++)
+  {
+    free (job[t].out.s);
+    free (job[t].tile);
+  }
+
+  return r;
+}
+
+/* Name of a register's type, or NULL if we can't print it. */
+static const char * txt_type_name (uint32_t typeword)
+{
+  switch (typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_UINT:   return "uint32";
+    case GCP_REG_INT:    return "int32";
+    case GCP_REG_UCHAR:  return "uint8";
+    case GCP_REG_CHAR:   return "int8";
+    case GCP_REG_FLOAT:  return "single";
+    case GCP_REG_DOUBLE: return "double";
+
+    /* Just treat UTC times as a UINT64, for now. */
+    case GCP_REG_UTC:    return "uint64";
+  }
+
+  return NULL;
+}
+
+/* The register a time column comes from: the one named, */
+/* or else the first UTC register read.                  */
+static struct databuf * find_time_reg (struct dataset * ds, char * name)
+{
+  struct databuf * ts;
+  int i;
+
+  for (i=0; i<ds->nb; i++)
+  {
+    ts = (name != NULL) ? dataset_find (ds, name) : &(ds->buf[i]);
+    if ((ts != NULL) && ((ts->in_typeword & GCP_REG_TYPE) == GCP_REG_UTC)
+        && !(ts->in_typeword & GCP_REG_COMPLEX) && (ts->bufsize > 0))
+      return ts;
+    if (name != NULL)
+      break;
+  }
+
+  return NULL;
+}
+
+static int output_plain (struct dataset * ds, struct txt_opts * opt, FILE * f, int nthreads)
+{
+  const char * type;
+  int i, r;
+
+  fprintf (f, "dump_timestreams: n=%d.\n", ds->nb);
+  for (i=0; i<ds->nb; i++)
+  {
+    fprintf (f, "###\n");
+    fprintf (f, "%s %s %s\n", rb_map (ds->buf[i].rb), rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+    type = txt_type_name (ds->buf[i].rb->typeword);
+    if (type == NULL)
+    {
+      fprintf (f, "Skipping register of type 0x%lx.\n", (unsigned long)(ds->buf[i].rb->typeword & GCP_REG_TYPE));
+      continue;
+    }
+    fprintf (f, "%s\n", type);
+    fprintf (f, "%ld %d\n", (long)ds->buf[i].spf * ds->buf[i].numframes, databuf_nchan (&(ds->buf[i])));
+    r = write_rows (f, &(ds->buf[i]), NULL, opt, nthreads);
+    if (r != 0)
+      return r;
+    fprintf (f, "\n\n");
+  }
+
+  return 0;
+}
+
+/* A table per register: a header row naming the columns, */
+/* then a row per sample.  Tables are split by blank lines. */
+static int output_table (struct dataset * ds, struct txt_opts * opt, FILE * f, int nthreads)
+{
+  struct databuf * tref = NULL;
+  struct databuf * ts;
+  char sep = (opt->style == TXT_TSV) ? '\t' : ',';
+  int i, k, r, ntab = 0;
+
+  if (opt->utc_col)
+  {
+    tref = find_time_reg (ds, opt->time_reg);
+    if (tref == NULL)
+    {
+      fprintf (stderr, "No UTC register %s to time rows by.\n", opt->time_reg ? opt->time_reg : "");
+      return -1;
     }
-    printf ("\n\n");
   }
+
+  for (i=0; i<ds->nb; i++)
+  {
+    ts = &(ds->buf[i]);
+    if ((ts->bufsize == 0) || (txt_type_name (ts->rb->typeword) == NULL))
+      continue;
+    if (ntab++ > 0)
+      fputc ('\n', f);
+    if (tref != NULL)
+      fprintf (f, "utc%c", sep);
+    for (k=0; k<databuf_nchan (ts); k++)
+      fprintf (f, "%s.%s.%s[%d]%c", rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb),
+        k, (k < databuf_nchan (ts) - 1) ? sep : '\n');
+    r = write_rows (f, ts, tref, opt, nthreads);
+    if (r != 0)
+      return r;
+  }
+
   return 0;
 }
 
+int output_txt_opts (struct dataset * ds, struct txt_opts * opt, FILE * f)
+{
+  int nthreads = opt->nthreads;
+
+  if (nthreads <= 0)
+    nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+#if !HAVE_PTHREAD
+  nthreads = 1;
+#endif
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > TXT_MAX_THREADS)
+    nthreads = TXT_MAX_THREADS;
+  DEBUG ("output_txt: formatting on %d threads.\n", nthreads);
+
+  if (opt->style == TXT_PLAIN)
+    return output_plain (ds, opt, f, nthreads);
+
+  return output_table (ds, opt, f, nthreads);
+}
+
+int output_txt (struct dataset * ds)
+{
+  struct txt_opts opt;
+
+  txt_opts_init (&opt);
+  fflush (stdout);
+
+  return output_txt_opts (ds, &opt, stdout);
+}
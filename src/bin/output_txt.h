@@ -1,3 +1,17 @@
 #include <stdlib.h>
+#include <stdio.h>
 
+#define TXT_PLAIN 0	/* A block per register, as arc2txt has always written */
+#define TXT_CSV   1	/* A table per register, with a header row */
+#define TXT_TSV   2
+
+struct txt_opts {
+    int style;			/* TXT_PLAIN, TXT_CSV or TXT_TSV      */
+    int utc_col;		/* Lead tables with each row's frame time */
+    char * time_reg;		/* map.board.reg to take it from, or NULL */
+    int nthreads;		/* Formatting threads, 0 for one per CPU */
+};
+
+void txt_opts_init (struct txt_opts * opt);
 int output_txt (struct dataset * ds);
+int output_txt_opts (struct dataset * ds, struct txt_opts * opt, FILE * f);
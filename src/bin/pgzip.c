@@ -0,0 +1,269 @@
+/*
+ * pgzip - write a gzip file, deflating it in blocks
+ *         on several threads.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "pgzip.h"
+
+#if HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
+#define DEBUG_PGZIP 0
+
+#if DEBUG_PGZIP == 1
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(args...)
+#endif
+
+static void put_le32 (unsigned char * p, uint32_t x)
+{
+  p[0] = x & 0xFF;
+  p[1] = (x >> 8) & 0xFF;
+  p[2] = (x >> 16) & 0xFF;
+  p[3] = (x >> 24) & 0xFF;
+}
+
+int pgzip_open (struct pgzip * pg, const char * fname, int level, int nthreads)
+{
+  /* No name, no time, OS Unix. */
+  static const unsigned char head[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+  int t;
+
+  if (nthreads <= 0)
+    nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+#if !HAVE_PTHREAD
+  nthreads = 1;
+#endif
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > PGZIP_MAX_THREADS)
+    nthreads = PGZIP_MAX_THREADS;
+
+  pg->level = level;
+  pg->nthreads = nthreads;
+  pg->nin = 0;
+  pg->ndict = 0;
+  pg->crc = crc32 (0L, Z_NULL, 0);
+  pg->isize = 0;
+  for (t=0; t<PGZIP_MAX_THREADS; t++)
+  {
+    pg->blk[t].out = NULL;
+    pg->blk[t].maxout = 0;
+  }
+  pg->in = malloc ((size_t)nthreads * PGZIP_BLOCK);
+  if (pg->in == NULL)
+  {
+    pg->f = NULL;
+    return -1;
+  }
+  pg->f = fopen (fname, "wb");
+  if (pg->f == NULL)
+  {
+    free (pg->in);
+    pg->in = NULL;
+    return -1;
+  }
+  DEBUG ("pgzip: writing %s on %d threads.\n", fname, nthreads);
+
+  if (fwrite (head, 1, sizeof (head), pg->f) != sizeof (head))
+  {
+    fclose (pg->f);
+    pg->f = NULL;
+    free (pg->in);
+    pg->in = NULL;
+    for (t=0; t<PGZIP_MAX_THREADS; t++)
+    {
+      free (pg->blk[t].out);
+      pg->blk[t].out = NULL;
+    }
+    return -1;
+  }
+
+  return 0;
+}
+
+static void deflate_block (struct pgzip_block * b)
+{
+  z_stream z;
+  size_t need;
+  int r;
+
+  b->err = 0;
+  b->nout = 0;
+  memset (&z, 0, sizeof (z));
+  if (deflateInit2 (&z, b->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    b->err = 1;
+    return;
+  }
+  if ((b->ndict > 0) && (deflateSetDictionary (&z, b->dict, b->ndict) != Z_OK))
+    b->err = 1;
+
+  /* Room for the worst case, and the empty stored */
+  /* block a sync flush ends with.                 */
+  need = deflateBound (&z, b->nin) + 64;
+  if (need > b->maxout)
+  {
+    free (b->out);
+    b->out = malloc (need);
+    b->maxout = (b->out != NULL) ? need : 0;
+    if (b->out == NULL)
+      b->err = 1;
+  }
+
+  if (!b->err)
+  {
+    z.next_in = b->in;
+    z.avail_in = b->nin;
+    z.next_out = b->out;
+    z.avail_out = b->maxout;
+    r = deflate (&z, b->last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((r != (b->last ? Z_STREAM_END : Z_OK)) || (z.avail_in != 0))
+      b->err = 1;
+    b->nout = b->maxout - z.avail_out;
+  }
+  deflateEnd (&z);
+
+  b->crc = crc32 (crc32 (0L, Z_NULL, 0), b->in, b->nin);
+}
+
+#if HAVE_PTHREAD
+static void * deflate_block_thread (void * arg)
+{
+  deflate_block ((struct pgzip_block *)arg);
+  return NULL;
+}
+#endif
+
+/* Deflate the round of input gathered so far, a block per */
+/* thread, and write the blocks out in order.              */
+static int pgzip_flush (struct pgzip * pg, int last)
+{
+#if HAVE_PTHREAD
+  pthread_t tid[PGZIP_MAX_THREADS];
+  int started[PGZIP_MAX_THREADS];
+#endif
+  struct pgzip_block * b;
+  int t, n, r = 0;
+
+  n = (pg->nin + PGZIP_BLOCK - 1) / PGZIP_BLOCK;
+  if (n == 0)
+  {
+    if (!last)
+      return 0;
+    n = 1;
+  }
+  for (t=0; t<n; t++)
+  {
+    b = &(pg->blk[t]);
+    b->in = pg->in + (size_t)t * PGZIP_BLOCK;
+    b->nin = (pg->nin - (size_t)t * PGZIP_BLOCK > PGZIP_BLOCK) ? PGZIP_BLOCK : pg->nin - (size_t)t * PGZIP_BLOCK;
+    if (t == 0)
+    {
+      b->dict = pg->dict;
+      b->ndict = pg->ndict;
+    }
+    else
+    {
+      b->dict = b->in - PGZIP_DICT;
+      b->ndict = PGZIP_DICT;
+    }
+    b->level = pg->level;
+    b->last = last && (t == n - 1);
+  }
+
+#if HAVE_PTHREAD
+  for (t=1; t<n; t++)
+    started[t] = (pthread_create (&(tid[t]), NULL, deflate_block_thread, &(pg->blk[t])) == 0);
+  deflate_block (&(pg->blk[0]));
+  for (t=1; t<n; t++)
+  {
+    if (started[t])
+      pthread_join (tid[t], NULL);
+    else
+      deflate_block (&(pg->blk[t]));
+  }
+#else
+  for (t=0; t<n; t++)
+    deflate_block (&(pg->blk[t]));
+#endif
+
+  for (t=0; t<n; t++)
+  {
+    b = &(pg->blk[t]);
+    if (b->err || (fwrite (b->out, 1, b->nout, pg->f) != b->nout))
+    {
+      r = -1;
+      break;
+    }
+    pg->crc = crc32_combine (pg->crc, b->crc, b->nin);
+    pg->isize += b->nin;
+  }
+
+  /* A full round is always longer than the dictionary. */
+  if (pg->nin >= PGZIP_DICT)
+  {
+    memcpy (pg->dict, pg->in + pg->nin - PGZIP_DICT, PGZIP_DICT);
+    pg->ndict = PGZIP_DICT;
+  }
+  pg->nin = 0;
+
+  return r;
+}
+
+int pgzip_write (struct pgzip * pg, const void * buf, size_t n)
+{
+  size_t max = (size_t)pg->nthreads * PGZIP_BLOCK;
+  size_t k;
+
+  while (n > 0)
+  {
+    /* Only deflate a full round once there's more to */
+    /* come, so that the last block is always known.  */
+    if ((pg->nin == max) && (pgzip_flush (pg, 0) != 0))
+      return -1;
+    k = max - pg->nin;
+    if (k > n)
+      k = n;
+    memcpy (pg->in + pg->nin, buf, k);
+    pg->nin += k;
+    buf = (const char *)buf + k;
+    n -= k;
+  }
+
+  return 0;
+}
+
+int pgzip_close (struct pgzip * pg)
+{
+  unsigned char tail[8];
+  int t, r;
+
+  r = pgzip_flush (pg, 1);
+  put_le32 (tail, pg->crc);
+  put_le32 (tail + 4, pg->isize);
+  if (fwrite (tail, 1, sizeof (tail), pg->f) != sizeof (tail))
+    r = -1;
+  if (fclose (pg->f) != 0)
+    r = -1;
+  pg->f = NULL;
+
+  free (pg->in);
+  pg->in = NULL;
+  for (t=0; t<PGZIP_MAX_THREADS; t++)
+  {
+    free (pg->blk[t].out);
+    pg->blk[t].out = NULL;
+    pg->blk[t].maxout = 0;
+  }
+
+  return r;
+}
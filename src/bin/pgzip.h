@@ -0,0 +1,52 @@
+/*
+ * pgzip.h - write a gzip file, deflating it in blocks
+ *           on several threads.
+ *
+ */
+
+#ifndef ARCFILE_PGZIP_H_
+#define ARCFILE_PGZIP_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#define PGZIP_BLOCK		(128 * 1024)	/* Input deflated per block   */
+#define PGZIP_DICT		(32 * 1024)	/* Input before a block it may refer to */
+#define PGZIP_MAX_THREADS	64
+
+struct pgzip_block {
+    unsigned char * in;
+    size_t nin;
+    unsigned char * dict;
+    size_t ndict;
+    unsigned char * out;
+    size_t nout, maxout;
+    uint32_t crc;
+    int level;
+    int last;
+    int err;
+};
+
+/* Input is gathered a round of nthreads blocks at a time.  */
+/* Each block is a raw deflate stream ending on a byte, with */
+/* the block before it as its dictionary, so that they join  */
+/* into one stream that compresses as well as a single one.  */
+struct pgzip {
+    FILE * f;
+    int level;
+    int nthreads;
+    unsigned char * in;
+    size_t nin;
+    unsigned char dict[PGZIP_DICT];
+    size_t ndict;
+    struct pgzip_block blk[PGZIP_MAX_THREADS];
+    uint32_t crc;
+    uint32_t isize;
+};
+
+int pgzip_open (struct pgzip * pg, const char * fname, int level, int nthreads);
+int pgzip_write (struct pgzip * pg, const void * buf, size_t n);
+int pgzip_close (struct pgzip * pg);
+
+#endif
@@ -6,21 +6,215 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "tarfile.h"
 
+#if HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
+#define TARFILE_MAX_THREADS 64
+
 char record_header[512];
 
+/* Write to the tar stream, plain or gzipped. */
+static int tar_write (struct tarfile * tf, const void * buf, size_t n)
+{
+  if (tf->type == TARFILE_TGZ)
+    return pgzip_write (&(tf->g), buf, n);
+  if (fwrite (buf, sizeof(char), n, tf->f) != n)
+    return -1;
+
+  return 0;
+}
+
+/* Pad a member of n bytes out to a whole record. */
+static int tar_pad (struct tarfile * tf, size_t n)
+{
+  static const char zeros[512];
+
+  if (n % 512 == 0)
+    return 0;
+
+  return tar_write (tf, zeros, 512 - n % 512);
+}
+
+static int tar_queue (struct tarfile * tf, const char * fname, const char * buf, size_t n, int owned, int append)
+{
+  struct tar_member * q;
+
+  if (tf->nqueue == tf->maxqueue)
+  {
+    q = realloc (tf->queue, (tf->maxqueue + 256) * sizeof (struct tar_member));
+    if (q == NULL)
+      return -1;
+    tf->queue = q;
+    tf->maxqueue += 256;
+  }
+  q = &(tf->queue[tf->nqueue]);
+  q->name = strdup (fname);
+  q->buf = buf;
+  q->n = n;
+  q->owned = owned;
+  q->append = append;
+  tf->nqueue++;
+
+  return 0;
+}
+
+/* Files of a directory are handed out in turn to a pool */
+/* of threads, and each written with one open, fallocate  */
+/* and pwrite; none is synced.                            */
+struct tar_pool {
+  struct tarfile * tf;
+  int next;
+  int nerr;
+#if HAVE_PTHREAD
+  pthread_mutex_t lock;
+#endif
+};
+
+static int write_member (const char * dir, struct tar_member * m)
+{
+  struct stat st;
+  char * path;
+  size_t off = 0;
+  off_t end = 0;
+  ssize_t w;
+  int fd;
+
+  path = malloc (strlen (dir) + strlen (m->name) + 2);
+  if (path == NULL)
+    return -1;
+  sprintf (path, "%s/%s", dir, m->name);
+  fd = open (path, O_WRONLY | O_CREAT | (m->append ? 0 : O_TRUNC), 0644);
+  if (fd < 0)
+  {
+    printf ("Could not create %s.\n", path);
+    free (path);
+    return -1;
+  }
+  free (path);
+  if (m->append && (fstat (fd, &st) == 0))
+    end = st.st_size;
+
+  /* Only a hint; not every filesystem can. */
+  if (m->n > 0)
+    posix_fallocate (fd, end, m->n);
+  while (off < m->n)
+  {
+    w = pwrite (fd, m->buf + off, m->n - off, end + off);
+    if (w < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    off += w;
+  }
+  if ((close (fd) != 0) || (off < m->n))
+  {
+    printf ("Error writing %s/%s.\n", dir, m->name);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void * write_members (void * arg)
+{
+  struct tar_pool * pool = arg;
+  int i, nerr = 0;
+
+  while (1)
+  {
+#if HAVE_PTHREAD
+    pthread_mutex_lock (&(pool->lock));
+#endif
+    i = pool->next++;
+#if HAVE_PTHREAD
+    pthread_mutex_unlock (&(pool->lock));
+#endif
+    if (i >= pool->tf->nqueue)
+      break;
+    if (write_member (pool->tf->fname, &(pool->tf->queue[i])) != 0)
+      nerr++;
+  }
+#if HAVE_PTHREAD
+  pthread_mutex_lock (&(pool->lock));
+#endif
+  pool->nerr += nerr;
+#if HAVE_PTHREAD
+  pthread_mutex_unlock (&(pool->lock));
+#endif
+
+  return NULL;
+}
+
+static int write_queue (struct tarfile * tf)
+{
+  struct tar_pool pool;
+#if HAVE_PTHREAD
+  pthread_t tid[TARFILE_MAX_THREADS];
+  int started[TARFILE_MAX_THREADS];
+#endif
+  int nthreads = 1;
+  int t;
+
+  pool.tf = tf;
+  pool.next = 0;
+  pool.nerr = 0;
+#if HAVE_PTHREAD
+  pthread_mutex_init (&(pool.lock), NULL);
+  nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (nthreads > tf->nqueue)
+    nthreads = tf->nqueue;
+  if (nthreads > TARFILE_MAX_THREADS)
+    nthreads = TARFILE_MAX_THREADS;
+  for (t=1; t<nthreads; t++)
+    started[t] = (pthread_create (&(tid[t]), NULL, write_members, &pool) == 0);
+  write_members (&pool);
+  for (t=1; t<nthreads; t++)
+    if (started[t])
+      pthread_join (tid[t], NULL);
+  pthread_mutex_destroy (&(pool.lock));
+#else
+  write_members (&pool);
+#endif
+
+  for (t=0; t<tf->nqueue; t++)
+  {
+    free (tf->queue[t].name);
+    if (tf->queue[t].owned)
+      free ((char *)tf->queue[t].buf);
+  }
+  free (tf->queue);
+  tf->queue = NULL;
+  tf->nqueue = 0;
+  tf->maxqueue = 0;
+
+  return (pool.nerr > 0) ? -1 : 0;
+}
+
 int tarfile_open (struct tarfile * tf, const char * fname, int type)
 {
   tf->f = NULL;
-  tf->g = NULL;
   tf->type = type;
   tf->username = NULL;
   tf->groupname = NULL;
   tf->uid = 0;
   tf->gid = 0;
   tf->fname = NULL;
+  tf->txt = NULL;
+  tf->maxtxt = 0;
+  tf->queue = NULL;
+  tf->nqueue = 0;
+  tf->maxqueue = 0;
 
   if (type == TARFILE_TAR)
   {
@@ -28,12 +222,21 @@ int tarfile_open (struct tarfile * tf, const char * fname, int type)
   }
   else if (type == TARFILE_TGZ)
   {
-    tf->g = gzopen (fname, "wb");
+    /* Deflate on one thread per CPU. */
+    if (pgzip_open (&(tf->g), fname, Z_DEFAULT_COMPRESSION, 0) != 0)
+    {
+      printf ("Could not open %s.\n", fname);
+      return -1;
+    }
   }
-  else if (type == TARFILE_NOTAR)
+  else if ((type == TARFILE_NOTAR) || (type == TARFILE_APPEND))
   {
-    tf->fname = malloc (strlen(fname)+1);
-    strncpy(tf->fname, fname, strlen(fname));
+    tf->fname = strdup (fname);
+    if ((mkdir (fname, 0755) != 0) && (errno != EEXIST))
+    {
+      printf ("Could not create directory %s.\n", fname);
+      return -1;
+    }
   }
   else
   {
@@ -46,6 +249,13 @@ int tarfile_open (struct tarfile * tf, const char * fname, int type)
 
 int tarfile_close (struct tarfile * tf)
 {
+  int r = 0;
+
+  /* Text started but never stopped is dropped. */
+  free (tf->txt);
+  tf->txt = NULL;
+  tf->maxtxt = 0;
+
   for (int i=0; i<512; i++)
     record_header[i] = 0;
 
@@ -58,13 +268,16 @@ int tarfile_close (struct tarfile * tf)
   }
   else if (tf->type == TARFILE_TGZ)
   {
-    gzwrite (tf->g, record_header, 512);
-    gzwrite (tf->g, record_header, 512);
-    gzclose (tf->g);
-    tf->g = NULL;
+    pgzip_write (&(tf->g), record_header, 512);
+    pgzip_write (&(tf->g), record_header, 512);
+    if (pgzip_close (&(tf->g)) != 0)
+      printf ("Error writing compressed tarball.\n");
   }
-  else if (tf->type == TARFILE_NOTAR)
+  else if ((tf->type == TARFILE_NOTAR) || (tf->type == TARFILE_APPEND))
   {
+    r = write_queue (tf);
+    free (tf->fname);
+    tf->fname = NULL;
   }
   else
   {
@@ -72,7 +285,7 @@ int tarfile_close (struct tarfile * tf)
     return -1;
   }
 
-  return 0;
+  return r;
 }
 
 int tarfile_set_user (struct tarfile * tf, const char * username, int uid, const char * groupname, int gid)
@@ -114,7 +327,7 @@ int fill_in_header (struct tarfile * tf, const char * fname)
   sprintf(record_header+116,"%06o ",tf->gid);
 
   /* File size */
-  sprintf(record_header+124,"%011o ",tf->n);
+  sprintf(record_header+124,"%011o ",(unsigned int)tf->n);
 
   /* Modification time */
   sprintf(record_header+136,"%011o ",time(NULL));
@@ -145,31 +358,19 @@ int fill_in_header (struct tarfile * tf, const char * fname)
   /* No good reason why */
   chk += 64;
   chk %= 01000000;
-  sprintf(record_header+148,"%06o%c 0",chk);
+  sprintf(record_header+148,"%06o%c 0",chk,0);
 
   return 0;
 }
 
-int tarfile_start_txt (struct tarfile * tf, const char * fname)
+int tarfile_start_txt (struct tarfile * tf)
 {
   tf->n = 0;
-  if (tf->type == TARFILE_TAR)
+  if ((tf->type == TARFILE_TAR) || (tf->type == TARFILE_TGZ) || (tf->type == TARFILE_NOTAR)
+      || (tf->type == TARFILE_APPEND))
   {
-    fill_in_header (tf, fname);
-    fgetpos (tf->f, &(tf->record_start));
-    fwrite (record_header,sizeof(char),512,tf->f);
-  }
-  else if (tf->type == TARFILE_TGZ)
-  {
-    fill_in_header (tf, fname);
-    tf->gz_record_start = gztell (tf->g);
-    gzwrite (tf->g,record_header,512);
-  } 
-  else if (tf->type == TARFILE_NOTAR)
-  {
-    char tmp[256];
-    snprintf(tmp,255,"%s/%s",tf->fname,fname);
-    tf->f=fopen(tmp,"wt");
+    /* Kept in memory until stopped: the header needs the */
+    /* size, and a directory gets it in one write.        */
   }
   else
   {
@@ -182,40 +383,22 @@ int tarfile_start_txt (struct tarfile * tf, const char * fname)
 
 int tarfile_stop_txt (struct tarfile * tf, const char * fname)
 {
-  if (tf->type == TARFILE_TAR)
-  {
-    fpos_t record_end;
-    int nzero = 512 - ((tf->n + 511) % 512) - 1;
-    while (nzero > 0)
-    {
-      fputc (0, tf->f);
-      nzero--;
-    }
-    fgetpos (tf->f, &(record_end));
-    fill_in_header (tf, fname);
-    fsetpos (tf->f, &(tf->record_start));
-    fwrite (record_header,sizeof(char),512,tf->f);
-    fsetpos (tf->f, &(record_end));
-  }
-  else if (tf->type == TARFILE_TGZ)
+  if ((tf->type == TARFILE_TAR) || (tf->type == TARFILE_TGZ))
   {
-    z_off_t gz_record_end;
-    int nzero = 512 - ((tf->n + 1) % 512) + 1;
-    while (nzero > 0)
-    {
-      gzputc (tf->g, 0);
-      nzero--;
-    }
-    gz_record_end = gztell (tf->g);
     fill_in_header (tf, fname);
-    gzseek (tf->g, tf->gz_record_start, SEEK_SET);
-    gzwrite (tf->g,record_header,512);
-    gzseek (tf->g, gz_record_end, SEEK_SET);
+    tar_write (tf, record_header, 512);
+    tar_write (tf, tf->txt, tf->n);
+    tar_pad (tf, tf->n);
+    free (tf->txt);
+    tf->txt = NULL;
+    tf->maxtxt = 0;
   }
-  else if (tf->type == TARFILE_NOTAR)
+  else if ((tf->type == TARFILE_NOTAR) || (tf->type == TARFILE_APPEND))
   {
-    fclose (tf->f);
-    tf->f = NULL;
+    if (tar_queue (tf, fname, tf->txt, tf->n, 1, 0) != 0)
+      return -1;
+    tf->txt = NULL;
+    tf->maxtxt = 0;
   }
   else
   {
@@ -229,38 +412,19 @@ int tarfile_stop_txt (struct tarfile * tf, const char * fname)
 
 int tarfile_binary (struct tarfile * tf, const char * fname, int numbytes, char * buf)
 {
-  int nzero = 512 - ((numbytes + 511) % 512) - 1;
-
   tf->n = numbytes;
   fill_in_header (tf, fname);
-  if (tf->type == TARFILE_TAR)
-  {
-    fwrite (record_header,sizeof(char),512,tf->f);
-    fwrite (buf,sizeof(char),numbytes,tf->f);
-    while (nzero > 0)
-    {
-      fputc (0, tf->f);
-      nzero--;
-    }
-  }
-  else if (tf->type == TARFILE_TGZ)
+  if ((tf->type == TARFILE_TAR) || (tf->type == TARFILE_TGZ))
   {
-    gzwrite (tf->g,record_header,512);
-    gzwrite (tf->g,buf,numbytes);
-    while (nzero > 0)
-    {
-      gzputc (tf->g, 0);
-      nzero--;
-    }
+    tar_write (tf, record_header, 512);
+    tar_write (tf, buf, numbytes);
+    tar_pad (tf, numbytes);
   }
-  else if (tf->type == TARFILE_NOTAR)
+  else if ((tf->type == TARFILE_NOTAR) || (tf->type == TARFILE_APPEND))
   {
-    char tmp[256];
-    snprintf(tmp,255,"%s/%s",tf->fname,fname);
-    tf->f=fopen(tmp,"wb");
-    fwrite (buf,sizeof(char),numbytes,tf->f);
-    fclose(tf->f);
-    tf->f=NULL;
+    /* buf is written from where it is, at tarfile_close. */
+    if (tar_queue (tf, fname, buf, numbytes, 0, tf->type == TARFILE_APPEND) != 0)
+      return -1;
   }
   else
   {
@@ -271,3 +435,33 @@ int tarfile_binary (struct tarfile * tf, const char * fname, int numbytes, char
   return 0;
 }
 
+int tarfile_printf (struct tarfile * tf, const char * fmt, ...)
+{
+  va_list ap;
+  size_t max;
+  char * txt;
+  int n;
+
+  va_start (ap, fmt);
+  n = vsnprintf (NULL, 0, fmt, ap);
+  va_end (ap);
+  if (n < 0)
+    return n;
+  if (tf->n + n + 1 > tf->maxtxt)
+  {
+    max = (tf->maxtxt > 0) ? tf->maxtxt : 4096;
+    while (max < tf->n + n + 1)
+      max *= 2;
+    txt = realloc (tf->txt, max);
+    if (txt == NULL)
+      return -1;
+    tf->txt = txt;
+    tf->maxtxt = max;
+  }
+  va_start (ap, fmt);
+  vsnprintf (tf->txt + tf->n, n + 1, fmt, ap);
+  va_end (ap);
+  tf->n += n;
+
+  return n;
+}
@@ -1,29 +1,45 @@
 #include <stdlib.h>
-#include <zlib.h>
+#include <stdio.h>
+#include "pgzip.h"
 
 #define TARFILE_NOTAR   0
 #define TARFILE_TAR     1
 #define TARFILE_TGZ     2
+#define TARFILE_APPEND  3	/* A directory, adding to its files */
+
+/* A file waiting to be written into a directory. */
+struct tar_member {
+  char * name;
+  const char * buf;
+  size_t n;
+  int owned;			/* buf is ours to free */
+  int append;			/* Add to the end of the file */
+};
 
 struct tarfile {
   int type;
   FILE * f;
-  gzFile * g;
+  struct pgzip g;
   char * fname;
   char * username;
   char * groupname;
   int uid;
   int gid;
-  fpos_t record_start;
-  z_off_t gz_record_start;
-  int n;
+  char * txt;			/* Text file being written, kept until */
+  size_t maxtxt;		/* its size is known for the header    */
+  size_t n;
+  struct tar_member * queue;	/* Files for a directory, written all */
+  int nqueue, maxqueue;		/* at once by tarfile_close           */
 };
 
 int tarfile_open (struct tarfile * tf, const char * fname, int type);
 int tarfile_close (struct tarfile * tf);
 int tarfile_set_user (struct tarfile * tf, const char * username, int uid, const char * groupname, int gid);
-int tarfile_start_txt (struct tarfile * tf, const char * fname);
+int tarfile_start_txt (struct tarfile * tf);
 int tarfile_stop_txt (struct tarfile * tf, const char * fname);
+/* Into a directory, buf is written by tarfile_close, so */
+/* it has to last until then.                           */
 int tarfile_binary (struct tarfile * tf, const char * fname, int numbytes, char * buf);
+int tarfile_printf (struct tarfile * tf, const char * fmt, ...);
 
-#define tfprintf(a,...) if (a->type==TARFILE_TGZ) a->n+=gzprintf(a->g,__VA_ARGS__); else a->n+=fprintf(a->f,__VA_ARGS__)
+#define tfprintf(a,...) tarfile_printf(a,__VA_ARGS__)
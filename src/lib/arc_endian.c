@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include "arc_endian.h"
 
 #define MAGIC_WORD *(uint32_t  *)"abcd"
 #define BACKWARDS_WORD *(uint32_t *)"dcba"
@@ -28,40 +30,82 @@ int check_endianness ()
     else return -1;
 }
 
-void swap_8 (void * s)
-{
-    char tmp;
-    tmp = *((char *) s + 0);
-    *((char *) s + 0) = *((char *) s + 7);
-    *((char *) s + 7) = tmp;
-    tmp = *((char *) s + 1);
-    *((char *) s + 1) = *((char *) s + 6);
-    *((char *) s + 6) = tmp;
-    tmp = *((char *) s + 2);
-    *((char *) s + 2) = *((char *) s + 5);
-    *((char *) s + 5) = tmp;
-    tmp = *((char *) s + 3);
-    *((char *) s + 3) = *((char *) s + 4);
-    *((char *) s + 4) = tmp;
-}
+#if defined (__SSSE3__)
+#include <tmmintrin.h>
 
-void swap_4 (void * s)
+/* Reverse the bytes of each size-byte word, 16 bytes at a */
+/* time.  Returns the number of words done.                */
+static int swap_copy_ssse3 (void * tgt, const void * src, int n, int size)
 {
-    char tmp;
-    tmp = *((char *) s + 0);
-    *((char *) s + 0) = *((char *) s + 3);
-    *((char *) s + 3) = tmp;
-    tmp = *((char *) s + 1);
-    *((char *) s + 1) = *((char *) s + 2);
-    *((char *) s + 2) = tmp;
-}
+  __m128i mask, x;
+  int k, nbytes;
 
-void swap_2 (void * s)
-{
-    char tmp;
-    tmp = *((char *) s + 0);
-    *((char *) s + 0) = *((char *) s + 1);
-    *((char *) s + 1) = tmp;
+  switch (size)
+  {
+    case 2: mask = _mm_set_epi8 (14,15,12,13,10,11,8,9,6,7,4,5,2,3,0,1); break;
+    case 4: mask = _mm_set_epi8 (12,13,14,15,8,9,10,11,4,5,6,7,0,1,2,3); break;
+    case 8: mask = _mm_set_epi8 (8,9,10,11,12,13,14,15,0,1,2,3,4,5,6,7); break;
+    default: return 0;
+  }
+  nbytes = (n * size) & ~15;
+  for (k=0; k<nbytes; k+=16)
+  {
+    x = _mm_loadu_si128 ((const __m128i *)(src + k));
+    _mm_storeu_si128 ((__m128i *)(tgt + k), _mm_shuffle_epi8 (x, mask));
+  }
+
+  return nbytes / size;
 }
+#endif
 
+/* Copy n words of size bytes, swapping each.  tgt may be */
+/* src.  With SSSE3 whole vectors are swapped with one    */
+/* byte shuffle, and the rest a word at a time.           */
+void swap_copy (void * tgt, const void * src, int n, int size)
+{
+  int k = 0;
 
+#if defined (__SSSE3__)
+  k = swap_copy_ssse3 (tgt, src, n, size);
+#endif
+  switch (size)
+  {
+    case 2:
+    {
+      uint16_t x;
+      for (; k<n; k++)
+      {
+        memcpy (&x, src + k * 2, 2);
+        x = arc_bswap16 (x);
+        memcpy (tgt + k * 2, &x, 2);
+      }
+      break;
+    }
+    case 4:
+    {
+      uint32_t x;
+      for (; k<n; k++)
+      {
+        memcpy (&x, src + k * 4, 4);
+        x = arc_bswap32 (x);
+        memcpy (tgt + k * 4, &x, 4);
+      }
+      break;
+    }
+    case 8:
+    {
+      uint64_t x;
+      for (; k<n; k++)
+      {
+        memcpy (&x, src + k * 8, 8);
+        x = arc_bswap64 (x);
+        memcpy (tgt + k * 8, &x, 8);
+      }
+      break;
+    }
+    default:
+      /* Single bytes: nothing to swap. */
+      if (tgt != src)
+        memmove (tgt, src, n * size);
+  }
+}
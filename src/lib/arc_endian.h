@@ -1,6 +1,67 @@
+/*
+ * arc_endian.h - byte order checks, and swaps for arc files
+ *                written on a host of the other endianness.
+ *
+ */
+
+#ifndef ARCFILE_ARC_ENDIAN_H_
+#define ARCFILE_ARC_ENDIAN_H_
+
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined (__GNUC__)
+#  define arc_bswap16(x) __builtin_bswap16 (x)
+#  define arc_bswap32(x) __builtin_bswap32 (x)
+#  define arc_bswap64(x) __builtin_bswap64 (x)
+#else
+static inline uint16_t arc_bswap16 (uint16_t x)
+{
+  return (x >> 8) | (x << 8);
+}
+
+static inline uint32_t arc_bswap32 (uint32_t x)
+{
+  return ((uint32_t)arc_bswap16 (x) << 16) | arc_bswap16 (x >> 16);
+}
+
+static inline uint64_t arc_bswap64 (uint64_t x)
+{
+  return ((uint64_t)arc_bswap32 (x) << 32) | arc_bswap32 (x >> 32);
+}
+#endif
 
 int check_endianness ();
-void swap_8 (void * s);
-void swap_4 (void * s);
-void swap_2 (void * s);
+
+/* Swap one value in place.  s need not be aligned. */
+static inline void swap_8 (void * s)
+{
+  uint64_t x;
+
+  memcpy (&x, s, 8);
+  x = arc_bswap64 (x);
+  memcpy (s, &x, 8);
+}
+
+static inline void swap_4 (void * s)
+{
+  uint32_t x;
+
+  memcpy (&x, s, 4);
+  x = arc_bswap32 (x);
+  memcpy (s, &x, 4);
+}
+
+static inline void swap_2 (void * s)
+{
+  uint16_t x;
+
+  memcpy (&x, s, 2);
+  x = arc_bswap16 (x);
+  memcpy (s, &x, 2);
+}
+
+void swap_copy (void * tgt, const void * src, int n, int size);
+
+#endif
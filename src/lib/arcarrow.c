@@ -0,0 +1,346 @@
+/*
+ * arcarrow.c - hand a data set to other libraries in the
+ *              same process through the Arrow C data
+ *              interface, without copying the samples.
+ *
+ * Each channel of a register becomes a column, pointing
+ * straight into its databuf: a primitive column with one
+ * sample per frame, or else a fixed size list of the
+ * frame's samples.  Undecoded UTC registers are the one
+ * exception, and become timestamps in ms.  Complex
+ * registers have no Arrow type, and are left out.
+ *
+ * Children are released along with their parent, which
+ * owns everything; moving a child out of the array is not
+ * supported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "readarc.h"
+#include "arcarrow.h"
+
+#if DO_DEBUG_ARCARROW
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(...)
+#endif
+
+struct arrow_column {
+    int ib;			/* Register block in the dataset */
+    int chan;
+    int spf;			/* Over 1: a list per frame      */
+    int is_utc;
+    char format[16];		/* Of each sample                */
+    char list_format[16];
+    char name[3 * MAX_NAME_LENGTH + 16];
+};
+
+/* What a released schema has to free.  Column k's schema is */
+/* child[k], and the items of its list child[ncol + k].      */
+struct export_schema {
+    int ncol;
+    struct arrow_column * col;
+    struct ArrowSchema * child;
+    struct ArrowSchema ** ptr;
+};
+
+/* And a released array, which owns the data set. */
+struct export_array {
+    int ncol;
+    struct dataset ds;
+    struct ArrowArray * child;
+    struct ArrowArray ** ptr;
+    const void ** bufs;
+    int64_t ** utc;
+};
+
+static const char * int_format (int elsize, int is_signed)
+{
+  switch (elsize)
+  {
+    case 1: return is_signed ? "c" : "C";
+    case 2: return is_signed ? "s" : "S";
+    case 4: return is_signed ? "i" : "I";
+    case 8: return is_signed ? "l" : "L";
+  }
+
+  return NULL;
+}
+
+/* The columns of a data set, leaving out what can't be */
+/* expressed.  Returns the number of columns, or -1.     */
+static int arrow_columns (struct dataset * ds, struct arrow_column ** col)
+{
+  struct databuf * ts;
+  const char * format;
+  int i, k, n = 0, nchan;
+
+  for (i=0; i<ds->nb; i++)
+    n += databuf_nchan (&(ds->buf[i]));
+  *col = malloc ((n > 0 ? n : 1) * sizeof (struct arrow_column));
+  if (*col == NULL)
+    return -1;
+
+  n = 0;
+  for (i=0; i<ds->nb; i++)
+  {
+    ts = &(ds->buf[i]);
+    if (rb_regblock (ts->rb)[0] == '\0')
+      continue;
+    switch (databuf_sample_kind (ts))
+    {
+      case SAMPLE_INT:
+        format = int_format (ts->elsize, 1);
+        break;
+      case SAMPLE_UINT:
+        format = int_format (ts->elsize, 0);
+        break;
+      case SAMPLE_FLOAT:
+        format = (ts->elsize == 4) ? "f" : "g";
+        break;
+      case SAMPLE_UTC:
+        format = "tsm:UTC";
+        break;
+      default:
+        format = NULL;
+    }
+    if (format == NULL)
+    {
+      DEBUG ("Leaving out register of type 0x%lx.\n", (unsigned long)(ts->rb->typeword & (GCP_REG_TYPE | GCP_REG_COMPLEX)));
+      continue;
+    }
+
+    nchan = databuf_nchan (ts);
+    for (k=0; k<nchan; k++)
+    {
+      (*col)[n].ib = i;
+      (*col)[n].chan = k;
+      (*col)[n].spf = ts->spf;
+      (*col)[n].is_utc = (databuf_sample_kind (ts) == SAMPLE_UTC);
+      strcpy ((*col)[n].format, format);
+      if (nchan == 1)
+        snprintf ((*col)[n].name, sizeof ((*col)[n].name), "%s.%s.%s",
+          rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb));
+      else
+        snprintf ((*col)[n].name, sizeof ((*col)[n].name), "%s.%s.%s[%d]",
+          rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb), k);
+      n++;
+    }
+  }
+
+  return n;
+}
+
+static void release_child_schema (struct ArrowSchema * s)
+{
+  s->release = NULL;
+}
+
+static void release_schema (struct ArrowSchema * s)
+{
+  struct export_schema * p = s->private_data;
+  int k;
+
+  for (k=0; k<2*p->ncol; k++)
+    if (p->child[k].release != NULL)
+      p->child[k].release (&(p->child[k]));
+  free (p->col);
+  free (p->child);
+  free (p->ptr);
+  free (p);
+  s->release = NULL;
+}
+
+static void release_child_array (struct ArrowArray * a)
+{
+  a->release = NULL;
+}
+
+static void release_array (struct ArrowArray * a)
+{
+  struct export_array * p = a->private_data;
+  int k;
+
+  DEBUG ("Releasing exported data set of %d frames.\n", p->ds.num_frames);
+  for (k=0; k<2*p->ncol; k++)
+    if (p->child[k].release != NULL)
+      p->child[k].release (&(p->child[k]));
+  for (k=0; k<p->ncol; k++)
+    free (p->utc[k]);
+  free_dataset (&(p->ds));
+  free (p->child);
+  free (p->ptr);
+  free (p->bufs);
+  free (p->utc);
+  free (p);
+  a->release = NULL;
+}
+
+static void init_schema (struct ArrowSchema * s, const char * format, const char * name,
+    int n_children, struct ArrowSchema ** children, void (*release) (struct ArrowSchema *), void * priv)
+{
+  s->format = format;
+  s->name = name;
+  s->metadata = NULL;
+  s->flags = 0;
+  s->n_children = n_children;
+  s->children = children;
+  s->dictionary = NULL;
+  s->release = release;
+  s->private_data = priv;
+}
+
+static void init_array (struct ArrowArray * a, int64_t length, int n_buffers, const void ** buffers,
+    int n_children, struct ArrowArray ** children, void (*release) (struct ArrowArray *), void * priv)
+{
+  a->length = length;
+  a->null_count = 0;
+  a->offset = 0;
+  a->n_buffers = n_buffers;
+  a->n_children = n_children;
+  a->buffers = buffers;
+  a->children = children;
+  a->dictionary = NULL;
+  a->release = release;
+  a->private_data = priv;
+}
+
+static int export_schema (struct arrow_column * col, int ncol, struct ArrowSchema * schema)
+{
+  struct export_schema * p;
+  struct arrow_column * c;
+  int k;
+
+  p = malloc (sizeof (struct export_schema));
+  if (p == NULL)
+    return ARC_ERR_NOMEM;
+  p->ncol = ncol;
+  p->col = col;
+  p->child = calloc (2 * ncol + 1, sizeof (struct ArrowSchema));
+  p->ptr = malloc ((2 * ncol + 1) * sizeof (struct ArrowSchema *));
+  if ((p->child == NULL) || (p->ptr == NULL))
+  {
+    free (p->child);
+    free (p->ptr);
+    free (p);
+    return ARC_ERR_NOMEM;
+  }
+
+  for (k=0; k<ncol; k++)
+  {
+    c = &(col[k]);
+    p->ptr[k] = &(p->child[k]);
+    p->ptr[ncol + k] = &(p->child[ncol + k]);
+    if (c->spf > 1)
+    {
+      snprintf (c->list_format, sizeof (c->list_format), "+w:%d", c->spf);
+      init_schema (&(p->child[ncol + k]), c->format, "item", 0, NULL, release_child_schema, NULL);
+      init_schema (&(p->child[k]), c->list_format, c->name, 1, &(p->ptr[ncol + k]), release_child_schema, NULL);
+    }
+    else
+      init_schema (&(p->child[k]), c->format, c->name, 0, NULL, release_child_schema, NULL);
+  }
+  init_schema (schema, "+s", "", ncol, p->ptr, release_schema, p);
+
+  return ARC_OK;
+}
+
+static int export_array (struct dataset * ds, struct arrow_column * col, int ncol, struct ArrowArray * array)
+{
+  struct export_array * p;
+  struct arrow_column * c;
+  struct databuf * ts;
+  const void ** b;
+  long n;
+  int k;
+
+  p = malloc (sizeof (struct export_array));
+  if (p == NULL)
+    return ARC_ERR_NOMEM;
+  p->ncol = ncol;
+  p->child = calloc (2 * ncol + 1, sizeof (struct ArrowArray));
+  p->ptr = malloc ((2 * ncol + 1) * sizeof (struct ArrowArray *));
+  p->bufs = calloc (3 * ncol + 1, sizeof (void *));
+  p->utc = calloc (ncol + 1, sizeof (int64_t *));
+  if ((p->child == NULL) || (p->ptr == NULL) || (p->bufs == NULL) || (p->utc == NULL))
+    goto nomem;
+
+  /* Validity buffers are all left out, as nothing is null. */
+  b = p->bufs + 1;
+  for (k=0; k<ncol; k++)
+  {
+    c = &(col[k]);
+    ts = &(ds->buf[c->ib]);
+    n = (long)ds->num_frames * c->spf;
+    p->ptr[k] = &(p->child[k]);
+    p->ptr[ncol + k] = &(p->child[ncol + k]);
+    if (c->is_utc)
+    {
+      p->utc[k] = databuf_utc_ms (ts, c->chan, n);
+      if (p->utc[k] == NULL)
+        goto nomem;
+      b[1] = p->utc[k];
+    }
+    else
+      b[1] = databuf_sample (ts, c->chan, 0);
+    if (c->spf > 1)
+    {
+      init_array (&(p->child[ncol + k]), n, 2, b, 0, NULL, release_child_array, NULL);
+      init_array (&(p->child[k]), ds->num_frames, 1, b + 2, 1, &(p->ptr[ncol + k]), release_child_array, NULL);
+    }
+    else
+      init_array (&(p->child[k]), n, 2, b, 0, NULL, release_child_array, NULL);
+    b += 3;
+  }
+
+  /* Take the buffers over from the caller. */
+  p->ds = *ds;
+  ds->nb = 0;
+  ds->buf = NULL;
+  ds->num_frames = 0;
+  ds->max_frames = 0;
+  init_array (array, p->ds.num_frames, 1, p->bufs, ncol, p->ptr, release_array, p);
+
+  return ARC_OK;
+
+nomem:
+  if (p->utc != NULL)
+    for (k=0; k<ncol; k++)
+      free (p->utc[k]);
+  free (p->child);
+  free (p->ptr);
+  free (p->bufs);
+  free (p->utc);
+  free (p);
+  return ARC_ERR_NOMEM;
+}
+
+int dataset_export_arrow (struct dataset * ds, struct ArrowSchema * schema, struct ArrowArray * array)
+{
+  struct arrow_column * col;
+  int i, ncol, r;
+
+  /* Channels must lie end to end, and hold every frame. */
+  for (i=0; i<ds->nb; i++)
+    if ((ds->buf[i].layout == LAYOUT_BY_FRAME) || ds->buf[i].stats_only)
+      return ARC_ERR_FORMAT;
+
+  ncol = arrow_columns (ds, &col);
+  if (ncol < 0)
+    return ARC_ERR_NOMEM;
+  DEBUG ("Exporting %d columns of %d frames.\n", ncol, ds->num_frames);
+
+  r = export_schema (col, ncol, schema);
+  if (r != ARC_OK)
+  {
+    free (col);
+    return r;
+  }
+  r = export_array (ds, col, ncol, array);
+  if (r != ARC_OK)
+    schema->release (schema);
+
+  return r;
+}
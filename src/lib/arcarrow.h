@@ -0,0 +1,59 @@
+/*
+ * arcarrow.h - hand a data set to other libraries in the
+ *              same process through the Arrow C data
+ *              interface, without copying the samples.
+ *
+ */
+
+#ifndef ARCFILE_ARCARROW_H_
+#define ARCFILE_ARCARROW_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define DO_DEBUG_ARCARROW 0
+
+#include "dataset.h"
+
+/* As laid down by the Arrow C data interface.  Whoever */
+/* else defines them first must use the same layout.    */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char * format;
+  const char * name;
+  const char * metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema ** children;
+  struct ArrowSchema * dictionary;
+  void (*release) (struct ArrowSchema *);
+  void * private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void ** buffers;
+  struct ArrowArray ** children;
+  struct ArrowArray * dictionary;
+  void (*release) (struct ArrowArray *);
+  void * private_data;
+};
+
+#endif
+
+/* A struct array with a child per channel, as a record batch. */
+/* The data set's buffers move into the array, leaving ds      */
+/* empty, and are freed when the array is released.            */
+int dataset_export_arrow (struct dataset * ds, struct ArrowSchema * schema, struct ArrowArray * array);
+
+#endif
@@ -8,6 +8,7 @@
 #include "namelist.h"
 #include "reglist.h"
 #include "arc_endian.h"
+#include "utcrange.h"
 #include "readarc.h"
 
 #if DO_DEBUG_ARCFILE
@@ -40,6 +41,9 @@ int arcfile_open (char * fname, struct arcfile * af)
 
   /* Check file size */
   af->fsize = get_arcfile_size (fname);
+  af->cancel = NULL;
+  af->frame_step = 1;
+  af->frame_skip = 0;
 
   DEBUG ("Guessing format of file %s.\n", fname);
   r = strlen (fname);
@@ -118,13 +122,7 @@ int arcfile_open (char * fname, struct arcfile * af)
   if (af->do_swap_header)
     for (r=0; r<6; r++)
       swap_4 (af->header + r);
-  if (check_endianness() == 0)
-    af->do_swap_data = 0;
-  else
-  {
-    printf ("Warning: endianness swap on frame data not yet supported.\n");
-    af->do_swap_data = 1;
-  }
+  arcfile_set_data_order (af, 0);
 
   af->version = af->header[0];
   af->frame_len = af->header[2] - 8;
@@ -149,6 +147,14 @@ int arcfile_open (char * fname, struct arcfile * af)
   return 0;
 }
 
+/* Frame data are in the byte order of the host that wrote */
+/* them, which the file doesn't record: little-endian (as  */
+/* on every archiver so far) unless told otherwise.        */
+void arcfile_set_data_order (struct arcfile * af, int big_endian)
+{
+  af->do_swap_data = (big_endian != (check_endianness () == 1));
+}
+
 int arcfile_close (struct arcfile * af)
 {
   switch (af->file_type)
@@ -217,44 +223,188 @@ static int af_eof (struct arcfile * af)
   return 0;
 }
 
-int arcfile_read_frames_3 (struct arcfile * af, struct reglist * rl, struct dataset * ds)
+/* Pass over n frames.  Plain files just seek.  Compressed */
+/* ones still have to be decompressed, but the frames are  */
+/* dropped without being scattered into the data set.      */
+static int af_skip_frames (struct arcfile * af, int n, char * buf)
 {
-#define NBUFFRAMES 64
-  int i, j, k, r, nread;
-  char * buf;
-  char * tmp;
-  uint32_t h[2];
-  int32_t ofs;
+  long nbytes = (long)n * af->frame_len;
+#if HAVE_BZ2 == 1
+  int r;
+#else
+  (void) buf;
+#endif
 
-  buf = malloc (af->frame_len * NBUFFRAMES);
-  if (buf == NULL)
-    return ARC_ERR_NOMEM;
+  switch (af->file_type)
+  {
+    case ARC_FILE_PLAIN :
+      return fseek (af->f, nbytes, SEEK_CUR);
 
-  j = 0;
-  while (!af_eof(af))
+#if HAVE_GZ == 1
+    case ARC_FILE_GZ :
+      return (gzseek (af->g, nbytes, SEEK_CUR) < 0) ? -1 : 0;
+#endif
+
+#if HAVE_BZ2 == 1
+    case ARC_FILE_BZ2 :
+      while (n > 0)
+      {
+        r = BZ2_bzread (af->b, buf, ((n < NBUFFRAMES) ? n : NBUFFRAMES) * af->frame_len);
+        if (r <= 0)
+          return -1;
+        n -= NBUFFRAMES;
+      }
+      return 0;
+#endif
+  }
+
+  return ARC_ERR_FORMAT;
+}
+
+/* Read up to nwant frames into buf, keeping only one in */
+/* af->frame_step.  The count to skip carries over from  */
+/* one call to the next.                                 */
+static int af_read_strided (struct arcfile * af, char * buf, int nwant)
+{
+  int k, r;
+
+  for (k=0; k<nwant; k++)
   {
-    DEBUG ("Reading from frame %d.\n", j);
+    if (af->frame_skip > 0)
+    {
+      if (af_skip_frames (af, af->frame_skip, buf) != 0)
+        break;
+      af->frame_skip = 0;
+    }
     switch (af->file_type)
     {
       case ARC_FILE_PLAIN :
-        nread = fread (buf, af->frame_len, NBUFFRAMES, af->f);
+        r = fread (buf + k * af->frame_len, af->frame_len, 1, af->f);
         break;
 
 #if HAVE_GZ == 1
       case ARC_FILE_GZ :
-        nread = gzread (af->g, buf, NBUFFRAMES * af->frame_len);
-        nread = nread / af->frame_len;
+        r = gzread (af->g, buf + k * af->frame_len, af->frame_len);
+        r = (r == af->frame_len);
         break;
 #endif
 
 #if HAVE_BZ2 == 1
       case ARC_FILE_BZ2 :
-        nread = BZ2_bzread (af->b, buf, NBUFFRAMES * af->frame_len);
-        nread = nread / af->frame_len;
+        r = BZ2_bzread (af->b, buf + k * af->frame_len, af->frame_len);
+        r = (r == af->frame_len);
         break;
 #endif
 
-      default: return ARC_ERR_FORMAT;
+      default : r = 0;
+    }
+    if (r != 1)
+      break;
+    af->frame_skip = af->frame_step - 1;
+  }
+
+  return k;
+}
+
+/* Read up to nwant whole frames into buf, as they are in */
+/* the file, keeping one in af->frame_step.  Returns the  */
+/* number read, or -1 for an unknown file type.           */
+int arcfile_read_raw_frames (struct arcfile * af, char * buf, int nwant)
+{
+  int nread = 0;
+
+  if (af->frame_step > 1)
+    return af_read_strided (af, buf, nwant);
+
+  switch (af->file_type)
+  {
+    case ARC_FILE_PLAIN :
+      nread = fread (buf, af->frame_len, nwant, af->f);
+      break;
+
+#if HAVE_GZ == 1
+    case ARC_FILE_GZ :
+      nread = gzread (af->g, buf, nwant * af->frame_len);
+      nread = (nread > 0) ? nread / af->frame_len : 0;
+      break;
+#endif
+
+#if HAVE_BZ2 == 1
+    case ARC_FILE_BZ2 :
+      nread = BZ2_bzread (af->b, buf, nwant * af->frame_len);
+      nread = (nread > 0) ? nread / af->frame_len : 0;
+      break;
+#endif
+
+    default :
+      return -1;
+  }
+
+  return nread;
+}
+
+/* Where a frame's time register falls against the reglist's */
+/* range: -1 before t1, 0 within it, 1 at or after t2.        */
+int arcfile_frame_time_cmp (struct arcfile * af, struct reglist * rl, char * frame)
+{
+  uint32_t t[2];
+
+  /* Day, then milliseconds. */
+  memcpy (t, frame + rl->time_ofs, sizeof (t));
+  if (af->do_swap_data)
+  {
+    swap_4 (t);
+    swap_4 (t+1);
+  }
+  if (utc_cmp (t, rl->t1) < 0)
+    return -1;
+
+  return (utc_cmp (t, rl->t2) < 0) ? 0 : 1;
+}
+
+int arcfile_read_frames_3 (struct arcfile * af, struct reglist * rl, struct dataset * ds)
+{
+  return arcfile_read_frames_max (af, rl, ds, -1);
+}
+
+/* Buffer N frames with fread, as in method 3, but stop after */
+/* max_frames frames (or at end of file if max_frames < 0).   */
+/* Frames past max_frames are left unread in the file, so the */
+/* next call picks up where this one stopped.  With a time    */
+/* range in rl, frames outside it are dropped unscattered and */
+/* don't count, and the first frame past it ends the file.    */
+int arcfile_read_frames_max (struct arcfile * af, struct reglist * rl, struct dataset * ds, int max_frames)
+{
+  int i, j, k, r, nread, nwant;
+  int past_end = 0;
+  char * buf;
+  char * tmp;
+  uint32_t h[2];
+  int32_t ofs;
+
+  buf = malloc (af->frame_len * NBUFFRAMES);
+  if (buf == NULL)
+    return ARC_ERR_NOMEM;
+
+  j = 0;
+  while (!af_eof(af) && !past_end)
+  {
+    if ((af->cancel != NULL) && check_arccancel (af->cancel))
+    {
+      free (buf);
+      return ARC_ERR_SIGINT;
+    }
+    nwant = NBUFFRAMES;
+    if ((max_frames >= 0) && (max_frames - j < nwant))
+      nwant = max_frames - j;
+    if (nwant <= 0)
+      break;
+    DEBUG ("Reading from frame %d.\n", j);
+    nread = arcfile_read_raw_frames (af, buf, nwant);
+    if (nread < 0)
+    {
+      free (buf);
+      return ARC_ERR_FORMAT;
     }
 
     if (nread == 0)
@@ -274,16 +424,38 @@ int arcfile_read_frames_3 (struct arcfile * af, struct reglist * rl, struct data
         return -1;
       }
 
+      if (rl->time_ofs >= 0)
+      {
+        r = arcfile_frame_time_cmp (af, rl, tmp);
+        if (r > 0)
+        {
+          past_end = 1;
+          break;
+        }
+        if (r < 0)
+        {
+          tmp += af->frame_len;
+          continue;
+        }
+      }
+
       if (ds->num_frames == ds->max_frames)
-	dataset_resize (ds, ds->max_frames * 2);
+      {
+	if (dataset_resize (ds, (ds->max_frames > 0) ? ds->max_frames * 2 : NBUFFRAMES) != 0)
+	{
+	  fprintf (stderr, "Out of memory growing buffers past %d frames.\n", ds->max_frames);
+	  free (buf);
+	  return ARC_ERR_NOMEM;
+	}
+      }
 
       for (i=0; i<rl->num_regblocks; i++)
       {
 	DEBUG2 ("Reading in frame %d, register block %d (%s.%s.%s).\n", j, i,
-	  rl->r[i].rb.map, rl->r[i].rb.board, rl->r[i].rb.regblock);
+	  rb_map (&(rl->r[i].rb)), rb_board (&(rl->r[i].rb)), rb_regblock (&(rl->r[i].rb)));
 
 	ofs = rl->r[i].ofs_in_frame;
-	r = memcopy_to_buf (tmp+ofs, &(ds->buf[i]));
+	r = memcopy_to_buf (tmp+ofs, &(ds->buf[i]), af->do_swap_data);
 	if (r != 0)
 	{
 	  free (buf);
@@ -330,10 +502,10 @@ int arcfile_read_frames_2 (struct arcfile * af, struct reglist * rl, struct data
     for (i=0; i<rl->num_regblocks; i++)
     {
       DEBUG2 ("Reading in frame %d, register block %d (%s.%s.%s).\n", j, i,
-        rl->r[i].rb.map, rl->r[i].rb.board, rl->r[i].rb.regblock);
+        rb_map (&(rl->r[i].rb)), rb_board (&(rl->r[i].rb)), rb_regblock (&(rl->r[i].rb)));
 
       ofs = rl->r[i].ofs_in_frame;
-      r = memcopy_to_buf (buf+ofs, &(ds->buf[i]));
+      r = memcopy_to_buf (buf+ofs, &(ds->buf[i]), af->do_swap_data);
       if (r != 0)
       {
         free (buf);
@@ -377,10 +549,10 @@ int arcfile_read_frames_1 (struct arcfile * af, struct reglist * rl, struct data
     for (i=0; i<rl->num_regblocks; i++)
     {
       DEBUG2 ("Reading in frame %d, register block %d (%s.%s.%s).\n", j, i,
-        rl->r[i].rb.map, rl->r[i].rb.board, rl->r[i].rb.regblock);
+        rb_map (&(rl->r[i].rb)), rb_board (&(rl->r[i].rb)), rb_regblock (&(rl->r[i].rb)));
       fseek (af->f, rl->r[i].ofs_in_frame - ofs, SEEK_CUR);
       ofs = rl->r[i].ofs_in_frame;
-      r = copy_to_buf (af->f, &(ds->buf[i]), &ofs);
+      r = copy_to_buf (af->f, &(ds->buf[i]), &ofs, af->do_swap_data);
       if (r != 0)
         return -1;
     }
@@ -398,41 +570,64 @@ int arcfile_read_frames_1 (struct arcfile * af, struct reglist * rl, struct data
   return 0;
 }
 
-int arcfile_read_regmap (struct arcfile * af, struct reglist * rl)
+/* Read the register map that follows the file header. */
+static int af_read_regmap_buf (struct arcfile * af, void ** buf, int * buflen)
 {
-  void * buf;
-  int buflen;
   int r;
 
-  DEBUG ("Reading register map without namelist.\n");
-  buflen = af->frame0_ofs - 24;
-  buf = malloc (buflen);
-  if (buf == NULL)
+  *buflen = af->frame0_ofs - 24;
+  *buf = malloc (*buflen);
+  if (*buf == NULL)
     return ARC_ERR_NOMEM;
 
   switch (af->file_type)
   {
-
     case ARC_FILE_PLAIN :
-      r = fread (buf, buflen, 1, af->f);
+      r = fread (*buf, *buflen, 1, af->f);
       break;
 
 #if HAVE_GZ == 1
     case ARC_FILE_GZ :
-      r = gzread (af->g, buf, buflen);
+      r = gzread (af->g, *buf, *buflen);
       break;
 #endif
 
 #if HAVE_BZ2 == 1
     case ARC_FILE_BZ2 :
-      r = BZ2_bzread (af->b, buf, buflen);
+      r = BZ2_bzread (af->b, *buf, *buflen);
       break;
 #endif
     default:
+      free (*buf);
       return ARC_ERR_FORMAT;
   }
+
   if (r < 1)
+  {
+    free (*buf);
     return ARC_ERR_EOF;
+  }
+
+  return ARC_OK;
+}
+
+/* The register map as it is in the file, for the caller */
+/* to free.                                               */
+int arcfile_read_regmap_raw (struct arcfile * af, void ** buf, int * buflen)
+{
+  return af_read_regmap_buf (af, buf, buflen);
+}
+
+int arcfile_read_regmap (struct arcfile * af, struct reglist * rl)
+{
+  void * buf;
+  int buflen;
+  int r;
+
+  DEBUG ("Reading register map without namelist.\n");
+  r = af_read_regmap_buf (af, &buf, &buflen);
+  if (r != 0)
+    return r;
   r = parse_reglist (buf, buflen, af->do_swap_header, rl, 0);
   free (buf);
 
@@ -446,36 +641,39 @@ int arcfile_read_regmap_namelist (struct arcfile * af, struct namelist * nl, str
   int r;
 
   DEBUG ("Reading register map with namelist.\n");
-  buflen = af->frame0_ofs - 24;
-  buf = malloc (buflen);
-  if (buf == NULL)
-    return ARC_ERR_NOMEM;
+  r = af_read_regmap_buf (af, &buf, &buflen);
+  if (r != 0)
+    return r;
+  r = parse_reglist_namelist (buf, buflen, af->do_swap_header, nl, rl, 0);
+  free (buf);
 
-  switch (af->file_type)
-  {
-    case ARC_FILE_PLAIN :
-      r = fread (buf, buflen, 1, af->f);
-      break;
+  return r;
+}
 
-#if HAVE_GZ == 1
-    case ARC_FILE_GZ :
-      r = gzread (af->g, buf, buflen);
-      break;
-#endif
+/* As arcfile_read_regmap_namelist (with everything if nl is */
+/* empty), also picking the registers tnl names out of the   */
+/* same map into trl.                                        */
+int arcfile_read_regmap_time (struct arcfile * af, struct namelist * nl, struct reglist * rl,
+    struct namelist * tnl, struct reglist * trl)
+{
+  void * buf;
+  int buflen;
+  int r;
 
-#if HAVE_BZ2 == 1
-    case ARC_FILE_BZ2 :
-      r = BZ2_bzread (af->b, buf, buflen);
-      break;
-#endif
-    default:
-      return ARC_ERR_FORMAT;
+  DEBUG ("Reading register map and time register.\n");
+  r = af_read_regmap_buf (af, &buf, &buflen);
+  if (r != 0)
+    return r;
+  if (nl->n == 0)
+    r = parse_reglist (buf, buflen, af->do_swap_header, rl, 0);
+  else
+    r = parse_reglist_namelist (buf, buflen, af->do_swap_header, nl, rl, 0);
+  if (r == 0)
+  {
+    r = parse_reglist_namelist (buf, buflen, af->do_swap_header, tnl, trl, 0);
+    if (r != 0)
+      free_reglist (rl);
   }
-
-  if (r < 1)
-    return ARC_ERR_EOF;
-
-  r = parse_reglist_namelist (buf, buflen, af->do_swap_header, nl, rl, 0);
   free (buf);
 
   return r;
@@ -15,6 +15,7 @@
 #include "reglist.h"
 #include "namelist.h"
 #include "dataset.h"
+#include "handlesig.h"
 
 #define HAVE_GZ		1
 #define HAVE_BZ2	0
@@ -39,6 +40,9 @@
 /*       (4 - straightforward mmap)               */
 #define arcfile_read_frames arcfile_read_frames_3
 
+/* Frames per read in method 3 */
+#define NBUFFRAMES 64
+
 struct arcfile {
     FILE * f;
 #if HAVE_GZ == 1
@@ -56,14 +60,25 @@ struct arcfile {
     uint32_t frame_len;
     uint32_t frame0_ofs;
     uint32_t numframes;
+
+    struct arccancel * cancel;	/* Polled between blocks of frames */
+    int frame_step;		/* Keep one frame in frame_step */
+    int frame_skip;		/* Frames to pass over before the next */
 };
 
 int arcfile_open (char * fname, struct arcfile * af);
 int arcfile_close (struct arcfile * af);
+void arcfile_set_data_order (struct arcfile * af, int big_endian);
+int arcfile_read_regmap_raw (struct arcfile * af, void ** buf, int * buflen);
 int arcfile_read_regmap (struct arcfile * af, struct reglist * rl);
 int arcfile_read_regmap_namelist (struct arcfile * af, struct namelist * nl, struct reglist * rl);
+int arcfile_read_regmap_time (struct arcfile * af, struct namelist * nl, struct reglist * rl,
+    struct namelist * tnl, struct reglist * trl);
 int arcfile_skip_regmap (struct arcfile * af);
+int arcfile_read_raw_frames (struct arcfile * af, char * buf, int nwant);
+int arcfile_frame_time_cmp (struct arcfile * af, struct reglist * rl, char * frame);
 int arcfile_read_frames (struct arcfile * af, struct reglist * rl, struct dataset * ds);
+int arcfile_read_frames_max (struct arcfile * af, struct reglist * rl, struct dataset * ds, int max_frames);
 int arcfile_read_frames_utc (struct arcfile * af, struct reglist * rl, uint32_t t1[2], uint32_t t2[2], struct dataset * ds);
 
 #endif
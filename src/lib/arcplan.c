@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arcplan.h"
+#include "arcfile.h"
+#include "fileset.h"
+#include "reglist.h"
+#include "databuf.h"
+#include "readarc.h"
+
+#if DO_DEBUG_ARCPLAN
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(...)
+#endif
+
+/* Uncompressed length from the last 4 bytes of a gzip file */
+/* (little-endian, mod 2^32).  Returns 0 if unreadable.     */
+static uint32_t gz_trailer_size (char * fname)
+{
+  FILE * f;
+  unsigned char b[4];
+  int r;
+
+  f = fopen (fname, "rb");
+  if (f == NULL)
+    return 0;
+  r = fseek (f, -4, SEEK_END);
+  if ((r != 0) || (fread (b, 1, 4, f) != 4))
+  {
+    fclose (f);
+    return 0;
+  }
+  fclose (f);
+
+  return (uint32_t)b[0] | ((uint32_t)b[1] << 8)
+    | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+/* Number of frames in one arc file.  Plain files go by size, */
+/* gzip files by the length in the gzip trailer.  The trailer */
+/* only covers the last gzip member, so if it doesn't come to */
+/* a whole number of frames, fall back on the standard count. */
+int arcplan_file_frames (struct fileset_file * ff, uint32_t frame0_ofs, uint32_t frame_len, int * exact)
+{
+  size_t n;
+  size_t size;
+
+  n = strlen (ff->name);
+  if ((frame_len > 0) && (n >= 4) && !strncmp (ff->name + (n-4), ".dat", 4))
+  {
+    if (ff->size < frame0_ofs)
+      return 0;
+    return (ff->size - frame0_ofs) / frame_len;
+  }
+
+  if ((frame_len > 0) && (n >= 3) && !strncmp (ff->name + (n-3), ".gz", 3))
+  {
+    size = gz_trailer_size (ff->name);
+    DEBUG ("arcplan: %s holds %lu bytes uncompressed.\n", ff->name, (unsigned long)size);
+    if ((size >= frame0_ofs) && ((size - frame0_ofs) % frame_len == 0))
+      return (size - frame0_ofs) / frame_len;
+  }
+
+  if (exact != NULL)
+    *exact = 0;
+  return STANDARD_FILE_NFRAMES;
+}
+
+/* Bytes of data kept for each frame read with rl.  Blocks */
+/* kept only as statistics don't grow with the frames.      */
+size_t arcplan_frame_bytes (struct reglist * rl)
+{
+  struct reglist_entry * e;
+  size_t nbytes = 0;
+  uint32_t typeword;
+  int nchan, spf;
+  int i;
+
+  for (i=0; i<rl->num_regblocks; i++)
+  {
+    e = &(rl->r[i]);
+    if (!e->rb.do_arc || (e->stats == STATS_ONLY))
+      continue;
+    if (databuf_layout (e, &nchan, &spf, &typeword) != 0)
+    {
+      nchan = (e->chan.n == 0) ? e->rb.nchan : e->chan.ntot;
+      spf = e->rb.spf;
+      typeword = e->rb.typeword;
+    }
+    nbytes += (size_t)element_size (typeword) * spf * nchan;
+  }
+
+  return nbytes;
+}
+
+/* Work out the frame count and memory use of readarc on */
+/* filt, reading only file headers and register maps.    */
+int readarc_plan (struct arcfilt * filt, struct arcplan * plan)
+{
+  struct fileset fset;
+  struct reglist rl;
+  struct arcfile af;
+  int nframes_first, nframes_last;
+  int ifile, nframes;
+  int i, r;
+
+  plan->nfiles = 0;
+  plan->nframes = 0;
+  plan->exact = 1;
+  plan->frame_bytes = 0;
+  plan->data_bytes = 0;
+  plan->peak_bytes = 0;
+
+  if (filt->use_utc)
+    r = init_fileset_utc (filt->fname, filt->t1, filt->t2, &fset);
+  else
+    r = init_fileset (filt->fname, &fset);
+  if (r != 0)
+    return r;
+  plan->nfiles = fset.nf;
+  if (fset.nf == 0)
+  {
+    free_fileset (&fset);
+    return ARC_OK;
+  }
+
+  /* Use the same file for the register map as readarc does. */
+  ifile = ((filt->use_utc) && (fset.nf > 1)) ? 1 : 0;
+  r = arcfile_open (fset.files[ifile].name, &af);
+  if (r != 0)
+  {
+    free_fileset (&fset);
+    return r;
+  }
+  r = arcfilt_read_regmap (filt, &af, &rl);
+  arcfile_close (&af);
+  if (r != 0)
+  {
+    free_fileset (&fset);
+    return r;
+  }
+  plan->frame_bytes = arcplan_frame_bytes (&rl);
+  free_reglist (&rl);
+
+  nframes_first = nframes_last = 0;
+  for (i=0; i<fset.nf; i++)
+  {
+    nframes = arcplan_file_frames (&(fset.files[i]), af.frame0_ofs, af.frame_len, &(plan->exact));
+    nframes = arcplan_strided (nframes, filt->frame_step);
+    DEBUG ("arcplan: %s, %d frames.\n", fset.files[i].name, nframes);
+    if (i == 0)
+      nframes_first = nframes;
+    if (i == fset.nf - 1)
+      nframes_last = nframes;
+    plan->nframes += nframes;
+  }
+  free_fileset (&fset);
+
+  plan->data_bytes = plan->nframes * plan->frame_bytes;
+  plan->peak_bytes = plan->data_bytes + (size_t)af.frame_len * NBUFFRAMES;
+
+  /* With a time range, the first and last files are read */
+  /* into buffers of their own, then copied into the rest. */
+  if ((filt->use_utc) && (fset.nf > 1))
+    plan->peak_bytes += (nframes_first + nframes_last) * plan->frame_bytes;
+
+  return ARC_OK;
+}
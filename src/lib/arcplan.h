@@ -0,0 +1,38 @@
+/*
+ * arcplan.h - work out how much memory a query will take
+ *             before reading any frames, so it can be
+ *             refused or cut into windows.
+ *
+ */
+
+#ifndef ARCFILE_ARCPLAN_H_
+#define ARCFILE_ARCPLAN_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "readarc.h"
+#include "fileset.h"
+#include "reglist.h"
+
+#define DO_DEBUG_ARCPLAN 0
+
+struct arcplan {
+    int nfiles;
+    long int nframes;		/* Frames to be kept from all files   */
+    int exact;			/* Whether every file's count is known */
+    size_t frame_bytes;		/* Data bytes kept per frame           */
+    size_t data_bytes;		/* nframes * frame_bytes               */
+    size_t peak_bytes;		/* Most readarc will hold at once      */
+};
+
+/* Frames kept from n, taking one in every step. */
+static inline int arcplan_strided (int n, int step)
+{
+  return (step > 1) ? (n + step - 1) / step : n;
+}
+
+int arcplan_file_frames (struct fileset_file * ff, uint32_t frame0_ofs, uint32_t frame_len, int * exact);
+size_t arcplan_frame_bytes (struct reglist * rl);
+int readarc_plan (struct arcfilt * filt, struct arcplan * plan);
+
+#endif
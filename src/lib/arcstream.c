@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "arcstream.h"
+#include "fileset.h"
+#include "reglist.h"
+#include "dataset.h"
+#include "arcfile.h"
+#include "readarc.h"
+#include "handlesig.h"
+#include "arcplan.h"
+
+#if DO_DEBUG_ARCSTREAM
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(...)
+#endif
+
+/* Set up a stream over the files selected by filt.  The     */
+/* register list comes from the first file, as in readarc.   */
+/* filt must stay valid until readarc_close.                 */
+int readarc_open (struct arcfilt * filt, struct arcstream * s)
+{
+  int r;
+
+  s->filt = filt;
+  s->ifile = 0;
+  s->is_open = 0;
+  s->ds_ready = 0;
+  s->owns_rl = 1;
+  s->rl.num_regblocks = 0;
+  s->rl.r = NULL;
+  s->rl.names = NULL;
+
+  if (filt->use_utc)
+    r = init_fileset_utc (filt->fname, filt->t1, filt->t2, &(s->fset));
+  else
+    r = init_fileset (filt->fname, &(s->fset));
+  if (r != 0)
+    return r;
+  DEBUG ("readarc_open: found %d files.\n", s->fset.nf);
+
+  if (s->fset.nf == 0)
+    return ARC_OK;
+
+  r = arcfile_open (s->fset.files[0].name, &(s->af));
+  if (r != 0)
+  {
+    free_fileset (&(s->fset));
+    return r;
+  }
+  s->af.cancel = filt->cancel;
+  s->af.frame_step = filt->frame_step;
+  arcfile_set_data_order (&(s->af), filt->big_endian);
+
+  r = arcfilt_read_regmap (filt, &(s->af), &(s->rl));
+  if (r != 0)
+  {
+    arcfile_close (&(s->af));
+    free_fileset (&(s->fset));
+    return r;
+  }
+  s->is_open = 1;
+
+  return ARC_OK;
+}
+
+/* As readarc_open, but read the register blocks in rl       */
+/* rather than those selected by the namelist.  rl is used    */
+/* in place, and must match the register map of every file;   */
+/* the caller keeps ownership of it.                          */
+int readarc_open_reglist (struct arcfilt * filt, struct reglist * rl, struct arcstream * s)
+{
+  int r;
+
+  s->filt = filt;
+  s->ifile = 0;
+  s->is_open = 0;
+  s->ds_ready = 0;
+  s->owns_rl = 0;
+  s->rl = *rl;
+
+  if (filt->use_utc)
+    r = init_fileset_utc (filt->fname, filt->t1, filt->t2, &(s->fset));
+  else
+    r = init_fileset (filt->fname, &(s->fset));
+
+  return r;
+}
+
+/* Make sure af is open on the next file with frames left,  */
+/* positioned at its first frame.  Returns ARC_ERR_EOF when */
+/* there are no files left.                                 */
+static int stream_open_file (struct arcstream * s)
+{
+  int r;
+
+  if (s->is_open)
+    return ARC_OK;
+  if (s->ifile >= s->fset.nf)
+    return ARC_ERR_EOF;
+
+  DEBUG ("readarc stream: opening %s.\n", s->fset.files[s->ifile].name);
+  r = arcfile_open (s->fset.files[s->ifile].name, &(s->af));
+  if (r != 0)
+    return r;
+  s->af.cancel = s->filt->cancel;
+  s->af.frame_step = s->filt->frame_step;
+  arcfile_set_data_order (&(s->af), s->filt->big_endian);
+  r = arcfile_skip_regmap (&(s->af));
+  if (r != 0)
+  {
+    arcfile_close (&(s->af));
+    return r;
+  }
+  s->is_open = 1;
+
+  return ARC_OK;
+}
+
+static void stream_close_file (struct arcstream * s)
+{
+  arcfile_close (&(s->af));
+  s->is_open = 0;
+  s->ifile++;
+}
+
+/* Read the next max_frames frames into ds, crossing file   */
+/* boundaries as needed.  Pass the same ds on every call:   */
+/* it is set up on the first call and its buffers are then  */
+/* reused.  On return ds->num_frames holds the number of    */
+/* frames read, which is short only for the last window and */
+/* zero once the stream is exhausted.  The caller frees ds  */
+/* with free_dataset after readarc_close.                   */
+int readarc_next (struct arcstream * s, int max_frames, struct dataset * ds)
+{
+  int i, r;
+
+  if (max_frames <= 0)
+    return ARC_ERR_NSAMP;
+
+  /* Under a memory budget, shrink the window to fit. */
+  if (s->filt->mem_budget > 0)
+  {
+    size_t nbytes = arcplan_frame_bytes (&(s->rl));
+
+    if ((nbytes > 0) && ((size_t)max_frames * nbytes > s->filt->mem_budget))
+    {
+      max_frames = s->filt->mem_budget / nbytes;
+      DEBUG ("readarc_next: window cut to %d frames by budget.\n", max_frames);
+      if (max_frames == 0)
+        return ARC_ERR_BUDGET;
+    }
+  }
+
+  if (!s->ds_ready)
+  {
+    r = init_dataset (ds, &(s->rl), max_frames);
+    if (r != 0)
+      return r;
+    s->ds_ready = 1;
+  }
+  else if (ds->max_frames != max_frames)
+  {
+    r = dataset_resize (ds, max_frames);
+    if (r != 0)
+      return r;
+  }
+  ds->num_frames = 0;
+  for (i=0; i<ds->nb; i++)
+    ds->buf[i].numframes = 0;
+
+  while (ds->num_frames < max_frames)
+  {
+    if ((s->filt->cancel != NULL) && check_arccancel (s->filt->cancel))
+      return ARC_ERR_SIGINT;
+
+    r = stream_open_file (s);
+    if (r == ARC_ERR_EOF)
+      break;
+    if (r != 0)
+      return r;
+
+    r = arcfile_read_frames_max (&(s->af), &(s->rl), ds, max_frames - ds->num_frames);
+    if (r != 0)
+      return r;
+
+    /* Came up short, so this file is used up. */
+    if (ds->num_frames < max_frames)
+      stream_close_file (s);
+  }
+
+  /* Consumers expect each channel's time stream to be   */
+  /* numframes long, so trim a short final window.  Keep */
+  /* the buffers of an empty one for the next caller.    */
+  if ((ds->num_frames > 0) && (ds->num_frames < ds->max_frames))
+    return dataset_tight_size (ds);
+
+  return ARC_OK;
+}
+
+/* Read all the remaining frames into ds, growing it as      */
+/* needed, like readarc.  Sets up ds itself, so don't mix    */
+/* with readarc_next on the same stream.                     */
+int readarc_all (struct arcstream * s, struct dataset * ds)
+{
+  int nframes;
+  int i, r;
+
+  if (s->ds_ready)
+    return ARC_ERR_NSAMP;
+
+  /* Size the buffers from the files' frame counts, */
+  /* taking the frame layout from the first one.    */
+  nframes = 0;
+  r = stream_open_file (s);
+  if (r == ARC_OK)
+  {
+    for (i=s->ifile; i<s->fset.nf; i++)
+      nframes += arcplan_strided (arcplan_file_frames (&(s->fset.files[i]),
+        s->af.frame0_ofs, s->af.frame_len, NULL), s->filt->frame_step);
+  }
+  else if (r != ARC_ERR_EOF)
+    return r;
+  if ((s->filt->mem_budget > 0)
+      && ((size_t)nframes * arcplan_frame_bytes (&(s->rl)) > s->filt->mem_budget))
+    return ARC_ERR_BUDGET;
+  if (nframes <= 0)
+    nframes = 1;
+  r = init_dataset (ds, &(s->rl), nframes);
+  if (r != 0)
+    return r;
+  s->ds_ready = 1;
+
+  while (1)
+  {
+    if ((s->filt->cancel != NULL) && check_arccancel (s->filt->cancel))
+      return ARC_ERR_SIGINT;
+
+    r = stream_open_file (s);
+    if (r == ARC_ERR_EOF)
+      break;
+    if (r != 0)
+      return r;
+
+    r = arcfile_read_frames_max (&(s->af), &(s->rl), ds, -1);
+    if (r != 0)
+      return r;
+    stream_close_file (s);
+  }
+
+  return dataset_tight_size (ds);
+}
+
+int readarc_close (struct arcstream * s)
+{
+  if (s->is_open)
+    arcfile_close (&(s->af));
+  s->is_open = 0;
+  if (s->owns_rl && (s->fset.nf > 0))
+    free_reglist (&(s->rl));
+  free_fileset (&(s->fset));
+
+  return ARC_OK;
+}
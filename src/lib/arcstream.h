@@ -0,0 +1,38 @@
+/*
+ * arcstream.h - read arc file data a window of frames at
+ *               a time, so consumers can work in bounded
+ *               memory.
+ *
+ */
+
+#ifndef ARCFILE_ARCSTREAM_H_
+#define ARCFILE_ARCSTREAM_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "readarc.h"
+#include "fileset.h"
+#include "arcfile.h"
+#include "reglist.h"
+#include "dataset.h"
+
+#define DO_DEBUG_ARCSTREAM 0
+
+struct arcstream {
+    struct arcfilt * filt;
+    struct fileset fset;
+    struct reglist rl;
+    struct arcfile af;
+    int ifile;		/* File currently (or next to be) read */
+    int is_open;	/* Whether af is open on file ifile    */
+    int ds_ready;	/* Whether the caller's dataset is set up */
+    int owns_rl;	/* Whether rl is freed by readarc_close */
+};
+
+int readarc_open (struct arcfilt * filt, struct arcstream * s);
+int readarc_open_reglist (struct arcfilt * filt, struct reglist * rl, struct arcstream * s);
+int readarc_next (struct arcstream * s, int max_frames, struct dataset * ds);
+int readarc_all (struct arcstream * s, struct dataset * ds);
+int readarc_close (struct arcstream * s);
+
+#endif
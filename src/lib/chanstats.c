@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "chanstats.h"
+#include "reglist.h"
+
+#if DO_DEBUG_CHANSTATS
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(...)
+#endif
+
+void chanstats_init (struct chanstats * cs, int nchan)
+{
+  int i;
+
+  for (i=0; i<nchan; i++)
+  {
+    cs[i].n = 0;
+    cs[i].nnan = 0;
+    cs[i].min = 0;
+    cs[i].max = 0;
+    cs[i].mean = 0;
+    cs[i].m2 = 0;
+  }
+}
+
+/* Merge the statistics of a batch into a running total.  */
+/* Chan et al.'s update: the means are combined weighted,  */
+/* and m2 picks up the spread between them.                */
+void chanstats_merge (struct chanstats * tgt, struct chanstats * src)
+{
+  double delta;
+  long n;
+
+  n = tgt->nnan + src->nnan;
+  if ((src->n == 0) || (tgt->n == 0))
+  {
+    if (tgt->n == 0)
+      *tgt = *src;
+    tgt->nnan = n;
+    return;
+  }
+  tgt->nnan = n;
+
+  n = tgt->n + src->n;
+  delta = src->mean - tgt->mean;
+  tgt->mean += delta * src->n / n;
+  tgt->m2 += src->m2 + delta * delta * ((double)tgt->n * src->n / n);
+  if (src->min < tgt->min)
+    tgt->min = src->min;
+  if (src->max > tgt->max)
+    tgt->max = src->max;
+  tgt->n = n;
+}
+
+/* Statistics of n samples in two passes: sum, range and */
+/* NaNs, then squares about the mean.  The loops carry    */
+/* no dependence but the sums, so they vectorize.         */
+#define DEFINE_BATCH(name, T) \
+static void name (struct chanstats * b, void * src, int n) \
+{ \
+  double sum = 0, m2 = 0, d; \
+  T x, lo, hi; \
+  long nnan = 0; \
+  int k; \
+ \
+  memcpy (&lo, src, sizeof (T)); \
+  hi = lo; \
+  for (k=0; k<n; k++) \
+  { \
+    memcpy (&x, src + k * sizeof (T), sizeof (T)); \
+    if (x != x) \
+    { \
+      nnan++; \
+      continue; \
+    } \
+    if ((x < lo) || (lo != lo)) \
+      lo = x; \
+    if ((x > hi) || (hi != hi)) \
+      hi = x; \
+    sum += x; \
+  } \
+  b->nnan = nnan; \
+  b->n = n - nnan; \
+  if (b->n == 0) \
+    return; \
+  b->mean = sum / b->n; \
+  for (k=0; k<n; k++) \
+  { \
+    memcpy (&x, src + k * sizeof (T), sizeof (T)); \
+    if (x != x) \
+      continue; \
+    d = x - b->mean; \
+    m2 += d * d; \
+  } \
+  b->m2 = m2; \
+  b->min = lo; \
+  b->max = hi; \
+}
+
+DEFINE_BATCH (batch_int8, int8_t)
+DEFINE_BATCH (batch_uint8, uint8_t)
+DEFINE_BATCH (batch_int16, int16_t)
+DEFINE_BATCH (batch_uint16, uint16_t)
+DEFINE_BATCH (batch_int32, int32_t)
+DEFINE_BATCH (batch_uint32, uint32_t)
+DEFINE_BATCH (batch_float, float)
+DEFINE_BATCH (batch_double, double)
+
+/* Add n samples of a type to one channel's statistics.   */
+/* Complex and undecoded UTC values aren't numbers we can */
+/* summarise, and are skipped.                            */
+void chanstats_add (struct chanstats * cs, uint32_t typeword, void * x, int n)
+{
+  struct chanstats b;
+
+  if ((n <= 0) || (typeword & GCP_REG_COMPLEX))
+    return;
+
+  chanstats_init (&b, 1);
+  switch (typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_CHAR:   batch_int8 (&b, x, n);   break;
+    case GCP_REG_BOOL:
+    case GCP_REG_UCHAR:  batch_uint8 (&b, x, n);  break;
+    case GCP_REG_SHORT:  batch_int16 (&b, x, n);  break;
+    case GCP_REG_USHORT: batch_uint16 (&b, x, n); break;
+    case GCP_REG_INT:    batch_int32 (&b, x, n);  break;
+    case GCP_REG_UINT:   batch_uint32 (&b, x, n); break;
+    case GCP_REG_FLOAT:  batch_float (&b, x, n);  break;
+    case GCP_REG_DOUBLE: batch_double (&b, x, n); break;
+    default:
+      return;
+  }
+  chanstats_merge (cs, &b);
+}
+
+/* Sample variance, or NaN with fewer than two samples. */
+double chanstats_var (struct chanstats * cs)
+{
+  if (cs->n < 2)
+    return NAN;
+
+  return cs->m2 / (cs->n - 1);
+}
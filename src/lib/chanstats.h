@@ -0,0 +1,33 @@
+/*
+ * chanstats.h - running summary statistics of each channel
+ *               of a register block, kept while frames are
+ *               scattered instead of (or as well as) the
+ *               samples themselves.
+ *
+ */
+
+#ifndef ARCFILE_CHANSTATS_H_
+#define ARCFILE_CHANSTATS_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define DO_DEBUG_CHANSTATS 0
+
+/* NaNs are counted but left out of everything else.   */
+/* The variance is kept as m2, the sum of squares about */
+/* the mean, so that adding a batch stays accurate.     */
+struct chanstats {
+    long n;			/* Samples counted, NaNs aside       */
+    long nnan;			/* NaN samples                       */
+    double min, max;
+    double mean;
+    double m2;
+};
+
+void chanstats_init (struct chanstats * cs, int nchan);
+void chanstats_add (struct chanstats * cs, uint32_t typeword, void * x, int n);
+void chanstats_merge (struct chanstats * tgt, struct chanstats * src);
+double chanstats_var (struct chanstats * cs);
+
+#endif
@@ -4,6 +4,7 @@
 #include <string.h>
 #include "dataset.h"
 #include "readarc.h"
+#include "arc_endian.h"
 
 #if DO_DEBUG_DATABUF
 #  define DEBUG(args...) printf(args)
@@ -57,11 +58,149 @@ int element_size (uint32_t typeword)
   return m;
 }
 
-int allocate_databuf (struct regblockspec * rb, struct chanlist * chan, int numframes, struct databuf * ts)
+/* Word size to byte swap a type by, or 0 for bytes.  */
+/* Complex values are swapped by part, and UTC values  */
+/* (day and milliseconds) by 32-bit word.              */
+static int swap_size (uint32_t typeword)
 {
+  int m = element_size (typeword);
+
+  if ((typeword & GCP_REG_TYPE) == GCP_REG_UTC)
+    m = 4;
+  else if (typeword & GCP_REG_COMPLEX)
+    m /= 2;
+
+  return (m > 1) ? m : 0;
+}
+
+/* Reduction actually done on a type.  Only "first" makes */
+/* sense for complex and UTC registers.                   */
+static int reduce_op (uint32_t typeword, int op)
+{
+  if ((op == REDUCE_NONE) || (op == REDUCE_FIRST))
+    return op;
+  if ((typeword & GCP_REG_COMPLEX) || ((typeword & GCP_REG_TYPE) == GCP_REG_UTC))
+    return REDUCE_FIRST;
+
+  return op;
+}
+
+/* Type stored for a register: means are kept as doubles. */
+static uint32_t reduce_typeword (uint32_t typeword, int op)
+{
+  if (reduce_op (typeword, op) != REDUCE_MEAN)
+    return typeword;
+
+  return (typeword & ~(GCP_REG_TYPE | GCP_REG_COMPLEX)) | GCP_REG_DOUBLE;
+}
+
+/* Conversion actually done on a type: none for complex */
+/* and UTC registers, or where it wouldn't change a thing. */
+static int convert_op (uint32_t typeword, struct conversion * cv)
+{
+  uint32_t t = typeword & GCP_REG_TYPE;
+
+  if ((cv->type == CONVERT_NONE) || (typeword & GCP_REG_COMPLEX) || (t == GCP_REG_UTC))
+    return CONVERT_NONE;
+  if ((cv->scale == 1) && (cv->offset == 0))
+  {
+    if ((cv->type == CONVERT_FLOAT) && (t == GCP_REG_FLOAT))
+      return CONVERT_NONE;
+    if ((cv->type == CONVERT_DOUBLE) && (t == GCP_REG_DOUBLE))
+      return CONVERT_NONE;
+  }
+
+  return cv->type;
+}
+
+/* Decoding actually done on a type: only UTC registers. */
+static int utc_op (uint32_t typeword, struct conversion * cv)
+{
+  if ((typeword & GCP_REG_COMPLEX) || ((typeword & GCP_REG_TYPE) != GCP_REG_UTC))
+    return UTC_RAW;
+
+  return cv->utc;
+}
+
+/* Type stored for a register after conversion. */
+static uint32_t convert_typeword (uint32_t typeword, struct conversion * cv)
+{
+  if (utc_op (typeword, cv) != UTC_RAW)
+    return (typeword & ~GCP_REG_TYPE) | GCP_REG_DOUBLE;
+
+  switch (convert_op (typeword, cv))
+  {
+    case CONVERT_FLOAT:
+      return (typeword & ~GCP_REG_TYPE) | GCP_REG_FLOAT;
+    case CONVERT_DOUBLE:
+      return (typeword & ~GCP_REG_TYPE) | GCP_REG_DOUBLE;
+  }
+
+  return typeword;
+}
+
+/* Samples stored per frame once nsamp selected samples */
+/* go through a reduction.                              */
+static int reduce_spf (struct reduction * red, int nsamp)
+{
+  if ((red->op == REDUCE_NONE) || (nsamp == 0))
+    return nsamp;
+  if ((red->n <= 0) || (red->n >= nsamp))
+    return 1;
+
+  return (nsamp + red->n - 1) / red->n;
+}
+
+/* Channels, samples per frame and type that a databuf */
+/* for e will hold.                                     */
+int databuf_layout (struct reglist_entry * e, int * nchan, int * spf, uint32_t * typeword)
+{
+  struct samplist samp;
+  int r;
+
+  *typeword = reduce_typeword (e->rb.typeword, e->red.op);
+  *nchan = (e->chan.n == 0) ? e->rb.nchan : e->chan.ntot;
+  if (utc_op (*typeword, &(e->conv)) == UTC_MJDSEC)
+    *nchan *= 2;
+  *typeword = convert_typeword (*typeword, &(e->conv));
+  r = resolve_samplist (&samp, &(e->samp), e->rb.spf, spf);
+  free_samplist (&samp);
+  if (r != 0)
+    return r;
+  *spf = reduce_spf (&(e->red), *spf);
+
+  return ARC_OK;
+}
+
+/* Bytes from the start of one channel's samples to the  */
+/* next: a whole time stream by channel, or just the one  */
+/* frame's worth by frame.                                */
+static long chan_stride (struct databuf * ts)
+{
+  if (ts->layout == LAYOUT_BY_FRAME)
+    return ts->spf * ts->elsize;
+
+  return (long)ts->maxframes * ts->spf * ts->elsize;
+}
+
+static int converting (struct databuf * ts)
+{
+  return (ts->conv.type != CONVERT_NONE) || (ts->conv.utc != UTC_RAW);
+}
+
+int allocate_databuf (struct reglist_entry * e, int numframes, struct databuf * ts)
+{
+  struct regblockspec * rb = &(e->rb);
+  int scratch_size;
+
   ts->rb = NULL;
   ts->chan.n = 0;
+  ts->samp.n = 0;
+  ts->spf = rb->spf;
   ts->buf = NULL;
+  ts->scratch = NULL;
+  ts->stats = NULL;
+  ts->stats_only = 0;
   ts->bufsize = 0;
   ts->numframes = 0;
   ts->maxframes = 0;
@@ -70,11 +209,31 @@ int allocate_databuf (struct regblockspec * rb, struct chanlist * chan, int numf
   if (ts->rb == NULL)
     return ARC_ERR_NOMEM;
   memcpy (ts->rb, rb, sizeof (struct regblockspec));
-  if (0 != copy_chanlist (&(ts->chan), chan))
+  strtab_ref (ts->rb->names);
+  if (0 != copy_chanlist (&(ts->chan), &(e->chan)))
     return ARC_ERR_NOMEM;
-  ts->elsize = element_size (rb->typeword);
-
-  DEBUG ("Allocating buffer for %s.%s.%s\n", rb->map, rb->board, rb->regblock);
+  if (0 != resolve_samplist (&(ts->samp), &(e->samp), rb->spf, &(ts->nsamp)))
+    return ARC_ERR_NOMEM;
+  ts->in_typeword = rb->typeword;
+  ts->in_elsize = element_size (rb->typeword);
+  ts->swap_size = swap_size (rb->typeword);
+  ts->layout = e->layout;
+  ts->red.op = reduce_op (rb->typeword, e->red.op);
+  ts->red.n = e->red.n;
+  ts->red_typeword = reduce_typeword (rb->typeword, e->red.op);
+  ts->red_elsize = element_size (ts->red_typeword);
+  ts->conv = e->conv;
+  ts->conv.type = convert_op (ts->red_typeword, &(e->conv));
+  ts->conv.utc = utc_op (ts->red_typeword, &(e->conv));
+  ts->rb->typeword = convert_typeword (ts->red_typeword, &(e->conv));
+  ts->elsize = element_size (ts->rb->typeword);
+  /* MJD and seconds go in channels of their own. */
+  ts->chan_out = (ts->conv.utc == UTC_MJDSEC) ? 2 : 1;
+  ts->rb->nchan *= ts->chan_out;
+  ts->chan.ntot *= ts->chan_out;
+  ts->spf = reduce_spf (&(ts->red), ts->nsamp);
+
+  DEBUG ("Allocating buffer for %s.%s.%s\n", rb_map (rb), rb_board (rb), rb_regblock (rb));
 
   if (!rb->do_arc)
   {
@@ -83,14 +242,43 @@ int allocate_databuf (struct regblockspec * rb, struct chanlist * chan, int numf
     return 0;
   }
 
+  /* Selected (or byte swapped) samples wait in scratch */
+  /* to be reduced or converted, and reduced ones to be  */
+  /* converted.                                          */
+  scratch_size = 0;
+  if ((ts->red.op != REDUCE_NONE) || converting (ts))
+    scratch_size += ts->nsamp * ts->in_elsize;
+  if ((ts->red.op != REDUCE_NONE) && converting (ts))
+    scratch_size += ts->spf * ts->red_elsize;
+  if (scratch_size > 0)
+  {
+    ts->scratch = malloc (scratch_size);
+    if (ts->scratch == NULL)
+      return ARC_ERR_NOMEM;
+  }
+
+  /* Statistics are of the samples as stored.  Without  */
+  /* the samples, each frame is scattered into the same  */
+  /* one-frame buffer and folded into them from there.   */
+  if (e->stats != STATS_NONE)
+  {
+    ts->stats = malloc (databuf_nchan (ts) * sizeof (struct chanstats));
+    if (ts->stats == NULL)
+      return ARC_ERR_NOMEM;
+    chanstats_init (ts->stats, databuf_nchan (ts));
+    ts->stats_only = (e->stats == STATS_ONLY);
+    if (ts->stats_only)
+      numframes = 1;
+  }
+
   if (ts->chan.n == 0)
-    ts->bufsize = numframes * ts->elsize * rb->spf * rb->nchan;
+    ts->bufsize = numframes * ts->elsize * ts->spf * ts->rb->nchan;
   else
-    ts->bufsize = numframes * ts->elsize * rb->spf * ts->chan.ntot;
+    ts->bufsize = numframes * ts->elsize * ts->spf * ts->chan.ntot;
   ts->buf = malloc (ts->bufsize);
   if (ts->buf == 0)
   {
-    printf ("Malloc failed when allocating buffer for %s.%s.%s.\n", rb->map, rb->board, rb->regblock);
+    printf ("Malloc failed when allocating buffer for %s.%s.%s.\n", rb_map (rb), rb_board (rb), rb_regblock (rb));
     return -ARC_ERR_NOMEM;
   }
 
@@ -99,6 +287,30 @@ int allocate_databuf (struct regblockspec * rb, struct chanlist * chan, int numf
   return 0;
 }
 
+int free_databuf (struct databuf * ts)
+{
+  if ((ts->buf != NULL) && (ts->maxframes > 0))
+    free (ts->buf);
+  ts->buf = NULL;
+  ts->maxframes = 0;
+  ts->numframes = 0;
+  ts->bufsize = 0;
+  free_chanlist (&(ts->chan));
+  free_samplist (&(ts->samp));
+  free (ts->scratch);
+  ts->scratch = NULL;
+  free (ts->stats);
+  ts->stats = NULL;
+  if (ts->rb != NULL)
+  {
+    strtab_unref (ts->rb->names);
+    free (ts->rb);
+  }
+  ts->rb = NULL;
+
+  return 0;
+}
+
 /* Changing number of frames is tricky - since we store the channels */
 /* as time streams, one after the other, changing the length of each */
 /* time stream means changing the offset of all the subsequent ones. */
@@ -116,14 +328,28 @@ int change_databuf_numframes (struct databuf * ts, int numframes)
     numchan = ts->chan.ntot;
 
   DEBUG ("change_databuf_numframes: %s.%s.%s: numframes=%d, elsize=%d, spf=%d, nchan=%d.\n",
-    ts->rb->map, ts->rb->board, ts->rb->regblock,
-    numframes, ts->elsize, ts->rb->spf, numchan);
+    rb_map (ts->rb), rb_board (ts->rb), rb_regblock (ts->rb),
+    numframes, ts->elsize, ts->spf, numchan);
 
-  new_bufsize = numframes * ts->elsize * ts->rb->spf * numchan;
+  new_bufsize = numframes * ts->elsize * ts->spf * numchan;
 
-  /* If old = new, just return. */
-  if (numframes == ts->maxframes)
+  /* If old = new, or we only keep one frame anyway, just return. */
+  if ((numframes == ts->maxframes) || ts->stats_only)
+    return 0;
+
+  /* By frame, the frames kept stay where they are. */
+  if ((ts->layout == LAYOUT_BY_FRAME) && (numframes > 0))
+  {
+    new_ptr = realloc (ts->buf, new_bufsize);
+    if (new_ptr == NULL)
+      return -1;
+    if ((numframes < ts->maxframes) && (ts->numframes < numframes))
+      ts->numframes = numframes;
+    ts->buf = new_ptr;
+    ts->bufsize = new_bufsize;
+    ts->maxframes = numframes;
     return 0;
+  }
 
   /* If new is zero, just free. */
   if (numframes == 0)
@@ -131,12 +357,13 @@ int change_databuf_numframes (struct databuf * ts, int numframes)
     DEBUG("Keeping zero frames -- about to free ts->buf and set ts->bufsize to 0.  Pointer was 0x%lX, size was %ld.\n", ts->buf, ts->bufsize);
     ts->bufsize = 0;
     free (ts->buf);
+    ts->buf = NULL;
     ts->maxframes = 0;
     return 0;
   }
 
-  old_chan_size = ts->maxframes * ts->rb->spf * ts->elsize;
-  new_chan_size = numframes * ts->rb->spf * ts->elsize;
+  old_chan_size = ts->maxframes * ts->spf * ts->elsize;
+  new_chan_size = numframes * ts->spf * ts->elsize;
 
   /* If old < new, reallocate and then move bytes as needed */
   if (numframes > ts->maxframes)
@@ -207,7 +434,7 @@ int check_promote_databuf (struct databuf * ts, uint32_t typeword)
   return -1;
 }
 
-int copy_to_buf (FILE * f, struct databuf * ts, int32_t * ofs)
+int copy_to_buf (FILE * f, struct databuf * ts, int32_t * ofs, int do_swap)
 {
   int r;
   int ichan;
@@ -218,7 +445,8 @@ int copy_to_buf (FILE * f, struct databuf * ts, int32_t * ofs)
   if (ts->numframes >= ts->maxframes)
     return -1;
 
-  if (ts->chan.n != 0)
+  if ((ts->chan.n != 0) || (ts->samp.n != 0) || (ts->red.op != REDUCE_NONE)
+    || converting (ts) || (ts->layout != LAYOUT_BY_CHANNEL) || (ts->stats != NULL))
     return -1;
 
   tmp = ts->buf + (ts->numframes * ts->rb->spf * ts->elsize);
@@ -231,6 +459,10 @@ int copy_to_buf (FILE * f, struct databuf * ts, int32_t * ofs)
       printf ("Tried to read %d elements, got %d.\n", ts->rb->spf, r);
       return -1;
     }
+    if (do_swap && (ts->swap_size > 0))
+      swap_copy (tmp + (ichan * ts->maxframes * ts->rb->spf * ts->elsize),
+        tmp + (ichan * ts->maxframes * ts->rb->spf * ts->elsize),
+        r * ts->elsize / ts->swap_size, ts->swap_size);
     *ofs += r * ts->elsize;
   }
 
@@ -239,29 +471,340 @@ int copy_to_buf (FILE * f, struct databuf * ts, int32_t * ofs)
   return 0;
 }
 
-int memcopy_to_buf (void * m, struct databuf * ts)
+/* Copy the selected samples of one channel's frame,  */
+/* swapping words of size swap unless it is 0.  The    */
+/* fixed-size memcpys compile to single (unaligned)    */
+/* moves.                                              */
+static void * copy_samples (void * tgt, void * src, struct samplist * samp, int elsize, int swap)
+{
+  int i, k, n;
+
+  for (i=0; i<samp->n; i++)
+  {
+    if (samp->step[i] == 1)
+    {
+      n = (samp->c2[i] - samp->c1[i] + 1) * elsize;
+      if (swap)
+        swap_copy (tgt, src + samp->c1[i] * elsize, n / swap, swap);
+      else
+        memcpy (tgt, src + samp->c1[i] * elsize, n);
+      tgt += n;
+      continue;
+    }
+    if (swap)
+    {
+      for (k=samp->c1[i]; k<=samp->c2[i]; k+=samp->step[i], tgt+=elsize)
+        swap_copy (tgt, src + k * elsize, elsize / swap, swap);
+      continue;
+    }
+    switch (elsize)
+    {
+      case 2:
+        for (k=samp->c1[i]; k<=samp->c2[i]; k+=samp->step[i], tgt+=2)
+          memcpy (tgt, src + k * 2, 2);
+        break;
+      case 4:
+        for (k=samp->c1[i]; k<=samp->c2[i]; k+=samp->step[i], tgt+=4)
+          memcpy (tgt, src + k * 4, 4);
+        break;
+      case 8:
+        for (k=samp->c1[i]; k<=samp->c2[i]; k+=samp->step[i], tgt+=8)
+          memcpy (tgt, src + k * 8, 8);
+        break;
+      default:
+        for (k=samp->c1[i]; k<=samp->c2[i]; k+=samp->step[i], tgt+=elsize)
+          memcpy (tgt, src + k * elsize, elsize);
+    }
+  }
+
+  return tgt;
+}
+
+/* Reduce each run of red->n samples to one, keeping the */
+/* running value in a local.  Means come out as doubles. */
+#define DEFINE_REDUCE(name, T) \
+static void name (int op, void * tgt, void * src, int n) \
+{ \
+  T x, a; \
+  double sum = 0; \
+  int k; \
+ \
+  memcpy (&a, src, sizeof (T)); \
+  switch (op) \
+  { \
+    case REDUCE_MIN: \
+      for (k=1; k<n; k++) \
+      { \
+        memcpy (&x, src + k * sizeof (T), sizeof (T)); \
+        if (x < a) \
+          a = x; \
+      } \
+      memcpy (tgt, &a, sizeof (T)); \
+      break; \
+    case REDUCE_MAX: \
+      for (k=1; k<n; k++) \
+      { \
+        memcpy (&x, src + k * sizeof (T), sizeof (T)); \
+        if (x > a) \
+          a = x; \
+      } \
+      memcpy (tgt, &a, sizeof (T)); \
+      break; \
+    case REDUCE_MEAN: \
+      for (k=0; k<n; k++) \
+      { \
+        memcpy (&x, src + k * sizeof (T), sizeof (T)); \
+        sum += x; \
+      } \
+      sum /= n; \
+      memcpy (tgt, &sum, sizeof (double)); \
+      break; \
+  } \
+}
+
+DEFINE_REDUCE (reduce_int8, int8_t)
+DEFINE_REDUCE (reduce_uint8, uint8_t)
+DEFINE_REDUCE (reduce_int16, int16_t)
+DEFINE_REDUCE (reduce_uint16, uint16_t)
+DEFINE_REDUCE (reduce_int32, int32_t)
+DEFINE_REDUCE (reduce_uint32, uint32_t)
+DEFINE_REDUCE (reduce_float, float)
+DEFINE_REDUCE (reduce_double, double)
+
+static void reduce_samples (struct databuf * ts, void * tgt, void * src, int nsamp)
+{
+  void (* f)(int, void *, void *, int) = NULL;
+  int win, n, k;
+
+  switch (ts->in_typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_CHAR:   f = reduce_int8;   break;
+    case GCP_REG_BOOL:
+    case GCP_REG_UCHAR:  f = reduce_uint8;  break;
+    case GCP_REG_SHORT:  f = reduce_int16;  break;
+    case GCP_REG_USHORT: f = reduce_uint16; break;
+    case GCP_REG_INT:    f = reduce_int32;  break;
+    case GCP_REG_UINT:   f = reduce_uint32; break;
+    case GCP_REG_FLOAT:  f = reduce_float;  break;
+    case GCP_REG_DOUBLE: f = reduce_double; break;
+  }
+
+  win = ((ts->red.n <= 0) || (ts->red.n > nsamp)) ? nsamp : ts->red.n;
+  for (k=0; k<nsamp; k+=win, tgt+=ts->red_elsize)
+  {
+    n = (nsamp - k < win) ? nsamp - k : win;
+    if ((ts->red.op == REDUCE_FIRST) || (f == NULL))
+      memcpy (tgt, src + k * ts->in_elsize, ts->red_elsize);
+    else
+      f (ts->red.op, tgt, src + k * ts->in_elsize, n);
+  }
+}
+
+/* Convert n samples to float or double as x * scale + offset. */
+/* The output is aligned, so these loops vectorize.             */
+#define DEFINE_CONVERT(name, T) \
+static void name (struct conversion * cv, void * tgt, void * src, int n) \
+{ \
+  double scale = cv->scale; \
+  double offset = cv->offset; \
+  float * f = tgt; \
+  double * d = tgt; \
+  T x; \
+  int k; \
+ \
+  if (cv->type == CONVERT_DOUBLE) \
+    for (k=0; k<n; k++) \
+    { \
+      memcpy (&x, src + k * sizeof (T), sizeof (T)); \
+      d[k] = x * scale + offset; \
+    } \
+  else \
+    for (k=0; k<n; k++) \
+    { \
+      memcpy (&x, src + k * sizeof (T), sizeof (T)); \
+      f[k] = x * scale + offset; \
+    } \
+}
+
+DEFINE_CONVERT (convert_int8, int8_t)
+DEFINE_CONVERT (convert_uint8, uint8_t)
+DEFINE_CONVERT (convert_int16, int16_t)
+DEFINE_CONVERT (convert_uint16, uint16_t)
+DEFINE_CONVERT (convert_int32, int32_t)
+DEFINE_CONVERT (convert_uint32, uint32_t)
+DEFINE_CONVERT (convert_float, float)
+DEFINE_CONVERT (convert_double, double)
+
+/* Decode n UTC samples, the low word of each the MJD and */
+/* the high word milliseconds into the day.  For MJDSEC,  */
+/* seconds go in the next channel.                        */
+static void decode_utc (struct databuf * ts, void * tgt, void * src, int n)
 {
+  double * d = tgt;
+  double * sec;
+  uint64_t u;
+  int k;
+
+  switch (ts->conv.utc)
+  {
+    case UTC_MJD:
+      for (k=0; k<n; k++)
+      {
+        memcpy (&u, src + k * 8, 8);
+        d[k] = (double)(u & 0xFFFFFFFF) + (double)(u >> 32) / 86400000.0;
+      }
+      break;
+    case UTC_UNIX:
+      for (k=0; k<n; k++)
+      {
+        memcpy (&u, src + k * 8, 8);
+        d[k] = ((double)(u & 0xFFFFFFFF) - MJD_UNIX_EPOCH) * 86400.0
+          + (double)(u >> 32) / 1000.0;
+      }
+      break;
+    case UTC_MJDSEC:
+      sec = tgt + chan_stride (ts);
+      for (k=0; k<n; k++)
+      {
+        memcpy (&u, src + k * 8, 8);
+        d[k] = (double)(u & 0xFFFFFFFF);
+        sec[k] = (double)(u >> 32) / 1000.0;
+      }
+      break;
+  }
+}
+
+static void convert_samples (struct databuf * ts, void * tgt, void * src, int n)
+{
+  if (ts->conv.utc != UTC_RAW)
+  {
+    decode_utc (ts, tgt, src, n);
+    return;
+  }
+  switch (ts->red_typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_CHAR:   convert_int8 (&(ts->conv), tgt, src, n);   break;
+    case GCP_REG_BOOL:
+    case GCP_REG_UCHAR:  convert_uint8 (&(ts->conv), tgt, src, n);  break;
+    case GCP_REG_SHORT:  convert_int16 (&(ts->conv), tgt, src, n);  break;
+    case GCP_REG_USHORT: convert_uint16 (&(ts->conv), tgt, src, n); break;
+    case GCP_REG_INT:    convert_int32 (&(ts->conv), tgt, src, n);  break;
+    case GCP_REG_UINT:   convert_uint32 (&(ts->conv), tgt, src, n); break;
+    case GCP_REG_FLOAT:  convert_float (&(ts->conv), tgt, src, n);  break;
+    case GCP_REG_DOUBLE: convert_double (&(ts->conv), tgt, src, n); break;
+  }
+}
+
+/* One channel's samples from one frame, byte swapped if */
+/* swap is nonzero, selected, reduced and converted.      */
+/* Steps before the last go via scratch.  The swap is     */
+/* done by the first copy out of the frame.               */
+static void copy_channel (struct databuf * ts, void * tgt, void * src, int swap)
+{
+  void * reduced;
+
+  if ((ts->red.op == REDUCE_NONE) && !converting (ts))
+  {
+    if (ts->samp.n != 0)
+      copy_samples (tgt, src, &(ts->samp), ts->elsize, swap);
+    else if (swap)
+      swap_copy (tgt, src, ts->spf * ts->elsize / swap, swap);
+    else
+      memcpy (tgt, src, ts->spf * ts->elsize);
+    return;
+  }
+
+  if (ts->samp.n != 0)
+  {
+    copy_samples (ts->scratch, src, &(ts->samp), ts->in_elsize, swap);
+    src = ts->scratch;
+  }
+  else if (swap)
+  {
+    swap_copy (ts->scratch, src, ts->nsamp * ts->in_elsize / swap, swap);
+    src = ts->scratch;
+  }
+  if (!converting (ts))
+  {
+    reduce_samples (ts, tgt, src, ts->nsamp);
+    return;
+  }
+  if (ts->red.op == REDUCE_NONE)
+  {
+    convert_samples (ts, tgt, src, ts->nsamp);
+    return;
+  }
+
+  reduced = ts->scratch + ts->nsamp * ts->in_elsize;
+  reduce_samples (ts, reduced, src, ts->nsamp);
+  convert_samples (ts, tgt, reduced, ts->spf);
+}
+
+/* Fold the frame just stored at tgt into the statistics. */
+static void add_stats (struct databuf * ts, void * tgt)
+{
+  long stride = chan_stride (ts);
+  int ichan;
+
+  for (ichan=0; ichan<databuf_nchan (ts); ichan++)
+    chanstats_add (&(ts->stats[ichan]), ts->rb->typeword, tgt + ichan * stride, ts->spf);
+}
+
+/* Scatter one frame's worth of a register block from m.  */
+/* With do_swap, samples come from a file of the other    */
+/* byte order and are swapped on the way.                 */
+int memcopy_to_buf (void * m, struct databuf * ts, int do_swap)
+{
+  int swap = do_swap ? ts->swap_size : 0;
   int ichan;
   void * tmp;
+  void * frame;
   uint32_t j = 0;
-  uint32_t chan_size, frame_chan_size;
+  uint32_t chan_size, frame_chan_size, src_chan_size;
 
   if (ts->bufsize == 0)
     return 0;
   if (ts->numframes >= ts->maxframes)
     return -1;
 
-  frame_chan_size = ts->rb->spf * ts->elsize;
-  chan_size = frame_chan_size * ts->maxframes;
-  tmp = ts->buf + (ts->numframes * frame_chan_size);
+  /* Source frames hold all rb->spf samples; we keep ts->spf. */
+  src_chan_size = ts->rb->spf * ts->in_elsize;
+  frame_chan_size = ts->spf * ts->elsize;
+  chan_size = chan_stride (ts);
+  if (ts->layout == LAYOUT_BY_FRAME)
+    tmp = ts->buf + ((long)ts->numframes * databuf_nchan (ts) * frame_chan_size);
+  else
+    tmp = ts->buf + (ts->numframes * frame_chan_size);
+  frame = tmp;
 
-  if (ts->chan.n == 0)
-    for (ichan=0; ichan<ts->rb->nchan; ichan++)
+  if ((ts->chan.n == 0) && (ts->samp.n == 0) && (ts->red.op == REDUCE_NONE)
+    && !converting (ts))
+  {
+    /* By frame, the whole block goes across in one piece. */
+    if (ts->layout == LAYOUT_BY_FRAME)
     {
-      memcpy (tmp,
-        m + j, frame_chan_size);
-      j += frame_chan_size;
-      tmp += chan_size;
+      if (swap)
+        swap_copy (tmp, m, ts->rb->nchan * frame_chan_size / swap, swap);
+      else
+        memcpy (tmp, m, ts->rb->nchan * frame_chan_size);
+    }
+    else
+      for (ichan=0; ichan<ts->rb->nchan; ichan++)
+      {
+        if (swap)
+          swap_copy (tmp, m + j, frame_chan_size / swap, swap);
+        else
+          memcpy (tmp,
+            m + j, frame_chan_size);
+        j += frame_chan_size;
+        tmp += chan_size;
+      }
+  }
+  else if (ts->chan.n == 0)
+    for (ichan=0; ichan<ts->rb->nchan / ts->chan_out; ichan++)
+    {
+      copy_channel (ts, tmp, m + ichan * src_chan_size, swap);
+      tmp += chan_size * ts->chan_out;
     }
   else
   {
@@ -269,15 +812,108 @@ int memcopy_to_buf (void * m, struct databuf * ts)
     {
       for (ichan=ts->chan.c1[j]; ichan<=ts->chan.c2[j]; ichan++)
       {
-        memcpy (tmp,
-          m + ichan * frame_chan_size, frame_chan_size);
-        tmp += chan_size;
+        copy_channel (ts, tmp, m + ichan * src_chan_size, swap);
+        tmp += chan_size * ts->chan_out;
       }
     }
   }
 
-  ts->numframes += 1;
+  if (ts->stats != NULL)
+    add_stats (ts, frame);
+  if (!ts->stats_only)
+    ts->numframes += 1;
 
   return 0;
 }
 
+static int64_t round_ms (double x)
+{
+  return (int64_t)((x < 0) ? x - 0.5 : x + 0.5);
+}
+
+int databuf_sample_kind (struct databuf * ts)
+{
+  if (ts->rb->typeword & GCP_REG_COMPLEX)
+    return SAMPLE_NONE;
+
+  switch (ts->rb->typeword & GCP_REG_TYPE)
+  {
+    case GCP_REG_CHAR:
+    case GCP_REG_SHORT:
+    case GCP_REG_INT:
+      return SAMPLE_INT;
+    case GCP_REG_BOOL:
+    case GCP_REG_UCHAR:
+    case GCP_REG_USHORT:
+    case GCP_REG_UINT:
+      return SAMPLE_UINT;
+    case GCP_REG_FLOAT:
+    case GCP_REG_DOUBLE:
+      return SAMPLE_FLOAT;
+    case GCP_REG_UTC:
+      return SAMPLE_UTC;
+  }
+
+  return SAMPLE_NONE;
+}
+
+/* The first n undecoded UTC samples of a channel as Unix */
+/* milliseconds, in a new array for the caller to free.   */
+int64_t * databuf_utc_ms (struct databuf * ts, int chan, long n)
+{
+  int64_t * ms = malloc ((n > 0 ? n : 1) * sizeof (int64_t));
+  uint64_t u;
+  long k;
+
+  if (ms == NULL)
+    return NULL;
+  for (k=0; k<n; k++)
+  {
+    memcpy (&u, databuf_sample (ts, chan, k), 8);
+    ms[k] = ((int64_t)(u & 0xFFFFFFFF) - MJD_UNIX_EPOCH) * 86400000 + (int64_t)(u >> 32);
+  }
+
+  return ms;
+}
+
+/* The UTC of a frame, day and then milliseconds, from its */
+/* first sample of a UTC register however it was decoded.  */
+int databuf_frame_utc (struct databuf * ts, long frame, uint32_t utc[2])
+{
+  uint64_t u;
+  double d, sec;
+  int64_t ms;
+
+  if (((ts->in_typeword & GCP_REG_TYPE) != GCP_REG_UTC)
+      || (ts->in_typeword & GCP_REG_COMPLEX) || (frame < 0) || (frame >= ts->numframes))
+    return -1;
+
+  if (ts->conv.utc == UTC_RAW)
+  {
+    memcpy (&u, databuf_sample (ts, 0, frame * ts->spf), 8);
+    utc[0] = u & 0xFFFFFFFF;
+    utc[1] = u >> 32;
+    return 0;
+  }
+
+  memcpy (&d, databuf_sample (ts, 0, frame * ts->spf), 8);
+  switch (ts->conv.utc)
+  {
+    case UTC_MJD:
+      ms = round_ms (d * 86400000.0);
+      break;
+    case UTC_UNIX:
+      ms = round_ms (d * 1000.0) + (int64_t)MJD_UNIX_EPOCH * 86400000;
+      break;
+    case UTC_MJDSEC:
+      memcpy (&sec, databuf_sample (ts, 1, frame * ts->spf), 8);
+      ms = (int64_t)d * 86400000 + round_ms (sec * 1000.0);
+      break;
+    default:
+      return -1;
+  }
+  utc[0] = ms / 86400000;
+  utc[1] = ms % 86400000;
+
+  return 0;
+}
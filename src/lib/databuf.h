@@ -6,9 +6,23 @@
 #include <stdio.h>
 
 #include "reglist.h"
+#include "chanstats.h"
 
 #define DO_DEBUG_DATABUF 0
 
+#define MJD_UNIX_EPOCH 40587
+
+/* What kind of number a register's samples are stored as, */
+/* for writers of typed formats.                           */
+#define SAMPLE_NONE	0	/* Complex, or unknown */
+#define SAMPLE_INT	1
+#define SAMPLE_UINT	2
+#define SAMPLE_FLOAT	3
+#define SAMPLE_UTC	4	/* Undecoded day and ms */
+
+/* rb->typeword and elsize describe the data as stored; */
+/* in_typeword and in_elsize as found in the arc file,  */
+/* and red_typeword and red_elsize after any reduction.  */
 struct databuf {
     int elsize;
     struct regblockspec * rb;
@@ -16,14 +30,49 @@ struct databuf {
     int bufsize;
     void * buf;
     struct chanlist chan;
+    struct samplist samp;	/* Resolved against rb->spf          */
+    struct reduction red;
+    int nsamp;			/* Samples selected from each frame  */
+    int spf;			/* Samples stored for each frame     */
+    uint32_t in_typeword;
+    int in_elsize;
+    uint32_t red_typeword;
+    int red_elsize;
+    struct conversion conv;
+    int chan_out;		/* Channels stored per channel read  */
+    int swap_size;		/* Word size to byte swap samples by */
+    int layout;			/* LAYOUT_BY_CHANNEL or LAYOUT_BY_FRAME */
+    void * scratch;		/* Samples between the steps of a copy */
+    struct chanstats * stats;	/* One per channel stored, or NULL   */
+    int stats_only;		/* buf only holds the frame in hand  */
 };
 
+static inline int databuf_nchan (struct databuf * ts)
+{
+  return (ts->chan.n == 0) ? ts->rb->nchan : ts->chan.ntot;
+}
+
+/* Sample i, counting through all frames, of channel c. */
+static inline void * databuf_sample (struct databuf * ts, int c, long i)
+{
+  if (ts->layout == LAYOUT_BY_FRAME)
+    return ts->buf + (((i / ts->spf) * databuf_nchan (ts) + c) * ts->spf
+      + i % ts->spf) * ts->elsize;
+
+  return ts->buf + ((long)c * ts->maxframes * ts->spf + i) * ts->elsize;
+}
+
 int element_size (uint32_t typeword);
-int allocate_databuf (struct regblockspec * rb, struct chanlist * chan, int numframes, struct databuf * ts);
+int databuf_layout (struct reglist_entry * e, int * nchan, int * spf, uint32_t * typeword);
+int allocate_databuf (struct reglist_entry * e, int numframes, struct databuf * ts);
+int free_databuf (struct databuf * ts);
 int change_databuf_numframes (struct databuf * ts, int numframes);
 int change_databuf_nchan (struct databuf * ts, int nchan);
 int check_promote_databuf (struct databuf * ts, uint32_t typeword);
-int copy_to_buf (FILE * f, struct databuf * ts, int32_t * ofs);
-int memcopy_to_buf (void * m, struct databuf * ts);
+int copy_to_buf (FILE * f, struct databuf * ts, int32_t * ofs, int do_swap);
+int memcopy_to_buf (void * m, struct databuf * ts, int do_swap);
+int databuf_frame_utc (struct databuf * ts, long frame, uint32_t utc[2]);
+int databuf_sample_kind (struct databuf * ts);
+int64_t * databuf_utc_ms (struct databuf * ts, int chan, long n);
 
 #endif
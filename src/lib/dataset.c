@@ -39,7 +39,7 @@ int init_dataset (struct dataset * ds, struct reglist * rl, int numframes)
 
   for (i=0; i<rl->num_regblocks; i++)
   {
-    r = allocate_databuf (&(rl->r[i].rb), &(rl->r[i].chan), numframes, &(ds->buf[i]));
+    r = allocate_databuf (&(rl->r[i]), numframes, &(ds->buf[i]));
     if (r != 0)
       break;
   }
@@ -63,15 +63,7 @@ int free_dataset (struct dataset * ds)
 
   DEBUG("Entering free_dataset.\n");
   for (i=0; i<ds->nb; i++)
-  {
-    if ((ds->buf[i].buf != NULL) && (ds->buf[i].maxframes > 0))
-      free (ds->buf[i].buf);
-    ds->buf[i].buf = NULL;
-    ds->buf[i].maxframes = 0;
-    free_chanlist (&(ds->buf[i].chan));
-    if (ds->buf[i].rb != NULL)
-      free (ds->buf[i].rb);
-  }
+    free_databuf (&(ds->buf[i]));
   ds->nb = 0;
   if (ds->buf != NULL)
   {
@@ -139,11 +131,28 @@ int copy_dataset (struct dataset * src, struct dataset * tgt)
 
   for (i=0; i<src->nb; i++)
   {
+    if ((src->buf[i].stats != NULL) && (tgt->buf[i].stats != NULL))
+      for (j=0; j<databuf_nchan (&(src->buf[i])); j++)
+        chanstats_merge (&(tgt->buf[i].stats[j]), &(src->buf[i].stats[j]));
+    if (src->buf[i].stats_only)
+      continue;
+
+    /* By frame, the new frames just follow the old ones. */
+    if (src->buf[i].layout == LAYOUT_BY_FRAME)
+    {
+      copy_size = (long)src->buf[i].numframes * src->buf[i].spf * src->buf[i].elsize
+        * databuf_nchan (&(src->buf[i]));
+      if (copy_size > 0)
+        memcpy (tgt->buf[i].buf + (long)tgt->buf[i].numframes * tgt->buf[i].spf
+          * tgt->buf[i].elsize * databuf_nchan (&(tgt->buf[i])), src->buf[i].buf, copy_size);
+      tgt->buf[i].numframes += src->buf[i].numframes;
+      continue;
+    }
     src_tmp = src->buf[i].buf;
-    tgt_tmp = tgt->buf[i].buf + tgt->buf[i].numframes * tgt->buf[i].rb->spf * tgt->buf[i].elsize;
-    src_chansize = src->buf[i].maxframes * src->buf[i].rb->spf * src->buf[i].elsize;
-    tgt_chansize = tgt->buf[i].maxframes * tgt->buf[i].rb->spf * tgt->buf[i].elsize;
-    copy_size = src->buf[i].numframes * src->buf[i].rb->spf * src->buf[i].elsize;
+    tgt_tmp = tgt->buf[i].buf + tgt->buf[i].numframes * tgt->buf[i].spf * tgt->buf[i].elsize;
+    src_chansize = src->buf[i].maxframes * src->buf[i].spf * src->buf[i].elsize;
+    tgt_chansize = tgt->buf[i].maxframes * tgt->buf[i].spf * tgt->buf[i].elsize;
+    copy_size = src->buf[i].numframes * src->buf[i].spf * src->buf[i].elsize;
     if (src->buf[i].chan.n == 0)
       numchan = src->buf[i].rb->nchan;
     else
@@ -159,3 +168,19 @@ int copy_dataset (struct dataset * src, struct dataset * tgt)
   return ARC_OK;
 }
 
+/* The buffer of the register named map.board.reg, or NULL. */
+struct databuf * dataset_find (struct dataset * ds, const char * name)
+{
+  char full[3 * MAX_NAME_LENGTH + 3];
+  int i;
+
+  for (i=0; i<ds->nb; i++)
+  {
+    snprintf (full, sizeof (full), "%s.%s.%s", rb_map (ds->buf[i].rb),
+      rb_board (ds->buf[i].rb), rb_regblock (ds->buf[i].rb));
+    if (!strcmp (full, name))
+      return &(ds->buf[i]);
+  }
+
+  return NULL;
+}
@@ -28,5 +28,6 @@ int free_dataset (struct dataset * ds);
 int copy_dataset (struct dataset * src, struct dataset * tgt);
 int dataset_tight_size (struct dataset * ds);
 int dataset_resize (struct dataset * ds, int nframes);
+struct databuf * dataset_find (struct dataset * ds, const char * name);
 
 #endif
@@ -73,5 +73,28 @@ int set_up_sigint ()
 int clean_up_sigint ()
 {
   sigaction (SIGINT, &old_sigint, 0);
+
+  return 0;
+}
+
+int init_arccancel (struct arccancel * c, int (* poll) (void *), void * arg)
+{
+  c->cancelled = 0;
+  c->poll = poll;
+  c->arg = arg;
+
+  return 0;
+}
+
+/* With no token, fall back on the global SIGINT flag. */
+int check_arccancel (struct arccancel * c)
+{
+  if (c == NULL)
+    return check_sigint (0);
+
+  if (!c->cancelled && (c->poll != NULL) && c->poll (c->arg))
+    c->cancelled = 1;
+
+  return c->cancelled;
 }
 
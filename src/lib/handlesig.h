@@ -18,4 +18,19 @@ int unblock_sigint ();
 int set_up_sigint ();
 int clean_up_sigint ();
 
+/* Per-call cancellation token.  If readarc is given one, it  */
+/* polls the token between blocks of frames instead of using */
+/* the process-wide SIGINT handler above, so several threads */
+/* can each run their own readarc.  Another thread may set   */
+/* cancelled directly; poll, if not NULL, is called with arg */
+/* and should return nonzero to cancel.                      */
+struct arccancel {
+    volatile sig_atomic_t cancelled;
+    int (* poll) (void * arg);
+    void * arg;
+};
+
+int init_arccancel (struct arccancel * c, int (* poll) (void *), void * arg);
+int check_arccancel (struct arccancel * c);
+
 #endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lazyarc.h"
+#include "arcstream.h"
+#include "reglist.h"
+#include "dataset.h"
+#include "databuf.h"
+#include "readarc.h"
+
+#if DO_DEBUG_LAZYARC
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(...)
+#endif
+
+/* Build the catalog from the first file's register map.   */
+/* No frame data is read.  filt must stay valid until      */
+/* lazyarc_close.                                          */
+int lazyarc_open (struct arcfilt * filt, struct lazyarc * la)
+{
+  struct arcstream s;
+  int i, r;
+
+  la->filt = filt;
+  la->col = NULL;
+  la->num_frames = -1;
+  la->rl.num_regblocks = 0;
+  la->rl.max_regblocks = 0;
+  la->rl.r = NULL;
+  la->rl.names = NULL;
+
+  r = readarc_open (filt, &s);
+  if (r != 0)
+    return r;
+
+  /* Keep the register list, drop the rest of the stream. */
+  la->rl = s.rl;
+  s.owns_rl = 0;
+  readarc_close (&s);
+  DEBUG ("lazyarc_open: %d register blocks in catalog.\n", la->rl.num_regblocks);
+
+  if (la->rl.num_regblocks == 0)
+    return ARC_OK;
+
+  la->col = malloc (la->rl.num_regblocks * sizeof (struct lazyarc_col));
+  if (la->col == NULL)
+  {
+    free_reglist (&(la->rl));
+    la->rl.r = NULL;
+    la->rl.num_regblocks = 0;
+    return ARC_ERR_NOMEM;
+  }
+  for (i=0; i<la->rl.num_regblocks; i++)
+  {
+    la->col[i].state = LAZY_UNLOADED;
+    memset (&(la->col[i].buf), 0, sizeof (struct databuf));
+  }
+
+  return ARC_OK;
+}
+
+/* Catalog index of a register block, or -1. */
+int lazyarc_find (struct lazyarc * la, char * m, char * b, char * r)
+{
+  int i;
+  int mi, bi, ri;
+  struct regblockspec * rb;
+
+  if (la->rl.num_regblocks == 0)
+    return -1;
+
+  /* A name that was never interned can't match anything. */
+  mi = strtab_find (la->rl.names, m);
+  bi = strtab_find (la->rl.names, b);
+  ri = strtab_find (la->rl.names, r);
+  if ((mi < 0) || (bi < 0) || (ri < 0))
+    return -1;
+
+  for (i=0; i<la->rl.num_regblocks; i++)
+  {
+    rb = &(la->rl.r[i].rb);
+    if ((rb->map_id == mi) && (rb->board_id == bi) && (rb->regblock_id == ri))
+      return i;
+  }
+
+  return -1;
+}
+
+/* Mark a block to be read by the next lazyarc_load. */
+int lazyarc_request (struct lazyarc * la, int i)
+{
+  if ((i < 0) || (i >= la->rl.num_regblocks))
+    return ARC_ERR_REGMAP;
+  if (la->col[i].state == LAZY_UNLOADED)
+    la->col[i].state = LAZY_PENDING;
+
+  return ARC_OK;
+}
+
+/* Read all pending blocks in a single pass over the files.  */
+/* On failure they stay pending, so the load can be retried. */
+int lazyarc_load (struct lazyarc * la)
+{
+  struct reglist sub;
+  struct arcstream s;
+  struct dataset ds;
+  int * idx;
+  int i, j, n, r;
+
+  n = 0;
+  for (i=0; i<la->rl.num_regblocks; i++)
+    if (la->col[i].state == LAZY_PENDING)
+      n++;
+  if (n == 0)
+    return ARC_OK;
+  DEBUG ("lazyarc_load: reading %d register blocks.\n", n);
+
+  sub.r = malloc (n * sizeof (struct reglist_entry));
+  idx = malloc (n * sizeof (int));
+  if ((sub.r == NULL) || (idx == NULL))
+  {
+    free (sub.r);
+    free (idx);
+    return ARC_ERR_NOMEM;
+  }
+  sub.num_regblocks = n;
+  sub.max_regblocks = n;
+  sub.utc_reg_num = -1;
+  sub.names = la->rl.names;
+  sub.time_ofs = la->rl.time_ofs;
+  memcpy (sub.t1, la->rl.t1, sizeof (sub.t1));
+  memcpy (sub.t2, la->rl.t2, sizeof (sub.t2));
+
+  /* The entries share their channel lists with the catalog. */
+  j = 0;
+  for (i=0; i<la->rl.num_regblocks; i++)
+  {
+    if (la->col[i].state != LAZY_PENDING)
+      continue;
+    sub.r[j] = la->rl.r[i];
+    idx[j] = i;
+    j++;
+  }
+
+  r = readarc_open_reglist (la->filt, &sub, &s);
+  if (r != 0)
+  {
+    free (sub.r);
+    free (idx);
+    return r;
+  }
+  r = readarc_all (&s, &ds);
+  if ((r != 0) && s.ds_ready)
+    free_dataset (&ds);
+  readarc_close (&s);
+  free (sub.r);
+  if (r != 0)
+  {
+    free (idx);
+    return r;
+  }
+
+  /* Hand each buffer over to its column. */
+  for (j=0; j<n; j++)
+  {
+    la->col[idx[j]].buf = ds.buf[j];
+    la->col[idx[j]].state = LAZY_LOADED;
+  }
+  la->num_frames = ds.num_frames;
+  free (ds.buf);
+  free (idx);
+
+  return ARC_OK;
+}
+
+/* Get a block's data, reading it (and anything else */
+/* pending) first if need be.                        */
+int lazyarc_get (struct lazyarc * la, int i, struct databuf ** buf)
+{
+  int r;
+
+  r = lazyarc_request (la, i);
+  if (r != 0)
+    return r;
+  if (la->col[i].state != LAZY_LOADED)
+  {
+    r = lazyarc_load (la);
+    if (r != 0)
+      return r;
+  }
+  *buf = &(la->col[i].buf);
+
+  return ARC_OK;
+}
+
+/* Free a block's data.  It will be read again if asked for. */
+int lazyarc_forget (struct lazyarc * la, int i)
+{
+  if ((i < 0) || (i >= la->rl.num_regblocks))
+    return ARC_ERR_REGMAP;
+  if (la->col[i].state == LAZY_LOADED)
+    free_databuf (&(la->col[i].buf));
+  la->col[i].state = LAZY_UNLOADED;
+
+  return ARC_OK;
+}
+
+int lazyarc_close (struct lazyarc * la)
+{
+  int i;
+
+  for (i=0; i<la->rl.num_regblocks; i++)
+    lazyarc_forget (la, i);
+  if (la->col != NULL)
+    free (la->col);
+  la->col = NULL;
+  if (la->rl.r != NULL)
+    free_reglist (&(la->rl));
+  la->rl.r = NULL;
+  la->rl.num_regblocks = 0;
+
+  return ARC_OK;
+}
@@ -0,0 +1,43 @@
+/*
+ * lazyarc.h - catalog the register blocks selected by a
+ *             filter up front, and read their data only
+ *             when asked for, several blocks per pass.
+ *
+ */
+
+#ifndef ARCFILE_LAZYARC_H_
+#define ARCFILE_LAZYARC_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "readarc.h"
+#include "reglist.h"
+#include "databuf.h"
+
+#define DO_DEBUG_LAZYARC 0
+
+#define LAZY_UNLOADED	0
+#define LAZY_PENDING	1
+#define LAZY_LOADED	2
+
+struct lazyarc_col {
+    int state;
+    struct databuf buf;	/* Valid when state is LAZY_LOADED */
+};
+
+struct lazyarc {
+    struct arcfilt * filt;
+    struct reglist rl;		/* Catalog of selected register blocks */
+    struct lazyarc_col * col;	/* One per catalog entry               */
+    int num_frames;		/* Frames per block, -1 until a load   */
+};
+
+int lazyarc_open (struct arcfilt * filt, struct lazyarc * la);
+int lazyarc_find (struct lazyarc * la, char * m, char * b, char * r);
+int lazyarc_request (struct lazyarc * la, int i);
+int lazyarc_load (struct lazyarc * la);
+int lazyarc_get (struct lazyarc * la, int i, struct databuf ** buf);
+int lazyarc_forget (struct lazyarc * la, int i);
+int lazyarc_close (struct lazyarc * la);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "namelist.h"
+#include "namematch.h"
 #include "readarc.h"
 
 #if DO_DEBUG_NAMELIST
@@ -110,7 +111,96 @@ static int count_sort_chanlist (struct chanlist * chan)
   return 0;
 }
 
-static int parse_chans (char * s, struct chanlist * cl, struct chanlist * sl)
+/* Parse one number of a sample range, or '*' for the end */
+/* of the frame if allow_end is set.  Returns characters  */
+/* used, or 0 if there's no number here.                  */
+static int parse_samp_num (char * s, int allow_end, int * v)
+{
+  char * e;
+  long l;
+
+  if (allow_end && (s[0] == '*'))
+  {
+    *v = SAMP_END;
+    return 1;
+  }
+  l = strtol (s, &e, 10);
+  if ((e == s) || (l < 0))
+    return 0;
+  *v = l;
+
+  return e - s;
+}
+
+/* Sample list, e.g. [0:99], [0:*:10], [5,7,100:*] */
+static int parse_samps (char * s, struct samplist * sl)
+{
+  int j, k, n;
+  int c1, c2, step;
+
+  j = 1;
+  n = 0;
+  for (k=0; s[k] != '\0'; k++)
+    if (s[k] == ',')
+      n++;
+  n++;
+  sl->c1 = malloc (n * sizeof (int));
+  sl->c2 = malloc (n * sizeof (int));
+  sl->step = malloc (n * sizeof (int));
+  if ((sl->c1 == NULL) || (sl->c2 == NULL) || (sl->step == NULL))
+  {
+    free (sl->c1);
+    free (sl->c2);
+    free (sl->step);
+    sl->n = -1;
+    return j;
+  }
+  sl->n = 0;
+  while (sl->n < n)
+  {
+    while ((s[j] == ' ') || (s[j] == ',')) j++;
+    k = parse_samp_num (s+j, 0, &c1);
+    if (k == 0)
+      break;
+    j += k;
+    c2 = c1;
+    step = 1;
+    if (s[j] == ':')
+    {
+      k = parse_samp_num (s+j+1, 1, &c2);
+      if (k == 0)
+        break;
+      j += k + 1;
+      if (s[j] == ':')
+      {
+        k = parse_samp_num (s+j+1, 0, &step);
+        if ((k == 0) || (step == 0))
+          break;
+        j += k + 1;
+      }
+    }
+    DEBUG ("Samples %d-%d step %d.\n", c1, c2, step);
+    sl->c1[sl->n] = c1;
+    sl->c2[sl->n] = c2;
+    sl->step[sl->n] = step;
+    sl->n++;
+  }
+
+  /* As with channels, an empty list keeps nothing. */
+  if (sl->n == 0)
+  {
+    free (sl->c1);
+    free (sl->c2);
+    free (sl->step);
+    sl->n = -1;
+  }
+  while ((s[j] != '\0') && (s[j] != ']')) j++;
+  if (s[j] == ']') j++;
+
+  return j;
+}
+
+static int parse_chans (char * s, struct chanlist * cl, struct samplist * sl)
 {
   int n, j, k;
   int ntmp;
@@ -121,6 +211,7 @@ static int parse_chans (char * s, struct chanlist * cl, struct chanlist * sl)
   sl->n = 0;
   sl->c1 = NULL;
   sl->c2 = NULL;
+  sl->step = NULL;
 
   j = 0;
   while (s[j] == ' ') j++;
@@ -133,7 +224,7 @@ static int parse_chans (char * s, struct chanlist * cl, struct chanlist * sl)
     return j;
   }
   j+=1;
-  len = strlen (s+j);
+  len = j + strlen (s+j);
   ntmp = (len + 1) / 2;
   cl->n = 0;
   c1tmp = malloc (ntmp * sizeof(int));
@@ -174,10 +265,168 @@ static int parse_chans (char * s, struct chanlist * cl, struct chanlist * sl)
     cl->n=-1;
   }
 
+  /* A second bracket picks samples within each frame. */
+  while ((s[j] != '\0') && (s[j] != ']')) j++;
+  if (s[j] == ']') j++;
+  while (s[j] == ' ') j++;
+  if (s[j] == '[')
+    j += parse_samps (s+j, sl);
+
   DEBUG("Parsed channel numbers in %d characters.\n", j);
   return j;
 }
 
+/* Reduction suffix, e.g. {mean:10}, {max}, {first:4} */
+static int parse_reduction (char * s, struct reduction * red)
+{
+  const char * ops[] = {"first", "mean", "min", "max"};
+  size_t i;
+  int len;
+
+  red->op = REDUCE_NONE;
+  red->n = 0;
+  for (i=0; i<sizeof(ops)/sizeof(ops[0]); i++)
+  {
+    len = strlen (ops[i]);
+    if (strncmp (s+1, ops[i], len) != 0)
+      continue;
+    if ((s[len+1] == ':') && (sscanf (s+len+2, "%d", &(red->n)) == 1) && (red->n >= 0))
+    {
+      red->op = REDUCE_FIRST + i;
+      return 0;
+    }
+    if (s[len+1] == '}')
+    {
+      red->op = REDUCE_FIRST + i;
+      return 0;
+    }
+  }
+  printf ("Unknown reduction or conversion %s, ignoring it.\n", s);
+  red->n = 0;
+
+  return -1;
+}
+
+static int conv_name (const char * s, const char * name)
+{
+  int len = strlen (name);
+
+  if (strncmp (s, name, len) != 0)
+    return 0;
+  if ((s[len] != '\0') && (s[len] != ':') && (s[len] != ',') && (s[len] != '}'))
+    return 0;
+
+  return len;
+}
+
+/* One conversion: a type, with an optional :scale:offset, */
+/* or a way to decode UTC registers.  Returns the rest of  */
+/* s, or NULL if it isn't one.                             */
+static const char * parse_one_conversion (const char * s, struct conversion * cv)
+{
+  const char * types[] = {"float32", "f32", "float", "float64", "f64", "double"};
+  const char * utcs[] = {"raw", "mjd", "unix", "mjdsec"};
+  char * end;
+  size_t i;
+  int len;
+
+  for (i=0; i<sizeof(utcs)/sizeof(utcs[0]); i++)
+  {
+    len = conv_name (s, utcs[i]);
+    if ((len > 0) && (s[len] != ':'))
+    {
+      cv->utc = UTC_RAW + i;
+      return s + len;
+    }
+  }
+
+  for (i=0; i<sizeof(types)/sizeof(types[0]); i++)
+  {
+    len = conv_name (s, types[i]);
+    if (len > 0)
+      break;
+  }
+  if (i == sizeof(types)/sizeof(types[0]))
+    return NULL;
+  cv->type = (i < 3) ? CONVERT_FLOAT : CONVERT_DOUBLE;
+  cv->scale = 1;
+  cv->offset = 0;
+
+  s += len;
+  if (*s == ':')
+  {
+    cv->scale = strtod (s+1, &end);
+    if (end == s+1)
+      return NULL;
+    s = end;
+  }
+  if (*s == ':')
+  {
+    cv->offset = strtod (s+1, &end);
+    if (end == s+1)
+      return NULL;
+    s = end;
+  }
+
+  return s;
+}
+
+/* Conversions separated by commas, e.g. f64:scale:offset,mjd, */
+/* alone or ending a {...} suffix.  Returns -1, leaving cv     */
+/* alone, if s isn't a list of them.                           */
+int parse_conversion (const char * s, struct conversion * cv)
+{
+  struct conversion tmp = *cv;
+
+  while (1)
+  {
+    s = parse_one_conversion (s, &tmp);
+    if (s == NULL)
+      return -1;
+    if (*s != ',')
+      break;
+    s++;
+  }
+  if ((*s != '\0') && (*s != '}'))
+    return -1;
+  *cv = tmp;
+
+  return 0;
+}
+
+/* Does the '[' at s[0] start a channel list, rather than a */
+/* character class?  Only if it holds nothing but numbers,  */
+/* colons, commas and spaces (and '*' for a sample list),   */
+/* and it and any sample list end the whole spec.           */
+static int is_chanlist (char * s)
+{
+  int i = 1;
+  int nbr = 1;
+
+  while (s[i] != '\0')
+  {
+    if ((s[i] == '[') && (nbr == 1))
+      return 0;
+    if (s[i] == ']')
+    {
+      /* Only a sample list may follow. */
+      i++;
+      while (s[i] == ' ')
+        i++;
+      if ((s[i] != '[') || (nbr == 2))
+        break;
+      nbr++;
+    }
+    else if (((s[i] < '0') || (s[i] > '9')) && (strchr (":,* ", s[i]) == NULL))
+      return 0;
+    i++;
+  }
+  while (s[i] == ' ')
+    i++;
+
+  return (s[i] == '\0');
+}
+
 static int parse_name_part (char * s, char ** p)
 {
   int i = 0;
@@ -186,6 +435,16 @@ static int parse_name_part (char * s, char ** p)
   n = -1;
   while (i < MAX_NAME_LENGTH)
   {
+    if ((s[i]=='[') && !is_chanlist (s+i))
+    {
+      /* Character class: copy through to its close. */
+      i++;
+      while ((i < MAX_NAME_LENGTH) && (s[i] != '\0') && (s[i] != ']'))
+        i++;
+      if (s[i] == ']')
+        i++;
+      continue;
+    }
     if ((s[i]=='\0') || (s[i]=='['))
     {
       n = i;
@@ -214,41 +473,97 @@ static int parse_name_part (char * s, char ** p)
 int create_namelist (int n, char ** s, struct namelist * f)
 {
   int i, j, k;
+  int nexcl;
+  char * p;
+  char * brace;
+  char spec[4*MAX_NAME_LENGTH];
 
-  f->s = malloc (n * sizeof (struct search_spec));
+  /* Leave room for a catch-all, in case there are only exclusions. */
+  f->s = malloc ((n + 1) * sizeof (struct search_spec));
   if (f->s == NULL)
     return ARC_ERR_NOMEM;
   f->n = n;
+  f->match = NULL;
 
+  nexcl = 0;
   for (i=0; i<n; i++)
   {
     f->s[i].m = NULL;
     f->s[i].b = NULL;
     f->s[i].r = NULL;
+    f->s[i].chan.n = 0;
+    f->s[i].samp.n = 0;
+    f->s[i].red.op = REDUCE_NONE;
+    f->s[i].red.n = 0;
+    f->s[i].conv.type = CONVERT_NONE;
+    f->s[i].conv.scale = 1;
+    f->s[i].conv.offset = 0;
+    f->s[i].conv.utc = UTC_RAW;
+
+    /* A leading ! drops matching registers. */
+    p = s[i];
+    f->s[i].exclude = (p[0] == '!');
+    if (f->s[i].exclude)
+    {
+      p++;
+      nexcl++;
+    }
 
-    j = parse_name_part (s[i], &(f->s[i].m));
+    /* Trailing {...} groups reduce or convert the samples; */
+    /* cut them off before parsing the name.                 */
+    while (((brace = strrchr (p, '{')) != NULL) && (p[strlen (p) - 1] == '}')
+      && (brace >= p) && ((size_t)(brace - p) < sizeof (spec)))
+    {
+      if (parse_conversion (brace + 1, &(f->s[i].conv)) != 0)
+        parse_reduction (brace, &(f->s[i].red));
+      memmove (spec, p, brace - p);
+      spec[brace - p] = '\0';
+      p = spec;
+    }
+
+    j = parse_name_part (p, &(f->s[i].m));
     if (j < 0)
       continue;
 
-    k = parse_name_part (s[i]+j, &(f->s[i].b));
+    k = parse_name_part (p+j, &(f->s[i].b));
     if (k < 0)
       continue;
     j += k;
 
-    k = parse_name_part (s[i]+j, &(f->s[i].r));
+    k = parse_name_part (p+j, &(f->s[i].r));
     if (k < 0)
       continue;
     j += k;
 
-    /* FIXME: parse and handle sample selections */
-    k = parse_chans (s[i]+j, &(f->s[i].chan), &(f->s[i].samp));
+    k = parse_chans (p+j, &(f->s[i].chan), &(f->s[i].samp));
     count_sort_chanlist (&(f->s[i].chan));
-    count_sort_chanlist (&(f->s[i].samp));
+  }
+  if ((n > 0) && (nexcl == n))
+  {
+    f->s[n].m = malloc (1);
+    if (f->s[n].m == NULL)
+    {
+      free_namelist (f);
+      return ARC_ERR_NOMEM;
+    }
+    f->s[n].m[0] = '\0';
+    f->s[n].b = NULL;
+    f->s[n].r = NULL;
+    f->s[n].chan.n = 0;
+    f->s[n].samp.n = 0;
+    f->s[n].red.op = REDUCE_NONE;
+    f->s[n].red.n = 0;
+    f->s[n].conv.type = CONVERT_NONE;
+    f->s[n].conv.scale = 1;
+    f->s[n].conv.offset = 0;
+    f->s[n].conv.utc = UTC_RAW;
+    f->s[n].exclude = 0;
+    f->n++;
   }
 #if DO_DEBUG_NAMELIST
-  for (i=0; i<n; i++)
+  for (i=0; i<f->n; i++)
   {
-    DEBUG("Filter %d: <%s> <%s> <%s>", i, f->s[i].m, f->s[i].b, f->s[i].r);
+    DEBUG("Filter %d: %s<%s> <%s> <%s>", i, f->s[i].exclude ? "!" : "", f->s[i].m, f->s[i].b, f->s[i].r);
     if (f->s[i].chan.n > 0)
     {
       DEBUG(" [ ");
@@ -265,6 +580,16 @@ int create_namelist (int n, char ** s, struct namelist * f)
 
   f->nutc = -1;
 
+  if (f->n > 0)
+  {
+    f->match = compile_name_matcher (f);
+    if (f->match == NULL)
+    {
+      free_namelist (f);
+      return ARC_ERR_NOMEM;
+    }
+  }
+
   return 0;
 }
 
@@ -279,83 +604,29 @@ int free_namelist (struct namelist * f)
     CHECK_FREE(f->s[i].b);
     CHECK_FREE(f->s[i].r);
     free_chanlist (&(f->s[i].chan));
-    free_chanlist (&(f->s[i].samp));
+    free_samplist (&(f->s[i].samp));
   }
   CHECK_FREE(f->s);
+  /* Front ends may set up an empty namelist by hand. */
+  if (f->n > 0)
+    free_name_matcher (f->match);
+  f->s = NULL;
+  f->n = 0;
 
   return ARC_OK;
 }
 
-/* Test a single string against name filter. */
-static int test_name_part (char * s, char * f)
-{
-  int i, flen, slen;
-
-  /* Null input is a match. */
-  if ((f == NULL) || (s == NULL))
-    return 1;
-
-  DEBUG2 ("Testing name part %s against filter %s.\n", s, f);
-
-  flen = strlen (f);
-  slen = strlen (s);
-
-  /* Zero-length input is a match. */
-  if ((flen == 0) || (slen == 0))
-    return 1;
-
-  /* Loop over characters */
-  i = 0;
-  while (i < flen)
-  {
-    /* If we hit a wild card, it's a match. */
-    if (f[i] == '*')
-      return 1;
-    /* If we get to the end of the test string, no match. */
-    if (i == slen)
-      break;
-    /* If we hit a mismatch, give up on this filter string. */
-    if (f[i] != s[i])
-      break;
-    /* If we get to the end, it's a match. */
-    if ((i == flen-1) && (i == slen-1))
-      return 1;
-
-    i++;
-  }
-  /* Didn't match. */
-  return 0;
-}
-
 /* Test whether a register m.b.r matches one of the entries */
-/* in the name list.  Wild cards are supported, but only at */
-/* the end of a name part.  Return -1 if no match, or index */
-/* of matching entry if a match is found - don't if(result) */
+/* in the name list.  Any of m, b, r may be NULL to test a  */
+/* whole map or board.  Return -1 if no match, or index of  */
+/* matching entry if a match is found - don't if(result)    */
 int test_reg_name (char * m, char * b, char * r, struct namelist * f)
 {
-  int j;
-
   DEBUG2 ("test_reg_name against %d filters.\n", f->n);
-  /* Loop over filter strings */
-  for (j=0; j<f->n; j++)
-  {
-    /* Try each part, and jump out if no match */
-    /* Treat null input as a match             */
-    if ((m != NULL) && !test_name_part (m, f->s[j].m))
-      continue;
-    if ((b != NULL) && !test_name_part (b, f->s[j].b))
-      continue;
-    if ((r != NULL) && !test_name_part (r, f->s[j].r))
-      continue;
-
-    DEBUG2 ("Match.\n");
-    /* If we got here, it's a match. */
-    return j;
-  }
+  if (f->n <= 0)
+    return -1;
 
-  DEBUG2 ("No match.\n");
-  /* Nothing matched. */
-  return -1;
+  return name_matcher_test (f, m, b, r);
 }
 
 int copy_chanlist (struct chanlist * dst, struct chanlist * src)
@@ -412,3 +683,92 @@ int free_chanlist (struct chanlist * chan)
   return ARC_OK;
 }
 
+int copy_samplist (struct samplist * dst, struct samplist * src)
+{
+  dst->c1 = NULL;
+  dst->c2 = NULL;
+  dst->step = NULL;
+  if ((src == NULL) || (src->n <= 0))
+  {
+    dst->n = (src == NULL) ? 0 : src->n;
+    return ARC_OK;
+  }
+  dst->n = 0;
+  dst->c1 = malloc (src->n * sizeof (int));
+  dst->c2 = malloc (src->n * sizeof (int));
+  dst->step = malloc (src->n * sizeof (int));
+  if ((dst->c1 == NULL) || (dst->c2 == NULL) || (dst->step == NULL))
+  {
+    free (dst->c1);
+    free (dst->c2);
+    free (dst->step);
+    return ARC_ERR_NOMEM;
+  }
+  memcpy (dst->c1, src->c1, src->n * sizeof(int));
+  memcpy (dst->c2, src->c2, src->n * sizeof(int));
+  memcpy (dst->step, src->step, src->n * sizeof(int));
+  dst->n = src->n;
+
+  return ARC_OK;
+}
+
+/* Fit a sample list to a register with spf samples per */
+/* frame: clip the ranges, drop empty ones, and count   */
+/* the samples kept in *nsamp.  A list that keeps the   */
+/* whole frame becomes n=0, so it can be copied whole.  */
+int resolve_samplist (struct samplist * dst, struct samplist * src, int spf, int * nsamp)
+{
+  int i, c2;
+  int r;
+
+  *nsamp = spf;
+  r = copy_samplist (dst, src);
+  if ((r != 0) || (dst->n == 0))
+    return r;
+  *nsamp = 0;
+  if (dst->n < 0)
+    return ARC_OK;
+
+  r = 0;
+  for (i=0; i<dst->n; i++)
+  {
+    c2 = dst->c2[i];
+    if ((c2 == SAMP_END) || (c2 >= spf))
+      c2 = spf - 1;
+    if (dst->c1[i] > c2)
+      continue;
+    /* End each range on a sample it keeps. */
+    c2 -= (c2 - dst->c1[i]) % dst->step[i];
+    dst->c1[r] = dst->c1[i];
+    dst->c2[r] = c2;
+    dst->step[r] = dst->step[i];
+    *nsamp += (c2 - dst->c1[i]) / dst->step[i] + 1;
+    r++;
+  }
+  if ((r == 0) || ((r == 1) && (dst->c1[0] == 0) && (dst->c2[0] == spf - 1) && (dst->step[0] == 1)))
+  {
+    free_samplist (dst);
+    if (r == 0)
+      dst->n = -1;
+  }
+  else
+    dst->n = r;
+
+  return ARC_OK;
+}
+
+int free_samplist (struct samplist * samp)
+{
+  if (samp->n > 0)
+  {
+    free (samp->c1);
+    free (samp->c2);
+    free (samp->step);
+  }
+  samp->c1 = NULL;
+  samp->c2 = NULL;
+  samp->step = NULL;
+  samp->n = 0;
+
+  return ARC_OK;
+}
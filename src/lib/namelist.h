@@ -22,18 +22,66 @@ struct chanlist {
     int * c2;
 };
 
+/* Samples to keep from each frame: c1 to c2 (inclusive) */
+/* every step samples, with c2 = SAMP_END for the last.   */
+#define SAMP_END -1
+
+struct samplist {
+    int n;
+    int * c1;
+    int * c2;
+    int * step;
+};
+
+/* Reduce each run of n samples (n=0: each frame) to one. */
+#define REDUCE_NONE	0
+#define REDUCE_FIRST	1
+#define REDUCE_MEAN	2
+#define REDUCE_MIN	3
+#define REDUCE_MAX	4
+
+struct reduction {
+    int op;
+    int n;
+};
+
+/* Store each sample as x * scale + offset, converted to */
+/* float or double as it is read.                       */
+#define CONVERT_NONE	0
+#define CONVERT_FLOAT	1
+#define CONVERT_DOUBLE	2
+
+/* UTC registers can be decoded to MJD, to Unix seconds, or */
+/* to an MJD channel followed by a seconds-of-day channel.  */
+#define UTC_RAW		0
+#define UTC_MJD		1
+#define UTC_UNIX	2
+#define UTC_MJDSEC	3
+
+struct conversion {
+    int type;
+    double scale, offset;
+    int utc;
+};
+
 struct search_spec {
     char * m;
     char * b;
     char * r;
     struct chanlist chan;
-    struct chanlist samp;
+    struct samplist samp;
+    struct reduction red;
+    struct conversion conv;
+    int exclude;		/* Drop matches, from a leading '!' */
 };
 
+struct name_matcher;
+
 struct namelist {
     int n;
     struct search_spec * s;
     int nutc;
+    struct name_matcher * match;	/* Compiled from s by create_namelist */
 };
 
 int create_namelist (int n, char ** s, struct namelist * f);
@@ -41,5 +89,9 @@ int test_reg_name (char * m, char * b, char * r, struct namelist * f);
 int free_namelist (struct namelist * f);
 int copy_chanlist (struct chanlist * dst, struct chanlist * src);
 int free_chanlist (struct chanlist * chan);
+int copy_samplist (struct samplist * dst, struct samplist * src);
+int resolve_samplist (struct samplist * dst, struct samplist * src, int spf, int * nsamp);
+int free_samplist (struct samplist * samp);
+int parse_conversion (const char * s, struct conversion * cv);
 
 #endif
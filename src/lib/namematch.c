@@ -0,0 +1,450 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "namematch.h"
+#include "namelist.h"
+#include "readarc.h"
+
+#if DO_DEBUG_NAMEMATCH
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(...)
+#endif
+
+#define GLOB_LIT	0
+#define GLOB_ANY	1
+#define GLOB_STAR	2
+#define GLOB_CLASS	3
+
+/* One name part, compiled */
+struct glob {
+    int n;			/* Number of ops                       */
+    unsigned char * op;
+    unsigned char * arg;	/* Character, or class number          */
+    uint8_t (* cls)[32];	/* Class bitmaps, one bit per character */
+    int all;			/* Matches anything                    */
+    int first;			/* Literal first character, or -1      */
+};
+
+struct name_bucket {
+    int n;
+    int * idx;
+};
+
+struct name_matcher {
+    int n;
+    struct glob (* g)[3];	/* Map, board and block part of each entry */
+    /* Entries by the literal first character of their map */
+    /* part, with those starting with a wild card in 256.   */
+    struct name_bucket first[257];
+};
+
+/* Index of the ']' closing a class that opens at s[i], or -1. */
+static int class_end (const char * s, int i)
+{
+  int k = i + 1;
+
+  if ((s[k] == '!') || (s[k] == '^'))
+    k++;
+  /* A ']' straight after the opening is part of the class. */
+  if (s[k] == ']')
+    k++;
+  while ((s[k] != '\0') && (s[k] != ']'))
+    k++;
+
+  return (s[k] == ']') ? k : -1;
+}
+
+static void compile_class (const char * s, int i, int j, uint8_t cls[32])
+{
+  int k, c, neg;
+
+  memset (cls, 0, 32);
+  k = i + 1;
+  neg = ((s[k] == '!') || (s[k] == '^'));
+  if (neg)
+    k++;
+  while (k < j)
+  {
+    if ((s[k+1] == '-') && (k+2 < j))
+    {
+      for (c=(unsigned char)s[k]; c<=(unsigned char)s[k+2]; c++)
+        cls[c >> 3] |= (1 << (c & 7));
+      k += 3;
+    }
+    else
+    {
+      c = (unsigned char)s[k];
+      cls[c >> 3] |= (1 << (c & 7));
+      k++;
+    }
+  }
+  if (neg)
+    for (k=0; k<32; k++)
+      cls[k] = ~cls[k];
+}
+
+static int compile_glob (const char * s, struct glob * g)
+{
+  int len, ncls;
+  int i, j;
+
+  g->n = 0;
+  g->op = NULL;
+  g->arg = NULL;
+  g->cls = NULL;
+  g->all = 1;
+  g->first = -1;
+  if ((s == NULL) || (s[0] == '\0'))
+    return ARC_OK;
+
+  len = strlen (s);
+  ncls = 0;
+  for (i=0; i<len; i++)
+    if (s[i] == '[')
+      ncls++;
+  g->op = malloc (len);
+  g->arg = malloc (len);
+  if (ncls > 0)
+    g->cls = malloc (ncls * sizeof (*(g->cls)));
+  if ((g->op == NULL) || (g->arg == NULL) || ((ncls > 0) && (g->cls == NULL)))
+    return ARC_ERR_NOMEM;
+
+  ncls = 0;
+  i = 0;
+  while (i < len)
+  {
+    switch (s[i])
+    {
+      case '*':
+        /* Runs of stars are the same as one. */
+        if ((g->n == 0) || (g->op[g->n-1] != GLOB_STAR))
+          g->op[g->n++] = GLOB_STAR;
+        i++;
+        continue;
+      case '?':
+        g->op[g->n++] = GLOB_ANY;
+        i++;
+        continue;
+      case '[':
+        j = class_end (s, i);
+        if (j < 0)
+          break;
+        compile_class (s, i, j, g->cls[ncls]);
+        g->op[g->n] = GLOB_CLASS;
+        g->arg[g->n++] = ncls++;
+        i = j + 1;
+        continue;
+    }
+    g->op[g->n] = GLOB_LIT;
+    g->arg[g->n++] = s[i];
+    i++;
+  }
+
+  g->all = (g->n == 1) && (g->op[0] == GLOB_STAR);
+  if (g->op[0] == GLOB_LIT)
+    g->first = g->arg[0];
+
+  return ARC_OK;
+}
+
+static void free_glob (struct glob * g)
+{
+  free (g->op);
+  free (g->arg);
+  free (g->cls);
+}
+
+/* Match a whole string.  A star remembers where it was, */
+/* and a mismatch later on backs up to let it take one   */
+/* more character; there's no deeper backtracking.       */
+static int glob_match (struct glob * g, const char * s)
+{
+  const unsigned char * p = (const unsigned char *)s;
+  const unsigned char * star_p = NULL;
+  int star = -1;
+  int i = 0;
+  int ok;
+
+  if (g->all)
+    return 1;
+
+  while (*p)
+  {
+    ok = 0;
+    if (i < g->n)
+    {
+      switch (g->op[i])
+      {
+        case GLOB_LIT:
+          ok = (g->arg[i] == *p);
+          break;
+        case GLOB_ANY:
+          ok = 1;
+          break;
+        case GLOB_CLASS:
+          ok = (g->cls[g->arg[i]][*p >> 3] >> (*p & 7)) & 1;
+          break;
+        case GLOB_STAR:
+          star = i++;
+          star_p = p;
+          continue;
+      }
+    }
+    if (ok)
+    {
+      i++;
+      p++;
+    }
+    else if (star >= 0)
+    {
+      i = star + 1;
+      p = ++star_p;
+    }
+    else
+      return 0;
+  }
+  while ((i < g->n) && (g->op[i] == GLOB_STAR))
+    i++;
+
+  return (i == g->n);
+}
+
+static int bucket_add (struct name_bucket * b, int i)
+{
+  int * tmp;
+
+  tmp = realloc (b->idx, (b->n + 1) * sizeof (int));
+  if (tmp == NULL)
+    return ARC_ERR_NOMEM;
+  b->idx = tmp;
+  b->idx[b->n++] = i;
+
+  return ARC_OK;
+}
+
+struct name_matcher * compile_name_matcher (struct namelist * f)
+{
+  struct name_matcher * nm;
+  int i, k, r;
+
+  nm = calloc (1, sizeof (struct name_matcher));
+  if (nm == NULL)
+    return NULL;
+  nm->g = calloc (f->n, sizeof (*(nm->g)));
+  if ((f->n > 0) && (nm->g == NULL))
+  {
+    free (nm);
+    return NULL;
+  }
+  nm->n = f->n;
+
+  r = ARC_OK;
+  for (i=0; (r == ARC_OK) && (i<f->n); i++)
+  {
+    r = compile_glob (f->s[i].m, &(nm->g[i][0]));
+    if (r == ARC_OK)
+      r = compile_glob (f->s[i].b, &(nm->g[i][1]));
+    if (r == ARC_OK)
+      r = compile_glob (f->s[i].r, &(nm->g[i][2]));
+    if (r != ARC_OK)
+      break;
+    k = nm->g[i][0].first;
+    r = bucket_add (&(nm->first[(k < 0) ? 256 : k]), i);
+  }
+  if (r != ARC_OK)
+  {
+    free_name_matcher (nm);
+    return NULL;
+  }
+  DEBUG ("Compiled %d name patterns.\n", nm->n);
+
+  return nm;
+}
+
+void free_name_matcher (struct name_matcher * nm)
+{
+  int i;
+
+  if (nm == NULL)
+    return;
+  for (i=0; i<nm->n; i++)
+  {
+    free_glob (&(nm->g[i][0]));
+    free_glob (&(nm->g[i][1]));
+    free_glob (&(nm->g[i][2]));
+  }
+  for (i=0; i<257; i++)
+    free (nm->first[i].idx);
+  free (nm->g);
+  free (nm);
+}
+
+/* Does entry i match as far as the names given?  A NULL */
+/* name matches anything.                                */
+static int entry_match (struct glob * g, char * m, char * b, char * r)
+{
+  if ((m != NULL) && !glob_match (&(g[0]), m))
+    return 0;
+  if ((b != NULL) && !glob_match (&(g[1]), b))
+    return 0;
+  if ((r != NULL) && !glob_match (&(g[2]), r))
+    return 0;
+
+  return 1;
+}
+
+/* As test_reg_name, without the cursor's narrowing.  An   */
+/* exclusion only rules out a partial name (map, or map &  */
+/* board) if it covers everything under it.                */
+int name_matcher_test (struct namelist * f, char * m, char * b, char * r)
+{
+  struct name_matcher * nm = f->match;
+  struct glob * g;
+  int i;
+
+  for (i=0; i<nm->n; i++)
+  {
+    if (!f->s[i].exclude)
+      continue;
+    g = nm->g[i];
+    if (!entry_match (g, m, b, r))
+      continue;
+    if ((b == NULL) && !g[1].all)
+      continue;
+    if ((r == NULL) && !g[2].all)
+      continue;
+    return -1;
+  }
+
+  for (i=0; i<nm->n; i++)
+    if (!f->s[i].exclude && entry_match (nm->g[i], m, b, r))
+      return i;
+
+  return -1;
+}
+
+int name_cursor_init (struct name_cursor * c, struct namelist * f)
+{
+  c->f = f;
+  c->nmap = 0;
+  c->nboard = 0;
+  c->map_cand = malloc ((f->n + 1) * sizeof (int));
+  c->board_cand = malloc ((f->n + 1) * sizeof (int));
+  if ((c->map_cand == NULL) || (c->board_cand == NULL))
+  {
+    free (c->map_cand);
+    free (c->board_cand);
+    return ARC_ERR_NOMEM;
+  }
+
+  return ARC_OK;
+}
+
+void name_cursor_free (struct name_cursor * c)
+{
+  free (c->map_cand);
+  free (c->board_cand);
+  c->map_cand = NULL;
+  c->board_cand = NULL;
+}
+
+/* Start on a new map.  Keeps the entries whose map part */
+/* matches, looking only at those that could: ones whose */
+/* pattern starts with m's first character, or with a    */
+/* wild card.  Returns -1 if nothing in the map can be   */
+/* selected, 0 otherwise.                                */
+int name_cursor_map (struct name_cursor * c, char * m)
+{
+  struct name_matcher * nm = c->f->match;
+  struct name_bucket * b1;
+  struct name_bucket * b2;
+  int i1 = 0, i2 = 0;
+  int i, any = 0;
+
+  c->nmap = 0;
+  c->nboard = 0;
+  /* An empty namelist matches nothing. */
+  if (nm == NULL)
+    return -1;
+  b1 = &(nm->first[(unsigned char)m[0]]);
+  b2 = &(nm->first[256]);
+  while ((i1 < b1->n) || (i2 < b2->n))
+  {
+    /* Merge the two buckets, keeping namelist order. */
+    if ((i2 >= b2->n) || ((i1 < b1->n) && (b1->idx[i1] < b2->idx[i2])))
+      i = b1->idx[i1++];
+    else
+      i = b2->idx[i2++];
+
+    if (!glob_match (&(nm->g[i][0]), m))
+      continue;
+    if (c->f->s[i].exclude)
+    {
+      if (nm->g[i][1].all && nm->g[i][2].all)
+      {
+        c->nmap = 0;
+        return -1;
+      }
+    }
+    else
+      any = 1;
+    c->map_cand[c->nmap++] = i;
+  }
+  DEBUG ("Map %s: %d candidate patterns.\n", m, c->nmap);
+
+  return any ? 0 : -1;
+}
+
+/* Start on a new board of the current map.  Returns -1 if */
+/* nothing on the board can be selected.                   */
+int name_cursor_board (struct name_cursor * c, char * b)
+{
+  struct name_matcher * nm = c->f->match;
+  int i, k, any = 0;
+
+  c->nboard = 0;
+  for (k=0; k<c->nmap; k++)
+  {
+    i = c->map_cand[k];
+    if (!glob_match (&(nm->g[i][1]), b))
+      continue;
+    if (c->f->s[i].exclude)
+    {
+      if (nm->g[i][2].all)
+      {
+        c->nboard = 0;
+        return -1;
+      }
+    }
+    else
+      any = 1;
+    c->board_cand[c->nboard++] = i;
+  }
+
+  return any ? 0 : -1;
+}
+
+/* Test a block on the current board.  Returns the index */
+/* of the first namelist entry selecting it, or -1.      */
+int name_cursor_regblock (struct name_cursor * c, char * r)
+{
+  struct name_matcher * nm = c->f->match;
+  int i, k;
+
+  for (k=0; k<c->nboard; k++)
+  {
+    i = c->board_cand[k];
+    if (c->f->s[i].exclude && glob_match (&(nm->g[i][2]), r))
+      return -1;
+  }
+  for (k=0; k<c->nboard; k++)
+  {
+    i = c->board_cand[k];
+    if (!c->f->s[i].exclude && glob_match (&(nm->g[i][2]), r))
+      return i;
+  }
+
+  return -1;
+}
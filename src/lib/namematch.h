@@ -0,0 +1,47 @@
+/*
+ * namematch.h - match register names against a namelist
+ *               compiled once into glob programs, with
+ *               candidates narrowed map by map and board
+ *               by board.
+ *
+ */
+
+#ifndef ARCFILE_NAMEMATCH_H_
+#define ARCFILE_NAMEMATCH_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "namelist.h"
+
+#define DO_DEBUG_NAMEMATCH 0
+
+/* Glob syntax in each name part:              */
+/*     *      any run of characters            */
+/*     ?      any one character                */
+/*     [a-z]  one character from a class       */
+/*     [!0-9] one character not in a class     */
+/* An empty or missing part matches anything.  */
+
+struct name_matcher;
+
+/* Where a walk through a register map has got to: the */
+/* namelist entries still in play for the current map  */
+/* and board, in namelist order.                       */
+struct name_cursor {
+    struct namelist * f;
+    int nmap, nboard;
+    int * map_cand;
+    int * board_cand;
+};
+
+struct name_matcher * compile_name_matcher (struct namelist * f);
+void free_name_matcher (struct name_matcher * nm);
+int name_matcher_test (struct namelist * f, char * m, char * b, char * r);
+
+int name_cursor_init (struct name_cursor * c, struct namelist * f);
+int name_cursor_map (struct name_cursor * c, char * m);
+int name_cursor_board (struct name_cursor * c, char * b);
+int name_cursor_regblock (struct name_cursor * c, char * r);
+void name_cursor_free (struct name_cursor * c);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h> 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "fileset.h"
 #include "namelist.h"
@@ -9,6 +10,7 @@
 #include "arcfile.h"
 #include "readarc.h"
 #include "handlesig.h"
+#include "arcplan.h"
 
 /* When Matlab is running in the desktop, Mathworks chooses to
  * thoroughly break printf.  We have to work around this
@@ -48,8 +50,112 @@
 static int readarc_onefile (struct arcfilt * filt, struct fileset * fset, int fnum, struct dataset * ds);
 static int readarc_multifile (struct arcfilt * filt, struct fileset * fset, struct dataset * ds);
 static int readarc_multifile_utc (struct arcfilt * filt, struct fileset * fset, struct dataset * ds);
-static int read_frames_utc_helper (char * fname, struct reglist * rl, uint32_t t1[2], uint32_t t2[2], struct dataset * ds);
-static int read_frames_helper (char * fname, struct reglist * rl, struct dataset * ds);
+static int read_frames_utc_helper (struct arcfilt * filt, char * fname, struct reglist * rl, struct dataset * ds);
+static int read_frames_helper (struct arcfilt * filt, char * fname, struct reglist * rl, struct dataset * ds);
+
+/* Frames to allocate for a file: its planned count, but at  */
+/* least one, since a zero-frame buffer can't be allocated.  */
+static int alloc_frames (struct fileset * fset, int fnum, uint32_t frame0_ofs, uint32_t frame_len, int step)
+{
+  int nframes;
+
+  nframes = arcplan_file_frames (&(fset->files[fnum]), frame0_ofs, frame_len, NULL);
+  nframes = arcplan_strided (nframes, step);
+  if (nframes < 1)
+    nframes = 1;
+
+  return nframes;
+}
+
+int arcfilt_init (struct arcfilt * af)
+{
+  af->use_utc = 0;
+  af->t1[0] = 0;
+  af->t1[1] = 0;
+  af->t2[0] = 0xFFFFFFFFUL;
+  af->t2[1] = 0xFFFFFFFFUL;
+  af->nl.n = 0;
+  af->nl.s = NULL;
+  af->nl.nutc = -1;
+  af->fname = NULL;
+  af->cancel = NULL;
+  af->mem_budget = 0;
+  af->frame_step = 1;
+  af->conv.type = CONVERT_NONE;
+  af->conv.scale = 1;
+  af->conv.offset = 0;
+  af->conv.utc = UTC_RAW;
+  af->time_reg = NULL;
+  af->big_endian = 0;
+  af->layout = LAYOUT_BY_CHANNEL;
+  af->stats = STATS_NONE;
+
+  return ARC_OK;
+}
+
+/* Find filt's time register in the same register map as */
+/* rl, and set rl to keep only frames in filt's range.    */
+static int arcfilt_read_time_reg (struct arcfilt * filt, struct arcfile * af, struct reglist * rl)
+{
+  struct namelist tnl;
+  struct reglist trl;
+  int i, r;
+
+  r = create_namelist (1, &(filt->time_reg), &tnl);
+  if (r != 0)
+    return r;
+  r = arcfile_read_regmap_time (af, &(filt->nl), rl, &tnl, &trl);
+  free_namelist (&tnl);
+  if (r != 0)
+    return r;
+
+  for (i=0; i<trl.num_regblocks; i++)
+    if ((trl.r[i].rb.typeword & GCP_REG_TYPE) == GCP_REG_UTC)
+      break;
+  if (i == trl.num_regblocks)
+  {
+    PR ("No UTC register %s to select times by.\n", filt->time_reg);
+    free_reglist (&trl);
+    free_reglist (rl);
+    return ARC_ERR_REGMAP;
+  }
+  DEBUG ("Selecting frames by %s.%s.%s.\n", rb_map (&(trl.r[i].rb)),
+    rb_board (&(trl.r[i].rb)), rb_regblock (&(trl.r[i].rb)));
+  rl->time_ofs = trl.r[i].ofs_in_frame;
+  memcpy (rl->t1, filt->t1, sizeof (rl->t1));
+  memcpy (rl->t2, filt->t2, sizeof (rl->t2));
+  free_reglist (&trl);
+
+  return ARC_OK;
+}
+
+/* Read the register map of an open file, keeping what filt */
+/* asks for, with filt's conversion for the rest and filt's */
+/* layout and statistics.  With a time register, frames are */
+/* also cut to filt's UTC range.                            */
+int arcfilt_read_regmap (struct arcfilt * filt, struct arcfile * af, struct reglist * rl)
+{
+  int r;
+
+  if (filt->use_utc && (filt->time_reg != NULL))
+    r = arcfilt_read_time_reg (filt, af, rl);
+  else if (filt->nl.n == 0)
+    r = arcfile_read_regmap (af, rl);
+  else
+    r = arcfile_read_regmap_namelist (af, &(filt->nl), rl);
+  if (r != 0)
+    return r;
+
+  r = reglist_set_conversion (rl, &(filt->conv));
+  if (r != 0)
+    return r;
+
+  r = reglist_set_layout (rl, filt->layout);
+  if (r != 0)
+    return r;
+
+  return reglist_set_stats (rl, filt->stats);
+}
 
 int readarc (struct arcfilt * filt, struct dataset * ds)
 {
@@ -58,6 +164,25 @@ int readarc (struct arcfilt * filt, struct dataset * ds)
 
   DEBUG ("Entering readarc.\n");
   ds->buf = NULL;
+  ds->nb = 0;
+
+  /* Refuse up front anything that won't fit in the budget, */
+  /* rather than failing on a realloc halfway through.      */
+  if (filt->mem_budget > 0)
+  {
+    struct arcplan plan;
+
+    r = readarc_plan (filt, &plan);
+    if (r != 0)
+      return r;
+    DEBUG ("Planned %ld frames, %lu bytes at peak.\n", plan.nframes, (unsigned long)plan.peak_bytes);
+    if (plan.peak_bytes > filt->mem_budget)
+    {
+      PR ("Reading %ld frames needs %lu bytes, over the budget of %lu.\n",
+        plan.nframes, (unsigned long)plan.peak_bytes, (unsigned long)filt->mem_budget);
+      return ARC_ERR_BUDGET;
+    }
+  }
   if (filt->use_utc)
   {
     /* Get list of files to read, based on path & UTC time */
@@ -86,7 +211,9 @@ int readarc (struct arcfilt * filt, struct dataset * ds)
   }
 
   /* Set up signal handling so user can terminate readarc if he gets bored. */
-  set_up_sigint ();
+  /* A caller-supplied cancellation token replaces the global handler.      */
+  if (filt->cancel == NULL)
+    set_up_sigint ();
 
   /* Handle one-file, multi-file (no UTC), and multi-file (with UTC range) cases separately. */
   DEBUG ("fset.nf = %d.\n", fset.nf);
@@ -99,7 +226,8 @@ int readarc (struct arcfilt * filt, struct dataset * ds)
   DEBUG ("Specific reader returned %d.\n", r);
 
   /* Unregister our SIGINT handler */
-  clean_up_sigint ();
+  if (filt->cancel == NULL)
+    clean_up_sigint ();
 
   DEBUG ("About to free fileset.\n");
   free_fileset (&fset);
@@ -130,13 +258,13 @@ static int readarc_onefile (struct arcfilt * filt, struct fileset * fset, int fn
   r = arcfile_open (fset->files[fnum].name, &af);
   if (r != 0)
     return r;
+  af.cancel = filt->cancel;
+  af.frame_step = filt->frame_step;
+  arcfile_set_data_order (&af, filt->big_endian);
   DEBUG ("Opened arcfile.\n");
 
   DEBUG ("Reading namelist.\n");
-  if (filt->nl.n == 0)
-    r = arcfile_read_regmap (&af, &rl);
-  else
-    r = arcfile_read_regmap_namelist (&af, &(filt->nl), &rl);
+  r = arcfilt_read_regmap (filt, &af, &rl);
   if (r != 0)
   {
     arcfile_close (&af);
@@ -156,7 +284,7 @@ static int readarc_onefile (struct arcfilt * filt, struct fileset * fset, int fn
       fset->files[fnum].name);
   }
 #else
-  nframes = STANDARD_FILE_NFRAMES;
+  nframes = alloc_frames (fset, fnum, af.frame0_ofs, af.frame_len, filt->frame_step);
 #endif
 
   DEBUG ("Initializing dataset buffer.\n");
@@ -175,7 +303,7 @@ static int readarc_onefile (struct arcfilt * filt, struct fileset * fset, int fn
 
   /* See if the user did a Ctrl-break.  We can't actually interrupt in the middle */
   /* of reading a single arc file, but we can pass on the to Matlab .             */
-  if (check_sigint(0))
+  if (check_arccancel (filt->cancel))
   {
     printf("Caught sigint in readarc_onefile.\n");
     r = ARC_ERR_SIGINT;
@@ -199,10 +327,10 @@ static int readarc_multifile (struct arcfilt * filt, struct fileset * fset, stru
   r = arcfile_open (fset->files[0].name, &af);
   if (r != 0)
     return r;
-  if (filt->nl.n == 0)
-    r = arcfile_read_regmap (&af, &rl);
-  else
-    r = arcfile_read_regmap_namelist (&af, &(filt->nl), &rl);
+  af.cancel = filt->cancel;
+  af.frame_step = filt->frame_step;
+  arcfile_set_data_order (&af, filt->big_endian);
+  r = arcfilt_read_regmap (filt, &af, &rl);
   if (r != 0)
   {
     arcfile_close (&af);
@@ -222,7 +350,7 @@ static int readarc_multifile (struct arcfilt * filt, struct fileset * fset, stru
         fset->files[i].name);
     nframes += tmp;
 #else
-    nframes += STANDARD_FILE_NFRAMES;
+    nframes += alloc_frames (fset, i, af.frame0_ofs, af.frame_len, filt->frame_step);
 #endif
   }
 
@@ -249,7 +377,7 @@ static int readarc_multifile (struct arcfilt * filt, struct fileset * fset, stru
   /* Now read frames from subsequent files into the buffer */
   for (i=1; i<fset->nf; i++)
   {
-    if (check_sigint(0))
+    if (check_arccancel (filt->cancel))
     {
       r = ARC_ERR_SIGINT;
       free_reglist (&rl);
@@ -257,7 +385,7 @@ static int readarc_multifile (struct arcfilt * filt, struct fileset * fset, stru
     }
     LISTFILES ("File %d of %d: %s.\n", i, fset->nf, fset->files[i].name);
     DEBUG ("Reading frames from file %s.\n", fset->files[i].name);
-    r = read_frames_helper (fset->files[i].name, &rl, ds);
+    r = read_frames_helper (filt, fset->files[i].name, &rl, ds);
     if (r != 0)
       break;
   }
@@ -282,10 +410,7 @@ static int readarc_multifile_utc (struct arcfilt * filt, struct fileset * fset,
   r = arcfile_open (fset->files[1].name, &af);
   if (r != 0)
     return r;
-  if (filt->nl.n == 0)
-    r = arcfile_read_regmap (&af, &rl);
-  else
-    r = arcfile_read_regmap_namelist (&af, &(filt->nl), &rl);
+  r = arcfilt_read_regmap (filt, &af, &rl);
   frame0_ofs = af.frame0_ofs;
   frame_len = af.frame_len;
   arcfile_close (&af);
@@ -297,23 +422,23 @@ static int readarc_multifile_utc (struct arcfilt * filt, struct fileset * fset,
 #ifndef STANDARD_FILE_NFRAMES
   nframes = (fset->files[0].size - frame0_ofs) / frame_len;
 #else
-  nframes = STANDARD_FILE_NFRAMES;
+  nframes = alloc_frames (fset, 0, frame0_ofs, frame_len, filt->frame_step);
 #endif
   DEBUG ("File %s: size=%d, frame0_ofs=%d, frame_len=%d, nframes=%d.\n", fset->files[0].name, fset->files[0].size, frame0_ofs, frame_len, nframes);
   LISTFILES ("File 1 of %d: %s.\n", fset->nf, fset->files[0].name);
   init_dataset (&ds0, &rl, nframes);
-  r = read_frames_utc_helper (fset->files[0].name, &rl, filt->t1, filt->t2, &ds0);
+  r = read_frames_utc_helper (filt, fset->files[0].name, &rl, &ds0);
 
   DEBUG ("About to read frames from file #N, %s.\n", fset->files[fset->nf-1].name);
 #ifndef STANDARD_FILE_NFRAMES
   nframes = (fset->files[fset->nf-1].size - frame0_ofs) / frame_len;
 #else
-  nframes = STANDARD_FILE_NFRAMES;
+  nframes = alloc_frames (fset, fset->nf-1, frame0_ofs, frame_len, filt->frame_step);
 #endif
   DEBUG ("File %s: size=%d, frame0_ofs=%d, frame_len=%d, nframes=%d.\n", fset->files[fset->nf-1].name, fset->files[fset->nf-1].size, frame0_ofs, frame_len, nframes);
   LISTFILES ("File 2 of %d: %s.\n", fset->nf, fset->files[fset->nf-1].name);
   init_dataset (&dsN, &rl, nframes);
-  r = read_frames_utc_helper (fset->files[fset->nf-1].name, &rl, filt->t1, filt->t2, &dsN);
+  r = read_frames_utc_helper (filt, fset->files[fset->nf-1].name, &rl, &dsN);
 
   /* Estimate total # frames in all other files */
   nframes = 0;
@@ -330,7 +455,7 @@ static int readarc_multifile_utc (struct arcfilt * filt, struct fileset * fset,
         fset->files[i].name);
     nframes += tmp;
 #else
-    nframes += STANDARD_FILE_NFRAMES;
+    nframes += alloc_frames (fset, i, frame0_ofs, frame_len, filt->frame_step);
 #endif
   }
 
@@ -352,7 +477,7 @@ static int readarc_multifile_utc (struct arcfilt * filt, struct fileset * fset,
   /* Now read frames into the buffer */
   for (i=1; i<((fset->nf)-1); i++)
   {
-    if (check_sigint(0))
+    if (check_arccancel (filt->cancel))
     {
       r = ARC_ERR_SIGINT;
       free_dataset (&dsN);
@@ -361,7 +486,7 @@ static int readarc_multifile_utc (struct arcfilt * filt, struct fileset * fset,
     }
     DEBUG ("Read data from file %d into big buffer.\n", i);
     LISTFILES ("File %d of %d: %s.\n", i+2, fset->nf, fset->files[i].name);
-    r = read_frames_helper (fset->files[i].name, &rl, ds);
+    r = read_frames_helper (filt, fset->files[i].name, &rl, ds);
     if (r != 0)
       break;
   }
@@ -379,7 +504,7 @@ static int readarc_multifile_utc (struct arcfilt * filt, struct fileset * fset,
 
 /* Should make read_frames_helper return an error code if register maps don't match, */
 /* or if number of frames is not as expected.                                        */
-static int read_frames_helper (char * fname, struct reglist * rl, struct dataset * ds)
+static int read_frames_helper (struct arcfilt * filt, char * fname, struct reglist * rl, struct dataset * ds)
 {
   struct arcfile af;
   int r;
@@ -387,6 +512,9 @@ static int read_frames_helper (char * fname, struct reglist * rl, struct dataset
   r = arcfile_open (fname, &af);
   if (r != 0)
     return r;
+  af.cancel = filt->cancel;
+  af.frame_step = filt->frame_step;
+  arcfile_set_data_order (&af, filt->big_endian);
 
   r = arcfile_skip_regmap (&af);
   if (r != 0)
@@ -401,7 +529,7 @@ static int read_frames_helper (char * fname, struct reglist * rl, struct dataset
   return r;
 }
 
-static int read_frames_utc_helper (char * fname, struct reglist * rl, uint32_t t1[2], uint32_t t2[2], struct dataset * ds)
+static int read_frames_utc_helper (struct arcfilt * filt, char * fname, struct reglist * rl, struct dataset * ds)
 {
   struct arcfile af;
   int r;
@@ -409,6 +537,9 @@ static int read_frames_utc_helper (char * fname, struct reglist * rl, uint32_t t
   r = arcfile_open (fname, &af);
   if (r != 0)
     return r;
+  af.cancel = filt->cancel;
+  af.frame_step = filt->frame_step;
+  arcfile_set_data_order (&af, filt->big_endian);
 
   r = arcfile_skip_regmap (&af);
   if (r != 0)
@@ -417,7 +548,7 @@ static int read_frames_utc_helper (char * fname, struct reglist * rl, uint32_t t
     return r;
   }
 
-  r = arcfile_read_frames_utc (&af, rl, t1, t2, ds);
+  r = arcfile_read_frames_utc (&af, rl, filt->t1, filt->t2, ds);
   arcfile_close (&af);
 
   return r;
@@ -7,6 +7,7 @@
 #include "namelist.h"
 #include "dataset.h"
 #include "utcrange.h"
+#include "handlesig.h"
 
 #define ARC_OK		0x00
 #define ARC_ERR_NOFILE	0x01
@@ -14,6 +15,7 @@
 #define ARC_ERR_REGMAP	0x10
 #define ARC_ERR_NSAMP	0x11
 #define ARC_ERR_NOMEM	0x20
+#define ARC_ERR_BUDGET	0x21
 #define ARC_ERR_FORMAT	0x40
 #define ARC_ERR_SIGINT  0x80
 
@@ -25,13 +27,24 @@ struct arcfilt {
     uint32_t t2[2];
     struct namelist nl;
     char * fname;
+    struct arccancel * cancel;	/* NULL: catch SIGINT instead */
+    size_t mem_budget;		/* Bytes of data allowed, 0 for no limit */
+    int frame_step;		/* Keep every frame_step'th frame of each file */
+    struct conversion conv;	/* For registers not given one in nl */
+    char * time_reg;		/* UTC register to cut frames to t1-t2 by, or NULL */
+    int big_endian;		/* Frame data were written on a big-endian host */
+    int layout;			/* LAYOUT_BY_CHANNEL or LAYOUT_BY_FRAME */
+    int stats;			/* STATS_NONE, STATS_WITH_DATA or STATS_ONLY */
 };
 
+struct arcfile;
+
 int arcfilt_init (struct arcfilt * af);
 int arcfilt_set_utcrange (struct arcfilt * af, char * t1str, char * t2str);
 int arcfilt_set_regs (struct arcfilt * af, int n, char ** r);
 int arcfilt_set_path (struct arcfilt * af, char * fn);
 int arcfilt_free (struct arcfilt * af);
+int arcfilt_read_regmap (struct arcfilt * filt, struct arcfile * af, struct reglist * rl);
 
 #define MAX_NAME_LENGTH 100
 
@@ -4,6 +4,7 @@
 #include "reglist.h"
 #include "arc_endian.h"
 #include "namelist.h"
+#include "namematch.h"
 #include "readarc.h"
 
 #define DEFAULT_MAX_REGBLOCKS 200
@@ -39,9 +40,9 @@ static int parse_uint16 (struct mem_buf * b, int do_swap, uint16_t * n)
   if (b->ofs + sizeof(uint16_t) > b->len)
     return -1;
 
-  *n = *(uint16_t *)(b->buf + b->ofs);
+  memcpy (n, b->buf + b->ofs, sizeof (uint16_t));
   if (do_swap)
-    swap_2 (n);
+    *n = arc_bswap16 (*n);
 
   b->ofs += sizeof(uint16_t);
 
@@ -75,14 +76,13 @@ static int parse_name (struct mem_buf * b, int do_swap, char * s, int buflen)
  */
 static int read_regblock_spec (struct mem_buf * b, int do_swap, uint32_t s[6])
 {
-  int r;
   if (b->ofs + 6 * sizeof (uint32_t) > b->len)
     return -1;
-  memcpy (s, b->buf + b->ofs, 6 * sizeof (uint32_t));
-  b->ofs += 6 * sizeof (uint32_t);
   if (do_swap)
-    for (r=0; r<6; r++)
-      swap_4 (s + r);
+    swap_copy (s, b->buf + b->ofs, 6, sizeof (uint32_t));
+  else
+    memcpy (s, b->buf + b->ofs, 6 * sizeof (uint32_t));
+  b->ofs += 6 * sizeof (uint32_t);
 
   return 0;
 }
@@ -140,7 +140,7 @@ static int realloc_regblock_buf (struct reglist * rm, int n)
 /* re-allocating a larger buffer in rm if needed.          */
 static int add_regblock (struct reglist * rm,
     char * on_map, char * on_board, char * on_regblock,
-    uint32_t regblock_spec[6], int ofs, struct chanlist * chan)
+    uint32_t regblock_spec[6], int ofs, struct search_spec * spec)
 {
   int r, n;
 
@@ -164,9 +164,20 @@ static int add_regblock (struct reglist * rm,
   rm->r[n].rb.is_complex = (rm->r[n].rb.typeword & 0x1) > 0;
   rm->r[n].rb.do_arc = (rm->r[n].rb.typeword & 0x100) == 0;
   rm->r[n].ofs_in_frame = ofs;
-  r = copy_chanlist (&(rm->r[n].chan), chan);
+  r = copy_chanlist (&(rm->r[n].chan), (spec == NULL) ? NULL : &(spec->chan));
   if (r != 0)
     return ARC_ERR_NOMEM;
+  r = copy_samplist (&(rm->r[n].samp), (spec == NULL) ? NULL : &(spec->samp));
+  if (r != 0)
+    return ARC_ERR_NOMEM;
+  rm->r[n].red.op = (spec == NULL) ? REDUCE_NONE : spec->red.op;
+  rm->r[n].red.n = (spec == NULL) ? 0 : spec->red.n;
+  rm->r[n].conv.type = (spec == NULL) ? CONVERT_NONE : spec->conv.type;
+  rm->r[n].conv.scale = (spec == NULL) ? 1 : spec->conv.scale;
+  rm->r[n].conv.offset = (spec == NULL) ? 0 : spec->conv.offset;
+  rm->r[n].conv.utc = (spec == NULL) ? UTC_RAW : spec->conv.utc;
+  rm->r[n].layout = LAYOUT_BY_CHANNEL;
+  rm->r[n].stats = STATS_NONE;
   if (rm->r[n].rb.is_fast && (rm->r[n].rb.spf==0))
   {
     rm->r[n].rb.spf = rm->r[n].rb.nchan;
@@ -176,9 +187,12 @@ static int add_regblock (struct reglist * rm,
   if (rm->r[n].rb.is_fast == 0)
     rm->r[n].rb.spf = 1;
 
-  strcpy (rm->r[n].rb.map, on_map);
-  strcpy (rm->r[n].rb.board, on_board);
-  strcpy (rm->r[n].rb.regblock, on_regblock);
+  rm->r[n].rb.names = rm->names;
+  rm->r[n].rb.map_id = strtab_intern (rm->names, on_map);
+  rm->r[n].rb.board_id = strtab_intern (rm->names, on_board);
+  rm->r[n].rb.regblock_id = strtab_intern (rm->names, on_regblock);
+  if ((rm->r[n].rb.map_id < 0) || (rm->r[n].rb.board_id < 0) || (rm->r[n].rb.regblock_id < 0))
+    return ARC_ERR_NOMEM;
 
   rm->num_regblocks = n+1;
 
@@ -189,7 +203,7 @@ static int add_regblock (struct reglist * rm,
 /* in the file's register map.  Add it separately.              */
 static int add_status_regblock (struct reglist * rm,
     char * on_map, char * on_board,
-    struct namelist * filt, int is_board_match, uint32_t * ofs)
+    struct name_cursor * cur, int is_board_match, uint32_t * ofs)
 {
   uint32_t regblock_spec[6];
   int regblock_match_num = 0;
@@ -202,10 +216,10 @@ static int add_status_regblock (struct reglist * rm,
   regblock_spec[4] = 1;
   regblock_spec[5] = 0;
 
-  if (filt != NULL)
+  if (cur != NULL)
   {
     if (is_board_match)
-      regblock_match_num = test_reg_name (on_map, on_board, "status", filt);
+      regblock_match_num = name_cursor_regblock (cur, "status");
     else
       regblock_match_num = -1;
   }
@@ -213,11 +227,11 @@ static int add_status_regblock (struct reglist * rm,
   DEBUG ("On board 'frame', block %s, offset=%ld.\n", regblocks[i], *ofs);
   if (regblock_match_num >= 0)
   {
-    if (filt == NULL)
+    if (cur == NULL)
       r = add_regblock (rm, on_map, (char *)on_board, "status", regblock_spec, *ofs, NULL);
     else
       r = add_regblock (rm, on_map, (char *)on_board, "status", regblock_spec, *ofs,
-        &(filt->s[regblock_match_num].chan));
+        &(cur->f->s[regblock_match_num]));
   }
 
   (*ofs) += regblock_size_fast (regblock_spec);
@@ -228,7 +242,7 @@ static int add_status_regblock (struct reglist * rm,
 /* Each map has a special "frame" board that's not given in the */
 /* file register map.                                           */
 static int add_frame_board (struct reglist * rm, char * on_map,
-    struct namelist * filt, int is_map_match, uint32_t * ofs)
+    struct name_cursor * cur, int is_map_match, uint32_t * ofs)
 {
   const char on_board[] = "frame";
   const char * regblocks[] = {"received", "nsnap", "record", "utc", "lst", "features", "markSeq"};
@@ -239,8 +253,8 @@ static int add_frame_board (struct reglist * rm, char * on_map,
   int i;
   int r;
 
-  if (filt != NULL)
-    is_board_match = is_map_match && (test_reg_name (on_map, (char *)on_board, NULL, filt) >= 0);
+  if (cur != NULL)
+    is_board_match = is_map_match && (name_cursor_board (cur, (char *)on_board) >= 0);
 
   regblock_spec[1] = 0x0F;
   regblock_spec[2] = 0;
@@ -248,15 +262,15 @@ static int add_frame_board (struct reglist * rm, char * on_map,
   regblock_spec[4] = 1;
   regblock_spec[5] = 0;
 
-  add_status_regblock (rm, on_map, on_board, filt, is_board_match, ofs);
+  add_status_regblock (rm, on_map, on_board, cur, is_board_match, ofs);
   
   for (i=0; i<sizeof(types)/sizeof(int); i++)
   {
     regblock_spec[0] = types[i];
-    if (filt != NULL)
+    if (cur != NULL)
     {
       if (is_board_match)
-        regblock_match_num = test_reg_name (on_map, (char *)on_board, (char *)regblocks[i], filt);
+        regblock_match_num = name_cursor_regblock (cur, (char *)regblocks[i]);
       else
         regblock_match_num = -1;
     }
@@ -264,11 +278,11 @@ static int add_frame_board (struct reglist * rm, char * on_map,
     DEBUG ("On board 'frame', block %s, offset=%ld.\n", regblocks[i], *ofs);
     if (regblock_match_num >= 0)
     {
-      if (filt == NULL)
+      if (cur == NULL)
         r = add_regblock (rm, on_map, (char *)on_board, (char *)regblocks[i], regblock_spec, *ofs, NULL);
       else
         r = add_regblock (rm, on_map, (char *)on_board, (char *)regblocks[i], regblock_spec, *ofs,
-          &(filt->s[regblock_match_num].chan));
+          &(cur->f->s[regblock_match_num]));
     }
 
     (*ofs) += regblock_size_fast (regblock_spec);
@@ -279,7 +293,7 @@ static int add_frame_board (struct reglist * rm, char * on_map,
 
 /* Ordinary boards are read from the arc file register map. */
 static int add_board (struct reglist * rm, char * on_map,
-    struct namelist * filt, int is_map_match, struct mem_buf * b, int do_swap, uint32_t * ofs)
+    struct name_cursor * cur, int is_map_match, struct mem_buf * b, int do_swap, uint32_t * ofs)
 {
   char on_board[MAX_NAME_LENGTH];
   char on_regblock[MAX_NAME_LENGTH];
@@ -293,10 +307,10 @@ static int add_board (struct reglist * rm, char * on_map,
   r = parse_name (b, do_swap, on_board, MAX_NAME_LENGTH-1);
   if (r != 0)
     return -1;
-  if (filt != NULL)
-    is_board_match = is_map_match && (test_reg_name (on_map, on_board, NULL, filt) >= 0);
+  if (cur != NULL)
+    is_board_match = is_map_match && (name_cursor_board (cur, on_board) >= 0);
 
-  add_status_regblock (rm, on_map, on_board, filt, is_board_match, ofs);
+  add_status_regblock (rm, on_map, on_board, cur, is_board_match, ofs);
 
   r = parse_uint16 (b, do_swap, &num_regblocks);
   if (r != 0)
@@ -310,10 +324,10 @@ static int add_board (struct reglist * rm, char * on_map,
     r = parse_name (b, do_swap, on_regblock, MAX_NAME_LENGTH-1);
     if (r != 0)
       return -1;
-    if (filt != NULL)
+    if (cur != NULL)
     {
       if (is_board_match)
-        regblock_match_num = test_reg_name (on_map, on_board, on_regblock, filt);
+        regblock_match_num = name_cursor_regblock (cur, on_regblock);
       else
         regblock_match_num = -1;
     }
@@ -325,11 +339,11 @@ static int add_board (struct reglist * rm, char * on_map,
 
     if (regblock_match_num >= 0)
     {
-      if (filt == NULL)
+      if (cur == NULL)
         r = add_regblock (rm, on_map, on_board, on_regblock, regblock_spec, *ofs, NULL);
       else
         r = add_regblock (rm, on_map, on_board, on_regblock, regblock_spec, *ofs,
-          &(filt->s[regblock_match_num].chan));
+          &(cur->f->s[regblock_match_num]));
     }
 
     *ofs += regblock_size_fast (regblock_spec);
@@ -363,6 +377,8 @@ int parse_reglist_namelist (void * buf, int buflen, int do_swap,
   int is_map_match = 1;
   uint32_t ofs = 8;
   struct mem_buf b;
+  struct name_cursor c;
+  struct name_cursor * cur = NULL;
 
   DEBUG ("entering read_reglist_namelist.\n");
   if (max_regblocks <= 0)
@@ -375,9 +391,26 @@ int parse_reglist_namelist (void * buf, int buflen, int do_swap,
   b.len = buflen;
 
   rm->num_regblocks = 0;
+  rm->time_ofs = -1;
   rm->r = malloc ((rm->max_regblocks) * sizeof(struct reglist_entry));
   if (rm->r == 0)
     return -1;
+  rm->names = strtab_new ();
+  if (rm->names == NULL)
+  {
+    free (rm->r);
+    return -1;
+  }
+  if (filt != NULL)
+  {
+    if (name_cursor_init (&c, filt) != 0)
+    {
+      free (rm->r);
+      strtab_unref (rm->names);
+      return -1;
+    }
+    cur = &c;
+  }
 
   on_map[0] = '\0';
   on_board[0] = '\0';
@@ -395,11 +428,11 @@ int parse_reglist_namelist (void * buf, int buflen, int do_swap,
     r = parse_name (&b, do_swap, on_map, MAX_NAME_LENGTH-1);
     if (r != 0)
       break;
-    if (filt != NULL)
-      is_map_match = (test_reg_name (on_map, NULL, NULL, filt) >= 0);
+    if (cur != NULL)
+      is_map_match = (name_cursor_map (cur, on_map) >= 0);
 
     /* ofs += 4; */
-    r = add_frame_board (rm, on_map, filt, is_map_match,  &ofs);
+    r = add_frame_board (rm, on_map, cur, is_map_match,  &ofs);
     if (r != 0)
     {
       printf ("Error adding 'frame' board.\n");
@@ -414,23 +447,26 @@ int parse_reglist_namelist (void * buf, int buflen, int do_swap,
     for (ib=0; ib<num_boards; ib++)
     {
       /* ofs += 4; */
-      r = add_board (rm, on_map, filt, is_map_match, &b, do_swap, &ofs);
+      r = add_board (rm, on_map, cur, is_map_match, &b, do_swap, &ofs);
     }
 
     if (r != 0)
       break;
   }
+  if (cur != NULL)
+    name_cursor_free (cur);
 
   if (r != 0)
   {
     DEBUG ("Error parsing through register specifications.\n");
     free (rm->r);
+    strtab_unref (rm->names);
     return -1;
   }
 
   DEBUG ("List of register blocks to load:\n");
   for (ib=0; ib<rm->num_regblocks; ib++)
-    DEBUG ("    %s.%s.%s\n", rm->r[ib].rb.map, rm->r[ib].rb.board, rm->r[ib].rb.regblock);
+    DEBUG ("    %s.%s.%s\n", rb_map (&(rm->r[ib].rb)), rb_board (&(rm->r[ib].rb)), rb_regblock (&(rm->r[ib].rb)));
 
   DEBUG ("Final offset is 0x%lx.\n", ofs);
   return 0;
@@ -442,9 +478,70 @@ int parse_reglist (void * buf, int buflen, int do_swap,
   return parse_reglist_namelist (buf, buflen, do_swap, NULL, rm, max_regblocks);
 }
 
+/* Give every register without a conversion of its own cv, */
+/* and every UTC register without a decoding cv's.          */
+int reglist_set_conversion (struct reglist * rm, struct conversion * cv)
+{
+  int i;
+
+  for (i=0; i<rm->num_regblocks; i++)
+  {
+    if ((cv->type != CONVERT_NONE) && (rm->r[i].conv.type == CONVERT_NONE))
+    {
+      rm->r[i].conv.type = cv->type;
+      rm->r[i].conv.scale = cv->scale;
+      rm->r[i].conv.offset = cv->offset;
+    }
+    if (rm->r[i].conv.utc == UTC_RAW)
+      rm->r[i].conv.utc = cv->utc;
+  }
+
+  return 0;
+}
+
+int reglist_set_layout (struct reglist * rm, int layout)
+{
+  int i;
+
+  for (i=0; i<rm->num_regblocks; i++)
+    rm->r[i].layout = layout;
+
+  return 0;
+}
+
+/* Layout named "channel" or "frame", or -1. */
+int parse_layout (const char * s)
+{
+  if (!strcasecmp (s, "channel"))
+    return LAYOUT_BY_CHANNEL;
+  if (!strcasecmp (s, "frame"))
+    return LAYOUT_BY_FRAME;
+
+  return -1;
+}
+
+int reglist_set_stats (struct reglist * rm, int stats)
+{
+  int i;
+
+  for (i=0; i<rm->num_regblocks; i++)
+    rm->r[i].stats = stats;
+
+  return 0;
+}
+
 int free_reglist (struct reglist * rm)
 {
+  int i;
+
+  for (i=0; i<rm->num_regblocks; i++)
+  {
+    free_chanlist (&(rm->r[i].chan));
+    free_samplist (&(rm->r[i].samp));
+  }
   free (rm->r);
+  strtab_unref (rm->names);
+  rm->names = NULL;
   /* free (rm); */
 
   return 0;
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "namelist.h"
+#include "strtab.h"
 
 #define MAX_NAME_LENGTH 100
 #define DO_DEBUG_REGLIST 0
@@ -32,30 +33,72 @@
 
 #define GCP_REG_TYPE       0xFFA00
 
+/* Names are ids in a string table shared by the whole   */
+/* register list; use rb_map() etc. to get the strings.  */
 struct regblockspec {
-    char map[MAX_NAME_LENGTH+1];
-    char board[MAX_NAME_LENGTH+1];
-    char regblock[MAX_NAME_LENGTH+1];
     uint32_t typeword;
     char is_fast, is_complex, do_arc;
     int nchan, spf;
+    int map_id, board_id, regblock_id;
+    struct strtab * names;
 };
 
+/* How a register block's data are laid out in memory:   */
+/* each channel's time stream in turn, or each frame's    */
+/* channels in turn, as [frame][channel][sample].         */
+#define LAYOUT_BY_CHANNEL	0
+#define LAYOUT_BY_FRAME		1
+
+/* Whether to keep per-channel statistics of a block, */
+/* and whether to keep its samples as well.           */
+#define STATS_NONE		0
+#define STATS_WITH_DATA		1
+#define STATS_ONLY		2
+
 struct reglist_entry {
     struct regblockspec rb;
     uint32_t ofs_in_frame;
     struct chanlist chan;
+    struct samplist samp;
+    struct reduction red;
+    struct conversion conv;
+    int layout;
+    int stats;
 };
 
 struct reglist {
     int max_regblocks, num_regblocks;
     struct reglist_entry * r;
     int utc_reg_num;
+    struct strtab * names;	/* Holds a reference */
+    /* Only frames whose time register, at time_ofs, is in */
+    /* [t1, t2) are kept.  time_ofs < 0 keeps them all.     */
+    int32_t time_ofs;
+    uint32_t t1[2], t2[2];
 };
 
+static inline char * rb_map (struct regblockspec * rb)
+{
+  return strtab_str (rb->names, rb->map_id);
+}
+
+static inline char * rb_board (struct regblockspec * rb)
+{
+  return strtab_str (rb->names, rb->board_id);
+}
+
+static inline char * rb_regblock (struct regblockspec * rb)
+{
+  return strtab_str (rb->names, rb->regblock_id);
+}
+
 int parse_reglist (void * buf, int buflen, int do_swap, struct reglist * rm, int max_regblocks);
 int parse_reglist_namelist (void * buf, int buflen, int do_swap, struct namelist * filt,
     struct reglist * rm, int max_regblocks);
+int reglist_set_conversion (struct reglist * rm, struct conversion * cv);
+int reglist_set_layout (struct reglist * rm, int layout);
+int parse_layout (const char * s);
+int reglist_set_stats (struct reglist * rm, int stats);
 int free_reglist (struct reglist * rm);
 
 #endif
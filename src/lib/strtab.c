@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "strtab.h"
+
+#if DO_DEBUG_STRTAB
+#  define DEBUG(args...) printf(args)
+#else
+#  define DEBUG(...)
+#endif
+
+#define STRTAB_CHUNK_SIZE 4096
+#define STRTAB_INIT_IDS   64
+
+/* Strings are packed into chunks that are never moved, */
+/* so pointers from strtab_str stay good.               */
+struct strtab_chunk {
+    struct strtab_chunk * next;
+    size_t used, size;
+    char data[];
+};
+
+/* FNV-1a */
+static uint32_t strtab_hash (const char * s)
+{
+  uint32_t h = 2166136261U;
+
+  while (*s)
+  {
+    h ^= (unsigned char)(*s++);
+    h *= 16777619U;
+  }
+
+  return h;
+}
+
+struct strtab * strtab_new (void)
+{
+  struct strtab * t;
+
+  t = malloc (sizeof (struct strtab));
+  if (t == NULL)
+    return NULL;
+  t->refs = 1;
+  t->n = 0;
+  t->max = STRTAB_INIT_IDS;
+  t->nhash = 2 * STRTAB_INIT_IDS;
+  t->chunks = NULL;
+  t->str = malloc (t->max * sizeof (char *));
+  t->hash = calloc (t->nhash, sizeof (int));
+  if ((t->str == NULL) || (t->hash == NULL))
+  {
+    free (t->str);
+    free (t->hash);
+    free (t);
+    return NULL;
+  }
+
+  return t;
+}
+
+struct strtab * strtab_ref (struct strtab * t)
+{
+  if (t != NULL)
+    t->refs++;
+
+  return t;
+}
+
+void strtab_unref (struct strtab * t)
+{
+  struct strtab_chunk * c;
+
+  if (t == NULL)
+    return;
+  t->refs--;
+  if (t->refs > 0)
+    return;
+
+  DEBUG ("Freeing string table with %d strings.\n", t->n);
+  while (t->chunks != NULL)
+  {
+    c = t->chunks;
+    t->chunks = c->next;
+    free (c);
+  }
+  free (t->str);
+  free (t->hash);
+  free (t);
+}
+
+/* Slot in the hash for s: either the one holding it, or */
+/* the empty one where it would go.                      */
+static int strtab_slot (struct strtab * t, const char * s)
+{
+  int i, mask;
+
+  mask = t->nhash - 1;
+  i = strtab_hash (s) & mask;
+  while ((t->hash[i] != 0) && (strcmp (t->str[t->hash[i]-1], s) != 0))
+    i = (i + 1) & mask;
+
+  return i;
+}
+
+static int strtab_grow (struct strtab * t)
+{
+  char ** str;
+  int * hash;
+  int * old_hash;
+  int old_nhash;
+  int i;
+
+  str = realloc (t->str, 2 * t->max * sizeof (char *));
+  if (str == NULL)
+    return -1;
+  t->str = str;
+  t->max *= 2;
+
+  hash = calloc (2 * t->nhash, sizeof (int));
+  if (hash == NULL)
+    return -1;
+  old_hash = t->hash;
+  old_nhash = t->nhash;
+  t->hash = hash;
+  t->nhash *= 2;
+  for (i=0; i<old_nhash; i++)
+    if (old_hash[i] != 0)
+      t->hash[strtab_slot (t, t->str[old_hash[i]-1])] = old_hash[i];
+  free (old_hash);
+
+  return 0;
+}
+
+static char * strtab_store (struct strtab * t, const char * s)
+{
+  struct strtab_chunk * c;
+  size_t len;
+  size_t size;
+  char * p;
+
+  len = strlen (s) + 1;
+  c = t->chunks;
+  if ((c == NULL) || (c->used + len > c->size))
+  {
+    size = (len > STRTAB_CHUNK_SIZE) ? len : STRTAB_CHUNK_SIZE;
+    c = malloc (sizeof (struct strtab_chunk) + size);
+    if (c == NULL)
+      return NULL;
+    c->next = t->chunks;
+    c->used = 0;
+    c->size = size;
+    t->chunks = c;
+  }
+  p = c->data + c->used;
+  memcpy (p, s, len);
+  c->used += len;
+
+  return p;
+}
+
+/* Id of s, adding it if it's new.  Returns -1 if out of memory. */
+int strtab_intern (struct strtab * t, const char * s)
+{
+  int i;
+
+  i = strtab_slot (t, s);
+  if (t->hash[i] != 0)
+    return t->hash[i] - 1;
+
+  if (t->n >= t->max)
+  {
+    if (strtab_grow (t) != 0)
+      return -1;
+    i = strtab_slot (t, s);
+  }
+
+  t->str[t->n] = strtab_store (t, s);
+  if (t->str[t->n] == NULL)
+    return -1;
+  t->hash[i] = t->n + 1;
+  t->n++;
+
+  return t->n - 1;
+}
+
+/* Id of s, or -1 if it hasn't been interned. */
+int strtab_find (struct strtab * t, const char * s)
+{
+  int i;
+
+  i = strtab_slot (t, s);
+
+  return t->hash[i] - 1;
+}
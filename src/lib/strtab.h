@@ -0,0 +1,39 @@
+/*
+ * strtab.h - intern register names, so that each distinct
+ *            map, board and block name is stored once and
+ *            referred to by a small integer id.
+ *
+ */
+
+#ifndef ARCFILE_STRTAB_H_
+#define ARCFILE_STRTAB_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define DO_DEBUG_STRTAB 0
+
+struct strtab_chunk;
+
+struct strtab {
+    int refs;			/* Owners; freed when this drops to 0 */
+    int n, max;			/* Strings interned, and room for ids */
+    char ** str;		/* id -> string                      */
+    int nhash;			/* Size of hash, a power of 2        */
+    int * hash;			/* Slots hold id+1, or 0 if empty    */
+    struct strtab_chunk * chunks;	/* Storage for the strings   */
+};
+
+struct strtab * strtab_new (void);
+struct strtab * strtab_ref (struct strtab * t);
+void strtab_unref (struct strtab * t);
+int strtab_intern (struct strtab * t, const char * s);
+int strtab_find (struct strtab * t, const char * s);
+
+/* String for an id.  Stays valid as long as t does. */
+static inline char * strtab_str (struct strtab * t, int id)
+{
+  return t->str[id];
+}
+
+#endif
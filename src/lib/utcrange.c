@@ -20,9 +20,10 @@ static uint32_t mjd (int d[3])
 
   uint32_t days;
 
-  days = 48987;
+  /* 1 Jan 1993, plus leap days since then. */
+  days = 48988;
   days += (d[0]-1993) * 365;
-  days += (d[0]-1) / 4;
+  days += (d[0]-1) / 4 - 1992 / 4;
   days += month_start_noleap[d[1]-1];
   if ((d[1] > 2) && (d[0] % 4 == 0))
     days += 1;
@@ -140,3 +141,14 @@ int main (int argc, char * argv[])
   return r;
 }
 #endif
+
+/* Compare two (MJD, ms) times, as strcmp does. */
+int utc_cmp (uint32_t a[2], uint32_t b[2])
+{
+  if (a[0] != b[0])
+    return (a[0] < b[0]) ? -1 : 1;
+  if (a[1] != b[1])
+    return (a[1] < b[1]) ? -1 : 1;
+
+  return 0;
+}
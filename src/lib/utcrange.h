@@ -15,5 +15,6 @@
 
 int fname2utc (char * fname, uint32_t utc[2]);
 int txt2utc (char * txt, uint32_t utc[2]);
+int utc_cmp (uint32_t a[2], uint32_t b[2]);
 
 #endif